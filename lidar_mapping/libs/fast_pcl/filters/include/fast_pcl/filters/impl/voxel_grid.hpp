@@ -40,6 +40,9 @@
 
 #include <pcl/common/common.h>
 #include <pcl/common/io.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 //#include <pcl/filters/voxel_grid.h>
 #include "fast_pcl/filters/voxel_grid.h"
 
@@ -205,10 +208,106 @@ struct cloud_point_index_idx
   unsigned int idx;
   unsigned int cloud_point_index;
 
+  cloud_point_index_idx () {}
   cloud_point_index_idx (unsigned int idx_, unsigned int cloud_point_index_) : idx (idx_), cloud_point_index (cloud_point_index_) {}
   bool operator < (const cloud_point_index_idx &p) const { return (idx < p.idx); }
 };
 
+namespace pcl
+{
+  namespace detail
+  {
+    /** \brief Number of bits of the voxel index sorted by a pass of \ref sortVoxelIndices. */
+    const int VOXEL_RADIX_BITS = 8;
+
+    /** \brief Minimum number of points for \ref sortVoxelIndices and VoxelGrid::applyFilter to use several threads. */
+    const size_t VOXEL_PARALLEL_MIN_POINTS = 16384;
+
+    /** \brief Get the number of threads used to process n points. */
+    inline int
+    getVoxelNumberOfThreads (size_t n)
+    {
+#ifdef _OPENMP
+      if (n >= VOXEL_PARALLEL_MIN_POINTS)
+        return (omp_get_max_threads ());
+#endif
+      return (1);
+    }
+
+    /** \brief Sort (voxel index, point index) pairs on the voxel index with a parallel LSD radix sort.
+      * \note The sort is stable, the points of a voxel stay in input order whatever the number of threads.
+      * The entries whose voxel index is \a invalid are dropped by the first pass.
+      * \param[in,out] index_vector the pairs to sort, resized to the entries kept
+      * \param[in] max_idx the largest valid voxel index, only the digits it uses are sorted
+      * \param[in] invalid the voxel index of the entries to drop, greater than max_idx
+      */
+    inline void
+    sortVoxelIndices (std::vector<cloud_point_index_idx> &index_vector, unsigned int max_idx, unsigned int invalid)
+    {
+      const int radix = 1 << VOXEL_RADIX_BITS;
+      int nr_passes = 1;
+      while (nr_passes * VOXEL_RADIX_BITS < 32 && (max_idx >> (nr_passes * VOXEL_RADIX_BITS)) != 0)
+        ++nr_passes;
+
+      std::vector<cloud_point_index_idx> buffer (index_vector.size ());
+      const int nr_threads = getVoxelNumberOfThreads (index_vector.size ());
+      // offsets[t * radix + d] is where thread t writes its next entry of digit d
+      std::vector<size_t> offsets (static_cast<size_t> (nr_threads) * radix);
+
+      size_t n = index_vector.size ();
+      for (int pass = 0; pass < nr_passes; ++pass)
+      {
+        const int shift = pass * VOXEL_RADIX_BITS;
+        const bool drop_invalid = (pass == 0);
+        std::fill (offsets.begin (), offsets.end (), 0);
+
+        // Histogram of the digits of the chunk of each thread
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(nr_threads)
+#endif
+        for (int t = 0; t < nr_threads; ++t)
+        {
+          size_t *hist = &offsets[static_cast<size_t> (t) * radix];
+          for (size_t i = n * t / nr_threads, end = n * (t + 1) / nr_threads; i < end; ++i)
+          {
+            if (drop_invalid && index_vector[i].idx == invalid)
+              continue;
+            ++hist[(index_vector[i].idx >> shift) & (radix - 1)];
+          }
+        }
+
+        // Exclusive prefix sum in (digit, thread) order keeps the sort stable
+        size_t total = 0;
+        for (int d = 0; d < radix; ++d)
+          for (int t = 0; t < nr_threads; ++t)
+          {
+            size_t count = offsets[static_cast<size_t> (t) * radix + d];
+            offsets[static_cast<size_t> (t) * radix + d] = total;
+            total += count;
+          }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(nr_threads)
+#endif
+        for (int t = 0; t < nr_threads; ++t)
+        {
+          size_t *offset = &offsets[static_cast<size_t> (t) * radix];
+          for (size_t i = n * t / nr_threads, end = n * (t + 1) / nr_threads; i < end; ++i)
+          {
+            if (drop_invalid && index_vector[i].idx == invalid)
+              continue;
+            buffer[offset[(index_vector[i].idx >> shift) & (radix - 1)]++] = index_vector[i];
+          }
+        }
+
+        index_vector.swap (buffer);
+        n = total;
+      }
+      index_vector.resize (n);
+    }
+  }
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template <typename PointT> void
 pcl::VoxelGrid<PointT>::applyFilter (PointCloud &output)
@@ -276,34 +375,45 @@ pcl::VoxelGrid<PointT>::applyFilter (PointCloud &output)
     centroid_size += 3;
   }
 
-  std::vector<cloud_point_index_idx> index_vector;
-  index_vector.reserve (indices_->size ());
-
   // If we don't want to process the entire cloud, but rather filter points far away from the viewpoint first...
+  int distance_idx = -1;
+  std::vector<pcl::PCLPointField> distance_fields;
   if (!filter_field_name_.empty ())
   {
     // Get the distance field index
-    std::vector<pcl::PCLPointField> fields;
-    int distance_idx = pcl::getFieldIndex (*input_, filter_field_name_, fields);
+    distance_idx = pcl::getFieldIndex (*input_, filter_field_name_, distance_fields);
     if (distance_idx == -1)
       PCL_WARN ("[pcl::%s::applyFilter] Invalid filter field name. Index is %d.\n", getClassName ().c_str (), distance_idx);
+  }
 
-    // First pass: go over all points and insert them into the index_vector vector
-    // with calculated idx. Points with the same idx value will contribute to the
-    // same point of resulting CloudPoint
-    for (std::vector<int>::const_iterator it = indices_->begin (); it != indices_->end (); ++it)
-    {
-      if (!input_->is_dense)
-        // Check if the point is invalid
-        if (!pcl_isfinite (input_->points[*it].x) || 
-            !pcl_isfinite (input_->points[*it].y) || 
-            !pcl_isfinite (input_->points[*it].z))
-          continue;
+  // First pass: compute the voxel index of every point of indices_, in parallel. Points with the same idx value
+  // will contribute to the same point of resulting CloudPoint, the rejected ones get an invalid idx
+  const unsigned int invalid_idx = std::numeric_limits<unsigned int>::max ();
+  const int nr_indices = static_cast<int> (indices_->size ());
+  std::vector<cloud_point_index_idx> index_vector (nr_indices);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(pcl::detail::getVoxelNumberOfThreads (nr_indices))
+#endif
+  for (int n = 0; n < nr_indices; ++n)
+  {
+    const int pid = (*indices_)[n];
+    const PointT &point = input_->points[pid];
+    index_vector[n] = cloud_point_index_idx (invalid_idx, pid);
+
+    if (!input_->is_dense)
+      // Check if the point is invalid
+      if (!pcl_isfinite (point.x) || 
+          !pcl_isfinite (point.y) || 
+          !pcl_isfinite (point.z))
+        continue;
 
+    if (!filter_field_name_.empty ())
+    {
       // Get the distance value
-      const uint8_t* pt_data = reinterpret_cast<const uint8_t*> (&input_->points[*it]);
+      const uint8_t* pt_data = reinterpret_cast<const uint8_t*> (&point);
       float distance_value = 0;
-      memcpy (&distance_value, pt_data + fields[distance_idx].offset, sizeof (float));
+      memcpy (&distance_value, pt_data + distance_fields[distance_idx].offset, sizeof (float));
 
       if (filter_limit_negative_)
       {
@@ -317,69 +427,59 @@ pcl::VoxelGrid<PointT>::applyFilter (PointCloud &output)
         if ((distance_value > filter_limit_max_) || (distance_value < filter_limit_min_))
           continue;
       }
-      
-      int ijk0 = static_cast<int> (floor (input_->points[*it].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-      int ijk1 = static_cast<int> (floor (input_->points[*it].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-      int ijk2 = static_cast<int> (floor (input_->points[*it].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
-
-      // Compute the centroid leaf index
-      int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-      index_vector.push_back (cloud_point_index_idx (static_cast<unsigned int> (idx), *it));
     }
-  }
-  // No distance filtering, process all data
-  else
-  {
-    // First pass: go over all points and insert them into the index_vector vector
-    // with calculated idx. Points with the same idx value will contribute to the
-    // same point of resulting CloudPoint
-    for (std::vector<int>::const_iterator it = indices_->begin (); it != indices_->end (); ++it)
-    {
-      if (!input_->is_dense)
-        // Check if the point is invalid
-        if (!pcl_isfinite (input_->points[*it].x) || 
-            !pcl_isfinite (input_->points[*it].y) || 
-            !pcl_isfinite (input_->points[*it].z))
-          continue;
 
-      int ijk0 = static_cast<int> (floor (input_->points[*it].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-      int ijk1 = static_cast<int> (floor (input_->points[*it].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-      int ijk2 = static_cast<int> (floor (input_->points[*it].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
+    int ijk0 = static_cast<int> (floor (point.x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
+    int ijk1 = static_cast<int> (floor (point.y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
+    int ijk2 = static_cast<int> (floor (point.z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
 
-      // Compute the centroid leaf index
-      int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-      index_vector.push_back (cloud_point_index_idx (static_cast<unsigned int> (idx), *it));
-    }
+    // Compute the centroid leaf index
+    index_vector[n].idx = static_cast<unsigned int> (ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2]);
   }
 
-  // Second pass: sort the index_vector vector using value representing target cell as index
-  // in effect all points belonging to the same output cell will be next to each other
-  std::sort (index_vector.begin (), index_vector.end (), std::less<cloud_point_index_idx> ());
-
-  // Third pass: count output cells
-  // we need to skip all the same, adjacenent idx values
-  unsigned int total = 0;
-  unsigned int index = 0;
-  // first_and_last_indices_vector[i] represents the index in index_vector of the first point in
-  // index_vector belonging to the voxel which corresponds to the i-th output point,
-  // and of the first point not belonging to.
-  std::vector<std::pair<unsigned int, unsigned int> > first_and_last_indices_vector;
-  // Worst case size
-  first_and_last_indices_vector.reserve (index_vector.size ());
-  while (index < index_vector.size ()) 
+  // Second pass: sort the index_vector vector using value representing target cell as index, dropping the
+  // rejected points. In effect all points belonging to the same output cell will be next to each other
+  const unsigned int max_idx = static_cast<unsigned int> (div_b_[0] * div_b_[1] * div_b_[2] - 1);
+  pcl::detail::sortVoxelIndices (index_vector, max_idx, invalid_idx);
+
+  // Third pass: count the output cells of each thread. The sorted vector is split into one range per thread,
+  // moved to the first point of a cell so that every cell is handled by a single thread
+  const unsigned int nr_points = static_cast<unsigned int> (index_vector.size ());
+  const int nr_threads = pcl::detail::getVoxelNumberOfThreads (nr_points);
+  std::vector<unsigned int> range_begin (nr_threads + 1, nr_points);
+  std::vector<unsigned int> range_total (nr_threads + 1, 0);
+  for (int t = 0; t < nr_threads; ++t)
   {
-    unsigned int i = index + 1;
-    while (i < index_vector.size () && index_vector[i].idx == index_vector[index].idx) 
-      ++i;
-    if (i - index >= min_points_per_voxel_)
+    unsigned int begin = static_cast<unsigned int> (static_cast<uint64_t> (nr_points) * t / nr_threads);
+    while (begin > 0 && begin < nr_points && index_vector[begin].idx == index_vector[begin - 1].idx)
+      ++begin;
+    range_begin[t] = begin;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(nr_threads)
+#endif
+  for (int t = 0; t < nr_threads; ++t)
+  {
+    unsigned int total = 0;
+    unsigned int index = range_begin[t];
+    while (index < range_begin[t + 1])
     {
-      ++total;
-      first_and_last_indices_vector.push_back (std::pair<unsigned int, unsigned int> (index, i));
+      unsigned int i = index + 1;
+      while (i < range_begin[t + 1] && index_vector[i].idx == index_vector[index].idx) 
+        ++i;
+      if (i - index >= min_points_per_voxel_)
+        ++total;
+      index = i;
     }
-    index = i;
+    range_total[t + 1] = total;
   }
 
-  // Fourth pass: compute centroids, insert them into their final position
+  // Output position of the first cell of each thread
+  for (int t = 0; t < nr_threads; ++t)
+    range_total[t + 1] += range_total[t];
+  unsigned int total = range_total[nr_threads];
+
   output.points.resize (total);
   if (save_leaf_layout_)
   {
@@ -406,44 +506,36 @@ pcl::VoxelGrid<PointT>::applyFilter (PointCloud &output)
         "voxel_grid.hpp", "applyFilter");	
     }
   }
-  
-  index = 0;
-  Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
-  Eigen::VectorXf temporary = Eigen::VectorXf::Zero (centroid_size);
 
-  for (unsigned int cp = 0; cp < first_and_last_indices_vector.size (); ++cp)
+  // Fourth pass: find the cells again and compute their centroids in the same pass, insert them into their
+  // final position. The cells are in the same (sorted) order as the serial filter
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(nr_threads)
+#endif
+  for (int t = 0; t < nr_threads; ++t)
   {
-    // calculate centroid - sum values from all input points, that have the same idx value in index_vector array
-	unsigned int first_index = first_and_last_indices_vector[cp].first;
-	unsigned int last_index = first_and_last_indices_vector[cp].second;
-    if (!downsample_all_data_) 
-    {
-      centroid[0] = input_->points[index_vector[first_index].cloud_point_index].x;
-      centroid[1] = input_->points[index_vector[first_index].cloud_point_index].y;
-      centroid[2] = input_->points[index_vector[first_index].cloud_point_index].z;
-    }
-    else 
+    Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
+    Eigen::VectorXf temporary = Eigen::VectorXf::Zero (centroid_size);
+    unsigned int index = range_total[t];
+    unsigned int first_index = range_begin[t];
+
+    while (first_index < range_begin[t + 1])
     {
-      // ---[ RGB special case
-      if (rgba_index >= 0)
+      unsigned int last_index = first_index + 1;
+      while (last_index < range_begin[t + 1] && index_vector[last_index].idx == index_vector[first_index].idx) 
+        ++last_index;
+      if (last_index - first_index < min_points_per_voxel_)
       {
-        // Fill r/g/b data, assuming that the order is BGRA
-        pcl::RGB rgb;
-        memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[index_vector[first_index].cloud_point_index]) + rgba_index, sizeof (RGB));
-        centroid[centroid_size-3] = rgb.r;
-        centroid[centroid_size-2] = rgb.g;
-        centroid[centroid_size-1] = rgb.b;
+        first_index = last_index;
+        continue;
       }
-      pcl::for_each_type <FieldList> (NdCopyPointEigenFunctor <PointT> (input_->points[index_vector[first_index].cloud_point_index], centroid));
-    }
 
-    for (unsigned int i = first_index + 1; i < last_index; ++i) 
-    {
+      // calculate centroid - sum values from all input points, that have the same idx value in index_vector array
       if (!downsample_all_data_) 
       {
-        centroid[0] += input_->points[index_vector[i].cloud_point_index].x;
-        centroid[1] += input_->points[index_vector[i].cloud_point_index].y;
-        centroid[2] += input_->points[index_vector[i].cloud_point_index].z;
+        centroid[0] = input_->points[index_vector[first_index].cloud_point_index].x;
+        centroid[1] = input_->points[index_vector[first_index].cloud_point_index].y;
+        centroid[2] = input_->points[index_vector[first_index].cloud_point_index].z;
       }
       else 
       {
@@ -452,43 +544,68 @@ pcl::VoxelGrid<PointT>::applyFilter (PointCloud &output)
         {
           // Fill r/g/b data, assuming that the order is BGRA
           pcl::RGB rgb;
-          memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[index_vector[i].cloud_point_index]) + rgba_index, sizeof (RGB));
-          temporary[centroid_size-3] = rgb.r;
-          temporary[centroid_size-2] = rgb.g;
-          temporary[centroid_size-1] = rgb.b;
+          memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[index_vector[first_index].cloud_point_index]) + rgba_index, sizeof (RGB));
+          centroid[centroid_size-3] = rgb.r;
+          centroid[centroid_size-2] = rgb.g;
+          centroid[centroid_size-1] = rgb.b;
+        }
+        pcl::for_each_type <FieldList> (NdCopyPointEigenFunctor <PointT> (input_->points[index_vector[first_index].cloud_point_index], centroid));
+      }
+
+      for (unsigned int i = first_index + 1; i < last_index; ++i) 
+      {
+        if (!downsample_all_data_) 
+        {
+          centroid[0] += input_->points[index_vector[i].cloud_point_index].x;
+          centroid[1] += input_->points[index_vector[i].cloud_point_index].y;
+          centroid[2] += input_->points[index_vector[i].cloud_point_index].z;
+        }
+        else 
+        {
+          // ---[ RGB special case
+          if (rgba_index >= 0)
+          {
+            // Fill r/g/b data, assuming that the order is BGRA
+            pcl::RGB rgb;
+            memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[index_vector[i].cloud_point_index]) + rgba_index, sizeof (RGB));
+            temporary[centroid_size-3] = rgb.r;
+            temporary[centroid_size-2] = rgb.g;
+            temporary[centroid_size-1] = rgb.b;
+          }
+          pcl::for_each_type <FieldList> (NdCopyPointEigenFunctor <PointT> (input_->points[index_vector[i].cloud_point_index], temporary));
+          centroid += temporary;
         }
-        pcl::for_each_type <FieldList> (NdCopyPointEigenFunctor <PointT> (input_->points[index_vector[i].cloud_point_index], temporary));
-        centroid += temporary;
       }
-    }
 
-    // index is centroid final position in resulting PointCloud
-    if (save_leaf_layout_)
-      leaf_layout_[index_vector[first_index].idx] = index;
+      // index is centroid final position in resulting PointCloud
+      if (save_leaf_layout_)
+        leaf_layout_[index_vector[first_index].idx] = index;
 
-    centroid /= static_cast<float> (last_index - first_index);
+      centroid /= static_cast<float> (last_index - first_index);
 
-    // store centroid
-    // Do we need to process all the fields?
-    if (!downsample_all_data_) 
-    {
-      output.points[index].x = centroid[0];
-      output.points[index].y = centroid[1];
-      output.points[index].z = centroid[2];
-    }
-    else 
-    {
-      pcl::for_each_type<FieldList> (pcl::NdCopyEigenPointFunctor <PointT> (centroid, output.points[index]));
-      // ---[ RGB special case
-      if (rgba_index >= 0) 
+      // store centroid
+      // Do we need to process all the fields?
+      if (!downsample_all_data_) 
+      {
+        output.points[index].x = centroid[0];
+        output.points[index].y = centroid[1];
+        output.points[index].z = centroid[2];
+      }
+      else 
       {
-        // pack r/g/b into rgb
-        float r = centroid[centroid_size-3], g = centroid[centroid_size-2], b = centroid[centroid_size-1];
-        int rgb = (static_cast<int> (r) << 16) | (static_cast<int> (g) << 8) | static_cast<int> (b);
-        memcpy (reinterpret_cast<char*> (&output.points[index]) + rgba_index, &rgb, sizeof (float));
+        pcl::for_each_type<FieldList> (pcl::NdCopyEigenPointFunctor <PointT> (centroid, output.points[index]));
+        // ---[ RGB special case
+        if (rgba_index >= 0) 
+        {
+          // pack r/g/b into rgb
+          float r = centroid[centroid_size-3], g = centroid[centroid_size-2], b = centroid[centroid_size-1];
+          int rgb = (static_cast<int> (r) << 16) | (static_cast<int> (g) << 8) | static_cast<int> (b);
+          memcpy (reinterpret_cast<char*> (&output.points[index]) + rgba_index, &rgb, sizeof (float));
+        }
       }
+      ++index;
+      first_index = last_index;
     }
-    ++index;
   }
   output.width = static_cast<uint32_t> (output.points.size ());
 }
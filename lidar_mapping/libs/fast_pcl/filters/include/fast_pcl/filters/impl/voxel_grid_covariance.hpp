@@ -43,8 +43,10 @@
 //#include <pcl/filters/voxel_grid_covariance.h>
 #include "fast_pcl/filters/boost.h"
 #include "fast_pcl/filters/voxel_grid_covariance.h"
+#include "fast_pcl/filters/symmetric_eigensolver3x3.h"
 #include <Eigen/Dense>
 #include <Eigen/Cholesky>
+#include <algorithm>
 
 //////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointT> void
@@ -78,7 +80,8 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
   int64_t dy = static_cast<int64_t>((max_p[1] - min_p[1]) * inverse_leaf_size_[1])+1;
   int64_t dz = static_cast<int64_t>((max_p[2] - min_p[2]) * inverse_leaf_size_[2])+1;
 
-  if((dx*dy*dz) > std::numeric_limits<int32_t>::max())
+  // Leaves are hashed by their voxel coordinates, the linear index is only needed by the leaf layout
+  if(save_leaf_layout_ && (dx*dy*dz) > std::numeric_limits<int32_t>::max())
   {
     PCL_WARN("[pcl::%s::applyFilter] Leaf size is too small for the input dataset. Integer indices would overflow.", getClassName().c_str());
     output.clear();
@@ -93,32 +96,28 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
   min_b_[2] = static_cast<int> (floor (min_p[2] * inverse_leaf_size_[2]));
   max_b_[2] = static_cast<int> (floor (max_p[2] * inverse_leaf_size_[2]));
 
+  if (!VoxelLeafIndex::inRange (min_b_[0], min_b_[1], min_b_[2]) || !VoxelLeafIndex::inRange (max_b_[0], max_b_[1], max_b_[2]))
+  {
+    PCL_WARN("[pcl::%s::applyFilter] Leaf size is too small for the input dataset. Voxel coordinates would overflow.", getClassName().c_str());
+    output.clear();
+    return;
+  }
+
   // Compute the number of divisions needed along all axis
   div_b_ = max_b_ - min_b_ + Eigen::Vector4i::Ones ();
   div_b_[3] = 0;
 
-  // Clear the leaves
+  // Clear the leaves, the hash table and the window keep their capacity for the next rebuild
   leaves_.clear ();
+  leaf_keys_.clear ();
+  leaf_index_.clear ();
+  resetWindow ();
 
   // Set up the division multiplier
   divb_mul_ = Eigen::Vector4i (1, div_b_[0], div_b_[0] * div_b_[1], 0);
 
-  int centroid_size = 4;
-
-  if (downsample_all_data_)
-    centroid_size = boost::mpl::size<FieldList>::value;
-
-  // ---[ RGB special case
-  std::vector<pcl::PCLPointField> fields;
   int rgba_index = -1;
-  rgba_index = pcl::getFieldIndex (*input_, "rgb", fields);
-  if (rgba_index == -1)
-    rgba_index = pcl::getFieldIndex (*input_, "rgba", fields);
-  if (rgba_index >= 0)
-  {
-    rgba_index = fields[rgba_index].offset;
-    centroid_size += 3;
-  }
+  int centroid_size = getCentroidSize (*input_, rgba_index);
 
   // If we don't want to process the entire cloud, but rather filter points far away from the viewpoint first...
   if (!filter_field_name_.empty ())
@@ -157,50 +156,7 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
           continue;
       }
 
-      int ijk0 = static_cast<int> (floor (input_->points[cp].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-      int ijk1 = static_cast<int> (floor (input_->points[cp].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-      int ijk2 = static_cast<int> (floor (input_->points[cp].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
-
-      // Compute the centroid leaf index
-      int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-
-      Leaf& leaf = leaves_[idx];
-      if (leaf.nr_points == 0)
-      {
-        leaf.centroid.resize (centroid_size);
-        leaf.centroid.setZero ();
-      }
-
-      Eigen::Vector3d pt3d (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z);
-      // Accumulate point sum for centroid calculation
-      leaf.mean_ += pt3d;
-      // Accumulate x*xT for single pass covariance calculation
-      leaf.cov_ += pt3d * pt3d.transpose ();
-
-      // Do we need to process all the fields?
-      if (!downsample_all_data_)
-      {
-        Eigen::Vector4f pt (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z, 0);
-        leaf.centroid.template head<4> () += pt;
-      }
-      else
-      {
-        // Copy all the fields
-        Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
-        // ---[ RGB special case
-        if (rgba_index >= 0)
-        {
-          // fill r/g/b data
-          int rgb;
-          memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[cp]) + rgba_index, sizeof (int));
-          centroid[centroid_size - 3] = static_cast<float> ((rgb >> 16) & 0x0000ff);
-          centroid[centroid_size - 2] = static_cast<float> ((rgb >> 8) & 0x0000ff);
-          centroid[centroid_size - 1] = static_cast<float> ((rgb) & 0x0000ff);
-        }
-        pcl::for_each_type<FieldList> (NdCopyPointEigenFunctor<PointT> (input_->points[cp], centroid));
-        leaf.centroid += centroid;
-      }
-      ++leaf.nr_points;
+      accumulatePoint (input_->points[cp], centroid_size, rgba_index, false);
     }
   }
   // No distance filtering, process all data
@@ -216,51 +172,7 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
             !pcl_isfinite (input_->points[cp].z))
           continue;
 
-      int ijk0 = static_cast<int> (floor (input_->points[cp].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-      int ijk1 = static_cast<int> (floor (input_->points[cp].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-      int ijk2 = static_cast<int> (floor (input_->points[cp].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
-
-      // Compute the centroid leaf index
-      int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-
-      //int idx = (((input_->points[cp].getArray4fmap () * inverse_leaf_size_).template cast<int> ()).matrix () - min_b_).dot (divb_mul_);
-      Leaf& leaf = leaves_[idx];
-      if (leaf.nr_points == 0)
-      {
-        leaf.centroid.resize (centroid_size);
-        leaf.centroid.setZero ();
-      }
-
-      Eigen::Vector3d pt3d (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z);
-      // Accumulate point sum for centroid calculation
-      leaf.mean_ += pt3d;
-      // Accumulate x*xT for single pass covariance calculation
-      leaf.cov_ += pt3d * pt3d.transpose ();
-
-      // Do we need to process all the fields?
-      if (!downsample_all_data_)
-      {
-        Eigen::Vector4f pt (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z, 0);
-        leaf.centroid.template head<4> () += pt;
-      }
-      else
-      {
-        // Copy all the fields
-        Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
-        // ---[ RGB special case
-        if (rgba_index >= 0)
-        {
-          // Fill r/g/b data, assuming that the order is BGRA
-          int rgb;
-          memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[cp]) + rgba_index, sizeof (int));
-          centroid[centroid_size - 3] = static_cast<float> ((rgb >> 16) & 0x0000ff);
-          centroid[centroid_size - 2] = static_cast<float> ((rgb >> 8) & 0x0000ff);
-          centroid[centroid_size - 1] = static_cast<float> ((rgb) & 0x0000ff);
-        }
-        pcl::for_each_type<FieldList> (NdCopyPointEigenFunctor<PointT> (input_->points[cp], centroid));
-        leaf.centroid += centroid;
-      }
-      ++leaf.nr_points;
+      accumulatePoint (input_->points[cp], centroid_size, rgba_index, false);
     }
   }
 
@@ -272,102 +184,479 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
   if (save_leaf_layout_)
     leaf_layout_.resize (div_b_[0] * div_b_[1] * div_b_[2], -1);
 
-  // Eigen values and vectors calculated to prevent near singluar matrices
-  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigensolver;
-  Eigen::Matrix3d eigen_val;
-  Eigen::Vector3d pt_sum;
-
-  // Eigen values less than a threshold of max eigen value are inflated to a set fraction of the max eigen value.
-  double min_covar_eigvalue;
-
-  for (typename std::map<size_t, Leaf>::iterator it = leaves_.begin (); it != leaves_.end (); ++it)
+  for (size_t li = 0; li < leaves_.size (); ++li)
   {
+    Leaf& leaf = leaves_[li];
 
     // Normalize the centroid
-    Leaf& leaf = it->second;
-
-    // Normalize the centroid
-    leaf.centroid /= static_cast<float> (leaf.nr_points);
-    // Point sum used for single pass covariance calculation
-    pt_sum = leaf.mean_;
-    // Normalize mean
-    leaf.mean_ /= leaf.nr_points;
+    leaf.centroid /= static_cast<float> (leaf.nr_sum_points_);
 
-    // If the voxel contains sufficient points, its covariance is calculated and is added to the voxel centroids and output clouds.
+    // If the voxel contains sufficient points, it is added to the voxel centroids and output clouds.
     // Points with less than the minimum points will have a can not be accuratly approximated using a normal distribution.
-    if (leaf.nr_points >= min_points_per_voxel_)
+    if (leaf.nr_sum_points_ >= min_points_per_voxel_)
     {
       if (save_leaf_layout_)
-        leaf_layout_[it->first] = cp++;
-
-      output.push_back (PointT ());
-
-      // Do we need to process all the fields?
-      if (!downsample_all_data_)
-      {
-        output.points.back ().x = leaf.centroid[0];
-        output.points.back ().y = leaf.centroid[1];
-        output.points.back ().z = leaf.centroid[2];
-      }
-      else
       {
-        pcl::for_each_type<FieldList> (pcl::NdCopyEigenPointFunctor<PointT> (leaf.centroid, output.back ()));
-        // ---[ RGB special case
-        if (rgba_index >= 0)
-        {
-          // pack r/g/b into rgb
-          float r = leaf.centroid[centroid_size - 3], g = leaf.centroid[centroid_size - 2], b = leaf.centroid[centroid_size - 1];
-          int rgb = (static_cast<int> (r)) << 16 | (static_cast<int> (g)) << 8 | (static_cast<int> (b));
-          memcpy (reinterpret_cast<char*> (&output.points.back ()) + rgba_index, &rgb, sizeof (float));
-        }
+        int i, j, k;
+        VoxelLeafIndex::unpackKey (leaf_keys_[li], i, j, k);
+        leaf_layout_[(Eigen::Vector4i (i, j, k, 0) - min_b_).dot (divb_mul_)] = cp++;
       }
 
+      appendCentroid (output, leaf, centroid_size, rgba_index);
+
       // Stores the voxel indice for fast access searching
       if (searchable_)
-        voxel_centroids_leaf_indices_.push_back (static_cast<int> (it->first));
+        voxel_centroids_leaf_indices_.push_back (static_cast<int> (li));
+    }
+  }
 
-      // Single pass covariance calculation
-      leaf.cov_ = (leaf.cov_ - 2 * (pt_sum * leaf.mean_.transpose ())) / leaf.nr_points + leaf.mean_ * leaf.mean_.transpose ();
-      leaf.cov_ *= (leaf.nr_points - 1.0) / leaf.nr_points;
+  // The statistics of each leaf are independent, the eigen decompositions are most of the time spent here
+  int nr_leaves = static_cast<int> (leaves_.size ());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int li = 0; li < nr_leaves; ++li)
+    computeLeafStatistics (leaves_[li]);
 
-      //Normalize Eigen Val such that max no more than 100x min.
-      eigensolver.compute (leaf.cov_);
-      eigen_val = eigensolver.eigenvalues ().asDiagonal ();
-      leaf.evecs_ = eigensolver.eigenvectors ();
+  output.width = static_cast<uint32_t> (output.points.size ());
+}
 
-      if (eigen_val (0, 0) < 0 || eigen_val (1, 1) < 0 || eigen_val (2, 2) <= 0)
-      {
-        leaf.nr_points = -1;
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::getCentroidSize (const PointCloud &cloud, int &rgba_index) const
+{
+  int centroid_size = 4;
+
+  if (downsample_all_data_)
+    centroid_size = boost::mpl::size<FieldList>::value;
+
+  // ---[ RGB special case
+  std::vector<pcl::PCLPointField> fields;
+  rgba_index = pcl::getFieldIndex (cloud, "rgb", fields);
+  if (rgba_index == -1)
+    rgba_index = pcl::getFieldIndex (cloud, "rgba", fields);
+  if (rgba_index >= 0)
+  {
+    rgba_index = fields[rgba_index].offset;
+    centroid_size += 3;
+  }
+
+  return (centroid_size);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::accumulatePoint (const PointT &point, int centroid_size, int rgba_index, bool running_mean)
+{
+  int ijk0 = static_cast<int> (floor (point.x * inverse_leaf_size_[0]));
+  int ijk1 = static_cast<int> (floor (point.y * inverse_leaf_size_[1]));
+  int ijk2 = static_cast<int> (floor (point.z * inverse_leaf_size_[2]));
+
+  if (!VoxelLeafIndex::inRange (ijk0, ijk1, ijk2))
+    return (-1);
+
+  int leaf_idx = getOrCreateLeaf (ijk0, ijk1, ijk2);
+  if (leaf_idx < 0)
+    return (-1);
+  Leaf& leaf = leaves_[leaf_idx];
+  if (leaf.nr_sum_points_ == 0)
+  {
+    leaf.centroid.resize (centroid_size);
+    leaf.centroid.setZero ();
+  }
+
+  Eigen::Vector3d pt3d (point.x, point.y, point.z);
+  // Accumulate point sum for centroid calculation
+  leaf.pt_sum_ += pt3d;
+  // Accumulate x*xT for single pass covariance calculation
+  leaf.pt_sq_sum_ += pt3d * pt3d.transpose ();
+  ++leaf.nr_sum_points_;
+
+  // Do we need to process all the fields?
+  if (!downsample_all_data_)
+  {
+    Eigen::Vector4f pt (point.x, point.y, point.z, 0);
+    if (running_mean)
+      leaf.centroid.template head<4> () += (pt - leaf.centroid.template head<4> ()) / static_cast<float> (leaf.nr_sum_points_);
+    else
+      leaf.centroid.template head<4> () += pt;
+  }
+  else
+  {
+    // Copy all the fields
+    Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
+    // ---[ RGB special case
+    if (rgba_index >= 0)
+    {
+      // Fill r/g/b data, assuming that the order is BGRA
+      int rgb;
+      memcpy (&rgb, reinterpret_cast<const char*> (&point) + rgba_index, sizeof (int));
+      centroid[centroid_size - 3] = static_cast<float> ((rgb >> 16) & 0x0000ff);
+      centroid[centroid_size - 2] = static_cast<float> ((rgb >> 8) & 0x0000ff);
+      centroid[centroid_size - 1] = static_cast<float> ((rgb) & 0x0000ff);
+    }
+    pcl::for_each_type<FieldList> (NdCopyPointEigenFunctor<PointT> (point, centroid));
+    if (running_mean)
+      leaf.centroid += (centroid - leaf.centroid) / static_cast<float> (leaf.nr_sum_points_);
+    else
+      leaf.centroid += centroid;
+  }
+
+  return (leaf_idx);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::computeLeafStatistics (Leaf &leaf) const
+{
+  leaf.nr_points = leaf.nr_sum_points_;
+  // Normalize mean
+  leaf.mean_ = leaf.pt_sum_ / leaf.nr_points;
+
+  // Points with less than the minimum points will have a can not be accuratly approximated using a normal distribution.
+  if (leaf.nr_points < min_points_per_voxel_)
+    return;
+
+  // Single pass covariance calculation
+  leaf.cov_ = (leaf.pt_sq_sum_ - 2 * (leaf.pt_sum_ * leaf.mean_.transpose ())) / leaf.nr_points + leaf.mean_ * leaf.mean_.transpose ();
+  leaf.cov_ *= (leaf.nr_points - 1.0) / leaf.nr_points;
+
+  // Eigen values and vectors calculated to prevent near singluar matrices
+  //Normalize Eigen Val such that max no more than 100x min.
+  Eigen::Vector3d eigenvalues;
+  SymmetricEigensolver3x3::compute (leaf.cov_, eigenvalues, leaf.evecs_);
+  Eigen::Matrix3d eigen_val = eigenvalues.asDiagonal ();
+
+  if (eigen_val (0, 0) < 0 || eigen_val (1, 1) < 0 || eigen_val (2, 2) <= 0)
+  {
+    leaf.nr_points = -1;
+    return;
+  }
+
+  // Avoids matrices near singularities (eq 6.11)[Magnusson 2009]
+  // Eigen values less than a threshold of max eigen value are inflated to a set fraction of the max eigen value.
+  double min_covar_eigvalue = min_covar_eigvalue_mult_ * eigen_val (2, 2);
+  if (eigen_val (0, 0) < min_covar_eigvalue)
+  {
+    eigen_val (0, 0) = min_covar_eigvalue;
+
+    if (eigen_val (1, 1) < min_covar_eigvalue)
+    {
+      eigen_val (1, 1) = min_covar_eigvalue;
+    }
+
+    leaf.cov_ = leaf.evecs_ * eigen_val * leaf.evecs_.transpose ();
+  }
+  leaf.evals_ = eigen_val.diagonal ();
+
+  // Inverse from the (inflated) decomposition, better conditioned than inverting cov_
+  leaf.icov_ = leaf.evecs_ * leaf.evals_.cwiseInverse ().asDiagonal () * leaf.evecs_.transpose ();
+  if (leaf.icov_.maxCoeff () == std::numeric_limits<float>::infinity ( )
+      || leaf.icov_.minCoeff () == -std::numeric_limits<float>::infinity ( ) )
+  {
+    leaf.nr_points = -1;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::appendCentroid (PointCloud &output, const Leaf &leaf, int centroid_size, int rgba_index) const
+{
+  output.push_back (PointT ());
+
+  // Do we need to process all the fields?
+  if (!downsample_all_data_)
+  {
+    output.points.back ().x = leaf.centroid[0];
+    output.points.back ().y = leaf.centroid[1];
+    output.points.back ().z = leaf.centroid[2];
+  }
+  else
+  {
+    pcl::for_each_type<FieldList> (pcl::NdCopyEigenPointFunctor<PointT> (leaf.centroid, output.back ()));
+    // ---[ RGB special case
+    if (rgba_index >= 0)
+    {
+      // pack r/g/b into rgb
+      float r = leaf.centroid[centroid_size - 3], g = leaf.centroid[centroid_size - 2], b = leaf.centroid[centroid_size - 1];
+      int rgb = (static_cast<int> (r)) << 16 | (static_cast<int> (g)) << 8 | (static_cast<int> (b));
+      memcpy (reinterpret_cast<char*> (&output.points.back ()) + rgba_index, &rgb, sizeof (float));
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::updateVoxelCentroids ()
+{
+  PointCloudPtr centroids (new PointCloud);
+  centroids->height = 1;
+  centroids->is_dense = true;
+
+  int rgba_index = -1;
+  int centroid_size = getCentroidSize (*centroids, rgba_index);
+
+  voxel_centroids_leaf_indices_.clear ();
+  centroids->points.reserve (leaves_.size ());
+  if (searchable_)
+    voxel_centroids_leaf_indices_.reserve (leaves_.size ());
+
+  // Same selection as in applyFilter
+  for (size_t li = 0; li < leaves_.size (); ++li)
+  {
+    if (leaves_[li].nr_sum_points_ < min_points_per_voxel_)
+      continue;
+
+    appendCentroid (*centroids, leaves_[li], centroid_size, rgba_index);
+    if (searchable_)
+      voxel_centroids_leaf_indices_.push_back (static_cast<int> (li));
+  }
+  centroids->width = static_cast<uint32_t> (centroids->points.size ());
+
+  voxel_centroids_ = centroids;
+  centroids_outdated_ = false;
+  if (searchable_ && voxel_centroids_->size () > 0)
+  {
+    // Initiates kdtree of the centroids of voxels containing a sufficient number of points
+    kdtree_.setInputCloud (voxel_centroids_);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::addPoints (const PointCloud &cloud, bool searchable)
+{
+  searchable_ = searchable;
+
+  int rgba_index = -1;
+  int centroid_size = getCentroidSize (cloud, rgba_index);
+  bool empty_bounds = leaves_.empty ();
+
+  // Accumulate the new points, keeping track of the leaves they fall in
+  std::vector<int> touched_leaves;
+  touched_leaves.reserve (cloud.points.size ());
+  for (size_t cp = 0; cp < cloud.points.size (); ++cp)
+  {
+    if (!cloud.is_dense)
+      // Check if the point is invalid
+      if (!pcl_isfinite (cloud.points[cp].x) ||
+          !pcl_isfinite (cloud.points[cp].y) ||
+          !pcl_isfinite (cloud.points[cp].z))
         continue;
-      }
 
-      // Avoids matrices near singularities (eq 6.11)[Magnusson 2009]
+    int leaf_idx = accumulatePoint (cloud.points[cp], centroid_size, rgba_index, true);
+    if (leaf_idx >= 0)
+      touched_leaves.push_back (leaf_idx);
+  }
 
-      min_covar_eigvalue = min_covar_eigvalue_mult_ * eigen_val (2, 2);
-      if (eigen_val (0, 0) < min_covar_eigvalue)
-      {
-        eigen_val (0, 0) = min_covar_eigvalue;
+  std::sort (touched_leaves.begin (), touched_leaves.end ());
+  touched_leaves.erase (std::unique (touched_leaves.begin (), touched_leaves.end ()), touched_leaves.end ());
 
-        if (eigen_val (1, 1) < min_covar_eigvalue)
-        {
-          eigen_val (1, 1) = min_covar_eigvalue;
-        }
+  // Only the touched leaves need their statistics recomputed
+  int nr_touched = static_cast<int> (touched_leaves.size ());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int ti = 0; ti < nr_touched; ++ti)
+    computeLeafStatistics (leaves_[touched_leaves[ti]]);
 
-        leaf.cov_ = leaf.evecs_ * eigen_val * leaf.evecs_.inverse ();
-      }
-      leaf.evals_ = eigen_val.diagonal ();
+  for (size_t ti = 0; ti < touched_leaves.size (); ++ti)
+  {
+    // Extend the bounding box
+    Eigen::Vector4i ijk (0, 0, 0, 0);
+    VoxelLeafIndex::unpackKey (leaf_keys_[touched_leaves[ti]], ijk[0], ijk[1], ijk[2]);
+    if (empty_bounds)
+    {
+      min_b_ = max_b_ = ijk;
+      empty_bounds = false;
+    }
+    min_b_ = min_b_.cwiseMin (ijk);
+    max_b_ = max_b_.cwiseMax (ijk);
+  }
+  div_b_ = max_b_ - min_b_ + Eigen::Vector4i::Ones ();
+  div_b_[3] = 0;
+  divb_mul_ = Eigen::Vector4i (1, div_b_[0], div_b_[0] * div_b_[1], 0);
+
+  // The centroids and the kdtree are only rebuilt when needed, see updateCentroids
+  if (!touched_leaves.empty ())
+    centroids_outdated_ = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::removeLeavesOutside (const Eigen::Vector3f &min_p, const Eigen::Vector3f &max_p)
+{
+  Eigen::Vector4i min_ijk (static_cast<int> (floor (min_p[0] * inverse_leaf_size_[0])),
+                           static_cast<int> (floor (min_p[1] * inverse_leaf_size_[1])),
+                           static_cast<int> (floor (min_p[2] * inverse_leaf_size_[2])), 0);
+  Eigen::Vector4i max_ijk (static_cast<int> (floor (max_p[0] * inverse_leaf_size_[0])),
+                           static_cast<int> (floor (max_p[1] * inverse_leaf_size_[1])),
+                           static_cast<int> (floor (max_p[2] * inverse_leaf_size_[2])), 0);
+  return (removeLeavesOutside (min_ijk, max_ijk));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::cropLeaves (const Eigen::Vector3f &min_p, const Eigen::Vector3f &max_p, const PointCloud &cloud)
+{
+  // Voxels lying completely inside the box: i * leaf_size >= min_p and (i + 1) * leaf_size <= max_p
+  Eigen::Vector4i min_ijk (0, 0, 0, 0), max_ijk (0, 0, 0, 0);
+  for (int d = 0; d < 3; ++d)
+  {
+    min_ijk[d] = static_cast<int> (ceil (min_p[d] * inverse_leaf_size_[d]));
+    max_ijk[d] = static_cast<int> (floor (max_p[d] * inverse_leaf_size_[d])) - 1;
+  }
+  int nr_removed = removeLeavesOutside (min_ijk, max_ijk);
+
+  // The points of the box falling in the straddling voxels
+  PointCloud border;
+  for (size_t cp = 0; cp < cloud.points.size (); ++cp)
+  {
+    const PointT &p = cloud.points[cp];
+    if (!pcl_isfinite (p.x) || !pcl_isfinite (p.y) || !pcl_isfinite (p.z))
+      continue;
+    Eigen::Vector3f xyz (p.x, p.y, p.z);
+    if ((xyz.array () < min_p.array ()).any () || (xyz.array () >= max_p.array ()).any ())
+      continue;
+    Eigen::Vector4i ijk (static_cast<int> (floor (p.x * inverse_leaf_size_[0])),
+                         static_cast<int> (floor (p.y * inverse_leaf_size_[1])),
+                         static_cast<int> (floor (p.z * inverse_leaf_size_[2])), 0);
+    if ((ijk.array () < min_ijk.array ()).any () || (ijk.array () > max_ijk.array ()).any ())
+      border.push_back (p);
+  }
+  if (!border.empty ())
+    addPoints (border, searchable_);
 
-      leaf.icov_ = leaf.cov_.inverse ();
-      if (leaf.icov_.maxCoeff () == std::numeric_limits<float>::infinity ( )
-          || leaf.icov_.minCoeff () == -std::numeric_limits<float>::infinity ( ) )
+  return (nr_removed);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::removeLeavesOutside (const Eigen::Vector4i &min_ijk, const Eigen::Vector4i &max_ijk)
+{
+  // Removed leaves are replaced by the last leaf of the array
+  int nr_removed = 0;
+  size_t li = 0;
+  while (li < leaves_.size ())
+  {
+    Eigen::Vector4i ijk (0, 0, 0, 0);
+    VoxelLeafIndex::unpackKey (leaf_keys_[li], ijk[0], ijk[1], ijk[2]);
+    if ((ijk.array () >= min_ijk.array ()).all () && (ijk.array () <= max_ijk.array ()).all ())
+    {
+      ++li;
+      continue;
+    }
+
+    if (use_window_)
+      leaf_window_.erase (ijk[0], ijk[1], ijk[2]);
+    else
+      leaf_index_.erase (leaf_keys_[li]);
+    size_t last = leaves_.size () - 1;
+    if (li != last)
+    {
+      leaves_[li] = leaves_[last];
+      leaf_keys_[li] = leaf_keys_[last];
+      if (use_window_)
       {
-        leaf.nr_points = -1;
+        VoxelLeafIndex::unpackKey (leaf_keys_[li], ijk[0], ijk[1], ijk[2]);
+        leaf_window_.assign (ijk[0], ijk[1], ijk[2], static_cast<int> (li));
       }
+      else
+        leaf_index_.assign (leaf_keys_[li], static_cast<int> (li));
+    }
+    leaves_.pop_back ();
+    leaf_keys_.pop_back ();
+    ++nr_removed;
+  }
 
+  if (nr_removed > 0)
+  {
+    // Shrink the bounding box to the remaining leaves
+    if (!leaves_.empty ())
+    {
+      min_b_ = min_b_.cwiseMax (min_ijk);
+      max_b_ = max_b_.cwiseMin (max_ijk);
+      min_b_[3] = max_b_[3] = 0;
+      div_b_ = max_b_ - min_b_ + Eigen::Vector4i::Ones ();
     }
+    else
+    {
+      min_b_.setZero ();
+      max_b_.setZero ();
+      div_b_.setZero ();
+    }
+    div_b_[3] = 0;
+    divb_mul_ = Eigen::Vector4i (1, div_b_[0], div_b_[0] * div_b_[1], 0);
+
+    centroids_outdated_ = true;
   }
 
-  output.width = static_cast<uint32_t> (output.points.size ());
+  return (nr_removed);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::setWindow (const Eigen::Vector3f &size, const Eigen::Vector3f &center)
+{
+  window_size_ = size.cwiseMax (Eigen::Vector3f::Zero ());
+  window_center_ = center;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::resetWindow ()
+{
+  use_window_ = (window_size_.array () > 0).all ();
+  if (!use_window_)
+    return;
+
+  // The window allocates the voxels of the box rounded up to powers of two (at most 8 times more), capped once rounded
+  const int64_t max_slots = static_cast<int64_t> (1) << 27;
+  int n[3];
+  int64_t nr_slots = 1;
+  for (int d = 0; d < 3 && nr_slots <= max_slots; d++)
+  {
+    double nr_leaves = std::max (1.0, ceil (window_size_[d] * inverse_leaf_size_[d]));
+    int64_t nr_dim_slots = 1;
+    while (nr_dim_slots < nr_leaves && nr_dim_slots <= max_slots)
+      nr_dim_slots <<= 1;
+    n[d] = static_cast<int> (std::min<double> (nr_leaves, nr_dim_slots));
+    nr_slots *= nr_dim_slots;
+  }
+
+  if (nr_slots > max_slots)
+  {
+    PCL_WARN ("[pcl::%s::resetWindow] Leaf size is too small for the window, the leaves are hashed instead.\n", getClassName ().c_str ());
+    use_window_ = false;
+    return;
+  }
+
+  leaf_window_.resize (n[0], n[1], n[2]);
+  leaf_window_.clear ();
+  leaf_window_.setOrigin (static_cast<int> (floor (window_center_[0] * inverse_leaf_size_[0])) - leaf_window_.getDimension (0) / 2,
+                          static_cast<int> (floor (window_center_[1] * inverse_leaf_size_[1])) - leaf_window_.getDimension (1) / 2,
+                          static_cast<int> (floor (window_center_[2] * inverse_leaf_size_[2])) - leaf_window_.getDimension (2) / 2);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::moveWindow (const Eigen::Vector3f &center, bool searchable)
+{
+  window_center_ = center;
+  if (!use_window_)
+    return (0);
+
+  Eigen::Vector4i min_ijk (static_cast<int> (floor (center[0] * inverse_leaf_size_[0])) - leaf_window_.getDimension (0) / 2,
+                           static_cast<int> (floor (center[1] * inverse_leaf_size_[1])) - leaf_window_.getDimension (1) / 2,
+                           static_cast<int> (floor (center[2] * inverse_leaf_size_[2])) - leaf_window_.getDimension (2) / 2, 0);
+  Eigen::Vector4i max_ijk = min_ijk + Eigen::Vector4i (leaf_window_.getDimension (0) - 1, leaf_window_.getDimension (1) - 1,
+                                                       leaf_window_.getDimension (2) - 1, 0);
+
+  // The leaves staying in the box keep their slots, the ones of the leaving leaves are freed before the move
+  searchable_ = searchable;
+  int nr_removed = removeLeavesOutside (min_ijk, max_ijk);
+  leaf_window_.setOrigin (min_ijk[0], min_ijk[1], min_ijk[2]);
+  return (nr_removed);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -381,8 +670,6 @@ pcl::VoxelGridCovariance<PointT>::getNeighborhoodAtPoint (const PointT& referenc
   Eigen::Vector4i ijk (static_cast<int> (floor (reference_point.x / leaf_size_[0])), 
                        static_cast<int> (floor (reference_point.y / leaf_size_[1])), 
                        static_cast<int> (floor (reference_point.z / leaf_size_[2])), 0);
-  Eigen::Array4i diff2min = min_b_ - ijk;
-  Eigen::Array4i diff2max = max_b_ - ijk;
   neighbors.reserve (relative_coordinates.cols ());
 
   // Check each neighbor to see if it is occupied and contains sufficient points
@@ -390,21 +677,72 @@ pcl::VoxelGridCovariance<PointT>::getNeighborhoodAtPoint (const PointT& referenc
   for (int ni = 0; ni < relative_coordinates.cols (); ni++)
   {
     Eigen::Vector4i displacement = (Eigen::Vector4i () << relative_coordinates.col (ni), 0).finished ();
-    // Checking if the specified cell is in the grid
-    if ((diff2min <= displacement.array ()).all () && (diff2max >= displacement.array ()).all ())
+    Eigen::Vector4i nijk = ijk + displacement;
+    // Empty voxels and voxels outside of the grid are not in the index
+    int leaf_idx = findLeafIndex (nijk[0], nijk[1], nijk[2]);
+    if (leaf_idx >= 0 && leaves_[leaf_idx].nr_points >= min_points_per_voxel_)
     {
-      typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (((ijk + displacement - min_b_).dot (divb_mul_)));
-      if (leaf_iter != leaves_.end () && leaf_iter->second.nr_points >= min_points_per_voxel_)
-      {
-        LeafConstPtr leaf = &(leaf_iter->second);
-        neighbors.push_back (leaf);
-      }
+      LeafConstPtr leaf = &leaves_[leaf_idx];
+      neighbors.push_back (leaf);
     }
   }
 
   return (static_cast<int> (neighbors.size ()));
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::getNeighborhoodAtPoint (const PointT& reference_point, NeighborSearchMethod search_method,
+                                                          std::vector<LeafConstPtr> &neighbors) const
+{
+  // Displacements of the searched voxels, the voxel containing the point comes first
+  static const int offsets[27][3] = {{ 0, 0, 0},
+                                     {-1, 0, 0}, { 1, 0, 0}, { 0,-1, 0}, { 0, 1, 0}, { 0, 0,-1}, { 0, 0, 1},
+                                     {-1,-1, 0}, {-1, 1, 0}, { 1,-1, 0}, { 1, 1, 0},
+                                     {-1, 0,-1}, {-1, 0, 1}, { 1, 0,-1}, { 1, 0, 1},
+                                     { 0,-1,-1}, { 0,-1, 1}, { 0, 1,-1}, { 0, 1, 1},
+                                     {-1,-1,-1}, {-1,-1, 1}, {-1, 1,-1}, {-1, 1, 1},
+                                     { 1,-1,-1}, { 1,-1, 1}, { 1, 1,-1}, { 1, 1, 1}};
+
+  neighbors.clear ();
+
+  int nr_offsets;
+  switch (search_method)
+  {
+    case DIRECT27:
+      nr_offsets = 27;
+      break;
+    case DIRECT7:
+      nr_offsets = 7;
+      break;
+    case DIRECT1:
+      nr_offsets = 1;
+      break;
+    default:
+      PCL_WARN ("[pcl::%s::getNeighborhoodAtPoint] Unsupported direct search method %d.\n", getClassName ().c_str (), search_method);
+      return (0);
+  }
+
+  // Voxel coordinates, computed the same way as in applyFilter
+  int ijk0 = static_cast<int> (floor (reference_point.x * inverse_leaf_size_[0]));
+  int ijk1 = static_cast<int> (floor (reference_point.y * inverse_leaf_size_[1]));
+  int ijk2 = static_cast<int> (floor (reference_point.z * inverse_leaf_size_[2]));
+
+  for (int ni = 0; ni < nr_offsets; ni++)
+  {
+    int i = ijk0 + offsets[ni][0];
+    int j = ijk1 + offsets[ni][1];
+    int k = ijk2 + offsets[ni][2];
+
+    // Empty voxels and voxels outside of the grid are not in the index
+    int leaf_idx = findLeafIndex (i, j, k);
+    if (leaf_idx >= 0 && leaves_[leaf_idx].nr_points >= min_points_per_voxel_)
+      neighbors.push_back (&leaves_[leaf_idx]);
+  }
+
+  return (static_cast<int> (neighbors.size ()));
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointT> void
 pcl::VoxelGridCovariance<PointT>::getDisplayCloud (pcl::PointCloud<PointXYZ>& cell_cloud)
@@ -423,9 +761,9 @@ pcl::VoxelGridCovariance<PointT>::getDisplayCloud (pcl::PointCloud<PointXYZ>& ce
   Eigen::Vector3d dist_point;
 
   // Generate points for each occupied voxel with sufficient points.
-  for (typename std::map<size_t, Leaf>::iterator it = leaves_.begin (); it != leaves_.end (); ++it)
+  for (size_t li = 0; li < leaves_.size (); ++li)
   {
-    Leaf& leaf = it->second;
+    Leaf& leaf = leaves_[li];
 
     if (leaf.nr_points >= min_points_per_voxel_)
     {
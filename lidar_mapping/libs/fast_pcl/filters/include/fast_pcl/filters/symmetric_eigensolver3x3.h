@@ -0,0 +1,187 @@
+#ifndef FAST_PCL_SYMMETRIC_EIGENSOLVER3X3_H_
+#define FAST_PCL_SYMMETRIC_EIGENSOLVER3X3_H_
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+
+namespace pcl
+{
+  /** \brief Closed form eigen decomposition of a symmetric 3x3 matrix (e.g. a voxel covariance).
+    * \note Non iterative algorithm of <b>Eberly, D. (2014). A Robust Eigensolver for 3x3 Symmetric Matrices.
+    * Geometric Tools.</b>, the same as gpu::SymmetricEigensolver3x3 of ndt_gpu: the eigenvalues are the roots of
+    * the characteristic polynomial computed with trigonometric functions, the eigenvector of the best separated
+    * eigenvalue is the largest cross product of the rows of (A - lambda I), the second one is found in its
+    * orthogonal complement and the third one is their cross product. The matrix is scaled by its largest coefficient
+    * first, so there is no overflow and no loop depending on the input.
+    */
+  class SymmetricEigensolver3x3
+  {
+    public:
+
+      /** \brief Compute the eigenvalues and eigenvectors of a symmetric matrix.
+        * \param[in] input the symmetric matrix, only its upper triangle is read
+        * \param[out] eigenvalues the eigenvalues in increasing order (as Eigen::SelfAdjointEigenSolver)
+        * \param[out] eigenvectors the matching unit eigenvectors, one per column (orthonormal)
+        */
+      static inline void
+      compute (const Eigen::Matrix3d &input, Eigen::Vector3d &eigenvalues, Eigen::Matrix3d &eigenvectors)
+      {
+        double a00 = input (0, 0), a01 = input (0, 1), a02 = input (0, 2);
+        double a11 = input (1, 1), a12 = input (1, 2), a22 = input (2, 2);
+
+        double max_abs_element = std::max (std::max (std::max (std::fabs (a00), std::fabs (a01)),
+                                                     std::max (std::fabs (a02), std::fabs (a11))),
+                                           std::max (std::fabs (a12), std::fabs (a22)));
+        if (max_abs_element == 0.0)
+        {
+          eigenvalues.setZero ();
+          eigenvectors.setIdentity ();
+          return;
+        }
+
+        // Precondition the matrix by its largest coefficient
+        double inv_max_abs_element = 1.0 / max_abs_element;
+        a00 *= inv_max_abs_element;
+        a01 *= inv_max_abs_element;
+        a02 *= inv_max_abs_element;
+        a11 *= inv_max_abs_element;
+        a12 *= inv_max_abs_element;
+        a22 *= inv_max_abs_element;
+
+        double norm = a01 * a01 + a02 * a02 + a12 * a12;
+        if (norm > 0.0)
+        {
+          // Roots of the characteristic polynomial of B = (A - trace(A) / 3 I) / denom, in [-2, 2]
+          double trace_div3 = (a00 + a11 + a22) / 3.0;
+          double b00 = a00 - trace_div3;
+          double b11 = a11 - trace_div3;
+          double b22 = a22 - trace_div3;
+          double denom = std::sqrt ((b00 * b00 + b11 * b11 + b22 * b22 + norm * 2.0) / 6.0);
+          double c00 = b11 * b22 - a12 * a12;
+          double c01 = a01 * b22 - a12 * a02;
+          double c02 = a01 * a12 - b11 * a02;
+          double half_det = (b00 * c00 - a01 * c01 + a02 * c02) / (denom * denom * denom) * 0.5;
+          half_det = std::min (std::max (half_det, -1.0), 1.0);
+
+          double angle = std::acos (half_det) / 3.0;
+          double beta2 = std::cos (angle) * 2.0;
+          double beta0 = std::cos (angle + M_PI * 2.0 / 3.0) * 2.0;
+          double beta1 = -(beta0 + beta2);
+
+          eigenvalues (0) = trace_div3 + denom * beta0;
+          eigenvalues (1) = trace_div3 + denom * beta1;
+          eigenvalues (2) = trace_div3 + denom * beta2;
+
+          // Start from the eigenvalue the furthest from the two others
+          int i0 = (half_det >= 0) ? 2 : 0;
+          int i2 = (half_det >= 0) ? 0 : 2;
+
+          Eigen::Vector3d evec0, evec1;
+          computeEigenvector0 (a00, a01, a02, a11, a12, a22, eigenvalues (i0), evec0);
+          computeEigenvector1 (a00, a01, a02, a11, a12, a22, evec0, eigenvalues (1), evec1);
+          eigenvectors.col (i0) = evec0;
+          eigenvectors.col (1) = evec1;
+          eigenvectors.col (i2) = evec0.cross (evec1);
+        }
+        else
+        {
+          // Diagonal matrix, only the order has to be found
+          int order[3] = {0, 1, 2};
+          double diagonal[3] = {a00, a11, a22};
+          if (diagonal[order[0]] > diagonal[order[1]]) std::swap (order[0], order[1]);
+          if (diagonal[order[1]] > diagonal[order[2]]) std::swap (order[1], order[2]);
+          if (diagonal[order[0]] > diagonal[order[1]]) std::swap (order[0], order[1]);
+
+          eigenvectors.setZero ();
+          for (int i = 0; i < 3; i++)
+          {
+            eigenvalues (i) = diagonal[order[i]];
+            eigenvectors (order[i], i) = 1.0;
+          }
+        }
+
+        eigenvalues *= max_abs_element;
+      }
+
+    private:
+
+      /** \brief Eigenvector of a simple eigenvalue, the largest cross product of two rows of (A - eval I). */
+      static inline void
+      computeEigenvector0 (double a00, double a01, double a02, double a11, double a12, double a22, double eval,
+                           Eigen::Vector3d &evec)
+      {
+        Eigen::Vector3d row0 (a00 - eval, a01, a02);
+        Eigen::Vector3d row1 (a01, a11 - eval, a12);
+        Eigen::Vector3d row2 (a02, a12, a22 - eval);
+        Eigen::Vector3d r0xr1 = row0.cross (row1);
+        Eigen::Vector3d r0xr2 = row0.cross (row2);
+        Eigen::Vector3d r1xr2 = row1.cross (row2);
+        double d0 = r0xr1.squaredNorm ();
+        double d1 = r0xr2.squaredNorm ();
+        double d2 = r1xr2.squaredNorm ();
+
+        if (d0 >= d1 && d0 >= d2)
+          evec = r0xr1 / std::sqrt (d0);
+        else if (d1 >= d2)
+          evec = r0xr2 / std::sqrt (d1);
+        else
+          evec = r1xr2 / std::sqrt (d2);
+      }
+
+      /** \brief Eigenvector of the middle eigenvalue, searched in the plane orthogonal to evec0. */
+      static inline void
+      computeEigenvector1 (double a00, double a01, double a02, double a11, double a12, double a22,
+                           const Eigen::Vector3d &evec0, double eval1, Eigen::Vector3d &evec1)
+      {
+        // Orthonormal basis (u, v) of the orthogonal complement of evec0
+        Eigen::Vector3d u, v;
+        if (std::fabs (evec0 (0)) > std::fabs (evec0 (1)))
+        {
+          double inv_length = 1.0 / std::sqrt (evec0 (0) * evec0 (0) + evec0 (2) * evec0 (2));
+          u << -evec0 (2) * inv_length, 0.0, evec0 (0) * inv_length;
+        }
+        else
+        {
+          double inv_length = 1.0 / std::sqrt (evec0 (1) * evec0 (1) + evec0 (2) * evec0 (2));
+          u << 0.0, evec0 (2) * inv_length, -evec0 (1) * inv_length;
+        }
+        v = evec0.cross (u);
+
+        Eigen::Vector3d au ((a00 - eval1) * u (0) + a01 * u (1) + a02 * u (2),
+                            a01 * u (0) + (a11 - eval1) * u (1) + a12 * u (2),
+                            a02 * u (0) + a12 * u (1) + (a22 - eval1) * u (2));
+        Eigen::Vector3d av ((a00 - eval1) * v (0) + a01 * v (1) + a02 * v (2),
+                            a01 * v (0) + (a11 - eval1) * v (1) + a12 * v (2),
+                            a02 * v (0) + a12 * v (1) + (a22 - eval1) * v (2));
+
+        // 2x2 matrix of (A - eval1 I) in the (u, v) basis, evec1 spans its null space
+        double m00 = u.dot (au);
+        double m01 = u.dot (av);
+        double m11 = v.dot (av);
+        double abs_m00 = std::fabs (m00);
+        double abs_m01 = std::fabs (m01);
+        double abs_m11 = std::fabs (m11);
+
+        if (abs_m00 == 0 && abs_m01 == 0 && abs_m11 == 0)
+        {
+          evec1 = u;
+          return;
+        }
+
+        double u_mult = (abs_m00 >= abs_m11) ? m01 : m11;
+        double v_mult = (abs_m00 >= abs_m11) ? m00 : m01;
+        bool u_larger = std::fabs (u_mult) >= std::fabs (v_mult);
+        double &large = u_larger ? u_mult : v_mult;
+        double &small = u_larger ? v_mult : u_mult;
+        small /= large;
+        large = 1.0 / std::sqrt (1.0 + small * small);
+        small *= large;
+
+        evec1 = u * u_mult - v * v_mult;
+      }
+  };
+}
+
+#endif  // FAST_PCL_SYMMETRIC_EIGENSOLVER3X3_H_
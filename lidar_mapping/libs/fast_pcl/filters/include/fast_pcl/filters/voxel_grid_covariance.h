@@ -42,13 +42,27 @@
 //#include <pcl/filters/voxel_grid.h>
 #include "fast_pcl/filters/boost.h"
 #include "fast_pcl/filters/voxel_grid.h"
+#include "fast_pcl/filters/voxel_leaf_index.h"
+#include "fast_pcl/filters/voxel_leaf_window.h"
 
-#include <map>
+#include <vector>
 #include <pcl/point_types.h>
 #include <pcl/kdtree/kdtree_flann.h>
 
 namespace pcl
 {
+  /** \brief Methods used to look up the occupied voxels surrounding a query point.
+    * \note KDTREE performs a radius search over the voxel centroids and requires the kdtree to be built,
+    * the DIRECT methods compute the voxel index of the query point and probe the leaf structure directly.
+    */
+  enum NeighborSearchMethod
+  {
+    KDTREE,   // Radius search over the centroids of the occupied voxels
+    DIRECT27, // The voxel containing the point and its 26 surrounding voxels
+    DIRECT7,  // The voxel containing the point and its 6 face neighbors
+    DIRECT1   // The voxel containing the point only
+  };
+
   /** \brief A searchable voxel strucure containing the mean and covariance of the data.
     * \note For more information please see
     * <b>Magnusson, M. (2009). The Three-Dimensional Normal-Distributions Transform —
@@ -92,7 +106,8 @@ namespace pcl
 
 
       /** \brief Simple structure to hold a centroid, covarince and the number of points in a leaf.
-        * Inverse covariance, eigen vectors and engen values are precomputed. */
+        * Inverse covariance, eigen vectors and engen values are precomputed.
+        * The point sums are kept so that the leaf can be updated when points are added (see \ref addPoints). */
       struct Leaf
       {
         /** \brief Constructor.
@@ -105,7 +120,10 @@ namespace pcl
           cov_ (Eigen::Matrix3d::Identity ()),
           icov_ (Eigen::Matrix3d::Zero ()),
           evecs_ (Eigen::Matrix3d::Identity ()),
-          evals_ (Eigen::Vector3d::Zero ())
+          evals_ (Eigen::Vector3d::Zero ()),
+          nr_sum_points_ (0),
+          pt_sum_ (Eigen::Vector3d::Zero ()),
+          pt_sq_sum_ (Eigen::Matrix3d::Zero ())
         {
         }
 
@@ -188,9 +206,22 @@ namespace pcl
         /** \brief Eigen values of voxel covariance matrix */
         Eigen::Vector3d evals_;
 
+        /** \brief Number of points accumulated in the sums
+         * \note Differs from \ref nr_points when the voxel covariance is unusable (nr_points is then -1)
+         */
+        int nr_sum_points_;
+
+        /** \brief Sum of the points contained by voxel */
+        Eigen::Vector3d pt_sum_;
+
+        /** \brief Sum of x*xT of the points contained by voxel, used for single pass covariance calculation */
+        Eigen::Matrix3d pt_sq_sum_;
+
       };
 
-      /** \brief Pointer to VoxelGridCovariance leaf structure */
+      /** \brief Pointer to VoxelGridCovariance leaf structure
+        * \note Leaves are stored contiguously, pointers remain valid until the structure is filtered again.
+        */
       typedef Leaf* LeafPtr;
 
       /** \brief Const pointer to VoxelGridCovariance leaf structure */
@@ -206,9 +237,16 @@ namespace pcl
         min_points_per_voxel_ (6),
         min_covar_eigvalue_mult_ (0.01),
         leaves_ (),
+        leaf_keys_ (),
+        leaf_index_ (),
+        use_window_ (false),
+        window_size_ (Eigen::Vector3f::Zero ()),
+        window_center_ (Eigen::Vector3f::Zero ()),
+        leaf_window_ (),
         voxel_centroids_ (),
         voxel_centroids_leaf_indices_ (),
-        kdtree_ ()
+        kdtree_ (),
+        centroids_outdated_ (false)
       {
         downsample_all_data_ = false;
         save_leaf_layout_ = false;
@@ -262,6 +300,32 @@ namespace pcl
         return min_covar_eigvalue_mult_;
       }
 
+      /** \brief Bound the voxel structure to a box around a center, the leaves are then indexed by a dense array instead of a hash table.
+       * \note Every voxel of the box has a slot in the array (see VoxelLeafWindow), which is allocated once and reused by the
+       * following filter calls and window moves. The box is rounded up to a power of two number of voxels along each axis,
+       * points outside of it are ignored. Takes effect at the next \ref filter call, the leaf size must be set first.
+       * \param[in] size minimum side lengths of the box, zero to index the leaves by a hash table over unbounded coordinates
+       * \param[in] center center of the box
+       */
+      void
+      setWindow (const Eigen::Vector3f &size, const Eigen::Vector3f &center);
+
+      /** \brief Get the minimum side lengths of the box bounding the voxel structure, zero if it is not bounded. */
+      inline Eigen::Vector3f
+      getWindowSize () const
+      {
+        return (window_size_);
+      }
+
+      /** \brief Move the box bounding the voxel structure, the leaves leaving it are removed and the others are kept in place.
+       * \note Leaf pointers obtained before the call are invalidated. Does nothing if the structure is not bounded.
+       * \param[in] center the new center of the box
+       * \param[in] searchable flag if voxel structure is searchable, if true then kdtree is built
+       * \return number of voxels removed
+       */
+      int
+      moveWindow (const Eigen::Vector3f &center, bool searchable = false);
+
       /** \brief Filter cloud and initializes voxel structure.
        * \param[out] output cloud containing centroids of voxels containing a sufficient number of points
        * \param[in] searchable flag if voxel structure is searchable, if true then kdtree is built
@@ -273,6 +337,7 @@ namespace pcl
         applyFilter (output);
 
         voxel_centroids_ = PointCloudPtr (new PointCloud (output));
+        centroids_outdated_ = false;
 
         if (searchable_ && voxel_centroids_->size() > 0)
         {
@@ -290,6 +355,7 @@ namespace pcl
         searchable_ = searchable;
         voxel_centroids_ = PointCloudPtr (new PointCloud);
         applyFilter (*voxel_centroids_);
+        centroids_outdated_ = false;
 
         if (searchable_ && voxel_centroids_->size() > 0)
         {
@@ -298,23 +364,52 @@ namespace pcl
         }
       }
 
-      /** \brief Get the voxel containing point p.
-       * \param[in] index the index of the leaf structure node
+      /** \brief Get the leaf structure at a given position of the leaf array.
+       * \param[in] index the index of the leaf in \ref getLeaves
        * \return const pointer to leaf structure
        */
       inline LeafConstPtr
       getLeaf (int index)
       {
-        typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (index);
-        if (leaf_iter != leaves_.end ())
-        {
-          LeafConstPtr ret (&(leaf_iter->second));
-          return ret;
-        }
+        if (index >= 0 && index < static_cast<int> (leaves_.size ()))
+          return (&leaves_[index]);
         else
           return NULL;
       }
 
+      /** \brief Add points to the voxel structure without rebuilding it.
+       * \note Only the voxels containing the new points are recomputed, the centroid cloud (and the kdtree if searchable)
+       * are rebuilt from the existing leaves. The input cloud and the filter limits are not used, and the leaf layout is not updated.
+       * Leaf pointers obtained before the call are invalidated.
+       * \param[in] cloud the points to add
+       * \param[in] searchable flag if voxel structure is searchable, if true then kdtree is built
+       */
+      void
+      addPoints (const PointCloud &cloud, bool searchable = false);
+
+      /** \brief Remove the voxels lying completely outside of an axis aligned box.
+       * \note Leaf pointers obtained before the call are invalidated.
+       * \param[in] min_p minimum corner of the box
+       * \param[in] max_p maximum corner of the box
+       * \return number of voxels removed
+       */
+      int
+      removeLeavesOutside (const Eigen::Vector3f &min_p, const Eigen::Vector3f &max_p);
+
+      /** \brief Remove the voxels not lying completely inside an axis aligned box, the voxels straddling its border are
+       * rebuilt from the points of a cloud inside the box.
+       * \note Used when the box slides over a larger map: cloud holds the map points still in the box (at least the ones
+       * near its border), so the straddling voxels lose the points of the part of the map that left the box and are not
+       * counted twice when that part enters it again. Leaf pointers obtained before the call are invalidated.
+       * \param[in] min_p minimum corner of the box
+       * \param[in] max_p maximum corner of the box
+       * \param[in] cloud the points the straddling voxels are rebuilt from, the ones outside of the box or in the
+       * voxels lying completely inside it are skipped
+       * \return number of voxels removed
+       */
+      int
+      cropLeaves (const Eigen::Vector3f &min_p, const Eigen::Vector3f &max_p, const PointCloud &cloud);
+
       /** \brief Get the voxel containing point p.
        * \param[in] p the point to get the leaf structure at
        * \return const pointer to leaf structure
@@ -322,22 +417,9 @@ namespace pcl
       inline LeafConstPtr
       getLeaf (PointT &p)
       {
-        // Generate index associated with p
-        int ijk0 = static_cast<int> (floor (p.x * inverse_leaf_size_[0]) - min_b_[0]);
-        int ijk1 = static_cast<int> (floor (p.y * inverse_leaf_size_[1]) - min_b_[1]);
-        int ijk2 = static_cast<int> (floor (p.z * inverse_leaf_size_[2]) - min_b_[2]);
-
-        // Compute the centroid leaf index
-        int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-
-        // Find leaf associated with index
-        typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (idx);
-        if (leaf_iter != leaves_.end ())
-        {
-          // If such a leaf exists return the pointer to the leaf structure
-          LeafConstPtr ret (&(leaf_iter->second));
-          return ret;
-        }
+        int leaf_idx = findLeafIndex (p.x, p.y, p.z);
+        if (leaf_idx >= 0)
+          return (&leaves_[leaf_idx]);
         else
           return NULL;
       }
@@ -349,25 +431,11 @@ namespace pcl
       inline LeafConstPtr
       getLeaf (Eigen::Vector3f &p)
       {
-        // Generate index associated with p
-        int ijk0 = static_cast<int> (floor (p[0] * inverse_leaf_size_[0]) - min_b_[0]);
-        int ijk1 = static_cast<int> (floor (p[1] * inverse_leaf_size_[1]) - min_b_[1]);
-        int ijk2 = static_cast<int> (floor (p[2] * inverse_leaf_size_[2]) - min_b_[2]);
-
-        // Compute the centroid leaf index
-        int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-
-        // Find leaf associated with index
-        typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (idx);
-        if (leaf_iter != leaves_.end ())
-        {
-          // If such a leaf exists return the pointer to the leaf structure
-          LeafConstPtr ret (&(leaf_iter->second));
-          return ret;
-        }
+        int leaf_idx = findLeafIndex (p[0], p[1], p[2]);
+        if (leaf_idx >= 0)
+          return (&leaves_[leaf_idx]);
         else
           return NULL;
-
       }
 
       /** \brief Get the voxels surrounding point p, not including the voxel contating point p.
@@ -379,10 +447,21 @@ namespace pcl
       int
       getNeighborhoodAtPoint (const PointT& reference_point, std::vector<LeafConstPtr> &neighbors);
 
-      /** \brief Get the leaf structure map
-       * \return a map contataining all leaves
+      /** \brief Get the occupied voxels around point p by direct voxel index computation, without using the kdtree.
+       * \note Only voxels containing a sufficient number of points are used.
+       * \param[in] reference_point the point to get the leaf structures at
+       * \param[in] search_method DIRECT27, DIRECT7 or DIRECT1, the voxel containing p is always included
+       * \param[out] neighbors the resultant leaves
+       * \return number of neighbors found
+       */
+      int
+      getNeighborhoodAtPoint (const PointT& reference_point, NeighborSearchMethod search_method,
+                              std::vector<LeafConstPtr> &neighbors) const;
+
+      /** \brief Get the leaf structures
+       * \return a contiguous array contataining all leaves, in order of first insertion
        */
-      inline const std::map<size_t, Leaf>&
+      inline const std::vector<Leaf>&
       getLeaves ()
       {
         return leaves_;
@@ -395,9 +474,29 @@ namespace pcl
       inline PointCloudPtr
       getCentroids ()
       {
+        updateCentroids ();
         return voxel_centroids_;
       }
 
+      /** \brief Get whether the voxel centroids (and the kdtree) are behind the leaves, after \ref addPoints or a removal.
+       * \note \ref nearestKSearch and \ref radiusSearch search the centroids as of the last \ref updateCentroids.
+       */
+      inline bool
+      areCentroidsOutdated () const
+      {
+        return (centroids_outdated_);
+      }
+
+      /** \brief Rebuild the voxel centroids (and the kdtree if searchable) if the leaves changed since they were built.
+       * \note Must not run concurrently with a search.
+       */
+      inline void
+      updateCentroids ()
+      {
+        if (centroids_outdated_)
+          updateVoxelCentroids ();
+      }
+
 
       /** \brief Get a cloud to visualize each voxels normal distribution.
        * \param[out] cell_cloud a cloud created by sampling the normal distributions of each voxel
@@ -469,7 +568,7 @@ namespace pcl
        */
       int
       radiusSearch (const PointT &point, double radius, std::vector<LeafConstPtr> &k_leaves,
-                    std::vector<float> &k_sqr_distances, unsigned int max_nn = 0)
+                    std::vector<float> &k_sqr_distances, unsigned int max_nn = 0) const
       {
         k_leaves.clear ();
 
@@ -506,7 +605,7 @@ namespace pcl
       inline int
       radiusSearch (const PointCloud &cloud, int index, double radius,
                     std::vector<LeafConstPtr> &k_leaves, std::vector<float> &k_sqr_distances,
-                    unsigned int max_nn = 0)
+                    unsigned int max_nn = 0) const
       {
         if (index >= static_cast<int> (cloud.points.size ()) || index < 0)
           return (0);
@@ -520,6 +619,88 @@ namespace pcl
        */
       void applyFilter (PointCloud &output);
 
+      /** \brief Get the index in \ref leaves_ of the voxel containing the given coordinates.
+       * \return index of the leaf or -1 if the voxel is empty
+       */
+      inline int
+      findLeafIndex (float x, float y, float z) const
+      {
+        int i = static_cast<int> (floor (x * inverse_leaf_size_[0]));
+        int j = static_cast<int> (floor (y * inverse_leaf_size_[1]));
+        int k = static_cast<int> (floor (z * inverse_leaf_size_[2]));
+
+        return (findLeafIndex (i, j, k));
+      }
+
+      /** \brief Get the index in \ref leaves_ of the voxel with the given coordinates, from the window or the hash table.
+       * \return index of the leaf or -1 if the voxel is empty
+       */
+      inline int
+      findLeafIndex (int i, int j, int k) const
+      {
+        if (use_window_)
+          return (leaf_window_.find (i, j, k));
+        if (!VoxelLeafIndex::inRange (i, j, k))
+          return (-1);
+        return (leaf_index_.find (VoxelLeafIndex::packKey (i, j, k)));
+      }
+
+      /** \brief Get the leaf of the voxel with the given coordinates, appending an empty leaf if the voxel is not occupied yet.
+       * \note May reallocate \ref leaves_, only used while the structure is being filled.
+       * \return index of the leaf in \ref leaves_, -1 if the voxel is outside of the window
+       */
+      inline int
+      getOrCreateLeaf (int i, int j, int k)
+      {
+        uint64_t key = VoxelLeafIndex::packKey (i, j, k);
+        int leaf_idx = use_window_ ? leaf_window_.insert (i, j, k, static_cast<int> (leaves_.size ()))
+                                   : leaf_index_.insert (key, static_cast<int> (leaves_.size ()));
+        if (leaf_idx == static_cast<int> (leaves_.size ()))
+        {
+          leaves_.push_back (Leaf ());
+          leaf_keys_.push_back (key);
+        }
+        return (leaf_idx);
+      }
+
+      /** \brief Get the size of the Nd centroid and the offset of the rgb field (-1 if there is none). */
+      int
+      getCentroidSize (const PointCloud &cloud, int &rgba_index) const;
+
+      /** \brief Add a point to the sums of the leaf containing it.
+       * \param[in] point the point to add
+       * \param[in] centroid_size size of the Nd centroid
+       * \param[in] rgba_index offset of the rgb field, -1 if there is none
+       * \param[in] running_mean if true the Nd centroid is kept normalized, otherwise it holds the sum of the points
+       * \return index of the leaf in \ref leaves_ or -1 if the point is out of the representable range
+       */
+      int
+      accumulatePoint (const PointT &point, int centroid_size, int rgba_index, bool running_mean);
+
+      /** \brief Compute the mean, covariance and inverse covariance of a leaf from its point sums.
+       * \note nr_points is set to -1 if the covariance is unusable.
+       */
+      void
+      computeLeafStatistics (Leaf &leaf) const;
+
+      /** \brief Append the Nd centroid of a leaf to a cloud. */
+      void
+      appendCentroid (PointCloud &output, const Leaf &leaf, int centroid_size, int rgba_index) const;
+
+      /** \brief Rebuild \ref voxel_centroids_, \ref voxel_centroids_leaf_indices_ and the kdtree (if searchable) from the leaves. */
+      void
+      updateVoxelCentroids ();
+
+      /** \brief Size the window to \ref window_size_, clear it and center it on \ref window_center_. */
+      void
+      resetWindow ();
+
+      /** \brief Remove the leaves whose voxel coordinates are not between min_ijk and max_ijk, see \ref removeLeavesOutside.
+       * \return number of voxels removed
+       */
+      int
+      removeLeavesOutside (const Eigen::Vector4i &min_ijk, const Eigen::Vector4i &max_ijk);
+
       /** \brief Flag to determine if voxel structure is searchable. */
       bool searchable_;
 
@@ -530,16 +711,37 @@ namespace pcl
       double min_covar_eigvalue_mult_;
 
       /** \brief Voxel structure containing all leaf nodes (includes voxels with less than a sufficient number of points). */
-      std::map<size_t, Leaf> leaves_;
+      std::vector<Leaf> leaves_;
+
+      /** \brief Packed voxel coordinates of each leaf in \ref leaves_. */
+      std::vector<uint64_t> leaf_keys_;
+
+      /** \brief Hash index from packed voxel coordinates to the position of the leaf in \ref leaves_. */
+      VoxelLeafIndex leaf_index_;
+
+      /** \brief Flag set if the leaves are indexed by \ref leaf_window_ instead of \ref leaf_index_. */
+      bool use_window_;
+
+      /** \brief Minimum side lengths of the box bounding the voxel structure, zero if it is not bounded. */
+      Eigen::Vector3f window_size_;
+
+      /** \brief Center of the box bounding the voxel structure. */
+      Eigen::Vector3f window_center_;
+
+      /** \brief Dense index from voxel coordinates to the position of the leaf in \ref leaves_, used if the structure is bounded. */
+      VoxelLeafWindow leaf_window_;
 
       /** \brief Point cloud containing centroids of voxels containing atleast minimum number of points. */
       PointCloudPtr voxel_centroids_;
 
-      /** \brief Indices of leaf structurs associated with each point in \ref voxel_centroids_ (used for searching). */
+      /** \brief Indices in \ref leaves_ of the leaf structurs associated with each point in \ref voxel_centroids_ (used for searching). */
       std::vector<int> voxel_centroids_leaf_indices_;
 
       /** \brief KdTree generated using \ref voxel_centroids_ (used for searching). */
       KdTreeFLANN<PointT> kdtree_;
+
+      /** \brief Whether leaves were added, updated or removed since \ref voxel_centroids_ and \ref kdtree_ were built. */
+      bool centroids_outdated_;
   };
 }
 
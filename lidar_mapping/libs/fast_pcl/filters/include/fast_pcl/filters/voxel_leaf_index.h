@@ -0,0 +1,14 @@
+#ifndef FAST_PCL_VOXEL_LEAF_INDEX_H_
+#define FAST_PCL_VOXEL_LEAF_INDEX_H_
+
+#include <lidar_pcl/voxel_index.h>
+
+namespace pcl
+{
+  /** \brief Open addressing hash table mapping packed integer voxel coordinates to the index of a leaf stored in a
+    * contiguous array, the one of the lidar_pcl voxel grids.
+    */
+  typedef lidar_pcl::VoxelIndex VoxelLeafIndex;
+}
+
+#endif  //#ifndef FAST_PCL_VOXEL_LEAF_INDEX_H_
@@ -0,0 +1,220 @@
+#ifndef FAST_PCL_VOXEL_LEAF_WINDOW_H_
+#define FAST_PCL_VOXEL_LEAF_WINDOW_H_
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+namespace pcl
+{
+  /** \brief Dense index mapping the integer coordinates of the voxels of a bounded box to the index of a leaf
+    * stored in a contiguous array, the bounded counterpart of VoxelLeafIndex.
+    * \note Every voxel of the box has a slot, so a lookup is a single load. The box is a ring buffer: the slot of
+    * voxel (i, j, k) only depends on (i, j, k) modulo the box size, so moving the box (\ref setOrigin) keeps the slots
+    * of the voxels that stay inside it. The side lengths are powers of two and the modulo is a mask.
+    */
+  class VoxelLeafWindow
+  {
+    public:
+
+      /** \brief Constructor, the window is empty until \ref resize is called. */
+      VoxelLeafWindow () :
+        slots_ (),
+        size_ (0)
+      {
+        for (int d = 0; d < 3; d++)
+        {
+          origin_[d] = 0;
+          dims_[d] = 0;
+          masks_[d] = 0;
+          shifts_[d] = 0;
+        }
+      }
+
+      /** \brief Set the number of voxels of the box along each axis, rounded up to a power of two.
+        * \note The slots are only reallocated (and the stored values lost) if the rounded size changes.
+        * \param[in] nx number of voxels along x
+        * \param[in] ny number of voxels along y
+        * \param[in] nz number of voxels along z
+        */
+      inline void
+      resize (int nx, int ny, int nz)
+      {
+        int n[3] = {nx, ny, nz}, bits[3];
+        for (int d = 0; d < 3; d++)
+        {
+          bits[d] = 0;
+          while ((1 << bits[d]) < n[d])
+            ++bits[d];
+        }
+        if (!slots_.empty () && dims_[0] == (1 << bits[0]) && dims_[1] == (1 << bits[1]) && dims_[2] == (1 << bits[2]))
+          return;
+
+        for (int d = 0; d < 3; d++)
+        {
+          dims_[d] = 1 << bits[d];
+          masks_[d] = dims_[d] - 1;
+        }
+        shifts_[2] = 0;
+        shifts_[1] = bits[2];
+        shifts_[0] = bits[1] + bits[2];
+
+        std::vector<int> (static_cast<size_t> (dims_[0]) * dims_[1] * dims_[2], -1).swap (slots_);
+        size_ = 0;
+      }
+
+      /** \brief Get the number of voxels of the box along an axis.
+        * \param[in] axis 0, 1 or 2 for x, y or z
+        */
+      inline int
+      getDimension (int axis) const
+      {
+        return (dims_[axis]);
+      }
+
+      /** \brief Get the coordinates of the first voxel of the box along an axis.
+        * \param[in] axis 0, 1 or 2 for x, y or z
+        */
+      inline int
+      getOrigin (int axis) const
+      {
+        return (origin_[axis]);
+      }
+
+      /** \brief Move the box so that its first voxel is (i, j, k).
+        * \note The values of the voxels leaving the box must have been erased before, the slots are reused by the
+        * voxels entering it.
+        * \param[in] i voxel coordinate along x
+        * \param[in] j voxel coordinate along y
+        * \param[in] k voxel coordinate along z
+        */
+      inline void
+      setOrigin (int i, int j, int k)
+      {
+        origin_[0] = i;
+        origin_[1] = j;
+        origin_[2] = k;
+      }
+
+      /** \brief Check that a voxel lies in the box.
+        * \param[in] i voxel coordinate along x
+        * \param[in] j voxel coordinate along y
+        * \param[in] k voxel coordinate along z
+        */
+      inline bool
+      contains (int i, int j, int k) const
+      {
+        return (static_cast<unsigned int> (i - origin_[0]) < static_cast<unsigned int> (dims_[0]) &&
+                static_cast<unsigned int> (j - origin_[1]) < static_cast<unsigned int> (dims_[1]) &&
+                static_cast<unsigned int> (k - origin_[2]) < static_cast<unsigned int> (dims_[2]));
+      }
+
+      /** \brief Number of values stored. */
+      inline size_t
+      size () const
+      {
+        return (size_);
+      }
+
+      /** \brief Remove all values, the slots are kept for the next fill. */
+      inline void
+      clear ()
+      {
+        if (size_ > 0)
+          std::fill (slots_.begin (), slots_.end (), -1);
+        size_ = 0;
+      }
+
+      /** \brief Get the value stored for a voxel.
+        * \param[in] i voxel coordinate along x
+        * \param[in] j voxel coordinate along y
+        * \param[in] k voxel coordinate along z
+        * \return the stored value or -1 if the voxel has none or is outside of the box
+        */
+      inline int
+      find (int i, int j, int k) const
+      {
+        if (!contains (i, j, k))
+          return (-1);
+        return (slots_[slot (i, j, k)]);
+      }
+
+      /** \brief Store a value for a voxel of the box if it has none yet.
+        * \param[in] i voxel coordinate along x
+        * \param[in] j voxel coordinate along y
+        * \param[in] k voxel coordinate along z
+        * \param[in] value value stored if the voxel has none, must not be negative
+        * \return the value associated with the voxel after the call, -1 if it is outside of the box
+        */
+      inline int
+      insert (int i, int j, int k, int value)
+      {
+        if (!contains (i, j, k))
+          return (-1);
+        int &stored = slots_[slot (i, j, k)];
+        if (stored < 0)
+        {
+          stored = value;
+          ++size_;
+        }
+        return (stored);
+      }
+
+      /** \brief Change the value stored for a voxel.
+        * \param[in] i voxel coordinate along x
+        * \param[in] j voxel coordinate along y
+        * \param[in] k voxel coordinate along z
+        * \param[in] value the new value
+        * \return false if the voxel has no value
+        */
+      inline bool
+      assign (int i, int j, int k, int value)
+      {
+        if (!contains (i, j, k) || slots_[slot (i, j, k)] < 0)
+          return (false);
+        slots_[slot (i, j, k)] = value;
+        return (true);
+      }
+
+      /** \brief Remove the value of a voxel.
+        * \param[in] i voxel coordinate along x
+        * \param[in] j voxel coordinate along y
+        * \param[in] k voxel coordinate along z
+        * \return false if the voxel has no value
+        */
+      inline bool
+      erase (int i, int j, int k)
+      {
+        if (!contains (i, j, k) || slots_[slot (i, j, k)] < 0)
+          return (false);
+        slots_[slot (i, j, k)] = -1;
+        --size_;
+        return (true);
+      }
+
+    private:
+
+      /** \brief Position of a voxel in \ref slots_, the coordinates are wrapped around the box size. */
+      inline size_t
+      slot (int i, int j, int k) const
+      {
+        return ((static_cast<size_t> (i & masks_[0]) << shifts_[0]) |
+                (static_cast<size_t> (j & masks_[1]) << shifts_[1]) |
+                 static_cast<size_t> (k & masks_[2]));
+      }
+
+      std::vector<int> slots_;
+
+      size_t size_;
+
+      int origin_[3];
+
+      int dims_[3];
+
+      int masks_[3];
+
+      int shifts_[3];
+  };
+}
+
+#endif  //#ifndef FAST_PCL_VOXEL_LEAF_WINDOW_H_
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+
+#include <Eigen/Eigenvalues>
+#include "fast_pcl/filters/symmetric_eigensolver3x3.h"
+
+static double
+uniform (double min, double max)
+{
+  return (min + (max - min) * rand () / RAND_MAX);
+}
+
+/** \brief Covariance of n random points stretched along the axes of a random rotation, as in a voxel. */
+static Eigen::Matrix3d
+randomCovariance (int n, const Eigen::Vector3d &extent)
+{
+  Eigen::Matrix3d rotation = Eigen::Quaterniond (uniform (-1, 1), uniform (-1, 1), uniform (-1, 1), uniform (-1, 1)).normalized ().toRotationMatrix ();
+  Eigen::Vector3d center (uniform (-100, 100), uniform (-100, 100), uniform (-10, 10));
+  Eigen::Vector3d sum = Eigen::Vector3d::Zero ();
+  Eigen::Matrix3d sum_squares = Eigen::Matrix3d::Zero ();
+  for (int i = 0; i < n; i++)
+  {
+    Eigen::Vector3d p = center + rotation * Eigen::Vector3d (uniform (-extent (0), extent (0)),
+                                                             uniform (-extent (1), extent (1)),
+                                                             uniform (-extent (2), extent (2)));
+    sum += p;
+    sum_squares += p * p.transpose ();
+  }
+  Eigen::Vector3d mean = sum / n;
+  return ((sum_squares - n * mean * mean.transpose ()) / (n - 1));
+}
+
+/** \brief Compare with Eigen::SelfAdjointEigenSolver: same eigenvalues, orthonormal eigenvectors solving A v = lambda v.
+  * \note A pair of clustered eigenvalues is only found to about sqrt(eps) times the largest coefficient (the acos of the
+  * characteristic polynomial is flat there), far below the eigenvalue clamping of the voxel covariances.
+  */
+static void
+expectSameDecomposition (const Eigen::Matrix3d &matrix)
+{
+  Eigen::Vector3d eigenvalues;
+  Eigen::Matrix3d eigenvectors;
+  pcl::SymmetricEigensolver3x3::compute (matrix, eigenvalues, eigenvectors);
+
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> reference (matrix);
+  double scale = std::max (matrix.cwiseAbs ().maxCoeff (), std::numeric_limits<double>::min ());
+
+  for (int i = 0; i < 3; i++)
+    EXPECT_NEAR (eigenvalues (i), reference.eigenvalues () (i), 1e-7 * scale) << "matrix\n" << matrix;
+  EXPECT_LE (eigenvalues (0), eigenvalues (1) + 1e-12 * scale);
+  EXPECT_LE (eigenvalues (1), eigenvalues (2) + 1e-12 * scale);
+
+  EXPECT_TRUE ((eigenvectors.transpose () * eigenvectors).isIdentity (1e-12)) << "matrix\n" << matrix;
+  EXPECT_LE ((matrix * eigenvectors - eigenvectors * eigenvalues.asDiagonal ()).norm (), 1e-7 * scale) << "matrix\n" << matrix;
+
+  // The eigenvectors of well separated eigenvalues are the same up to their sign
+  for (int i = 0; i < 3; i++)
+  {
+    double gap = 1e30;
+    for (int j = 0; j < 3; j++)
+      if (j != i)
+        gap = std::min (gap, std::abs (reference.eigenvalues () (i) - reference.eigenvalues () (j)));
+    if (gap > 1e-3 * scale)
+    {
+      EXPECT_NEAR (std::abs (eigenvectors.col (i).dot (reference.eigenvectors ().col (i))), 1.0, 1e-9);
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST (SymmetricEigensolver3x3, VoxelCovariances)
+{
+  srand (3);
+  for (int i = 0; i < 2000; i++)
+  {
+    // Volumes, planes and lines, from a few points as in sparse voxels to many
+    Eigen::Vector3d extent (uniform (0.01, 1), uniform (0.01, 1), uniform (0.01, 1));
+    switch (i % 3)
+    {
+      case 1: extent (2) = 1e-4; break;
+      case 2: extent (1) = extent (2) = 1e-4; break;
+      default: break;
+    }
+    expectSameDecomposition (randomCovariance (6 + i % 50, extent));
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST (SymmetricEigensolver3x3, RandomSymmetric)
+{
+  srand (5);
+  for (int i = 0; i < 2000; i++)
+  {
+    Eigen::Matrix3d matrix = Eigen::Matrix3d::Random ();
+    matrix = (matrix + matrix.transpose ()).eval () * std::pow (10.0, uniform (-6, 6));
+    expectSameDecomposition (matrix);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST (SymmetricEigensolver3x3, DegenerateMatrices)
+{
+  expectSameDecomposition (Eigen::Matrix3d::Zero ());
+  expectSameDecomposition (Eigen::Matrix3d::Identity ());
+  expectSameDecomposition (Eigen::Vector3d (3, -1, 2).asDiagonal ());
+  expectSameDecomposition (Eigen::Vector3d (2, 2, 1e-9).asDiagonal ());
+
+  // Repeated eigenvalues in a rotated basis
+  Eigen::Matrix3d rotation = Eigen::AngleAxisd (0.7, Eigen::Vector3d (1, 2, 3).normalized ()).toRotationMatrix ();
+  const double values[][3] = {{1, 1, 4}, {1, 4, 4}, {0, 0, 1}, {0, 1, 1}, {2, 2, 2}};
+  for (int i = 0; i < 5; i++)
+  {
+    Eigen::Matrix3d matrix = rotation * Eigen::Vector3d (values[i][0], values[i][1], values[i][2]).asDiagonal () * rotation.transpose ();
+    expectSameDecomposition (matrix);
+  }
+
+  // Only the upper triangle is read
+  Eigen::Matrix3d upper;
+  upper << 2, 1, 0.5,
+           0, 3, 0.25,
+           0, 0, 1;
+  Eigen::Matrix3d full = upper.selfadjointView<Eigen::Upper> ();
+  Eigen::Vector3d eigenvalues, full_eigenvalues;
+  Eigen::Matrix3d eigenvectors, full_eigenvectors;
+  pcl::SymmetricEigensolver3x3::compute (upper, eigenvalues, eigenvectors);
+  pcl::SymmetricEigensolver3x3::compute (full, full_eigenvalues, full_eigenvectors);
+  EXPECT_EQ (eigenvalues, full_eigenvalues);
+  EXPECT_EQ (eigenvectors, full_eigenvectors);
+}
+
+int
+main (int argc, char **argv)
+{
+  testing::InitGoogleTest (&argc, argv);
+  return (RUN_ALL_TESTS ());
+}
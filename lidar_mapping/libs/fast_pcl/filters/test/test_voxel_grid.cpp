@@ -0,0 +1,198 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#include <pcl/point_types.h>
+#include "fast_pcl/filters/voxel_grid.h"
+#include "fast_pcl/filters/impl/voxel_grid.hpp"
+
+typedef pcl::PointCloud<pcl::PointXYZI> PointCloud;
+
+/** \brief A cloud spread over a few hundred voxels per axis, with denser patches and some invalid points. */
+static PointCloud::Ptr
+makeCloud (size_t nr_points, bool with_nan)
+{
+  srand (13);
+  PointCloud::Ptr cloud (new PointCloud);
+  for (size_t i = 0; i < nr_points; i++)
+  {
+    pcl::PointXYZI p;
+    float spread = (i % 3 == 0) ? 2.f : 60.f;
+    p.x = spread * (2.f * rand () / RAND_MAX - 1.f);
+    p.y = spread * (2.f * rand () / RAND_MAX - 1.f) - 10.f;
+    p.z = 0.1f * spread * rand () / RAND_MAX - 1.f;
+    p.intensity = static_cast<float> (rand () % 256);
+    if (with_nan && i % 97 == 0)
+      p.x = std::numeric_limits<float>::quiet_NaN ();
+    cloud->push_back (p);
+  }
+  cloud->is_dense = !with_nan;
+  return (cloud);
+}
+
+/** \brief The previous VoxelGrid::applyFilter: voxel index of each kept point, std::sort, one centroid per run of
+  * equal indices. The sort is stable here so that the points of a voxel are summed in input order.
+  */
+static void
+referenceFilter (const PointCloud &input, const std::vector<int> &indices, pcl::VoxelGrid<pcl::PointXYZI> &grid,
+                 float leaf_size, const std::string &field, float limit_min, float limit_max, bool negative,
+                 PointCloud &output)
+{
+  const Eigen::Vector3i min_b = grid.getMinBoxCoordinates ();
+  const Eigen::Vector3i divb_mul = grid.getDivisionMultiplier ();
+  const float inverse_leaf_size = 1.f / leaf_size;
+
+  std::vector<cloud_point_index_idx> index_vector;
+  for (size_t n = 0; n < indices.size (); n++)
+  {
+    const pcl::PointXYZI &p = input.points[indices[n]];
+    if (!pcl_isfinite (p.x) || !pcl_isfinite (p.y) || !pcl_isfinite (p.z))
+      continue;
+    if (!field.empty ())
+    {
+      if (negative && p.z < limit_max && p.z > limit_min)
+        continue;
+      if (!negative && (p.z > limit_max || p.z < limit_min))
+        continue;
+    }
+    int ijk0 = static_cast<int> (floor (p.x * inverse_leaf_size) - static_cast<float> (min_b[0]));
+    int ijk1 = static_cast<int> (floor (p.y * inverse_leaf_size) - static_cast<float> (min_b[1]));
+    int ijk2 = static_cast<int> (floor (p.z * inverse_leaf_size) - static_cast<float> (min_b[2]));
+    int idx = ijk0 * divb_mul[0] + ijk1 * divb_mul[1] + ijk2 * divb_mul[2];
+    index_vector.push_back (cloud_point_index_idx (static_cast<unsigned int> (idx), indices[n]));
+  }
+  std::stable_sort (index_vector.begin (), index_vector.end ());
+
+  output.clear ();
+  for (size_t first = 0, last; first < index_vector.size (); first = last)
+  {
+    last = first + 1;
+    while (last < index_vector.size () && index_vector[last].idx == index_vector[first].idx)
+      ++last;
+    if (last - first < grid.getMinimumPointsNumberPerVoxel ())
+      continue;
+
+    Eigen::Vector4f centroid = input.points[index_vector[first].cloud_point_index].getVector4fMap ();
+    centroid[3] = input.points[index_vector[first].cloud_point_index].intensity;
+    for (size_t i = first + 1; i < last; i++)
+    {
+      const pcl::PointXYZI &p = input.points[index_vector[i].cloud_point_index];
+      centroid += Eigen::Vector4f (p.x, p.y, p.z, p.intensity);
+    }
+    centroid /= static_cast<float> (last - first);
+
+    pcl::PointXYZI p;
+    p.x = centroid[0];
+    p.y = centroid[1];
+    p.z = centroid[2];
+    p.intensity = centroid[3];
+    output.push_back (p);
+  }
+}
+
+/** \brief Filter cloud with every option combination and compare the output with \ref referenceFilter. */
+static void
+checkOptions (const PointCloud::Ptr &cloud)
+{
+  const float leaf_size = 0.5f;
+  std::vector<int> all_indices (cloud->size ()), some_indices;
+  for (size_t i = 0; i < cloud->size (); i++)
+  {
+    all_indices[i] = static_cast<int> (i);
+    if (i % 5 != 2)
+      some_indices.push_back (static_cast<int> (i));
+  }
+
+  for (int option = 0; option < 16; option++)
+  {
+    const bool use_indices = (option & 1) != 0;
+    const bool use_field = (option & 2) != 0;
+    const bool negative = (option & 4) != 0;
+    const unsigned int min_points = (option & 8) ? 3 : 1;
+    if (negative && !use_field)
+      continue;
+    SCOPED_TRACE (option);
+
+    pcl::VoxelGrid<pcl::PointXYZI> grid;
+    grid.setLeafSize (leaf_size, leaf_size, leaf_size);
+    grid.setDownsampleAllData (true);
+    grid.setSaveLeafLayout (true);
+    grid.setMinimumPointsNumberPerVoxel (min_points);
+    grid.setInputCloud (cloud);
+    const std::vector<int> &indices = use_indices ? some_indices : all_indices;
+    if (use_indices)
+      grid.setIndices (boost::shared_ptr<std::vector<int> > (new std::vector<int> (some_indices)));
+    if (use_field)
+    {
+      grid.setFilterFieldName ("z");
+      grid.setFilterLimits (-0.5, 0.5);
+      grid.setFilterLimitsNegative (negative);
+    }
+
+    PointCloud output, reference;
+    grid.filter (output);
+    referenceFilter (*cloud, indices, grid, leaf_size, use_field ? "z" : "", -0.5f, 0.5f, negative, reference);
+
+    ASSERT_EQ (output.size (), reference.size ());
+    EXPECT_GT (output.size (), 100u);
+    for (size_t i = 0; i < output.size (); i++)
+    {
+      EXPECT_FLOAT_EQ (output.points[i].x, reference.points[i].x);
+      EXPECT_FLOAT_EQ (output.points[i].y, reference.points[i].y);
+      EXPECT_FLOAT_EQ (output.points[i].z, reference.points[i].z);
+      EXPECT_FLOAT_EQ (output.points[i].intensity, reference.points[i].intensity);
+      // The leaf layout maps the voxel of each centroid to its output position
+      EXPECT_EQ (grid.getCentroidIndex (output.points[i]), static_cast<int> (i));
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST (VoxelGrid, SortVoxelIndices)
+{
+  srand (17);
+  const unsigned int invalid = std::numeric_limits<unsigned int>::max ();
+  const unsigned int max_indices[] = {200, 70000, 30000000};
+  const size_t sizes[] = {1000, 100000};
+  for (int m = 0; m < 3; m++)
+    for (int s = 0; s < 2; s++)
+    {
+      std::vector<cloud_point_index_idx> index_vector, reference;
+      for (size_t i = 0; i < sizes[s]; i++)
+      {
+        unsigned int idx = (i % 11 == 0) ? invalid : static_cast<unsigned int> (rand ()) % (max_indices[m] + 1);
+        index_vector.push_back (cloud_point_index_idx (idx, static_cast<unsigned int> (i)));
+        if (idx != invalid)
+          reference.push_back (index_vector.back ());
+      }
+      std::stable_sort (reference.begin (), reference.end ());
+
+      pcl::detail::sortVoxelIndices (index_vector, max_indices[m], invalid);
+      ASSERT_EQ (index_vector.size (), reference.size ());
+      for (size_t i = 0; i < reference.size (); i++)
+      {
+        EXPECT_EQ (index_vector[i].idx, reference[i].idx);
+        EXPECT_EQ (index_vector[i].cloud_point_index, reference[i].cloud_point_index);
+      }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST (VoxelGrid, SameAsPreviousFilter)
+{
+  // Small clouds stay on one thread, large ones are split over the OpenMP threads
+  checkOptions (makeCloud (5000, false));
+  checkOptions (makeCloud (200000, false));
+  checkOptions (makeCloud (200000, true));
+}
+
+int
+main (int argc, char **argv)
+{
+  testing::InitGoogleTest (&argc, argv);
+  return (RUN_ALL_TESTS ());
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+
+#include <pcl/point_types.h>
+#include "fast_pcl/filters/voxel_grid_covariance.h"
+#include "fast_pcl/filters/impl/voxel_grid_covariance.hpp"
+
+typedef pcl::PointCloud<pcl::PointXYZ> PointCloud;
+typedef pcl::VoxelGridCovariance<pcl::PointXYZ> Grid;
+
+/** \brief Random points of a 20 x 20 x 2 box starting at x = x_min. */
+static PointCloud::Ptr
+makeCloud (size_t nr_points, float x_min)
+{
+  PointCloud::Ptr cloud (new PointCloud);
+  for (size_t i = 0; i < nr_points; i++)
+    cloud->push_back (pcl::PointXYZ (x_min + 20.f * rand () / RAND_MAX,
+                                     -10.f + 20.f * rand () / RAND_MAX,
+                                     2.f * rand () / RAND_MAX));
+  return (cloud);
+}
+
+/** \brief Build a grid of 0.7 m voxels from cloud. */
+static void
+buildGrid (const PointCloud::Ptr &cloud, Grid &grid)
+{
+  grid.setLeafSize (0.7f, 0.7f, 0.7f);
+  grid.setInputCloud (cloud);
+  grid.filter ();
+}
+
+/** \brief Same voxels with the same points, the sums up to their summation order. */
+static void
+expectSameLeaves (Grid &grid, Grid &reference)
+{
+  const std::vector<Grid::Leaf> &leaves = reference.getLeaves ();
+  ASSERT_EQ (grid.getLeaves ().size (), leaves.size ());
+  for (size_t i = 0; i < leaves.size (); i++)
+  {
+    Eigen::Vector3f mean = (leaves[i].pt_sum_ / leaves[i].nr_sum_points_).cast<float> ();
+    Grid::LeafConstPtr leaf = grid.getLeaf (mean);
+    ASSERT_TRUE (leaf != NULL);
+    EXPECT_EQ (leaf->nr_sum_points_, leaves[i].nr_sum_points_);
+    EXPECT_EQ (leaf->nr_points, leaves[i].nr_points);
+    EXPECT_TRUE (leaf->pt_sum_.isApprox (leaves[i].pt_sum_, 1e-9));
+    EXPECT_TRUE (leaf->pt_sq_sum_.isApprox (leaves[i].pt_sq_sum_, 1e-9));
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST (VoxelGridCovariance, CropLeaves)
+{
+  srand (7);
+  // The voxel [0, 0.7[ holds points of both halves
+  PointCloud::Ptr left = makeCloud (20000, -19.8f), right = makeCloud (20000, 0.35f);
+  PointCloud::Ptr both (new PointCloud (*left));
+  *both += *right;
+
+  // Cropped to x >= 0.35, the voxels straddling it only keep the points of the right half
+  Grid grid, right_grid;
+  buildGrid (both, grid);
+  buildGrid (right, right_grid);
+  int nr_removed = grid.cropLeaves (Eigen::Vector3f (0.35f, -100, -100), Eigen::Vector3f (100, 100, 100), *right);
+  EXPECT_GT (nr_removed, 0);
+  expectSameLeaves (grid, right_grid);
+
+  // The left half entering the box again is not counted twice
+  Grid both_grid;
+  buildGrid (both, both_grid);
+  grid.addPoints (*left);
+  expectSameLeaves (grid, both_grid);
+}
+
+int
+main (int argc, char **argv)
+{
+  testing::InitGoogleTest (&argc, argv);
+  return (RUN_ALL_TESTS ());
+}
@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "fast_pcl/filters/voxel_leaf_index.h"
+
+/** \brief Random voxel coordinates in a small cube so that inserts, erases and lookups collide often. */
+static uint64_t
+randomKey (int half_extent)
+{
+  int i = rand () % (2 * half_extent + 1) - half_extent;
+  int j = rand () % (2 * half_extent + 1) - half_extent;
+  int k = rand () % (2 * half_extent + 1) - half_extent;
+  return (pcl::VoxelLeafIndex::packKey (i, j, k));
+}
+
+/** \brief Check every key of the reference map and the size of the index. */
+static void
+expectSameContent (const pcl::VoxelLeafIndex &index, const std::map<uint64_t, int> &reference)
+{
+  ASSERT_EQ (index.size (), reference.size ());
+  for (std::map<uint64_t, int>::const_iterator it = reference.begin (); it != reference.end (); ++it)
+    EXPECT_EQ (index.find (it->first), it->second);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST (VoxelLeafIndex, PackKey)
+{
+  const int half = 1 << (pcl::VoxelLeafIndex::COORD_BITS - 1);
+  EXPECT_TRUE (pcl::VoxelLeafIndex::inRange (-half, 0, half - 1));
+  EXPECT_FALSE (pcl::VoxelLeafIndex::inRange (-half - 1, 0, 0));
+  EXPECT_FALSE (pcl::VoxelLeafIndex::inRange (0, half, 0));
+  EXPECT_FALSE (pcl::VoxelLeafIndex::inRange (0, 0, half));
+
+  const int coords[] = {-half, -half + 1, -1, 0, 1, 12345, half - 1};
+  const int n = sizeof (coords) / sizeof (coords[0]);
+  std::map<uint64_t, int> keys;
+  for (int a = 0; a < n; a++)
+    for (int b = 0; b < n; b++)
+      for (int c = 0; c < n; c++)
+      {
+        uint64_t key = pcl::VoxelLeafIndex::packKey (coords[a], coords[b], coords[c]);
+        int i, j, k;
+        pcl::VoxelLeafIndex::unpackKey (key, i, j, k);
+        EXPECT_EQ (i, coords[a]);
+        EXPECT_EQ (j, coords[b]);
+        EXPECT_EQ (k, coords[c]);
+        keys[key] = a;
+      }
+  // Distinct coordinates give distinct keys
+  EXPECT_EQ (keys.size (), static_cast<size_t> (n * n * n));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST (VoxelLeafIndex, MatchesStdMap)
+{
+  srand (7);
+  pcl::VoxelLeafIndex index;
+  std::map<uint64_t, int> reference;
+
+  EXPECT_EQ (index.find (pcl::VoxelLeafIndex::packKey (0, 0, 0)), -1);
+  EXPECT_FALSE (index.erase (pcl::VoxelLeafIndex::packKey (0, 0, 0)));
+  EXPECT_FALSE (index.assign (pcl::VoxelLeafIndex::packKey (0, 0, 0), 1));
+
+  for (int step = 0; step < 200000; step++)
+  {
+    uint64_t key = randomKey (12);
+    int value = rand ();
+    switch (rand () % 4)
+    {
+      case 0:
+      case 1:
+      {
+        // Insert keeps the value of a key already present
+        std::pair<std::map<uint64_t, int>::iterator, bool> ret = reference.insert (std::make_pair (key, value));
+        EXPECT_EQ (index.insert (key, value), ret.first->second);
+        break;
+      }
+      case 2:
+      {
+        std::map<uint64_t, int>::iterator it = reference.find (key);
+        EXPECT_EQ (index.assign (key, value), it != reference.end ());
+        if (it != reference.end ())
+          it->second = value;
+        break;
+      }
+      default:
+        EXPECT_EQ (index.erase (key), reference.erase (key) == 1);
+        break;
+    }
+
+    std::map<uint64_t, int>::const_iterator it = reference.find (key);
+    EXPECT_EQ (index.find (key), it == reference.end () ? -1 : it->second);
+    ASSERT_EQ (index.size (), reference.size ());
+  }
+  expectSameContent (index, reference);
+
+  // Erasing everything leaves a table where no probe sequence is broken
+  std::vector<uint64_t> keys;
+  for (std::map<uint64_t, int>::const_iterator it = reference.begin (); it != reference.end (); ++it)
+    keys.push_back (it->first);
+  std::random_shuffle (keys.begin (), keys.end ());
+  for (size_t i = 0; i < keys.size (); i++)
+  {
+    EXPECT_TRUE (index.erase (keys[i]));
+    reference.erase (keys[i]);
+    if (reference.size () % 1000 == 0)
+      expectSameContent (index, reference);
+  }
+  EXPECT_EQ (index.size (), 0u);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST (VoxelLeafIndex, ClearAndReserve)
+{
+  srand (11);
+  pcl::VoxelLeafIndex index;
+  index.reserve (5000);
+  std::map<uint64_t, int> reference;
+  for (int i = 0; i < 5000; i++)
+  {
+    uint64_t key = randomKey (1000);
+    reference.insert (std::make_pair (key, i));
+    index.insert (key, i);
+  }
+  expectSameContent (index, reference);
+
+  index.clear ();
+  EXPECT_EQ (index.size (), 0u);
+  for (std::map<uint64_t, int>::const_iterator it = reference.begin (); it != reference.end (); ++it)
+    EXPECT_EQ (index.find (it->first), -1);
+
+  // The cleared table is reused, growing past the reserved size rehashes the stored keys
+  reference.clear ();
+  for (int i = 0; i < 20000; i++)
+  {
+    uint64_t key = randomKey (1000);
+    reference.insert (std::make_pair (key, i));
+    index.insert (key, i);
+  }
+  expectSameContent (index, reference);
+}
+
+int
+main (int argc, char **argv)
+{
+  testing::InitGoogleTest (&argc, argv);
+  return (RUN_ALL_TESTS ());
+}
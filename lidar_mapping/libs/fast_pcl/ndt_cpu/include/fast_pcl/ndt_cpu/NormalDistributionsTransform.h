@@ -0,0 +1,97 @@
+#ifndef CPU_NDT_H_
+#define CPU_NDT_H_
+
+#include "Registration.h"
+#include "VoxelGrid.h"
+#include "fast_pcl/registration/ndt_derivative_batch.h"
+#include <eigen3/Eigen/Geometry>
+#include <float.h>
+
+namespace cpu {
+/* CPU counterpart of gpu::GNormalDistributionsTransform, a drop in replacement
+ * for nodes built without CUDA or on hosts where the CPU is the faster backend.
+ * The radius search of every point is done in one batch, then the score,
+ * gradient and hessian are accumulated by one pcl::NDTDerivativeBatch per thread. */
+class NormalDistributionsTransform: public Registration {
+public:
+	NormalDistributionsTransform();
+
+	NormalDistributionsTransform(const NormalDistributionsTransform &other);
+
+	void setStepSize(double step_size);
+
+	void setResolution(float resolution);
+
+	void setOutlierRatio(double olr);
+
+	double getStepSize() const;
+
+	float getResolution() const;
+
+	double getOutlierRatio() const;
+
+	double getTransformationProbability() const;
+
+	int getRealIterations();
+
+	/* Set the input map points */
+	void setInputTarget(pcl::PointCloud<pcl::PointXYZI>::Ptr input);
+	void setInputTarget(pcl::PointCloud<pcl::PointXYZ>::Ptr input);
+
+	/* Compute and get fitness score, the mean squared distance between the
+	 * aligned scan points and their nearest map points (as pcl::Registration) */
+	double getFitnessScore(double max_range = DBL_MAX);
+
+	~NormalDistributionsTransform();
+
+protected:
+	void computeTransformation(const Eigen::Matrix<float, 4, 4> &guess);
+	double computeDerivatives(Eigen::Matrix<double, 6, 1> &score_gradient, Eigen::Matrix<double, 6, 6> &hessian,
+								const Eigen::Matrix<double, 6, 1> &pose, bool compute_hessian = true);
+
+private:
+	void transformPointCloud(const std::vector<float> &in_x, const std::vector<float> &in_y, const std::vector<float> &in_z,
+								std::vector<float> &out_x, std::vector<float> &out_y, std::vector<float> &out_z,
+								const Eigen::Matrix<float, 4, 4> &transform);
+
+	void computeAngleDerivatives(const Eigen::Matrix<double, 6, 1> &pose, bool compute_hessian = true);
+
+	/* Score and its derivative along step_dir only, for the trial steps of the line search */
+	double computeDirectionalDerivative(double &score, const Eigen::Matrix<double, 6, 1> &step_dir,
+										const Eigen::Matrix<double, 6, 1> &pose);
+
+	/* Radius search of the transformed points then accumulation of the pairs into the batches */
+	void evaluateDerivativeBatches(int num_threads);
+
+	int resizeDerivativeBatches();
+
+	double computeStepLengthMT(const Eigen::Matrix<double, 6, 1> &x, Eigen::Matrix<double, 6, 1> &step_dir,
+								double step_init, double step_max, double step_min, double &score,
+								Eigen::Matrix<double, 6, 1> &score_gradient, Eigen::Matrix<double, 6, 6> &hessian);
+
+	double gauss_d1_, gauss_d2_;
+	double outlier_ratio_;
+
+	// Angular gradient terms a to h of eq. 6.19 [Magnusson 2009], 3 doubles each
+	double j_ang_[24];
+
+	// Angular hessian terms a2 to f3 of eq. 6.21 [Magnusson 2009], 3 doubles each
+	double h_ang_[45];
+
+	double step_size_;
+	float resolution_;
+	double trans_probability_;
+
+	int real_iterations_;
+
+	VoxelGrid voxel_grid_;
+
+	// Results of the last radius search
+	std::vector<int> valid_points_, starting_voxel_id_, voxel_id_;
+
+	// One batch per thread
+	std::vector<pcl::NDTDerivativeBatch> derivative_batches_;
+};
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef CPU_REGISTRATION_H_
+#define CPU_REGISTRATION_H_
+
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Geometry>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <vector>
+
+namespace cpu {
+/* CPU counterpart of gpu::GRegistration: same interface, the points
+ * are kept in structure of arrays buffers in the main memory. */
+class Registration {
+public:
+	Registration();
+
+	void align(const Eigen::Matrix<float, 4, 4> &guess);
+
+	void setTransformationEpsilon(double trans_eps);
+
+	double getTransformationEpsilon() const;
+
+	void setMaximumIterations(int max_itr);
+
+	int getMaximumIterations() const;
+
+	Eigen::Matrix<float, 4, 4> getFinalTransformation() const;
+
+	/* Set input Scanned point cloud.
+	 * Copy input points to the x, y, z buffers */
+	void setInputSource(pcl::PointCloud<pcl::PointXYZI>::Ptr input);
+	void setInputSource(pcl::PointCloud<pcl::PointXYZ>::Ptr input);
+
+	/* Set input reference map point cloud.
+	 * Copy input points to the target x, y, z buffers */
+	void setInputTarget(pcl::PointCloud<pcl::PointXYZI>::Ptr input);
+	void setInputTarget(pcl::PointCloud<pcl::PointXYZ>::Ptr input);
+
+	int getFinalNumIteration() const;
+
+	bool hasConverged() const;
+
+	/* Number of threads used by the derived registrations, 0 for the OpenMP default */
+	void setNumThreads(int num_threads);
+
+	int getNumThreads() const;
+
+	virtual ~Registration();
+protected:
+
+	virtual void computeTransformation(const Eigen::Matrix<float, 4, 4> &guess) = 0;
+
+	double transformation_epsilon_;
+	int max_iterations_;
+
+	//Original scanned point clouds
+	std::vector<float> x_, y_, z_;
+	int points_number_;
+
+	//Transformed point clouds
+	std::vector<float> trans_x_, trans_y_, trans_z_;
+
+	bool converged_;
+	int nr_iterations_;
+
+	Eigen::Matrix<float, 4, 4> final_transformation_, transformation_, previous_transformation_;
+
+	bool target_cloud_updated_;
+
+	// Reference map point
+	std::vector<float> target_x_, target_y_, target_z_;
+	int target_points_number_;
+
+	int num_threads_;
+
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef CPU_VOXEL_GRID_H_
+#define CPU_VOXEL_GRID_H_
+
+#include "fast_pcl/filters/voxel_leaf_index.h"
+#include <float.h>
+#include <vector>
+
+namespace cpu {
+/* CPU counterpart of gpu::GVoxelGrid. Only the occupied voxels are stored,
+ * they are indexed by a hash table of their integer coordinates instead of
+ * a dense grid, and the input points are sorted by voxel. The centroids and
+ * covariances are computed in parallel with OpenMP. */
+class VoxelGrid {
+public:
+	VoxelGrid();
+
+	/* Set input points, the voxels are computed immediately */
+	void setInput(const float *x, const float *y, const float *z, int points_num);
+
+	void setMinVoxelSize(int size);
+
+	/* Number of threads of the parallel loops, 0 for the OpenMP default */
+	void setNumThreads(int num_threads);
+
+	/* For each input point, search for voxels whose distance between their centroids and
+	 * the input point are less than radius.
+	 * Results of the search are stored into valid_points, starting_voxel_id, and voxel_id.
+	 * Valid points: the function return one or more voxels for these points. Other points
+	 * are considered as invalid.
+	 * The voxels of the ith valid point are voxel_id[starting_voxel_id[i]] to
+	 * voxel_id[starting_voxel_id[i + 1] - 1], so starting_voxel_id has one more
+	 * element than valid_points.
+	 * Only voxels with at least min voxel size points are returned. */
+	void radiusSearch(const float *qx, const float *qy, const float *qz, int points_num, float radius, int max_nn,
+						std::vector<int> &valid_points, std::vector<int> &starting_voxel_id, std::vector<int> &voxel_id) const;
+
+	int getVoxelNum() const;
+
+	float getMaxX() const;
+	float getMaxY() const;
+	float getMaxZ() const;
+
+	float getMinX() const;
+	float getMinY() const;
+	float getMinZ() const;
+
+	float getVoxelX() const;
+	float getVoxelY() const;
+	float getVoxelZ() const;
+
+	int getMaxBX() const;
+	int getMaxBY() const;
+	int getMaxBZ() const;
+
+	int getMinBX() const;
+	int getMinBY() const;
+	int getMinBZ() const;
+
+	void setLeafSize(float voxel_x, float voxel_y, float voxel_z);
+
+	/* Get the centroid list, 3 doubles per voxel. */
+	const double *getCentroidList() const;
+
+	/* Get the covariance list, 9 doubles (row major 3x3 matrix) per voxel. */
+	const double *getCovarianceList() const;
+
+	/* Get the inverse covariances list, 9 doubles (row major 3x3 matrix) per voxel. */
+	const double *getInverseCovarianceList() const;
+
+	/* Get the number of points per voxel, -1 for the voxels whose covariance is singular. */
+	const int *getPointsPerVoxelList() const;
+
+	/* Searching for the nearest point of each input query point.
+	 * Coordinates of query points are input by trans_x, trans_y, and trans_z.
+	 * The ith element of valid_distance is 1 if the squared distance between
+	 * the ith input point and its nearest neighbor is less than or equal
+	 * to max_range. Otherwise, it is 0.
+	 * The ith element of min_distance stores the squared distance between
+	 * the corresponding input point and its nearest neighbor. It is 0 if
+	 * the distance is larger than max_range. */
+	void nearestNeighborSearch(const float *trans_x, const float *trans_y, const float *trans_z, int point_num,
+								std::vector<int> &valid_distance, std::vector<double> &min_distance, float max_range = FLT_MAX) const;
+
+private:
+
+	/* Put points into voxels */
+	void scatterPointsToVoxelGrid();
+
+	/* Compute centroids and covariances of voxels. */
+	void computeCentroidAndCovariance();
+
+	/* Index of the voxel of integer coordinates (i, j, k), -1 if it is empty */
+	int findVoxel(int i, int j, int k) const;
+
+	/* Squared distance between a query point and the nearest point of a voxel,
+	 * the minimum is kept in min_dist */
+	void searchVoxelPoints(int voxel, float qx, float qy, float qz, double &min_dist) const;
+
+	int getThreadsNum() const;
+
+	//Coordinate of input points, sorted by voxel
+	std::vector<float> x_, y_, z_;
+	int points_num_;
+
+	std::vector<double> centroid_;				// List of 3x1 double vector
+	std::vector<double> covariance_;			// List of 3x3 double matrix
+	std::vector<double> inverse_covariance_;	// List of 3x3 double matrix
+	std::vector<int> points_per_voxel_;
+
+	int voxel_num_;						// Number of voxels
+	float max_x_, max_y_, max_z_;		// Upper bounds of the grid (maximum coordinate)
+	float min_x_, min_y_, min_z_;		// Lower bounds of the grid (minimum coordinate)
+	float voxel_x_, voxel_y_, voxel_z_;	// Leaf size, a.k.a, size of each voxel
+
+	int max_b_x_, max_b_y_, max_b_z_;	// Upper bounds of the grid, measured in number of voxels
+	int min_b_x_, min_b_y_, min_b_z_;	// Lower bounds of the grid, measured in number of voxels
+	int min_points_per_voxel_;
+
+	// Points of voxel i are starting_point_ids_[i] to starting_point_ids_[i + 1] - 1 in x_, y_, z_
+	std::vector<int> starting_point_ids_;
+
+	pcl::VoxelLeafIndex voxel_index_;
+
+	int num_threads_;
+};
+}
+
+#endif
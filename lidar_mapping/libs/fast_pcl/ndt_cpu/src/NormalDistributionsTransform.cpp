@@ -0,0 +1,551 @@
+#include "fast_pcl/ndt_cpu/NormalDistributionsTransform.h"
+#include "fast_pcl/registration/ndt_line_search.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace cpu {
+
+NormalDistributionsTransform::NormalDistributionsTransform()
+{
+	gauss_d1_ = gauss_d2_ = 0;
+	outlier_ratio_ = 0.55;
+	step_size_ = 0.1;
+	resolution_ = 1.0f;
+	trans_probability_ = 0;
+
+	double gauss_c1, gauss_c2, gauss_d3;
+
+	// Initializes the guassian fitting parameters (eq. 6.8) [Magnusson 2009]
+	gauss_c1 = 10.0 * (1 - outlier_ratio_);
+	gauss_c2 = outlier_ratio_ / pow (resolution_, 3);
+	gauss_d3 = -log (gauss_c2);
+	gauss_d1_ = -log ( gauss_c1 + gauss_c2 ) - gauss_d3;
+	gauss_d2_ = -2 * log ((-log ( gauss_c1 * exp ( -0.5 ) + gauss_c2 ) - gauss_d3) / gauss_d1_);
+
+	transformation_epsilon_ = 0.1;
+	max_iterations_ = 35;
+
+	std::fill(j_ang_, j_ang_ + 24, 0);
+	std::fill(h_ang_, h_ang_ + 45, 0);
+
+	real_iterations_ = 0;
+}
+
+NormalDistributionsTransform::NormalDistributionsTransform(const NormalDistributionsTransform &other):
+	Registration(other)
+{
+	gauss_d1_ = other.gauss_d1_;
+	gauss_d2_ = other.gauss_d2_;
+
+	outlier_ratio_ = other.outlier_ratio_;
+
+	std::copy(other.j_ang_, other.j_ang_ + 24, j_ang_);
+	std::copy(other.h_ang_, other.h_ang_ + 45, h_ang_);
+
+	step_size_ = other.step_size_;
+	resolution_ = other.resolution_;
+	trans_probability_ = other.trans_probability_;
+	real_iterations_ = other.real_iterations_;
+
+	voxel_grid_ = other.voxel_grid_;
+}
+
+NormalDistributionsTransform::~NormalDistributionsTransform()
+{
+}
+
+void NormalDistributionsTransform::setStepSize(double step_size)
+{
+	step_size_ = step_size;
+}
+
+void NormalDistributionsTransform::setResolution(float resolution)
+{
+	resolution_ = resolution;
+}
+
+void NormalDistributionsTransform::setOutlierRatio(double olr)
+{
+	outlier_ratio_ = olr;
+}
+
+double NormalDistributionsTransform::getStepSize() const
+{
+	return step_size_;
+}
+
+float NormalDistributionsTransform::getResolution() const
+{
+	return resolution_;
+}
+
+double NormalDistributionsTransform::getOutlierRatio() const
+{
+	return outlier_ratio_;
+}
+
+double NormalDistributionsTransform::getTransformationProbability() const
+{
+	return trans_probability_;
+}
+
+int NormalDistributionsTransform::getRealIterations()
+{
+	 return real_iterations_;
+}
+
+void NormalDistributionsTransform::setInputTarget(pcl::PointCloud<pcl::PointXYZI>::Ptr input)
+{
+	Registration::setInputTarget(input);
+
+	// Build the voxel grid
+	if (target_points_number_ != 0) {
+		voxel_grid_.setNumThreads(num_threads_);
+		voxel_grid_.setLeafSize(resolution_, resolution_, resolution_);
+		voxel_grid_.setInput(target_x_.data(), target_y_.data(), target_z_.data(), target_points_number_);
+	}
+}
+
+void NormalDistributionsTransform::setInputTarget(pcl::PointCloud<pcl::PointXYZ>::Ptr input)
+{
+	Registration::setInputTarget(input);
+
+	// Build the voxel grid
+	if (target_points_number_ != 0) {
+		voxel_grid_.setNumThreads(num_threads_);
+		voxel_grid_.setLeafSize(resolution_, resolution_, resolution_);
+		voxel_grid_.setInput(target_x_.data(), target_y_.data(), target_z_.data(), target_points_number_);
+	}
+}
+
+void NormalDistributionsTransform::computeTransformation(const Eigen::Matrix<float, 4, 4> &guess)
+{
+	nr_iterations_ = 0;
+	converged_ = false;
+
+	double gauss_c1, gauss_c2, gauss_d3;
+
+	gauss_c1 = 10 * ( 1 - outlier_ratio_);
+	gauss_c2 = outlier_ratio_ / pow(resolution_, 3);
+	gauss_d3 = - log(gauss_c2);
+	gauss_d1_ = -log(gauss_c1 + gauss_c2) - gauss_d3;
+	gauss_d2_ = -2 * log((-log(gauss_c1 * exp(-0.5) + gauss_c2) - gauss_d3) / gauss_d1_);
+
+	if (guess != Eigen::Matrix4f::Identity()) {
+		final_transformation_ = guess;
+
+		transformPointCloud(x_, y_, z_, trans_x_, trans_y_, trans_z_, guess);
+	}
+
+	Eigen::Transform<float, 3, Eigen::Affine, Eigen::ColMajor> eig_transformation;
+	eig_transformation.matrix() = final_transformation_;
+
+	Eigen::Matrix<double, 6, 1> p, delta_p, score_gradient;
+	Eigen::Vector3f init_translation = eig_transformation.translation();
+	Eigen::Vector3f init_rotation = eig_transformation.rotation().eulerAngles(0, 1, 2);
+
+	p << init_translation(0), init_translation(1), init_translation(2), init_rotation(0), init_rotation(1), init_rotation(2);
+
+	Eigen::Matrix<double, 6, 6> hessian;
+
+	double score = 0;
+	double delta_p_norm;
+
+	score = computeDerivatives(score_gradient, hessian, p);
+
+	while (!converged_) {
+		previous_transformation_ = transformation_;
+
+		Eigen::JacobiSVD<Eigen::Matrix<double, 6, 6> > sv(hessian, Eigen::ComputeFullU | Eigen::ComputeFullV);
+
+		delta_p = sv.solve(-score_gradient);
+
+		delta_p_norm = delta_p.norm();
+
+		if (delta_p_norm == 0 || delta_p_norm != delta_p_norm) {
+			trans_probability_ = score / static_cast<double>(points_number_);
+			converged_ = delta_p_norm == delta_p_norm;
+			return;
+		}
+
+		delta_p.normalize();
+		delta_p_norm = computeStepLengthMT(p, delta_p, delta_p_norm, step_size_, transformation_epsilon_ / 2, score, score_gradient, hessian);
+
+		delta_p *= delta_p_norm;
+
+		transformation_ = (Eigen::Translation<float, 3>(static_cast<float>(delta_p(0)), static_cast<float>(delta_p(1)), static_cast<float>(delta_p(2))) *
+							Eigen::AngleAxis<float>(static_cast<float>(delta_p(3)), Eigen::Vector3f::UnitX()) *
+							Eigen::AngleAxis<float>(static_cast<float>(delta_p(4)), Eigen::Vector3f::UnitY()) *
+							Eigen::AngleAxis<float>(static_cast<float>(delta_p(5)), Eigen::Vector3f::UnitZ())).matrix();
+
+		p = p + delta_p;
+
+		if (nr_iterations_ > max_iterations_ || (nr_iterations_ && (std::fabs(delta_p_norm) < transformation_epsilon_)))
+			converged_ = true;
+
+		nr_iterations_++;
+	}
+
+	trans_probability_ = score / static_cast<double>(points_number_);
+}
+
+int NormalDistributionsTransform::resizeDerivativeBatches()
+{
+#ifdef _OPENMP
+	int num_threads = (num_threads_ > 0) ? num_threads_ : omp_get_max_threads();
+#else
+	int num_threads = 1;
+#endif
+	if (static_cast<int>(derivative_batches_.size()) < num_threads)
+		derivative_batches_.resize(num_threads);
+
+	return num_threads;
+}
+
+void NormalDistributionsTransform::evaluateDerivativeBatches(int num_threads)
+{
+	// All the points are searched at once, then each thread evaluates the (point, voxel) pairs of its own points
+	voxel_grid_.setNumThreads(num_threads);
+	voxel_grid_.radiusSearch(trans_x_.data(), trans_y_.data(), trans_z_.data(), points_number_, resolution_, INT_MAX,
+								valid_points_, starting_voxel_id_, voxel_id_);
+
+	const double *centroid = voxel_grid_.getCentroidList();
+	const double *inverse_covariance = voxel_grid_.getInverseCovarianceList();
+	int valid_points_num = valid_points_.size();
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+	{
+#ifdef _OPENMP
+		pcl::NDTDerivativeBatch &batch = derivative_batches_[omp_get_thread_num()];
+#else
+		pcl::NDTDerivativeBatch &batch = derivative_batches_[0];
+#endif
+		Eigen::Vector3d x, x_trans;
+		Eigen::Matrix3d c_inv;
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (int i = 0; i < valid_points_num; i++) {
+			int pid = valid_points_[i];
+
+			x << x_[pid], y_[pid], z_[pid];
+
+			for (int j = starting_voxel_id_[i]; j < starting_voxel_id_[i + 1]; j++) {
+				int vid = voxel_id_[j];
+				const double *mean = centroid + vid * 3;
+				const double *icov = inverse_covariance + vid * 9;
+
+				// Denorm point, x_k' in Equations 6.12 and 6.13 [Magnusson 2009]
+				x_trans << trans_x_[pid] - mean[0], trans_y_[pid] - mean[1], trans_z_[pid] - mean[2];
+				c_inv << icov[0], icov[1], icov[2],
+						 icov[3], icov[4], icov[5],
+						 icov[6], icov[7], icov[8];
+
+				batch.push(x, x_trans, c_inv);
+			}
+		}
+
+		batch.flush();
+	}
+}
+
+double NormalDistributionsTransform::computeDerivatives(Eigen::Matrix<double, 6, 1> &score_gradient, Eigen::Matrix<double, 6, 6> &hessian,
+														const Eigen::Matrix<double, 6, 1> &pose, bool compute_hessian)
+{
+	score_gradient.setZero();
+	hessian.setZero();
+
+	//Compute Angle Derivatives
+	computeAngleDerivatives(pose, compute_hessian);
+
+	int num_threads = resizeDerivativeBatches();
+
+	for (int i = 0; i < num_threads; i++)
+		derivative_batches_[i].reset(gauss_d1_, gauss_d2_, j_ang_, h_ang_, compute_hessian);
+
+	evaluateDerivativeBatches(num_threads);
+
+	double score = 0;
+
+	for (int i = 0; i < num_threads; i++)
+		derivative_batches_[i].addTo(score, score_gradient, hessian);
+
+	return score;
+}
+
+double NormalDistributionsTransform::computeDirectionalDerivative(double &score, const Eigen::Matrix<double, 6, 1> &step_dir,
+																	const Eigen::Matrix<double, 6, 1> &pose)
+{
+	// Only the angular gradient terms are needed (eq. 6.19)[Magnusson 2009]
+	computeAngleDerivatives(pose, false);
+
+	double dir[6];
+
+	for (int i = 0; i < 6; i++)
+		dir[i] = step_dir(i);
+
+	int num_threads = resizeDerivativeBatches();
+
+	for (int i = 0; i < num_threads; i++)
+		derivative_batches_[i].resetDirectional(gauss_d1_, gauss_d2_, j_ang_, dir);
+
+	evaluateDerivativeBatches(num_threads);
+
+	double derivative = 0;
+
+	score = 0;
+
+	for (int i = 0; i < num_threads; i++)
+		derivative_batches_[i].addDirectionalTo(score, derivative);
+
+	return derivative;
+}
+
+void NormalDistributionsTransform::computeAngleDerivatives(const Eigen::Matrix<double, 6, 1> &pose, bool compute_hessian)
+{
+	double cx, cy, cz, sx, sy, sz;
+
+	// Simplified math for near 0 angles
+	if (fabs(pose(3)) < 10e-5) {
+		cx = 1.0;
+		sx = 0.0;
+	} else {
+		cx = cos(pose(3));
+		sx = sin(pose(3));
+	}
+
+	if (fabs(pose(4)) < 10e-5) {
+		cy = 1.0;
+		sy = 0.0;
+	} else {
+		cy = cos(pose(4));
+		sy = sin(pose(4));
+	}
+
+	if (fabs(pose(5)) < 10e-5) {
+		cz = 1.0;
+		sz = 0.0;
+	} else {
+		cz = cos(pose(5));
+		sz = sin(pose(5));
+	}
+
+	// Precomputed angular gradiant components. Letters correspond to Equation 6.19 [Magnusson 2009]
+	double j_ang[24] = {
+		-sx * sz + cx * sy * cz, -sx * cz - cx * sy * sz, -cx * cy,		// a
+		cx * sz + sx * sy * cz, cx * cz - sx * sy * sz, -sx * cy,		// b
+		-sy * cz, sy * sz, cy,											// c
+		sx * cy * cz, -sx * cy * sz, sx * sy,							// d
+		-cx * cy * cz, cx * cy * sz, -cx * sy,							// e
+		-cy * sz, -cy * cz, 0,											// f
+		cx * cz - sx * sy * sz, -cx * sz - sx * sy * cz, 0,				// g
+		sx * cz + cx * sy * sz, cx * sy * cz - sx * sz, 0				// h
+	};
+
+	std::copy(j_ang, j_ang + 24, j_ang_);
+
+	if (compute_hessian) {
+		// Precomputed angular hessian components. Letters correspond to Equation 6.21 and numbers correspond to row index [Magnusson 2009]
+		double h_ang[45] = {
+			-cx * sz - sx * sy * cz, -cx * cz + sx * sy * sz, sx * cy,		// a2
+			-sx * sz + cx * sy * cz, -cx * sy * sz - sx * cz, -cx * cy,		// a3
+
+			cx * cy * cz, -cx * cy * sz, cx * sy,							// b2
+			sx * cy * cz, -sx * cy * sz, sx * sy,							// b3
+
+			-sx * cz - cx * sy * sz, sx * sz - cx * sy * cz, 0,				// c2
+			cx * cz - sx * sy * sz, -sx * sy * cz - cx * sz, 0,				// c3
+
+			-cy * cz, cy * sz, sy,											// d1
+			-sx * sy * cz, sx * sy * sz, sx * cy,							// d2
+			cx * sy * cz, -cx * sy * sz, -cx * cy,							// d3
+
+			sy * sz, sy * cz, 0,											// e1
+			-sx * cy * sz, -sx * cy * cz, 0,								// e2
+			cx * cy * sz, cx * cy * cz, 0,									// e3
+
+			-cy * cz, cy * sz, 0,											// f1
+			-cx * sz - sx * sy * cz, -cx * cz + sx * sy * sz, 0,			// f2
+			-sx * sz + cx * sy * cz, -cx * sy * sz - sx * cz, 0				// f3
+		};
+
+		std::copy(h_ang, h_ang + 45, h_ang_);
+	}
+}
+
+void NormalDistributionsTransform::transformPointCloud(const std::vector<float> &in_x, const std::vector<float> &in_y, const std::vector<float> &in_z,
+														std::vector<float> &trans_x, std::vector<float> &trans_y, std::vector<float> &trans_z,
+														const Eigen::Matrix<float, 4, 4> &transform)
+{
+	Eigen::Transform<float, 3, Eigen::Affine> t(transform);
+	int points_number = in_x.size();
+
+	trans_x.resize(points_number);
+	trans_y.resize(points_number);
+	trans_z.resize(points_number);
+
+#ifdef _OPENMP
+	int num_threads = (num_threads_ > 0) ? num_threads_ : omp_get_max_threads();
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+	for (int i = 0; i < points_number; i++) {
+		float x = in_x[i];
+		float y = in_y[i];
+		float z = in_z[i];
+
+		trans_x[i] = t(0, 0) * x + t(0, 1) * y + t(0, 2) * z + t(0, 3);
+		trans_y[i] = t(1, 0) * x + t(1, 1) * y + t(1, 2) * z + t(1, 3);
+		trans_z[i] = t(2, 0) * x + t(2, 1) * y + t(2, 2) * z + t(2, 3);
+	}
+}
+
+double NormalDistributionsTransform::computeStepLengthMT(const Eigen::Matrix<double, 6, 1> &x, Eigen::Matrix<double, 6, 1> &step_dir,
+														double step_init, double step_max, double step_min, double &score,
+														Eigen::Matrix<double, 6, 1> &score_gradient, Eigen::Matrix<double, 6, 6> &hessian)
+{
+	double phi_0 = -score;
+	double d_phi_0 = -(score_gradient.dot(step_dir));
+
+	Eigen::Matrix<double, 6, 1> x_t;
+
+	if (d_phi_0 >= 0) {
+		if (d_phi_0 == 0)
+			return 0;
+		else {
+			d_phi_0 *= -1;
+			step_dir *= -1;
+		}
+	}
+
+	int max_step_iterations = 10;
+	int step_iterations = 0;
+
+	double mu = 1.e-4;
+	double nu = 0.9;
+	double a_l = 0, a_u = 0;
+
+	double f_l = pcl::ndt_line_search::auxilaryFunction_PsiMT(a_l, phi_0, phi_0, d_phi_0, mu);
+	double g_l = pcl::ndt_line_search::auxilaryFunction_dPsiMT(d_phi_0, d_phi_0, mu);
+
+	double f_u = pcl::ndt_line_search::auxilaryFunction_PsiMT(a_u, phi_0, phi_0, d_phi_0, mu);
+	double g_u = pcl::ndt_line_search::auxilaryFunction_dPsiMT(d_phi_0, d_phi_0, mu);
+
+	// The search is skipped by making step_min == step_max
+	bool interval_converged = (step_max - step_min) <= 0, open_interval = true;
+
+	double a_t = step_init;
+	a_t = std::min(a_t, step_max);
+	a_t = std::max(a_t, step_min);
+
+	x_t = x + step_dir * a_t;
+
+	final_transformation_ = (Eigen::Translation<float, 3>(static_cast<float>(x_t(0)), static_cast<float>(x_t(1)), static_cast<float>(x_t(2))) *
+								Eigen::AngleAxis<float>(static_cast<float>(x_t(3)), Eigen::Vector3f::UnitX()) *
+								Eigen::AngleAxis<float>(static_cast<float>(x_t(4)), Eigen::Vector3f::UnitY()) *
+								Eigen::AngleAxis<float>(static_cast<float>(x_t(5)), Eigen::Vector3f::UnitZ())).matrix();
+
+	transformPointCloud(x_, y_, z_, trans_x_, trans_y_, trans_z_, final_transformation_);
+
+	// Trial steps only need the score and its derivative along the step direction, the gradient and
+	// hessian are computed once the step is accepted (as pcl::NormalDistributionsTransform)
+	bool search_steps = !interval_converged;
+	double phi_t, d_phi_t;
+
+	if (search_steps) {
+		d_phi_t = -computeDirectionalDerivative(score, step_dir, x_t);
+	} else {
+		score = computeDerivatives(score_gradient, hessian, x_t);
+		d_phi_t = -(score_gradient.dot(step_dir));
+	}
+
+	phi_t = -score;
+
+	double psi_t = pcl::ndt_line_search::auxilaryFunction_PsiMT(a_t, phi_t, phi_0, d_phi_0, mu);
+	double d_psi_t = pcl::ndt_line_search::auxilaryFunction_dPsiMT(d_phi_t, d_phi_0, mu);
+
+	while (!interval_converged && step_iterations < max_step_iterations && !(psi_t <= 0 && d_phi_t <= -nu * d_phi_0)) {
+		if (open_interval) {
+			a_t = pcl::ndt_line_search::trialValueSelectionMT(a_l, f_l, g_l, a_u, f_u, g_u, a_t, psi_t, d_psi_t);
+		} else {
+			a_t = pcl::ndt_line_search::trialValueSelectionMT(a_l, f_l, g_l, a_u, f_u, g_u, a_t, phi_t, d_phi_t);
+		}
+
+		a_t = std::min(a_t, step_max);
+		a_t = std::max(a_t, step_min);
+
+		x_t = x + step_dir * a_t;
+
+		final_transformation_ = (Eigen::Translation<float, 3>(static_cast<float>(x_t(0)), static_cast<float>(x_t(1)), static_cast<float>(x_t(2))) *
+								 Eigen::AngleAxis<float>(static_cast<float>(x_t(3)), Eigen::Vector3f::UnitX()) *
+								 Eigen::AngleAxis<float>(static_cast<float>(x_t(4)), Eigen::Vector3f::UnitY()) *
+								 Eigen::AngleAxis<float>(static_cast<float>(x_t(5)), Eigen::Vector3f::UnitZ())).matrix();
+
+		transformPointCloud(x_, y_, z_, trans_x_, trans_y_, trans_z_, final_transformation_);
+
+		d_phi_t = -computeDirectionalDerivative(score, step_dir, x_t);
+		phi_t = -score;
+
+		psi_t = pcl::ndt_line_search::auxilaryFunction_PsiMT(a_t, phi_t, phi_0, d_phi_0, mu);
+		d_psi_t = pcl::ndt_line_search::auxilaryFunction_dPsiMT(d_phi_t, d_phi_0, mu);
+
+		if (open_interval && (psi_t <= 0 && d_psi_t >= 0)) {
+			open_interval = false;
+
+			f_l += phi_0 - mu * d_phi_0 * a_l;
+			g_l += mu * d_phi_0;
+
+			f_u += phi_0 - mu * d_phi_0 * a_u;
+			g_u += mu * d_phi_0;
+		}
+
+		if (open_interval) {
+			interval_converged = pcl::ndt_line_search::updateIntervalMT(a_l, f_l, g_l, a_u, f_u, g_u, a_t, psi_t, d_psi_t);
+		} else {
+			interval_converged = pcl::ndt_line_search::updateIntervalMT(a_l, f_l, g_l, a_u, f_u, g_u, a_t, phi_t, d_phi_t);
+		}
+		step_iterations++;
+	}
+
+	if (search_steps)
+		score = computeDerivatives(score_gradient, hessian, x_t);
+
+	real_iterations_ += step_iterations;
+
+	return a_t;
+}
+
+double NormalDistributionsTransform::getFitnessScore(double max_range)
+{
+	std::vector<float> trans_x, trans_y, trans_z;
+
+	transformPointCloud(x_, y_, z_, trans_x, trans_y, trans_z, final_transformation_);
+
+	std::vector<int> valid_distance;
+	std::vector<double> min_distance;
+
+	voxel_grid_.setNumThreads(num_threads_);
+	voxel_grid_.nearestNeighborSearch(trans_x.data(), trans_y.data(), trans_z.data(), points_number_, valid_distance, min_distance,
+										static_cast<float>(std::min(max_range, static_cast<double>(FLT_MAX))));
+
+	double fitness_score = 0.0;
+	int nr = 0;
+
+	for (int i = 0; i < points_number_; i++) {
+		fitness_score += min_distance[i];
+		nr += valid_distance[i];
+	}
+
+	if (nr > 0)
+		return (fitness_score / nr);
+
+	return DBL_MAX;
+}
+
+}
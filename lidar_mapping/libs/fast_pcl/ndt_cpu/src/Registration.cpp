@@ -0,0 +1,154 @@
+#include "fast_pcl/ndt_cpu/Registration.h"
+
+namespace cpu {
+
+Registration::Registration()
+{
+	max_iterations_ = 0;
+	points_number_ = 0;
+
+	converged_ = false;
+	nr_iterations_ = 0;
+
+	transformation_epsilon_ = 0;
+	target_cloud_updated_ = true;
+	target_points_number_ = 0;
+
+	num_threads_ = 0;
+
+	final_transformation_ = transformation_ = previous_transformation_ = Eigen::Matrix<float, 4, 4>::Identity();
+}
+
+Registration::~Registration()
+{
+}
+
+void Registration::setTransformationEpsilon(double trans_eps)
+{
+	transformation_epsilon_ = trans_eps;
+}
+
+double Registration::getTransformationEpsilon() const
+{
+	return transformation_epsilon_;
+}
+
+void Registration::setMaximumIterations(int max_itr)
+{
+	max_iterations_ = max_itr;
+}
+
+int Registration::getMaximumIterations() const
+{
+	return max_iterations_;
+}
+
+Eigen::Matrix<float, 4, 4> Registration::getFinalTransformation() const
+{
+	return final_transformation_;
+}
+
+int Registration::getFinalNumIteration() const
+{
+	return nr_iterations_;
+}
+
+bool Registration::hasConverged() const
+{
+	return converged_;
+}
+
+void Registration::setNumThreads(int num_threads)
+{
+	num_threads_ = num_threads;
+}
+
+int Registration::getNumThreads() const
+{
+	return num_threads_;
+}
+
+template <typename T>
+static void convertInput(const pcl::PointCloud<T> &input, std::vector<float> &out_x, std::vector<float> &out_y, std::vector<float> &out_z)
+{
+	int point_num = input.size();
+
+	out_x.resize(point_num);
+	out_y.resize(point_num);
+	out_z.resize(point_num);
+
+	for (int i = 0; i < point_num; i++) {
+		const T &tmp = input.points[i];
+		out_x[i] = tmp.x;
+		out_y[i] = tmp.y;
+		out_z[i] = tmp.z;
+	}
+}
+
+void Registration::setInputSource(pcl::PointCloud<pcl::PointXYZI>::Ptr input)
+{
+	//Convert point cloud to float x, y, z
+	if (input->size() > 0) {
+		points_number_ = input->size();
+
+		convertInput(*input, x_, y_, z_);
+
+		// Initially, also copy scanned points to transformed buffers
+		trans_x_ = x_;
+		trans_y_ = y_;
+		trans_z_ = z_;
+	}
+}
+
+void Registration::setInputSource(pcl::PointCloud<pcl::PointXYZ>::Ptr input)
+{
+	//Convert point cloud to float x, y, z
+	if (input->size() > 0) {
+		points_number_ = input->size();
+
+		convertInput(*input, x_, y_, z_);
+
+		trans_x_ = x_;
+		trans_y_ = y_;
+		trans_z_ = z_;
+	}
+}
+
+//Set input MAP data
+void Registration::setInputTarget(pcl::PointCloud<pcl::PointXYZI>::Ptr input)
+{
+	if (input->size() > 0) {
+		target_points_number_ = input->size();
+
+		convertInput(*input, target_x_, target_y_, target_z_);
+
+		target_cloud_updated_ = true;
+	}
+}
+
+void Registration::setInputTarget(pcl::PointCloud<pcl::PointXYZ>::Ptr input)
+{
+	if (input->size() > 0) {
+		target_points_number_ = input->size();
+
+		convertInput(*input, target_x_, target_y_, target_z_);
+
+		target_cloud_updated_ = true;
+	}
+}
+
+void Registration::align(const Eigen::Matrix<float, 4, 4> &guess)
+{
+	converged_ = false;
+
+	final_transformation_ = transformation_ = previous_transformation_ = Eigen::Matrix<float, 4, 4>::Identity();
+
+	// Start from the scanned points, the previous alignment left its result in the transformed buffers
+	trans_x_ = x_;
+	trans_y_ = y_;
+	trans_z_ = z_;
+
+	computeTransformation(guess);
+}
+
+}
@@ -0,0 +1,511 @@
+#include "fast_pcl/ndt_cpu/VoxelGrid.h"
+#include "fast_pcl/filters/symmetric_eigensolver3x3.h"
+#include <Eigen/Dense>
+#include <cmath>
+#include <limits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace cpu {
+
+VoxelGrid::VoxelGrid():
+	points_num_(0),
+	voxel_num_(0),
+	max_x_(FLT_MIN),
+	max_y_(FLT_MIN),
+	max_z_(FLT_MIN),
+	min_x_(FLT_MAX),
+	min_y_(FLT_MAX),
+	min_z_(FLT_MAX),
+	voxel_x_(0),
+	voxel_y_(0),
+	voxel_z_(0),
+	max_b_x_(0),
+	max_b_y_(0),
+	max_b_z_(0),
+	min_b_x_(0),
+	min_b_y_(0),
+	min_b_z_(0),
+	min_points_per_voxel_(6),
+	num_threads_(0)
+{
+}
+
+int VoxelGrid::getVoxelNum() const
+{
+	return voxel_num_;
+}
+
+float VoxelGrid::getMaxX() const
+{
+	return max_x_;
+}
+float VoxelGrid::getMaxY() const
+{
+	return max_y_;
+}
+float VoxelGrid::getMaxZ() const
+{
+	return max_z_;
+}
+
+float VoxelGrid::getMinX() const
+{
+	return min_x_;
+}
+float VoxelGrid::getMinY() const
+{
+	return min_y_;
+}
+float VoxelGrid::getMinZ() const
+{
+	return min_z_;
+}
+
+float VoxelGrid::getVoxelX() const
+{
+	return voxel_x_;
+}
+float VoxelGrid::getVoxelY() const
+{
+	return voxel_y_;
+}
+float VoxelGrid::getVoxelZ() const
+{
+	return voxel_z_;
+}
+
+int VoxelGrid::getMaxBX() const
+{
+	return max_b_x_;
+}
+int VoxelGrid::getMaxBY() const
+{
+	return max_b_y_;
+}
+int VoxelGrid::getMaxBZ() const
+{
+	return max_b_z_;
+}
+
+int VoxelGrid::getMinBX() const
+{
+	return min_b_x_;
+}
+int VoxelGrid::getMinBY() const
+{
+	return min_b_y_;
+}
+int VoxelGrid::getMinBZ() const
+{
+	return min_b_z_;
+}
+
+const double *VoxelGrid::getCentroidList() const
+{
+	return centroid_.empty() ? NULL : &centroid_[0];
+}
+
+const double *VoxelGrid::getCovarianceList() const
+{
+	return covariance_.empty() ? NULL : &covariance_[0];
+}
+
+const double *VoxelGrid::getInverseCovarianceList() const
+{
+	return inverse_covariance_.empty() ? NULL : &inverse_covariance_[0];
+}
+
+const int *VoxelGrid::getPointsPerVoxelList() const
+{
+	return points_per_voxel_.empty() ? NULL : &points_per_voxel_[0];
+}
+
+void VoxelGrid::setLeafSize(float voxel_x, float voxel_y, float voxel_z)
+{
+	voxel_x_ = voxel_x;
+	voxel_y_ = voxel_y;
+	voxel_z_ = voxel_z;
+}
+
+void VoxelGrid::setMinVoxelSize(int size)
+{
+	min_points_per_voxel_ = size;
+}
+
+void VoxelGrid::setNumThreads(int num_threads)
+{
+	num_threads_ = num_threads;
+}
+
+int VoxelGrid::getThreadsNum() const
+{
+#ifdef _OPENMP
+	return (num_threads_ > 0) ? num_threads_ : omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+void VoxelGrid::setInput(const float *x, const float *y, const float *z, int points_num)
+{
+	points_num_ = 0;
+	voxel_num_ = 0;
+	voxel_index_.clear();
+
+	if (points_num <= 0 || voxel_x_ <= 0 || voxel_y_ <= 0 || voxel_z_ <= 0)
+		return;
+
+	x_.assign(x, x + points_num);
+	y_.assign(y, y + points_num);
+	z_.assign(z, z + points_num);
+	points_num_ = points_num;
+
+	scatterPointsToVoxelGrid();
+
+	computeCentroidAndCovariance();
+}
+
+void VoxelGrid::scatterPointsToVoxelGrid()
+{
+	std::vector<int> point_voxel(points_num_, -1);
+
+	voxel_index_.reserve(points_num_ / 8);
+	voxel_num_ = 0;
+
+	max_x_ = max_y_ = max_z_ = -FLT_MAX;
+	min_x_ = min_y_ = min_z_ = FLT_MAX;
+
+	// Voxels are numbered in the order they are met, the hash table maps their coordinates to that number
+	for (int i = 0; i < points_num_; i++) {
+		float px = x_[i], py = y_[i], pz = z_[i];
+
+		if (!std::isfinite(px) || !std::isfinite(py) || !std::isfinite(pz))
+			continue;
+
+		int ix = static_cast<int>(std::floor(px / voxel_x_));
+		int iy = static_cast<int>(std::floor(py / voxel_y_));
+		int iz = static_cast<int>(std::floor(pz / voxel_z_));
+
+		if (!pcl::VoxelLeafIndex::inRange(ix, iy, iz))
+			continue;
+
+		int voxel = voxel_index_.insert(pcl::VoxelLeafIndex::packKey(ix, iy, iz), voxel_num_);
+
+		if (voxel == voxel_num_)
+			voxel_num_++;
+
+		point_voxel[i] = voxel;
+
+		max_x_ = std::max(max_x_, px);
+		max_y_ = std::max(max_y_, py);
+		max_z_ = std::max(max_z_, pz);
+		min_x_ = std::min(min_x_, px);
+		min_y_ = std::min(min_y_, py);
+		min_z_ = std::min(min_z_, pz);
+	}
+
+	max_b_x_ = static_cast<int>(std::floor(max_x_ / voxel_x_));
+	max_b_y_ = static_cast<int>(std::floor(max_y_ / voxel_y_));
+	max_b_z_ = static_cast<int>(std::floor(max_z_ / voxel_z_));
+	min_b_x_ = static_cast<int>(std::floor(min_x_ / voxel_x_));
+	min_b_y_ = static_cast<int>(std::floor(min_y_ / voxel_y_));
+	min_b_z_ = static_cast<int>(std::floor(min_z_ / voxel_z_));
+
+	// Counting sort of the points by voxel, the points of a voxel are contiguous afterwards
+	starting_point_ids_.assign(voxel_num_ + 1, 0);
+
+	for (int i = 0; i < points_num_; i++) {
+		if (point_voxel[i] >= 0)
+			starting_point_ids_[point_voxel[i] + 1]++;
+	}
+
+	for (int i = 0; i < voxel_num_; i++)
+		starting_point_ids_[i + 1] += starting_point_ids_[i];
+
+	std::vector<int> write_ids(starting_point_ids_.begin(), starting_point_ids_.end() - 1);
+	std::vector<float> sorted_x(starting_point_ids_[voxel_num_]);
+	std::vector<float> sorted_y(sorted_x.size());
+	std::vector<float> sorted_z(sorted_x.size());
+
+	for (int i = 0; i < points_num_; i++) {
+		if (point_voxel[i] < 0)
+			continue;
+
+		int dst = write_ids[point_voxel[i]]++;
+
+		sorted_x[dst] = x_[i];
+		sorted_y[dst] = y_[i];
+		sorted_z[dst] = z_[i];
+	}
+
+	x_.swap(sorted_x);
+	y_.swap(sorted_y);
+	z_.swap(sorted_z);
+	points_num_ = x_.size();
+}
+
+void VoxelGrid::computeCentroidAndCovariance()
+{
+	centroid_.assign(voxel_num_ * 3, 0);
+	covariance_.assign(voxel_num_ * 9, 0);
+	inverse_covariance_.assign(voxel_num_ * 9, 0);
+	points_per_voxel_.resize(voxel_num_);
+
+	int num_threads = getThreadsNum();
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+	for (int i = 0; i < voxel_num_; i++) {
+		int start = starting_point_ids_[i];
+		int end = starting_point_ids_[i + 1];
+		int points_num = end - start;
+
+		Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+
+		for (int j = start; j < end; j++)
+			mean += Eigen::Vector3d(x_[j], y_[j], z_[j]);
+
+		mean /= points_num;
+
+		centroid_[i * 3] = mean(0);
+		centroid_[i * 3 + 1] = mean(1);
+		centroid_[i * 3 + 2] = mean(2);
+		points_per_voxel_[i] = points_num;
+
+		// Voxels with less than the minimum points can not be accurately approximated by a normal distribution
+		if (points_num < min_points_per_voxel_)
+			continue;
+
+		// Two pass covariance, the same value as the single pass formula of pcl::VoxelGridCovariance
+		Eigen::Matrix3d cov = Eigen::Matrix3d::Zero();
+
+		for (int j = start; j < end; j++) {
+			Eigen::Vector3d d(x_[j] - mean(0), y_[j] - mean(1), z_[j] - mean(2));
+
+			cov += d * d.transpose();
+		}
+
+		cov *= (points_num - 1.0) / (static_cast<double>(points_num) * points_num);
+
+		// Eigen values less than a threshold of max eigen value are inflated to a set fraction of the max eigen value (eq 6.11)[Magnusson 2009]
+		Eigen::Vector3d evals;
+		Eigen::Matrix3d evecs;
+
+		pcl::SymmetricEigensolver3x3::compute(cov, evals, evecs);
+
+		if (evals(0) < 0 || evals(1) < 0 || evals(2) <= 0) {
+			points_per_voxel_[i] = -1;
+			continue;
+		}
+
+		double min_covar_eigvalue = 0.01 * evals(2);
+
+		if (evals(0) < min_covar_eigvalue) {
+			evals(0) = min_covar_eigvalue;
+
+			if (evals(1) < min_covar_eigvalue)
+				evals(1) = min_covar_eigvalue;
+
+			cov = evecs * evals.asDiagonal() * evecs.transpose();
+		}
+
+		// Same inverse as pcl::VoxelGridCovariance, from the (inflated) decomposition
+		Eigen::Matrix3d icov = evecs * evals.cwiseInverse().asDiagonal() * evecs.transpose();
+
+		if (!icov.allFinite()) {
+			points_per_voxel_[i] = -1;
+			continue;
+		}
+
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 3; c++) {
+				covariance_[i * 9 + r * 3 + c] = cov(r, c);
+				inverse_covariance_[i * 9 + r * 3 + c] = icov(r, c);
+			}
+		}
+	}
+}
+
+int VoxelGrid::findVoxel(int i, int j, int k) const
+{
+	if (!pcl::VoxelLeafIndex::inRange(i, j, k))
+		return -1;
+
+	return voxel_index_.find(pcl::VoxelLeafIndex::packKey(i, j, k));
+}
+
+void VoxelGrid::radiusSearch(const float *qx, const float *qy, const float *qz, int points_num, float radius, int max_nn,
+								std::vector<int> &valid_points, std::vector<int> &starting_voxel_id, std::vector<int> &voxel_id) const
+{
+	valid_points.clear();
+	starting_voxel_id.assign(1, 0);
+	voxel_id.clear();
+
+	if (voxel_num_ == 0 || points_num <= 0)
+		return;
+
+	int num_threads = getThreadsNum();
+	double radius2 = static_cast<double>(radius) * radius;
+
+	// Each thread searches a contiguous range of the query points, the ranges are concatenated in order
+	std::vector<std::vector<int> > local_points(num_threads), local_counts(num_threads), local_voxels(num_threads);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+	{
+#ifdef _OPENMP
+		int tid = omp_get_thread_num();
+#else
+		int tid = 0;
+#endif
+		std::vector<int> &points = local_points[tid];
+		std::vector<int> &counts = local_counts[tid];
+		std::vector<int> &voxels = local_voxels[tid];
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (int i = 0; i < points_num; i++) {
+			float x = qx[i], y = qy[i], z = qz[i];
+
+			int lower_x = static_cast<int>(std::floor((x - radius) / voxel_x_));
+			int lower_y = static_cast<int>(std::floor((y - radius) / voxel_y_));
+			int lower_z = static_cast<int>(std::floor((z - radius) / voxel_z_));
+			int upper_x = static_cast<int>(std::floor((x + radius) / voxel_x_));
+			int upper_y = static_cast<int>(std::floor((y + radius) / voxel_y_));
+			int upper_z = static_cast<int>(std::floor((z + radius) / voxel_z_));
+
+			lower_x = std::max(lower_x, min_b_x_);
+			lower_y = std::max(lower_y, min_b_y_);
+			lower_z = std::max(lower_z, min_b_z_);
+			upper_x = std::min(upper_x, max_b_x_);
+			upper_y = std::min(upper_y, max_b_y_);
+			upper_z = std::min(upper_z, max_b_z_);
+
+			int found = 0;
+
+			for (int vx = lower_x; vx <= upper_x && found < max_nn; vx++) {
+				for (int vy = lower_y; vy <= upper_y && found < max_nn; vy++) {
+					for (int vz = lower_z; vz <= upper_z && found < max_nn; vz++) {
+						int voxel = findVoxel(vx, vy, vz);
+
+						if (voxel < 0 || points_per_voxel_[voxel] < min_points_per_voxel_)
+							continue;
+
+						const double *centroid = &centroid_[voxel * 3];
+						double dx = x - centroid[0];
+						double dy = y - centroid[1];
+						double dz = z - centroid[2];
+
+						if (dx * dx + dy * dy + dz * dz <= radius2) {
+							voxels.push_back(voxel);
+							found++;
+						}
+					}
+				}
+			}
+
+			if (found > 0) {
+				points.push_back(i);
+				counts.push_back(found);
+			}
+		}
+	}
+
+	size_t total_points = 0, total_voxels = 0;
+
+	for (int t = 0; t < num_threads; t++) {
+		total_points += local_points[t].size();
+		total_voxels += local_voxels[t].size();
+	}
+
+	valid_points.reserve(total_points);
+	starting_voxel_id.reserve(total_points + 1);
+	voxel_id.reserve(total_voxels);
+
+	for (int t = 0; t < num_threads; t++) {
+		valid_points.insert(valid_points.end(), local_points[t].begin(), local_points[t].end());
+		voxel_id.insert(voxel_id.end(), local_voxels[t].begin(), local_voxels[t].end());
+
+		for (size_t j = 0; j < local_counts[t].size(); j++)
+			starting_voxel_id.push_back(starting_voxel_id.back() + local_counts[t][j]);
+	}
+}
+
+void VoxelGrid::searchVoxelPoints(int voxel, float qx, float qy, float qz, double &min_dist) const
+{
+	for (int j = starting_point_ids_[voxel]; j < starting_point_ids_[voxel + 1]; j++) {
+		double dx = qx - x_[j];
+		double dy = qy - y_[j];
+		double dz = qz - z_[j];
+		double dist = dx * dx + dy * dy + dz * dz;
+
+		if (dist < min_dist)
+			min_dist = dist;
+	}
+}
+
+void VoxelGrid::nearestNeighborSearch(const float *trans_x, const float *trans_y, const float *trans_z, int point_num,
+										std::vector<int> &valid_distance, std::vector<double> &min_distance, float max_range) const
+{
+	valid_distance.assign(point_num, 0);
+	min_distance.assign(point_num, 0);
+
+	if (voxel_num_ == 0)
+		return;
+
+	int num_threads = getThreadsNum();
+	float voxel_min = std::min(voxel_x_, std::min(voxel_y_, voxel_z_));
+
+	// Voxel shells farther than the whole grid never have to be visited
+	int max_ring = std::max(max_b_x_ - min_b_x_, std::max(max_b_y_ - min_b_y_, max_b_z_ - min_b_z_)) + 1;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+	for (int i = 0; i < point_num; i++) {
+		float x = trans_x[i], y = trans_y[i], z = trans_z[i];
+		int cx = static_cast<int>(std::floor(x / voxel_x_));
+		int cy = static_cast<int>(std::floor(y / voxel_y_));
+		int cz = static_cast<int>(std::floor(z / voxel_z_));
+
+		// Clamp to the grid so that a query far outside of it starts from the closest voxels
+		int ring_offset = std::max(std::max(std::max(min_b_x_ - cx, cx - max_b_x_), std::max(min_b_y_ - cy, cy - max_b_y_)),
+									std::max(std::max(min_b_z_ - cz, cz - max_b_z_), 0));
+
+		double min_dist = DBL_MAX;
+
+		// Visit the shells of voxels around the query, a point of shell r + 1 is at least r voxels away
+		for (int r = ring_offset; r <= ring_offset + max_ring; r++) {
+			double reach = static_cast<double>(std::max(r - 1, 0)) * voxel_min;
+
+			if (min_dist <= reach * reach || reach * reach > max_range)
+				break;
+
+			for (int vx = cx - r; vx <= cx + r; vx++) {
+				for (int vy = cy - r; vy <= cy + r; vy++) {
+					bool face = (vx == cx - r || vx == cx + r || vy == cy - r || vy == cy + r);
+					int step = face ? 1 : 2 * r;
+
+					for (int vz = cz - r; vz <= cz + r; vz += std::max(step, 1)) {
+						int voxel = findVoxel(vx, vy, vz);
+
+						if (voxel >= 0)
+							searchVoxelPoints(voxel, x, y, z, min_dist);
+					}
+				}
+			}
+		}
+
+		if (min_dist <= max_range) {
+			valid_distance[i] = 1;
+			min_distance[i] = min_dist;
+		}
+	}
+}
+
+}
@@ -261,15 +261,15 @@ CUDAH void SymmetricEigensolver3x3::computeEigenvector01(int tid)
 		MatrixDevice rxr(3, 3, offset_, buffer_ + 3 * 3 * offset_ + tid);
 
 
-		double d0 = rxr(0, 0) * rxr(0, 0) + rxr(0, 1) * rxr(0, 1) * rxr(0, 2) * rxr(0, 2);
-		double d1 = rxr(1, 0) * rxr(1, 0) + rxr(1, 1) * rxr(1, 1) * rxr(1, 2) * rxr(1, 2);
-		double d2 = rxr(2, 0) * rxr(2, 0) + rxr(2, 1) * rxr(2, 1) * rxr(2, 2) * rxr(2, 2);
+		double d0 = rxr(0, 0) * rxr(0, 0) + rxr(0, 1) * rxr(0, 1) + rxr(0, 2) * rxr(0, 2);
+		double d1 = rxr(1, 0) * rxr(1, 0) + rxr(1, 1) * rxr(1, 1) + rxr(1, 2) * rxr(1, 2);
+		double d2 = rxr(2, 0) * rxr(2, 0) + rxr(2, 1) * rxr(2, 1) + rxr(2, 2) * rxr(2, 2);
 
 		double dmax = (d0 > d1) ? d0 : d1;
 		int imax = (d0 > d1) ? 0 : 1;
 
-		dmax = (d2 > dmax) ? d2 : dmax;
 		imax = (d2 > dmax) ? 2 : imax;
+		dmax = (d2 > dmax) ? d2 : dmax;
 
 		divide(rxr.row(imax), sqrt(dmax), evec0);
 	}
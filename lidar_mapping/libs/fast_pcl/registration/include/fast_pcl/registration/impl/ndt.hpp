@@ -41,11 +41,20 @@
 #ifndef FAST_PCL_REGISTRATION_NDT_IMPL_H_
 #define FAST_PCL_REGISTRATION_NDT_IMPL_H_
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointSource, typename PointTarget>
 pcl::NormalDistributionsTransform<PointSource, PointTarget>::NormalDistributionsTransform ()
   : target_cells_ ()
   , resolution_ (1.0f)
+  , coarse_resolutions_ ()
+  , level_ (-1)
+  , search_method_ (KDTREE)
+  , target_window_size_ (Eigen::Vector3f::Zero ())
+  , target_window_center_ (Eigen::Vector3f::Zero ())
   , step_size_ (0.1)
   , outlier_ratio_ (0.55)
   , gauss_d1_ ()
@@ -56,6 +65,15 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::NormalDistributions
   , h_ang_d3_ (), h_ang_e1_ (), h_ang_e2_ (), h_ang_e3_ (), h_ang_f1_ (), h_ang_f2_ (), h_ang_f3_ ()
   , point_gradient_ ()
   , point_hessian_ ()
+  , batch_prune_iterations_ (5)
+  , batch_prune_ratio_ (0.5)
+  , use_gauss_newton_ (false)
+  , num_threads_ (0)
+  , derivative_batches_ ()
+  , min_samples_ (0)
+  , sample_order_ ()
+  , nr_samples_ (0)
+  , target_tree_outdated_ (false)
 {
   reg_name_ = "NormalDistributionsTransform";
 
@@ -76,17 +94,24 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::NormalDistributions
 template<typename PointSource, typename PointTarget> void
 pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess)
 {
-  nr_iterations_ = 0;
-  converged_ = false;
+  computePyramidTransformation (output, guess, false);
+}
 
-  double gauss_c1, gauss_c2, gauss_d3;
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess)
+{
+  computePyramidTransformation (output, guess, true);
+}
 
-  // Initializes the guassian fitting parameters (eq. 6.8) [Magnusson 2009]
-  gauss_c1 = 10 * (1 - outlier_ratio_);
-  gauss_c2 = outlier_ratio_ / pow (resolution_, 3);
-  gauss_d3 = -log (gauss_c2);
-  gauss_d1_ = -log ( gauss_c1 + gauss_c2 ) - gauss_d3;
-  gauss_d2_ = -2 * log ((-log ( gauss_c1 * exp ( -0.5 ) + gauss_c2 ) - gauss_d3) / gauss_d1_);
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::computePyramidTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess,
+                                                                                           bool use_omp, bool finest_only)
+{
+  nr_iterations_ = 0;
+  converged_ = false;
+  updateTargetSearch ();
 
   if (guess != Eigen::Matrix4f::Identity ())
   {
@@ -105,19 +130,54 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeTransformati
   eig_transformation.matrix () = final_transformation_;
 
   // Convert initial guess matrix to 6 element transformation vector
-  Eigen::Matrix<double, 6, 1> p, delta_p, score_gradient;
+  Eigen::Matrix<double, 6, 1> p;
   Eigen::Vector3f init_translation = eig_transformation.translation ();
   Eigen::Vector3f init_rotation = eig_transformation.rotation ().eulerAngles (0, 1, 2);
   p << init_translation (0), init_translation (1), init_translation (2),
   init_rotation (0), init_rotation (1), init_rotation (2);
 
+  if (min_samples_ > 0 && min_samples_ < static_cast<int> (input_->points.size ()))
+    computeSampleOrder ();
+
+  // Coarse levels only bring the transform vector into the basin of the finer ones, each starts from the previous result
+  for (level_ = 0; level_ < static_cast<int> (coarse_resolutions_.size ()) && !finest_only; level_++)
+  {
+    updateGaussParameters (coarse_resolutions_[level_]);
+    computeLevelTransformation (output, p, use_omp);
+  }
+  level_ = -1;
+
+  // Initializes the guassian fitting parameters (eq. 6.8) [Magnusson 2009]
+  updateGaussParameters (resolution_);
+  double score = computeLevelTransformation (output, p, use_omp);
+
+  // Store transformation probability.  The realtive differences within each scan registration are accurate
+  // but the normalization constants need to be modified for it to be globally accurate
+  trans_probability_ = score / static_cast<double> (input_->points.size ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> double
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeLevelTransformation (PointCloudSource &output, Eigen::Matrix<double, 6, 1> &p,
+                                                                                        bool use_omp)
+{
+  converged_ = false;
+
+  Eigen::Matrix<double, 6, 1> delta_p, score_gradient;
   Eigen::Matrix<double, 6, 6> hessian;
 
   double score = 0;
   double delta_p_norm;
+  int level_iterations = 0;
+
+  // The first iterations evaluate a subset of the source points, see setMinSamples
+  nr_samples_ = (min_samples_ > 0 && min_samples_ < static_cast<int> (input_->points.size ())) ? min_samples_ : 0;
 
   // Calculate derivates of initial transform vector, subsequent derivative calculations are done in the step length determination.
-  score = computeDerivatives (score_gradient, hessian, output, p);
+  if (use_omp)
+    score = omp_computeDerivatives (score_gradient, hessian, output, p);
+  else
+    score = computeDerivatives (score_gradient, hessian, output, p);
 
   while (!converged_)
   {
@@ -125,18 +185,31 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeTransformati
     previous_transformation_ = transformation_;
 
     // Solve for decent direction using newton method, line 23 in Algorithm 2 [Magnusson 2009]
-    Eigen::JacobiSVD<Eigen::Matrix<double, 6, 6> > sv (hessian, Eigen::ComputeFullU | Eigen::ComputeFullV);
-    // Negative for maximization as opposed to minimization
-    delta_p = sv.solve (-score_gradient);
+    bool solved = false;
+    if (use_gauss_newton_)
+    {
+      // The gauss-newton hessian is negative semidefinite, SVD is only needed when it is singular
+      Eigen::LDLT<Eigen::Matrix<double, 6, 6> > ldlt (hessian);
+      if (ldlt.info () == Eigen::Success && ldlt.isNegative () && ldlt.vectorD ().maxCoeff () < 0)
+      {
+        delta_p = ldlt.solve (-score_gradient);
+        solved = true;
+      }
+    }
+    if (!solved)
+    {
+      Eigen::JacobiSVD<Eigen::Matrix<double, 6, 6> > sv (hessian, Eigen::ComputeFullU | Eigen::ComputeFullV);
+      // Negative for maximization as opposed to minimization
+      delta_p = sv.solve (-score_gradient);
+    }
 
     //Calculate step length with guarnteed sufficient decrease [More, Thuente 1994]
     delta_p_norm = delta_p.norm ();
 
     if (delta_p_norm == 0 || delta_p_norm != delta_p_norm)
     {
-      trans_probability_ = score / static_cast<double> (input_->points.size ());
       converged_ = delta_p_norm == delta_p_norm;
-      return;
+      break;
     }
 
     delta_p.normalize ();
@@ -162,124 +235,246 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeTransformati
                              transformation_.coeff (2, 3) * transformation_.coeff (2, 3);
 
     nr_iterations_++;
+    level_iterations++;
 
-    if (nr_iterations_ >= max_iterations_ ||
-        ((transformation_epsilon_ > 0 && translation_sqr <= transformation_epsilon_) && (transformation_rotation_epsilon_ > 0 && cos_angle >= transformation_rotation_epsilon_)) ||
-        ((transformation_epsilon_ <= 0)                                             && (transformation_rotation_epsilon_ > 0 && cos_angle >= transformation_rotation_epsilon_)) ||
-        ((transformation_epsilon_ > 0 && translation_sqr <= transformation_epsilon_) && (transformation_rotation_epsilon_ <= 0)))
+    bool small_step = ((transformation_epsilon_ > 0 && translation_sqr <= transformation_epsilon_) && (transformation_rotation_epsilon_ > 0 && cos_angle >= transformation_rotation_epsilon_)) ||
+                      ((transformation_epsilon_ <= 0)                                             && (transformation_rotation_epsilon_ > 0 && cos_angle >= transformation_rotation_epsilon_)) ||
+                      ((transformation_epsilon_ > 0 && translation_sqr <= transformation_epsilon_) && (transformation_rotation_epsilon_ <= 0));
+
+    // The finest level only converges on every point, a small step on a subset switches to the full cloud instead
+    if (level_iterations >= max_iterations_ || (small_step && (nr_samples_ == 0 || level_ >= 0)))
     {
       converged_ = true;
     }
+    else if (nr_samples_ > 0 && updateSampleSize (small_step ? 0 : delta_p_norm))
+    {
+      // The derivatives at p were accumulated over the previous subset
+      if (use_omp)
+        score = omp_computeDerivatives (score_gradient, hessian, output, p);
+      else
+        score = computeDerivatives (score_gradient, hessian, output, p);
+    }
   }
 
-  // Store transformation probability.  The realtive differences within each scan registration are accurate
-  // but the normalization constants need to be modified for it to be globally accurate
-  trans_probability_ = score / static_cast<double> (input_->points.size ());
+  // The score of the finest level gives the transformation probability, it covers every point
+  if (nr_samples_ > 0)
+  {
+    nr_samples_ = 0;
+    if (level_ < 0)
+    {
+      if (use_omp)
+        score = omp_computeDerivatives (score_gradient, hessian, output, p, false);
+      else
+        score = computeDerivatives (score_gradient, hessian, output, p, false);
+    }
+  }
+
+  return (score);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-template<typename PointSource, typename PointTarget> void
-pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess)
+template<typename PointSource, typename PointTarget> Eigen::Matrix4f
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::alignBatch (const PointCloudSourceConstPtr &source,
+                                                                         const TransformationList &guesses,
+                                                                         HypothesisList &ranked)
 {
-  nr_iterations_ = 0;
-  converged_ = false;
-
-  double gauss_c1, gauss_c2, gauss_d3;
-
-  // Initializes the guassian fitting parameters (eq. 6.8) [Magnusson 2009]
-  gauss_c1 = 10 * (1 - outlier_ratio_);
-  gauss_c2 = outlier_ratio_ / pow (resolution_, 3);
-  gauss_d3 = -log (gauss_c2);
-  gauss_d1_ = -log ( gauss_c1 + gauss_c2 ) - gauss_d3;
-  gauss_d2_ = -2 * log ((-log ( gauss_c1 * exp ( -0.5 ) + gauss_c2 ) - gauss_d3) / gauss_d1_);
-
-  if (guess != Eigen::Matrix4f::Identity ())
+  ranked.clear ();
+  Registration<PointSource, PointTarget>::setInputSource (source);
+  if (guesses.empty () || !target_cells_ || !input_ || input_->points.empty ())
   {
-    // Initialise final transformation to the guessed one
-    final_transformation_ = guess;
-    // Apply guessed transformation prior to search for neighbours
-    transformPointCloud (output, output, guess);
+    PCL_ERROR ("[pcl::%s::alignBatch] No guess, input source or input target given!\n", getClassName ().c_str ());
+    return (Eigen::Matrix4f::Identity ());
   }
+  // Before the workers share the target
+  updateTargetSearch ();
 
-  // Initialize Point Gradient and Hessian
-  point_gradient_.setZero ();
-  point_gradient_.block<3, 3>(0, 0).setIdentity ();
-  point_hessian_.setZero ();
-
-  Eigen::Transform<float, 3, Eigen::Affine, Eigen::ColMajor> eig_transformation;
-  eig_transformation.matrix () = final_transformation_;
+  ranked.resize (guesses.size ());
+  for (size_t i = 0; i < guesses.size (); i++)
+  {
+    ranked[i].guess = ranked[i].transformation = guesses[i];
+    ranked[i].index = static_cast<int> (i);
+  }
 
-  // Convert initial guess matrix to 6 element transformation vector
-  Eigen::Matrix<double, 6, 1> p, delta_p, score_gradient;
-  Eigen::Vector3f init_translation = eig_transformation.translation ();
-  Eigen::Vector3f init_rotation = eig_transformation.rotation ().eulerAngles (0, 1, 2);
-  p << init_translation (0), init_translation (1), init_translation (2),
-  init_rotation (0), init_rotation (1), init_rotation (2);
+#ifdef _OPENMP
+  int num_threads = (num_threads_ > 0) ? num_threads_ : omp_get_max_threads ();
+#endif
 
-  Eigen::Matrix<double, 6, 6> hessian;
+  // A short first round from every guess, then the hypotheses close enough to the best one continue
+  int first_iterations = (batch_prune_iterations_ > 0) ? std::min (batch_prune_iterations_, max_iterations_) : max_iterations_;
+  std::vector<int> active (ranked.size ());
+  for (size_t i = 0; i < active.size (); i++)
+    active[i] = static_cast<int> (i);
 
-  double score = 0;
-  double delta_p_norm;
+  for (int round = 0; round < 2 && !active.empty (); round++)
+  {
+    // The survivors resume the finest level from their pose, the coarse levels brought them there already
+    int max_iterations = (round == 0) ? first_iterations : std::max (1, max_iterations_ - first_iterations);
 
-  // Calculate derivates of initial transform vector, subsequent derivative calculations are done in the step length determination.
-  score = omp_computeDerivatives (score_gradient, hessian, output, p);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+    {
+      // One worker per thread sharing the (unmodified) target voxel grids, each hypothesis evaluates its derivatives
+      // on a single thread
+      NormalDistributionsTransform<PointSource, PointTarget> worker;
+      worker.setTarget (target_cells_);
+      worker.input_ = input_;
+      worker.step_size_ = step_size_;
+      worker.outlier_ratio_ = outlier_ratio_;
+      worker.use_gauss_newton_ = use_gauss_newton_;
+      worker.min_samples_ = min_samples_;
+      worker.transformation_epsilon_ = transformation_epsilon_;
+      worker.transformation_rotation_epsilon_ = transformation_rotation_epsilon_;
+      worker.num_threads_ = 1;
 
-  while (!converged_)
-  {
-    // Store previous transformation
-    previous_transformation_ = transformation_;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+      for (int i = 0; i < static_cast<int> (active.size ()); i++)
+        worker.alignHypothesis (ranked[active[i]], max_iterations, round > 0);
+    }
 
-    // Solve for decent direction using newton method, line 23 in Algorithm 2 [Magnusson 2009]
-    Eigen::JacobiSVD<Eigen::Matrix<double, 6, 6> > sv (hessian, Eigen::ComputeFullU | Eigen::ComputeFullV);
-    // Negative for maximization as opposed to minimization
-    delta_p = sv.solve (-score_gradient);
+    if (round > 0 || first_iterations >= max_iterations_)
+      break;
 
-    //Calculate step length with guarnteed sufficient decrease [More, Thuente 1994]
-    delta_p_norm = delta_p.norm ();
+    double best_probability = 0;
+    for (size_t i = 0; i < active.size (); i++)
+      best_probability = std::max (best_probability, ranked[active[i]].probability);
 
-    if (delta_p_norm == 0 || delta_p_norm != delta_p_norm)
+    std::vector<int> kept;
+    for (size_t i = 0; i < active.size (); i++)
     {
-      trans_probability_ = score / static_cast<double> (input_->points.size ());
-      converged_ = delta_p_norm == delta_p_norm;
-      return;
+      NDTHypothesis &hypothesis = ranked[active[i]];
+      if (hypothesis.probability < batch_prune_ratio_ * best_probability)
+        hypothesis.pruned = true;
+      else
+        kept.push_back (active[i]);
     }
+    active.swap (kept);
+  }
 
-    delta_p.normalize ();
-    delta_p_norm = computeStepLengthMT (p, delta_p, delta_p_norm, step_size_, transformation_epsilon_ / 2, score, score_gradient, hessian, output);
-    delta_p *= delta_p_norm;
+  std::stable_sort (ranked.begin (), ranked.end (), NDTHypothesis::ranksBefore);
 
+  const NDTHypothesis &best = ranked.front ();
+  final_transformation_ = best.transformation;
+  trans_probability_ = best.probability;
+  nr_iterations_ = best.iterations;
+  converged_ = best.converged;
 
-    transformation_ = (Eigen::Translation<float, 3> (static_cast<float> (delta_p (0)), static_cast<float> (delta_p (1)), static_cast<float> (delta_p (2))) *
-                       Eigen::AngleAxis<float> (static_cast<float> (delta_p (3)), Eigen::Vector3f::UnitX ()) *
-                       Eigen::AngleAxis<float> (static_cast<float> (delta_p (4)), Eigen::Vector3f::UnitY ()) *
-                       Eigen::AngleAxis<float> (static_cast<float> (delta_p (5)), Eigen::Vector3f::UnitZ ())).matrix ();
+  return (best.transformation);
+}
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::alignHypothesis (NDTHypothesis &hypothesis, int max_iterations,
+                                                                            bool finest_only)
+{
+  // Same preparation of the output as Registration::align
+  PointCloudSource output (*input_);
+  for (size_t i = 0; i < output.points.size (); ++i)
+    output.points[i].data[3] = 1.0;
 
-    p = p + delta_p;
+  converged_ = false;
+  final_transformation_ = transformation_ = previous_transformation_ = Eigen::Matrix4f::Identity ();
 
-    // Update Visualizer (untested)
-    if (update_visualizer_ != 0)
-      update_visualizer_ (output, std::vector<int>(), *target_, std::vector<int>() );
+  int all_iterations = max_iterations_;
+  max_iterations_ = max_iterations;
+  computePyramidTransformation (output, hypothesis.transformation, true, finest_only);
+  max_iterations_ = all_iterations;
 
-    double cos_angle = 0.5 * (transformation_.coeff (0, 0) + transformation_.coeff (1, 1) + transformation_.coeff (2, 2) - 1);
-    double translation_sqr = transformation_.coeff (0, 3) * transformation_.coeff (0, 3) +
-                             transformation_.coeff (1, 3) * transformation_.coeff (1, 3) +
-                             transformation_.coeff (2, 3) * transformation_.coeff (2, 3);
+  hypothesis.transformation = final_transformation_;
+  hypothesis.probability = trans_probability_;
+  hypothesis.iterations += nr_iterations_;
+  hypothesis.converged = converged_;
+}
 
-    nr_iterations_++;
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> double
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeFitness (NDTFitness &fitness, double max_mahalanobis,
+                                                                            int histogram_bins)
+{
+  fitness = NDTFitness ();
+  histogram_bins = std::max (histogram_bins, 1);
+  fitness.likelihood_histogram.assign (histogram_bins, 0);
+  if (!target_cells_ || !input_ || input_->points.empty ())
+  {
+    PCL_ERROR ("[pcl::%s::computeFitness] No input source or input target given!\n", getClassName ().c_str ());
+    return (std::numeric_limits<double>::max ());
+  }
 
-    if (nr_iterations_ >= max_iterations_ ||
-        ((transformation_epsilon_ > 0 && translation_sqr <= transformation_epsilon_) && (transformation_rotation_epsilon_ > 0 && cos_angle >= transformation_rotation_epsilon_)) ||
-        ((transformation_epsilon_ <= 0)                                             && (transformation_rotation_epsilon_ > 0 && cos_angle >= transformation_rotation_epsilon_)) ||
-        ((transformation_epsilon_ > 0 && translation_sqr <= transformation_epsilon_) && (transformation_rotation_epsilon_ <= 0)))
+  updateTargetSearch ();
+
+  // The finest level, with the gaussian fitting parameters of its resolution (eq. 6.8) [Magnusson 2009]
+  int level = target_cells_->getNumberOfLevels () - 1;
+  updateGaussParameters (resolution_);
+
+  int nr_points = static_cast<int> (input_->points.size ());
+  double max_distance_sq = max_mahalanobis * max_mahalanobis;
+  double score = 0;
+  double distance_sum = 0;
+  int nr_inliers = 0;
+  std::vector<int> &histogram = fitness.likelihood_histogram;
+
+#ifdef _OPENMP
+  int num_threads = (num_threads_ > 0) ? num_threads_ : omp_get_max_threads ();
+#pragma omp parallel num_threads(num_threads) reduction(+:score, distance_sum, nr_inliers)
+#endif
+  {
+    std::vector<TargetGridLeafConstPtr> neighborhood;
+    std::vector<int> thread_histogram (histogram_bins, 0);
+    PointTarget x_trans_pt;
+    Eigen::Vector3d x_trans;
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (int idx = 0; idx < nr_points; idx++)
     {
-      converged_ = true;
+      const PointSource &x_pt = input_->points[idx];
+      x_trans_pt.x = static_cast<float> (final_transformation_ (0, 0) * x_pt.x + final_transformation_ (0, 1) * x_pt.y + final_transformation_ (0, 2) * x_pt.z + final_transformation_ (0, 3));
+      x_trans_pt.y = static_cast<float> (final_transformation_ (1, 0) * x_pt.x + final_transformation_ (1, 1) * x_pt.y + final_transformation_ (1, 2) * x_pt.z + final_transformation_ (1, 3));
+      x_trans_pt.z = static_cast<float> (final_transformation_ (2, 0) * x_pt.x + final_transformation_ (2, 1) * x_pt.y + final_transformation_ (2, 2) * x_pt.z + final_transformation_ (2, 3));
+
+      target_cells_->searchCells (x_trans_pt, level, neighborhood);
+
+      // Squared Mahalanobis distance to the closest distribution, the score sums all of them as the alignment does
+      double min_distance_sq = std::numeric_limits<double>::max ();
+      for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
+      {
+        TargetGridLeafConstPtr cell = *neighborhood_it;
+        x_trans = Eigen::Vector3d (x_trans_pt.x, x_trans_pt.y, x_trans_pt.z) - cell->getMean ();
+        double distance_sq = x_trans.dot (cell->getInverseCov () * x_trans);
+        // Equation 6.9 [Magnusson 2009]
+        score += -gauss_d1_ * exp (-gauss_d2_ * distance_sq / 2);
+        min_distance_sq = std::min (min_distance_sq, distance_sq);
+      }
+
+      double likelihood = neighborhood.empty () ? 0 : exp (-gauss_d2_ * min_distance_sq / 2);
+      thread_histogram[std::min (static_cast<int> (likelihood * histogram_bins), histogram_bins - 1)]++;
+
+      if (min_distance_sq <= max_distance_sq)
+      {
+        distance_sum += sqrt (min_distance_sq);
+        nr_inliers++;
+      }
     }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+    for (int i = 0; i < histogram_bins; i++)
+      histogram[i] += thread_histogram[i];
   }
 
-  // Store transformation probability.  The realtive differences within each scan registration are accurate
-  // but the normalization constants need to be modified for it to be globally accurate
-  trans_probability_ = score / static_cast<double> (input_->points.size ());
+  fitness.probability = score / static_cast<double> (nr_points);
+  fitness.nr_points = nr_points;
+  fitness.nr_inliers = nr_inliers;
+  fitness.inlier_ratio = static_cast<double> (nr_inliers) / static_cast<double> (nr_points);
+  if (nr_inliers == 0)
+    return (std::numeric_limits<double>::max ());
+
+  fitness.mean_mahalanobis = distance_sum / static_cast<double> (nr_inliers);
+  return (fitness.mean_mahalanobis);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -303,18 +498,19 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeDerivatives
   hessian.setZero ();
   double score = 0;
 
-  // Precompute Angular Derivatives (eq. 6.19 and 6.21)[Magnusson 2009]
-  computeAngleDerivatives (p);
+  // Precompute Angular Derivatives (eq. 6.19 and 6.21)[Magnusson 2009], the gauss-newton hessian only needs eq. 6.19
+  computeAngleDerivatives (p, !use_gauss_newton_);
 
   // Update gradient and hessian for each point, line 17 in Algorithm 2 [Magnusson 2009]
-  for (size_t idx = 0; idx < input_->points.size (); idx++)
+  int nr_samples = getNumberOfSamples ();
+  for (int i = 0; i < nr_samples; i++)
   {
+    int idx = getSampleIndex (i);
     x_trans_pt = trans_cloud.points[idx];
 
-    // Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
+    // Find nieghbors, either by radius search over the voxel centroids or by direct voxel lookup
     std::vector<TargetGridLeafConstPtr> neighborhood;
-    std::vector<float> distances;
-    target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
+    searchTargetCells (x_trans_pt, neighborhood);
 
     for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
     {
@@ -330,7 +526,7 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeDerivatives
       c_inv = cell->getInverseCov ();
 
       // Compute derivative of transform function w.r.t. transform vector, J_E and H_E in Equations 6.18 and 6.20 [Magnusson 2009]
-      computePointDerivatives (x);
+      computePointDerivatives (x, !use_gauss_newton_);
       // Update score, gradient and hessian, lines 19-21 in Algorithm 2, according to Equations 6.10, 6.12 and 6.13, respectively [Magnusson 2009]
       score += updateDerivatives (score_gradient, hessian, x_trans, c_inv, compute_hessian);
 
@@ -347,121 +543,228 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeDerivati
                                                                                  Eigen::Matrix<double, 6, 1> &p,
                                                                                  bool compute_hessian)
 {
-  // Original Point and Transformed Point
-  PointSource x_pt, x_trans_pt;
-  // Original Point and Transformed Point (for math)
-  Eigen::Vector3d x, x_trans;
-  // Occupied Voxel
-  TargetGridLeafConstPtr cell;
-  // Inverse Covariance of Occupied Voxel
-  Eigen::Matrix3d c_inv;
-
   score_gradient.setZero ();
   hessian.setZero ();
+
+  // Precompute Angular Derivatives (eq. 6.19 and 6.21)[Magnusson 2009], the gauss-newton hessian only needs eq. 6.19
+  computeAngleDerivatives (p, !use_gauss_newton_);
+
+  // Update score, gradient and hessian, lines 17-21 in Algorithm 2 [Magnusson 2009]
+  return (accumulateDerivatives (score_gradient, hessian, trans_cloud, compute_hessian));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> double
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::accumulateDerivatives (Eigen::Matrix<double, 6, 1> &score_gradient,
+                                                                                    Eigen::Matrix<double, 6, 6> &hessian,
+                                                                                    PointCloudSource &trans_cloud,
+                                                                                    bool compute_hessian)
+{
+  double j_ang[24], h_ang[45];
+  getAngleDerivatives (j_ang, h_ang);
+
+  // Each thread evaluates its own (point, voxel) pairs, the point derivatives are computed inside the batch kernel
+  int num_threads = resizeDerivativeBatches ();
+  for (int i = 0; i < num_threads; ++i)
+    derivative_batches_[i].reset (gauss_d1_, gauss_d2_, j_ang, h_ang, compute_hessian, use_gauss_newton_);
+
+  evaluateDerivativeBatches (trans_cloud, num_threads);
+
   double score = 0;
+  for (int i = 0; i < num_threads; ++i)
+    derivative_batches_[i].addTo (score, score_gradient, hessian);
 
-  // Precompute Angular Derivatives (eq. 6.19 and 6.21)[Magnusson 2009]
-  computeAngleDerivatives (p);
+  return (score);
+}
 
-#ifdef _OPENMP
-  int num_threads = omp_get_max_threads() * 2;
-  Eigen::Matrix<double, 6, 1> score_gradient_i[num_threads];
-  Eigen::Matrix<double, 6, 6> hessian_i[num_threads];
-  for (int i = 0; i < num_threads; ++i) {
-      score_gradient_i[i].setZero ();
-      hessian_i[i].setZero ();
-  }
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> double
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeDirectionalDerivative (double &score,
+                                                                                           const Eigen::Matrix<double, 6, 1> &step_dir,
+                                                                                           PointCloudSource &trans_cloud,
+                                                                                           Eigen::Matrix<double, 6, 1> &p)
+{
+  // Only the angular gradient terms are needed (eq. 6.19)[Magnusson 2009]
+  computeAngleDerivatives (p, false);
 
-  omp_set_nested(1);
-  omp_set_dynamic(1);
-#pragma omp parallel for num_threads(num_threads) reduction(+:score) private(x_pt, x_trans_pt, x, x_trans, cell, c_inv)
-#endif
+  double j_ang[24], h_ang[45], dir[6];
+  getAngleDerivatives (j_ang, h_ang);
+  for (int i = 0; i < 6; i++)
+    dir[i] = step_dir (i);
 
-  // Update gradient and hessian for each point, line 17 in Algorithm 2 [Magnusson 2009]
-  for (size_t idx = 0; idx < input_->points.size (); idx++)
-  {
-    x_trans_pt = trans_cloud.points[idx];
+  int num_threads = resizeDerivativeBatches ();
+  for (int i = 0; i < num_threads; ++i)
+    derivative_batches_[i].resetDirectional (gauss_d1_, gauss_d2_, j_ang, dir);
 
-    // Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
-    std::vector<TargetGridLeafConstPtr> neighborhood;
-    std::vector<float> distances;
-    target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
+  evaluateDerivativeBatches (trans_cloud, num_threads);
 
-    for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
-    {
-      cell = *neighborhood_it;
-      x_pt = input_->points[idx];
-      x = Eigen::Vector3d (x_pt.x, x_pt.y, x_pt.z);
+  double derivative = 0;
+  score = 0;
+  for (int i = 0; i < num_threads; ++i)
+    derivative_batches_[i].addDirectionalTo (score, derivative);
 
-      x_trans = Eigen::Vector3d (x_trans_pt.x, x_trans_pt.y, x_trans_pt.z);
+  return (derivative);
+}
 
-      // Denorm point, x_k' in Equations 6.12 and 6.13 [Magnusson 2009]
-      x_trans -= cell->getMean ();
-      // Uses precomputed covariance for speed.
-      c_inv = cell->getInverseCov ();
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeSampleOrder ()
+{
+  const int azimuth_bins = 32;
+  const int range_bins = 8;
+  int nr_points = static_cast<int> (input_->points.size ());
+
+  // Bin of every point, the azimuth uses the diamond angle in [0, 4) instead of atan2 and the range bins are
+  // logarithmic (1 m, 2 m, 4 m, ...)
+  std::vector<int> bins (nr_points);
+  std::vector<int> bin_begin (azimuth_bins * range_bins + 1, 0);
+  for (int idx = 0; idx < nr_points; idx++)
+  {
+    const PointSource &pt = input_->points[idx];
+    float x = pt.x, y = pt.y;
+    float angle = 0;
+    if (x != 0 || y != 0)
+    {
+      if (y >= 0)
+        angle = (x >= 0) ? y / (x + y) : 1 - x / (y - x);
+      else
+        angle = (x < 0) ? 2 - y / (-x - y) : 3 + x / (x - y);
+    }
+    int azimuth = std::min (static_cast<int> (angle * (azimuth_bins / 4)), azimuth_bins - 1);
+    float range = sqrt (x * x + y * y + pt.z * pt.z);
+    int ring = std::min (static_cast<int> (log2 (1 + range)), range_bins - 1);
 
-      // Compute derivative of transform function w.r.t. transform vector, J_E and H_E in Equations 6.18 and 6.20 [Magnusson 2009]
-      computePointDerivatives (x);
-      // Update score, gradient and hessian, lines 19-21 in Algorithm 2, according to Equations 6.10, 6.12 and 6.13, respectively [Magnusson 2009]
-      //score += updateDerivatives (score_gradient, hessian, x_trans, c_inv, compute_hessian);
+    bins[idx] = azimuth * range_bins + ring;
+    bin_begin[bins[idx] + 1]++;
+  }
+
+  // Counting sort of the points by bin, in scan order inside a bin
+  for (size_t b = 1; b < bin_begin.size (); b++)
+    bin_begin[b] += bin_begin[b - 1];
+  std::vector<int> binned (nr_points);
+  std::vector<int> fill (bin_begin.begin (), bin_begin.end () - 1);
+  for (int idx = 0; idx < nr_points; idx++)
+    binned[fill[bins[idx]]++] = idx;
+
+  // Stride coprime with the size of each bin, close to the golden ratio of it
+  std::vector<int> active, strides (bin_begin.size () - 1, 1);
+  for (size_t b = 0; b + 1 < bin_begin.size (); b++)
+  {
+    int size = bin_begin[b + 1] - bin_begin[b];
+    if (size == 0)
+      continue;
+    int stride = std::max (1, static_cast<int> (0.618 * size));
+    for (;; stride++)
+    {
+      int u = size, v = stride;
+      while (v != 0)
       {
-          Eigen::Vector3d cov_dxd_pi;
-          // e^(-d_2/2 * (x_k - mu_k)^T Sigma_k^-1 (x_k - mu_k)) Equation 6.9 [Magnusson 2009]
-          double e_x_cov_x = exp (-gauss_d2_ * x_trans.dot (c_inv * x_trans) / 2);
-          // Calculate probability of transtormed points existance, Equation 6.9 [Magnusson 2009]
-          double score_inc = -gauss_d1_ * e_x_cov_x;
+        int r = u % v;
+        u = v;
+        v = r;
+      }
+      if (u == 1)
+        break;
+    }
+    strides[b] = stride;
+    active.push_back (static_cast<int> (b));
+  }
 
-          e_x_cov_x = gauss_d2_ * e_x_cov_x;
+  // One point per non empty bin per round
+  sample_order_.clear ();
+  sample_order_.reserve (nr_points);
+  for (int round = 0; !active.empty (); round++)
+  {
+    std::vector<int> remaining;
+    for (size_t k = 0; k < active.size (); k++)
+    {
+      int b = active[k];
+      int size = bin_begin[b + 1] - bin_begin[b];
+      sample_order_.push_back (binned[bin_begin[b] + static_cast<int> ((static_cast<long long> (round) * strides[b]) % size)]);
+      if (round + 1 < size)
+        remaining.push_back (b);
+    }
+    active.swap (remaining);
+  }
+}
 
-          // Error checking for invalid values.
-          if (e_x_cov_x > 1 || e_x_cov_x < 0 || e_x_cov_x != e_x_cov_x) {
-              score_inc = 0;
-          } else {
-              // Reusable portion of Equation 6.12 and 6.13 [Magnusson 2009]
-              e_x_cov_x *= gauss_d1_;
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> bool
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateSampleSize (double step_length)
+{
+  int nr_points = static_cast<int> (input_->points.size ());
+  int previous = nr_samples_;
 
+  // The subset is inversely proportional to the step length, starting from min_samples_ at the maximum step length
+  double wanted = (step_length > 0) ? min_samples_ * step_size_ / step_length : nr_points;
+  while (nr_samples_ > 0 && nr_samples_ < wanted)
+    nr_samples_ = (2 * nr_samples_ < nr_points) ? 2 * nr_samples_ : 0;
 
-              for (int i = 0; i < 6; i++)
-              {
-                  // Sigma_k^-1 d(T(x,p))/dpi, Reusable portion of Equation 6.12 and 6.13 [Magnusson 2009o
-                  cov_dxd_pi = c_inv * point_gradient_.col (i);
+  return (nr_samples_ != previous);
+}
 
-                  // Update gradient, Equation 6.12 [Magnusson 2009]
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> int
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::resizeDerivativeBatches ()
+{
 #ifdef _OPENMP
-                  score_gradient_i[omp_get_thread_num()] (i) += x_trans.dot (cov_dxd_pi) * e_x_cov_x;
+  int num_threads = (num_threads_ > 0) ? num_threads_ : omp_get_max_threads ();
 #else
-                  score_gradient (i) += x_trans.dot (cov_dxd_pi) * e_x_cov_x;
+  int num_threads = 1;
 #endif
-                  if (compute_hessian)
-                  {
-                      for (int j = 0; j < hessian.cols (); j++)
-                      {
-                          // Update hessian, Equation 6.13 [Magnusson 2009]
+  if (static_cast<int> (derivative_batches_.size ()) < num_threads)
+    derivative_batches_.resize (num_threads);
+  return (num_threads);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::evaluateDerivativeBatches (PointCloudSource &trans_cloud, int num_threads)
+{
+  int nr_samples = getNumberOfSamples ();
+
 #ifdef _OPENMP
-                          hessian_i[omp_get_thread_num()] (i, j) += e_x_cov_x * (-gauss_d2_ * x_trans.dot (cov_dxd_pi) * x_trans.dot (c_inv * point_gradient_.col (j)) +
-                                                         x_trans.dot (c_inv * point_hessian_.block<3, 1>(3 * i, j)) +
-                                                         point_gradient_.col (j).dot (cov_dxd_pi) );
+#pragma omp parallel num_threads(num_threads)
+#endif
+  {
+#ifdef _OPENMP
+    NDTDerivativeBatch &batch = derivative_batches_[omp_get_thread_num ()];
 #else
-                          hessian (i, j) += e_x_cov_x * (-gauss_d2_ * x_trans.dot (cov_dxd_pi) * x_trans.dot (c_inv * point_gradient_.col (j)) +
-                                                         x_trans.dot (c_inv * point_hessian_.block<3, 1>(3 * i, j)) +
-                                                         point_gradient_.col (j).dot (cov_dxd_pi) );
+    NDTDerivativeBatch &batch = derivative_batches_[0];
 #endif
-                      }
-                  }
-              }
-          }
-          score += score_inc;
-      }
-    }
-  }
+    std::vector<TargetGridLeafConstPtr> neighborhood;
+    Eigen::Vector3d x, x_trans;
+
+    // Static chunks, the source points are scan ordered so neighboring points search neighboring voxels
 #ifdef _OPENMP
-  for (int i = 0; i < num_threads; ++i) {
-    score_gradient += score_gradient_i[i];
-    hessian += hessian_i[i];
-  }
+#pragma omp for schedule(static)
 #endif
+    for (int i = 0; i < nr_samples; i++)
+    {
+      int idx = getSampleIndex (i);
+      const PointSource &x_trans_pt = trans_cloud.points[idx];
 
-  return (score);
+      // Find nieghbors, either by radius search over the voxel centroids or by direct voxel lookup
+      searchTargetCells (x_trans_pt, neighborhood);
+      if (neighborhood.empty ())
+        continue;
+
+      const PointSource &x_pt = input_->points[idx];
+      x = Eigen::Vector3d (x_pt.x, x_pt.y, x_pt.z);
+
+      for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
+      {
+        TargetGridLeafConstPtr cell = *neighborhood_it;
+
+        // Denorm point, x_k' in Equations 6.12 and 6.13 [Magnusson 2009]
+        x_trans = Eigen::Vector3d (x_trans_pt.x, x_trans_pt.y, x_trans_pt.z) - cell->getMean ();
+        // Uses precomputed covariance for speed.
+        batch.push (x, x_trans, cell->getInverseCov ());
+      }
+    }
+
+    batch.flush ();
+  }
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -617,10 +920,13 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateDerivatives (
     {
       for (int j = 0; j < hessian.cols (); j++)
       {
-        // Update hessian, Equation 6.13 [Magnusson 2009]
-        hessian (i, j) += e_x_cov_x * (-gauss_d2_ * x_trans.dot (cov_dxd_pi) * x_trans.dot (c_inv * point_gradient_.col (j)) +
-                                    x_trans.dot (c_inv * point_hessian_.block<3, 1>(3 * i, j)) +
-                                    point_gradient_.col (j).dot (cov_dxd_pi) );
+        // Update hessian, Equation 6.13 [Magnusson 2009], or its gauss-newton approximation
+        if (use_gauss_newton_)
+          hessian (i, j) += e_x_cov_x * point_gradient_.col (j).dot (cov_dxd_pi);
+        else
+          hessian (i, j) += e_x_cov_x * (-gauss_d2_ * x_trans.dot (cov_dxd_pi) * x_trans.dot (c_inv * point_gradient_.col (j)) +
+                                      x_trans.dot (c_inv * point_hessian_.block<3, 1>(3 * i, j)) +
+                                      point_gradient_.col (j).dot (cov_dxd_pi) );
       }
     }
   }
@@ -633,51 +939,13 @@ template<typename PointSource, typename PointTarget> void
 pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeHessian (Eigen::Matrix<double, 6, 6> &hessian,
                                                                              PointCloudSource &trans_cloud, Eigen::Matrix<double, 6, 1> &)
 {
-  // Original Point and Transformed Point
-  PointSource x_pt, x_trans_pt;
-  // Original Point and Transformed Point (for math)
-  Eigen::Vector3d x, x_trans;
-  // Occupied Voxel
-  TargetGridLeafConstPtr cell;
-  // Inverse Covariance of Occupied Voxel
-  Eigen::Matrix3d c_inv;
-
+  Eigen::Matrix<double, 6, 1> score_gradient = Eigen::Matrix<double, 6, 1>::Zero ();
   hessian.setZero ();
 
   // Precompute Angular Derivatives unessisary because only used after regular derivative calculation
 
-  // Update hessian for each point, line 17 in Algorithm 2 [Magnusson 2009]
-  for (size_t idx = 0; idx < input_->points.size (); idx++)
-  {
-    x_trans_pt = trans_cloud.points[idx];
-
-    // Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
-    std::vector<TargetGridLeafConstPtr> neighborhood;
-    std::vector<float> distances;
-    target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
-
-    for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
-    {
-      cell = *neighborhood_it;
-
-      {
-        x_pt = input_->points[idx];
-        x = Eigen::Vector3d (x_pt.x, x_pt.y, x_pt.z);
-
-        x_trans = Eigen::Vector3d (x_trans_pt.x, x_trans_pt.y, x_trans_pt.z);
-
-        // Denorm point, x_k' in Equations 6.12 and 6.13 [Magnusson 2009]
-        x_trans -= cell->getMean ();
-        // Uses precomputed covariance for speed.
-        c_inv = cell->getInverseCov ();
-
-        // Compute derivative of transform function w.r.t. transform vector, J_E and H_E in Equations 6.18 and 6.20 [Magnusson 2009]
-        computePointDerivatives (x);
-        // Update hessian, lines 21 in Algorithm 2, according to Equations 6.10, 6.12 and 6.13, respectively [Magnusson 2009]
-        updateHessian (hessian, x_trans, c_inv);
-      }
-    }
-  }
+  // Update hessian for each point, lines 17-21 in Algorithm 2 [Magnusson 2009]
+  accumulateDerivatives (score_gradient, hessian, trans_cloud, true);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -711,130 +979,6 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateHessian (Eige
 
 }
 
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-template<typename PointSource, typename PointTarget> bool
-pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateIntervalMT (double &a_l, double &f_l, double &g_l,
-                                                                               double &a_u, double &f_u, double &g_u,
-                                                                               double a_t, double f_t, double g_t)
-{
-  // Case U1 in Update Algorithm and Case a in Modified Update Algorithm [More, Thuente 1994]
-  if (f_t > f_l)
-  {
-    a_u = a_t;
-    f_u = f_t;
-    g_u = g_t;
-    return (false);
-  }
-  // Case U2 in Update Algorithm and Case b in Modified Update Algorithm [More, Thuente 1994]
-  else
-  if (g_t * (a_l - a_t) > 0)
-  {
-    a_l = a_t;
-    f_l = f_t;
-    g_l = g_t;
-    return (false);
-  }
-  // Case U3 in Update Algorithm and Case c in Modified Update Algorithm [More, Thuente 1994]
-  else
-  if (g_t * (a_l - a_t) < 0)
-  {
-    a_u = a_l;
-    f_u = f_l;
-    g_u = g_l;
-
-    a_l = a_t;
-    f_l = f_t;
-    g_l = g_t;
-    return (false);
-  }
-  // Interval Converged
-  else
-    return (true);
-}
-
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-template<typename PointSource, typename PointTarget> double
-pcl::NormalDistributionsTransform<PointSource, PointTarget>::trialValueSelectionMT (double a_l, double f_l, double g_l,
-                                                                                    double a_u, double f_u, double g_u,
-                                                                                    double a_t, double f_t, double g_t)
-{
-  // Case 1 in Trial Value Selection [More, Thuente 1994]
-  if (f_t > f_l)
-  {
-    // Calculate the minimizer of the cubic that interpolates f_l, f_t, g_l and g_t
-    // Equation 2.4.52 [Sun, Yuan 2006]
-    double z = 3 * (f_t - f_l) / (a_t - a_l) - g_t - g_l;
-    double w = std::sqrt (z * z - g_t * g_l);
-    // Equation 2.4.56 [Sun, Yuan 2006]
-    double a_c = a_l + (a_t - a_l) * (w - g_l - z) / (g_t - g_l + 2 * w);
-
-    // Calculate the minimizer of the quadratic that interpolates f_l, f_t and g_l
-    // Equation 2.4.2 [Sun, Yuan 2006]
-    double a_q = a_l - 0.5 * (a_l - a_t) * g_l / (g_l - (f_l - f_t) / (a_l - a_t));
-
-    if (std::fabs (a_c - a_l) < std::fabs (a_q - a_l))
-      return (a_c);
-    else
-      return (0.5 * (a_q + a_c));
-  }
-  // Case 2 in Trial Value Selection [More, Thuente 1994]
-  else
-  if (g_t * g_l < 0)
-  {
-    // Calculate the minimizer of the cubic that interpolates f_l, f_t, g_l and g_t
-    // Equation 2.4.52 [Sun, Yuan 2006]
-    double z = 3 * (f_t - f_l) / (a_t - a_l) - g_t - g_l;
-    double w = std::sqrt (z * z - g_t * g_l);
-    // Equation 2.4.56 [Sun, Yuan 2006]
-    double a_c = a_l + (a_t - a_l) * (w - g_l - z) / (g_t - g_l + 2 * w);
-
-    // Calculate the minimizer of the quadratic that interpolates f_l, g_l and g_t
-    // Equation 2.4.5 [Sun, Yuan 2006]
-    double a_s = a_l - (a_l - a_t) / (g_l - g_t) * g_l;
-
-    if (std::fabs (a_c - a_t) >= std::fabs (a_s - a_t))
-      return (a_c);
-    else
-      return (a_s);
-  }
-  // Case 3 in Trial Value Selection [More, Thuente 1994]
-  else
-  if (std::fabs (g_t) <= std::fabs (g_l))
-  {
-    // Calculate the minimizer of the cubic that interpolates f_l, f_t, g_l and g_t
-    // Equation 2.4.52 [Sun, Yuan 2006]
-    double z = 3 * (f_t - f_l) / (a_t - a_l) - g_t - g_l;
-    double w = std::sqrt (z * z - g_t * g_l);
-    double a_c = a_l + (a_t - a_l) * (w - g_l - z) / (g_t - g_l + 2 * w);
-
-    // Calculate the minimizer of the quadratic that interpolates g_l and g_t
-    // Equation 2.4.5 [Sun, Yuan 2006]
-    double a_s = a_l - (a_l - a_t) / (g_l - g_t) * g_l;
-
-    double a_t_next;
-
-    if (std::fabs (a_c - a_t) < std::fabs (a_s - a_t))
-      a_t_next = a_c;
-    else
-      a_t_next = a_s;
-
-    if (a_t > a_l)
-      return (std::min (a_t + 0.66 * (a_u - a_t), a_t_next));
-    else
-      return (std::max (a_t + 0.66 * (a_u - a_t), a_t_next));
-  }
-  // Case 4 in Trial Value Selection [More, Thuente 1994]
-  else
-  {
-    // Calculate the minimizer of the cubic that interpolates f_u, f_t, g_u and g_t
-    // Equation 2.4.52 [Sun, Yuan 2006]
-    double z = 3 * (f_t - f_u) / (a_t - a_u) - g_t - g_u;
-    double w = std::sqrt (z * z - g_t * g_u);
-    // Equation 2.4.56 [Sun, Yuan 2006]
-    return (a_u + (a_t - a_u) * (w - g_u - z) / (g_t - g_u + 2 * w));
-  }
-}
-
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointSource, typename PointTarget> double
 pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeStepLengthMT (const Eigen::Matrix<double, 6, 1> &x, Eigen::Matrix<double, 6, 1> &step_dir, double step_init, double step_max,
@@ -876,14 +1020,14 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeStepLengthMT
   double a_l = 0, a_u = 0;
 
   // Auxiliary function psi is used until I is determined ot be a closed interval, Equation 2.1 [More, Thuente 1994]
-  double f_l = auxilaryFunction_PsiMT (a_l, phi_0, phi_0, d_phi_0, mu);
-  double g_l = auxilaryFunction_dPsiMT (d_phi_0, d_phi_0, mu);
+  double f_l = ndt_line_search::auxilaryFunction_PsiMT (a_l, phi_0, phi_0, d_phi_0, mu);
+  double g_l = ndt_line_search::auxilaryFunction_dPsiMT (d_phi_0, d_phi_0, mu);
 
-  double f_u = auxilaryFunction_PsiMT (a_u, phi_0, phi_0, d_phi_0, mu);
-  double g_u = auxilaryFunction_dPsiMT (d_phi_0, d_phi_0, mu);
+  double f_u = ndt_line_search::auxilaryFunction_PsiMT (a_u, phi_0, phi_0, d_phi_0, mu);
+  double g_u = ndt_line_search::auxilaryFunction_dPsiMT (d_phi_0, d_phi_0, mu);
 
   // Check used to allow More-Thuente step length calculation to be skipped by making step_min == step_max
-  bool interval_converged = (step_max - step_min) > 0, open_interval = true;
+  bool interval_converged = (step_max - step_min) <= 0, open_interval = true;
 
   double a_t = step_init;
   a_t = std::min (a_t, step_max);
@@ -897,21 +1041,32 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeStepLengthMT
                            Eigen::AngleAxis<float> (static_cast<float> (x_t (5)), Eigen::Vector3f::UnitZ ())).matrix ();
 
   // New transformed point cloud
-  transformPointCloud (*input_, trans_cloud, final_transformation_);
-
-  // Updates score, gradient and hessian.  Hessian calculation is unessisary but testing showed that most step calculations use the
-  // initial step suggestion and recalculation the reusable portions of the hessian would intail more computation time.
-  score = omp_computeDerivatives (score_gradient, hessian, trans_cloud, x_t, true);
-
+  transformSource (trans_cloud);
+
+  // Trial steps only need the score and its derivative along the step direction, the gradient and hessian are computed
+  // once the step is accepted. When the interval search is disabled the initial step is always accepted, so they are
+  // computed right away.
+  bool search_steps = !interval_converged;
+  double phi_t, d_phi_t;
+  if (search_steps)
+  {
+    // Calculate phi'(alpha_t)
+    d_phi_t = -computeDirectionalDerivative (score, step_dir, trans_cloud, x_t);
+  }
+  else
+  {
+    // Updates score, gradient and hessian.
+    score = omp_computeDerivatives (score_gradient, hessian, trans_cloud, x_t, true);
+    // Calculate phi'(alpha_t)
+    d_phi_t = -(score_gradient.dot (step_dir));
+  }
   // Calculate phi(alpha_t)
-  double phi_t = -score;
-  // Calculate phi'(alpha_t)
-  double d_phi_t = -(score_gradient.dot (step_dir));
+  phi_t = -score;
 
   // Calculate psi(alpha_t)
-  double psi_t = auxilaryFunction_PsiMT (a_t, phi_t, phi_0, d_phi_0, mu);
+  double psi_t = ndt_line_search::auxilaryFunction_PsiMT (a_t, phi_t, phi_0, d_phi_0, mu);
   // Calculate psi'(alpha_t)
-  double d_psi_t = auxilaryFunction_dPsiMT (d_phi_t, d_phi_0, mu);
+  double d_psi_t = ndt_line_search::auxilaryFunction_dPsiMT (d_phi_t, d_phi_0, mu);
 
   // Iterate until max number of iterations, interval convergance or a value satisfies the sufficient decrease, Equation 1.1, and curvature condition, Equation 1.2 [More, Thuente 1994]
   while (!interval_converged && step_iterations < max_step_iterations && !(psi_t <= 0 /*Sufficient Decrease*/ && d_phi_t <= -nu * d_phi_0 /*Curvature Condition*/))
@@ -919,15 +1074,15 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeStepLengthMT
     // Use auxilary function if interval I is not closed
     if (open_interval)
     {
-      a_t = trialValueSelectionMT (a_l, f_l, g_l,
-                                   a_u, f_u, g_u,
-                                   a_t, psi_t, d_psi_t);
+      a_t = ndt_line_search::trialValueSelectionMT (a_l, f_l, g_l,
+                                                    a_u, f_u, g_u,
+                                                    a_t, psi_t, d_psi_t);
     }
     else
     {
-      a_t = trialValueSelectionMT (a_l, f_l, g_l,
-                                   a_u, f_u, g_u,
-                                   a_t, phi_t, d_phi_t);
+      a_t = ndt_line_search::trialValueSelectionMT (a_l, f_l, g_l,
+                                                    a_u, f_u, g_u,
+                                                    a_t, phi_t, d_phi_t);
     }
 
     a_t = std::min (a_t, step_max);
@@ -942,20 +1097,18 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeStepLengthMT
 
     // New transformed point cloud
     // Done on final cloud to prevent wasted computation
-    transformPointCloud (*input_, trans_cloud, final_transformation_);
-
-    // Updates score, gradient. Values stored to prevent wasted computation.
-    score = omp_computeDerivatives (score_gradient, hessian, trans_cloud, x_t, false);
+    transformSource (trans_cloud);
 
+    // Updates score and its derivative along the step direction.
+    // Calculate phi'(alpha_t+)
+    d_phi_t = -computeDirectionalDerivative (score, step_dir, trans_cloud, x_t);
     // Calculate phi(alpha_t+)
     phi_t = -score;
-    // Calculate phi'(alpha_t+)
-    d_phi_t = -(score_gradient.dot (step_dir));
 
     // Calculate psi(alpha_t+)
-    psi_t = auxilaryFunction_PsiMT (a_t, phi_t, phi_0, d_phi_0, mu);
+    psi_t = ndt_line_search::auxilaryFunction_PsiMT (a_t, phi_t, phi_0, d_phi_0, mu);
     // Calculate psi'(alpha_t+)
-    d_psi_t = auxilaryFunction_dPsiMT (d_phi_t, d_phi_0, mu);
+    d_psi_t = ndt_line_search::auxilaryFunction_dPsiMT (d_phi_t, d_phi_0, mu);
 
     // Check if I is now a closed interval
     if (open_interval && (psi_t <= 0 && d_psi_t >= 0))
@@ -974,26 +1127,25 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeStepLengthMT
     if (open_interval)
     {
       // Update interval end points using Updating Algorithm [More, Thuente 1994]
-      interval_converged = updateIntervalMT (a_l, f_l, g_l,
-                                             a_u, f_u, g_u,
-                                             a_t, psi_t, d_psi_t);
+      interval_converged = ndt_line_search::updateIntervalMT (a_l, f_l, g_l,
+                                                              a_u, f_u, g_u,
+                                                              a_t, psi_t, d_psi_t);
     }
     else
     {
       // Update interval end points using Modified Updating Algorithm [More, Thuente 1994]
-      interval_converged = updateIntervalMT (a_l, f_l, g_l,
-                                             a_u, f_u, g_u,
-                                             a_t, phi_t, d_phi_t);
+      interval_converged = ndt_line_search::updateIntervalMT (a_l, f_l, g_l,
+                                                              a_u, f_u, g_u,
+                                                              a_t, phi_t, d_phi_t);
     }
 
     step_iterations++;
   }
 
-  // If inner loop was run then hessian needs to be calculated.
-  // Hessian is unnessisary for step length determination but gradients are required
-  // so derivative and transform data is stored for the next iteration.
-  if (step_iterations)
-    computeHessian (hessian, trans_cloud, x_t);
+  // Gradient and hessian are unnessisary for step length determination but are required for the next iteration,
+  // a single full pass is done for the accepted step.
+  if (search_steps)
+    score = omp_computeDerivatives (score_gradient, hessian, trans_cloud, x_t, true);
 
   return (a_t);
 }
@@ -0,0 +1,141 @@
+#ifndef FAST_PCL_REGISTRATION_NDT_D2D_IMPL_H_
+#define FAST_PCL_REGISTRATION_NDT_D2D_IMPL_H_
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget>
+pcl::NormalDistributionsTransformD2D<PointSource, PointTarget>::NormalDistributionsTransformD2D ()
+  : source_resolutions_ ()
+  , source_distributions_ ()
+{
+  reg_name_ = "NormalDistributionsTransformD2D";
+  // The exact hessian of the D2D score needs the second derivatives of the rotated covariance, not provided by the batches
+  use_gauss_newton_ = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransformD2D<PointSource, PointTarget>::omp_computeTransformation (PointCloudSource &output,
+                                                                                          const Eigen::Matrix4f &guess)
+{
+  // The sample subsets are of source points, the distributions are always all evaluated
+  if (min_samples_ > 0)
+  {
+    PCL_WARN ("[pcl::%s::computeTransformation] The minimum number of samples is ignored, it is reset to 0.\n", getClassName ().c_str ());
+    min_samples_ = 0;
+  }
+
+  computePyramidTransformation (output, guess, true);
+
+  // The line search does not transform the source points, see transformSource
+  transformPointCloud (*input_, output, final_transformation_);
+
+  // The score is summed over the source distributions, not over the points
+  int nr_distributions = getNumberOfSourceDistributions ();
+  if (nr_distributions > 0)
+    trans_probability_ *= static_cast<double> (input_->points.size ()) / nr_distributions;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget>
+const std::vector<typename pcl::NormalDistributionsTransformD2D<PointSource, PointTarget>::SourceDistribution>&
+pcl::NormalDistributionsTransformD2D<PointSource, PointTarget>::getSourceDistributions ()
+{
+  float resolution = (level_ < 0) ? resolution_ : coarse_resolutions_[level_];
+  for (size_t i = 0; i < source_resolutions_.size (); i++)
+    if (source_resolutions_[i] == resolution)
+      return (source_distributions_[i]);
+
+  SourceGrid grid;
+  grid.setLeafSize (resolution, resolution, resolution);
+  grid.setInputCloud (input_);
+  grid.filter (false);
+
+  std::vector<SourceDistribution> distributions;
+  const std::vector<typename SourceGrid::Leaf> &leaves = grid.getLeaves ();
+  distributions.reserve (leaves.size ());
+  for (size_t i = 0; i < leaves.size (); i++)
+  {
+    // Skip the voxels without covariance and the singular ones
+    if (leaves[i].nr_points < grid.getMinPointPerVoxel ())
+      continue;
+
+    SourceDistribution distribution;
+    distribution.mean = leaves[i].getMean ();
+    distribution.cov = leaves[i].getCov ();
+    distributions.push_back (distribution);
+  }
+
+  source_resolutions_.push_back (resolution);
+  source_distributions_.push_back (distributions);
+  return (source_distributions_.back ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransformD2D<PointSource, PointTarget>::evaluateDerivativeBatches (PointCloudSource &, int num_threads)
+{
+  // Built before the parallel region, a new level is only seen by the first evaluation
+  const std::vector<SourceDistribution> &distributions = getSourceDistributions ();
+  int nr_distributions = static_cast<int> (distributions.size ());
+
+  Eigen::Matrix3d rotation = final_transformation_.template block<3, 3> (0, 0).template cast<double> ();
+  Eigen::Vector3d translation = final_transformation_.template block<3, 1> (0, 3).template cast<double> ();
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+  {
+#ifdef _OPENMP
+    NDTDerivativeBatch &batch = derivative_batches_[omp_get_thread_num ()];
+#else
+    NDTDerivativeBatch &batch = derivative_batches_[0];
+#endif
+    std::vector<TargetGridLeafConstPtr> neighborhood;
+    Eigen::Vector3d x, x_trans;
+    Eigen::Matrix3d c_trans, c_inv;
+    PointSource x_trans_pt;
+
+    // Static chunks, the distributions are in the order of the voxels created by the scan ordered points
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (int i = 0; i < nr_distributions; i++)
+    {
+      const SourceDistribution &distribution = distributions[i];
+
+      // Transformed source distribution, mean and covariance R C R^T
+      Eigen::Vector3d mean_trans = rotation * distribution.mean + translation;
+      x_trans_pt.x = static_cast<float> (mean_trans (0));
+      x_trans_pt.y = static_cast<float> (mean_trans (1));
+      x_trans_pt.z = static_cast<float> (mean_trans (2));
+
+      searchTargetCells (x_trans_pt, neighborhood);
+      if (neighborhood.empty ())
+        continue;
+
+      c_trans = rotation * distribution.cov * rotation.transpose ();
+
+      for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
+      {
+        TargetGridLeafConstPtr cell = *neighborhood_it;
+
+        // Mean difference and inverse of the summed covariances, Equation 3 of [Stoyanov et al. 2012]
+        x_trans = mean_trans - cell->getMean ();
+        c_inv = (c_trans + cell->getCov ()).inverse ();
+
+        // The derivative of the rotated covariance, -(y^T dR C R^T y) with y = c_inv x_trans, adds to the one of the
+        // mean, y^T dR mean, so the pair has the derivatives of a point at mean - C R^T y
+        x = distribution.mean - distribution.cov * (rotation.transpose () * (c_inv * x_trans));
+        batch.push (x, x_trans, c_inv);
+      }
+    }
+
+    batch.flush ();
+  }
+}
+
+#endif // FAST_PCL_REGISTRATION_NDT_D2D_IMPL_H_
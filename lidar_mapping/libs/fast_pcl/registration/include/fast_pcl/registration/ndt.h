@@ -45,11 +45,100 @@
 #include "fast_pcl/registration/registration.h"
 //#include <pcl/filters/voxel_grid_covariance.h>
 #include "fast_pcl/filters/voxel_grid_covariance.h"
+#include "fast_pcl/registration/ndt_derivative_batch.h"
+#include "fast_pcl/registration/ndt_line_search.h"
+#include "fast_pcl/registration/ndt_target.h"
 
 #include <unsupported/Eigen/NonLinearOptimization>
 
+#include <algorithm>
+#include <functional>
+
 namespace pcl
 {
+  /** \brief Result of the alignment from one initial guess, see \ref NormalDistributionsTransform::alignBatch. */
+  struct NDTHypothesis
+  {
+    NDTHypothesis () :
+      guess (Eigen::Matrix4f::Identity ()),
+      transformation (Eigen::Matrix4f::Identity ()),
+      index (-1),
+      probability (0),
+      iterations (0),
+      converged (false),
+      pruned (false)
+    {
+    }
+
+    /** \brief The initial guess. */
+    Eigen::Matrix4f guess;
+
+    /** \brief The final transformation. */
+    Eigen::Matrix4f transformation;
+
+    /** \brief Index of the guess in the list given to alignBatch. */
+    int index;
+
+    /** \brief Transformation probability (score divided by the number of source points), higher is better. */
+    double probability;
+
+    /** \brief Number of newton iterations run. */
+    int iterations;
+
+    bool converged;
+
+    /** \brief True if the alignment was stopped early because its score was too far below the best one. */
+    bool pruned;
+
+    /** \brief Ranking of alignBatch, hypotheses run to the end come first, then by decreasing probability. */
+    static inline bool
+    ranksBefore (const NDTHypothesis &a, const NDTHypothesis &b)
+    {
+      if (a.pruned != b.pruned)
+        return (!a.pruned);
+      return (a.probability > b.probability);
+    }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  /** \brief Quality of an alignment measured with the target voxel distributions, see
+    * \ref NormalDistributionsTransform::computeFitness.
+    */
+  struct NDTFitness
+  {
+    NDTFitness () :
+      probability (0),
+      mean_mahalanobis (0),
+      inlier_ratio (0),
+      nr_points (0),
+      nr_inliers (0),
+      likelihood_histogram ()
+    {
+    }
+
+    /** \brief Score of the finest voxel grid divided by the number of source points, as the transformation probability. */
+    double probability;
+
+    /** \brief Mean Mahalanobis distance between the inliers and their closest distribution. */
+    double mean_mahalanobis;
+
+    /** \brief Ratio of the source points which are inliers. */
+    double inlier_ratio;
+
+    /** \brief Number of source points. */
+    int nr_points;
+
+    /** \brief Number of source points within the inlier Mahalanobis distance of a distribution. */
+    int nr_inliers;
+
+    /** \brief Number of source points per likelihood bin, bin i of n counts the likelihoods in [i / n, (i + 1) / n).
+      * The likelihood of a point is the exponential term of Equation 6.9 [Magnusson 2009] for its closest
+      * distribution, 0 if there is no distribution around it.
+      */
+    std::vector<int> likelihood_histogram;
+  };
+
   /** \brief A 3D Normal Distribution Transform registration implementation for point cloud data.
     * \note For more information please see
     * <b>Magnusson, M. (2009). The Three-Dimensional Normal-Distributions Transform —
@@ -92,6 +181,13 @@ namespace pcl
       typedef boost::shared_ptr< NormalDistributionsTransform<PointSource, PointTarget> > Ptr;
       typedef boost::shared_ptr< const NormalDistributionsTransform<PointSource, PointTarget> > ConstPtr;
 
+      /** \brief Typename of the voxel grids built from the target, shareable between solvers. */
+      typedef NDTTarget<PointTarget> Target;
+      typedef typename Target::Ptr TargetPtr;
+      typedef typename Target::ConstPtr TargetConstPtr;
+
+      typedef std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > TransformationList;
+      typedef std::vector<NDTHypothesis, Eigen::aligned_allocator<NDTHypothesis> > HypothesisList;
 
       /** \brief Constructor.
         * Sets \ref outlier_ratio_ to 0.35, \ref step_size_ to 0.05 and \ref resolution_ to 1.0
@@ -108,17 +204,95 @@ namespace pcl
       setInputTarget (const PointCloudTargetConstPtr &cloud)
       {
         Registration<PointSource, PointTarget>::setInputTarget (cloud);
+        deferTargetTree ();
         init ();
       }
 
+      /** \brief Attach voxel grids already built from a target instead of building them from a cloud.
+        * \note The target is shared, not copied: any number of solvers may align against it at the same time. Its
+        * cloud becomes the input target, and its resolutions and neighbor search method become the ones of this
+        * solver (changing them afterwards builds new grids for this solver only).
+        * \param[in] target the voxel grids, e.g. from \ref getTarget of another solver or built by NDTTarget
+        */
+      inline void
+      setTarget (const TargetConstPtr &target)
+      {
+        Registration<PointSource, PointTarget>::setInputTarget (target->getInputCloud ());
+        deferTargetTree ();
+        const std::vector<float> &levels = target->getResolutionPyramid ();
+        resolution_ = levels.back ();
+        coarse_resolutions_.assign (levels.begin (), levels.end () - 1);
+        search_method_ = target->getNeighborhoodSearchMethod ();
+        target_window_size_ = target->getWindowSize ();
+        target_cells_ = target;
+      }
+
+      /** \brief Get the voxel grids built from the input target, to be shared with other solvers (see \ref setTarget).
+        * \return the voxel grids, NULL if no target was given
+        */
+      inline TargetConstPtr
+      getTarget () const
+      {
+        return (target_cells_);
+      }
+
+      /** \brief Add points to the target voxel structure, only the voxels containing them are recomputed.
+        * \note The voxel structure is copied first if it is shared with other solvers. The target cloud itself is not modified (e.g. getFitnessScore still uses the previous target), and the added
+        * points are lost when the voxel structure is rebuilt from it (setInputTarget, setResolution, setNeighborhoodSearchMethod).
+        * \param[in] cloud the points to add, in the target frame
+        */
+      inline void
+      addPointsToTarget (const PointCloudTargetConstPtr &cloud)
+      {
+        if (!target_)
+        {
+          setInputTarget (cloud);
+          return;
+        }
+        getMutableTarget ().addPoints (*cloud);
+      }
+
+      /** \brief Remove the target voxels lying completely outside of an axis aligned box.
+        * \note The voxel structure is copied first if it is shared with other solvers.
+        * \param[in] min_p minimum corner of the box
+        * \param[in] max_p maximum corner of the box
+        * \return number of voxels removed
+        */
+      inline int
+      removeTargetCellsOutside (const Eigen::Vector3f &min_p, const Eigen::Vector3f &max_p)
+      {
+        if (!target_cells_)
+          return (0);
+        return (getMutableTarget ().removeLeavesOutside (min_p, max_p));
+      }
+
+      /** \brief Crop the target voxels to an axis aligned box, the voxels straddling its border are rebuilt from the
+        * points of cloud inside the box (see NDTTarget::cropLeaves), e.g. when the target slides over a tiled map.
+        * \note The voxel structure is copied first if it is shared with other solvers.
+        * \param[in] min_p minimum corner of the box
+        * \param[in] max_p maximum corner of the box
+        * \param[in] cloud the target points still in the box, at least the ones near its border
+        * \return number of voxels removed
+        */
+      inline int
+      cropTarget (const Eigen::Vector3f &min_p, const Eigen::Vector3f &max_p, const PointCloudTarget &cloud)
+      {
+        if (!target_cells_)
+          return (0);
+        return (getMutableTarget ().cropLeaves (min_p, max_p, cloud));
+      }
+
       /** \brief Set/change the voxel grid resolution.
+        * \note Coarser levels previously set with \ref setResolutionPyramid are discarded.
         * \param[in] resolution side length of voxels
         */
       inline void
       setResolution (float resolution)
       {
+        bool had_levels = !coarse_resolutions_.empty ();
+        coarse_resolutions_.clear ();
         // Prevents unnessary voxel initiations
-        if (resolution_ != resolution)
+        if (resolution_ != resolution || had_levels)
         {
           resolution_ = resolution;
           if (input_)
@@ -126,6 +300,94 @@ namespace pcl
         }
       }
 
+      /** \brief Set/change the voxel grid resolutions aligned from coarse to fine.
+        * \note One voxel grid is built per level from the same target, each level starts from the transformation
+        * found at the previous one and runs at most \ref max_iterations_ iterations. The finest resolution becomes
+        * the one returned by \ref getResolution and used for the transformation probability.
+        * \param[in] resolutions side lengths of voxels (e.g. {4.0, 2.0, 1.0}), in any order
+        */
+      inline void
+      setResolutionPyramid (const std::vector<float> &resolutions)
+      {
+        if (resolutions.empty ())
+          return;
+
+        std::vector<float> levels (resolutions);
+        std::sort (levels.begin (), levels.end (), std::greater<float> ());
+        levels.erase (std::unique (levels.begin (), levels.end ()), levels.end ());
+
+        resolution_ = levels.back ();
+        coarse_resolutions_.assign (levels.begin (), levels.end () - 1);
+        if (target_)
+          init ();
+      }
+
+      /** \brief Get the voxel grid resolutions aligned from coarse to fine, the last one is \ref getResolution. */
+      inline std::vector<float>
+      getResolutionPyramid () const
+      {
+        std::vector<float> levels (coarse_resolutions_);
+        levels.push_back (resolution_);
+        return (levels);
+      }
+
+      /** \brief Set/change the method used to find the target voxels surrounding each source point.
+        * \note The DIRECT methods do not need the kdtree over the voxel centroids, so it is not built for them.
+        * \param[in] search_method KDTREE (radius search, default), DIRECT27, DIRECT7 or DIRECT1
+        */
+      inline void
+      setNeighborhoodSearchMethod (NeighborSearchMethod search_method)
+      {
+        if (search_method_ != search_method)
+        {
+          search_method_ = search_method;
+          if (target_)
+            init ();
+        }
+      }
+
+      /** \brief Get the method used to find the target voxels surrounding each source point.
+        * \return neighbor search method
+        */
+      inline NeighborSearchMethod
+      getNeighborhoodSearchMethod () const
+      {
+        return (search_method_);
+      }
+
+      /** \brief Bound the target voxel grids to a box, their voxels are then indexed by a dense array instead of a hash table.
+        * \note Suited to a target covering a known area around the sensor (e.g. a local map), see
+        * VoxelGridCovariance::setWindow. Target points outside of the box are ignored. Takes effect at the next setInputTarget.
+        * \param[in] size minimum side lengths of the box, zero for unbounded grids (default)
+        */
+      inline void
+      setTargetWindow (const Eigen::Vector3f &size)
+      {
+        target_window_size_ = size;
+      }
+
+      /** \brief Get the minimum side lengths of the box bounding the target voxel grids, zero if they are not bounded. */
+      inline Eigen::Vector3f
+      getTargetWindowSize () const
+      {
+        return (target_window_size_);
+      }
+
+      /** \brief Move the box bounding the target voxel grids, the voxels leaving it are removed and the others are kept.
+        * \note The voxel structure is copied first if it is shared with other solvers. The center is also the one of the
+        * grids built by the following setInputTarget.
+        * \param[in] center the new center of the box
+        * \return number of voxels removed
+        */
+      inline int
+      moveTargetWindow (const Eigen::Vector3f &center)
+      {
+        target_window_center_ = center;
+        if (!target_cells_)
+          return (0);
+        return (getMutableTarget ().moveWindow (center));
+      }
+
       /** \brief Get voxel grid resolution.
         * \return side length of voxels
         */
@@ -153,6 +415,69 @@ namespace pcl
         step_size_ = step_size;
       }
 
+      /** \brief Get the number of threads used to evaluate the derivatives.
+        * \return number of threads, 0 means the OpenMP default
+        */
+      inline int
+      getNumThreads () const
+      {
+        return (num_threads_);
+      }
+
+      /** \brief Set/change the number of threads used to evaluate the derivatives.
+        * \note The threads of the OpenMP team are kept alive between the parallel regions of successive alignments.
+        * \param[in] num_threads number of threads, 0 to use the OpenMP default (one per core)
+        */
+      inline void
+      setNumThreads (int num_threads)
+      {
+        num_threads_ = (num_threads > 0) ? num_threads : 0;
+      }
+
+      /** \brief Get whether the gauss-newton approximation of the hessian is used.
+        * \return true if the second order terms are dropped
+        */
+      inline bool
+      getUseGaussNewton () const
+      {
+        return (use_gauss_newton_);
+      }
+
+      /** \brief Set/change whether the newton step uses the gauss-newton approximation of the hessian.
+        * \note The approximation keeps the first order point derivatives weighted by the exponential term of each
+        * (point, voxel) pair and drops the second order point derivatives (Equation 6.20) and the curvature of the
+        * exponential. It is negative semidefinite, so the step is solved with LDLT instead of SVD (SVD is used as
+        * a fallback when it is singular).
+        * \param[in] use_gauss_newton true to use the approximation, false for the exact hessian (Equation 6.13)
+        */
+      inline void
+      setUseGaussNewton (bool use_gauss_newton)
+      {
+        use_gauss_newton_ = use_gauss_newton;
+      }
+
+      /** \brief Get the number of source points evaluated by the first iterations of every level.
+        * \return number of points, 0 if every point is always evaluated
+        */
+      inline int
+      getMinSamples () const
+      {
+        return (min_samples_);
+      }
+
+      /** \brief Set/change the sampling schedule of the source points.
+        * \note The first iterations of every pyramid level only need a rough descent direction, they evaluate a subset
+        * of min_samples points spread over the azimuth and range of the source frame. The subset doubles whenever the
+        * accepted step is shorter than step_size * min_samples / (subset size), so it grows towards the full cloud as
+        * the steps shrink. The finest level only converges, and computes the transformation probability, on every point.
+        * \param[in] min_samples number of points of the first iterations, 0 to evaluate every point (default)
+        */
+      inline void
+      setMinSamples (int min_samples)
+      {
+        min_samples_ = (min_samples > 0) ? min_samples : 0;
+      }
+
       /** \brief Get the point cloud outlier ratio.
         * \return outlier ratio
         */
@@ -180,6 +505,66 @@ namespace pcl
         return (trans_probability_);
       }
 
+      /** \brief Measure the final transformation with the distributions of the finest target voxel grid.
+        * \note Unlike \ref getFitnessScore, no kdtree over the target points is needed: every transformed source point
+        * is compared to the distributions found by the neighbor search method of the alignment.
+        * \param[out] fitness the Mahalanobis distances, inlier ratio, probability and likelihood histogram
+        * \param[in] max_mahalanobis maximum Mahalanobis distance between an inlier and its closest distribution
+        * \param[in] histogram_bins number of bins of the likelihood histogram
+        * \return the mean Mahalanobis distance of the inliers, std::numeric_limits<double>::max () if there is none
+        */
+      double
+      computeFitness (NDTFitness &fitness, double max_mahalanobis = 3.0, int histogram_bins = 10);
+
+      using Registration<PointSource, PointTarget>::getFitnessScore;
+
+      /** \brief Obtain the Euclidean fitness score (e.g., sum of squared distances from the source to the target).
+        * \note The kdtree over the target points is only built by the first call after the target changed, the
+        * alignment itself does not need it (see \ref computeFitness).
+        * \param[in] max_range maximum allowable distance between a point and its correspondence in the target
+        */
+      inline double
+      getFitnessScore (double max_range = std::numeric_limits<double>::max ())
+      {
+        updateTargetTree ();
+        return (Registration<PointSource, PointTarget>::getFitnessScore (max_range));
+      }
+
+      /** \brief Obtain the Euclidean fitness score with OpenMP, see \ref getFitnessScore.
+        * \param[in] max_range maximum allowable distance between a point and its correspondence in the target
+        */
+      inline double
+      omp_getFitnessScore (double max_range = std::numeric_limits<double>::max ())
+      {
+        updateTargetTree ();
+        return (Registration<PointSource, PointTarget>::omp_getFitnessScore (max_range));
+      }
+
+      /** \brief Set the early pruning of \ref alignBatch.
+        * \param[in] iterations number of iterations run from every guess before pruning
+        * \param[in] probability_ratio hypotheses whose transformation probability is below this ratio of the best one
+        * are dropped after the first iterations
+        */
+      inline void
+      setBatchPruning (int iterations, double probability_ratio)
+      {
+        batch_prune_iterations_ = iterations;
+        batch_prune_ratio_ = probability_ratio;
+      }
+
+      /** \brief Align a source cloud from several initial guesses against the current target.
+        * \note The hypotheses run in parallel (one per thread) and share the target voxel grids, which are not modified.
+        * Every hypothesis first runs the number of iterations set with \ref setBatchPruning, the ones scoring far below the
+        * best are then dropped and the others resume on the finest level until convergence. The final transformation,
+        * probability, number of iterations and convergence of this object are set from the best hypothesis.
+        * \param[in] source the source cloud, becomes the input source
+        * \param[in] guesses the initial guesses
+        * \param[out] ranked the hypotheses, best first (pruned hypotheses come last)
+        * \return the transformation of the best hypothesis (identity if there is no guess or no target)
+        */
+      Eigen::Matrix4f
+      alignBatch (const PointCloudSourceConstPtr &source, const TransformationList &guesses, HypothesisList &ranked);
+
       /** \brief Get the number of iterations required to calculate alignment.
         * \return final number of iterations
         */
@@ -231,9 +616,31 @@ namespace pcl
       using Registration<PointSource, PointTarget>::converged_;
       using Registration<PointSource, PointTarget>::corr_dist_threshold_;
       using Registration<PointSource, PointTarget>::inlier_threshold_;
+      using Registration<PointSource, PointTarget>::tree_;
+      using Registration<PointSource, PointTarget>::target_cloud_updated_;
+      using Registration<PointSource, PointTarget>::force_no_recompute_;
 
       using Registration<PointSource, PointTarget>::update_visualizer_;
 
+      /** \brief Keep Registration::initCompute from building the kdtree over the new target points at the next
+        * alignment, it is built by \ref updateTargetTree when a fitness score needs it.
+        */
+      inline void
+      deferTargetTree ()
+      {
+        target_tree_outdated_ = target_tree_outdated_ || target_cloud_updated_;
+        target_cloud_updated_ = false;
+      }
+
+      /** \brief Build the kdtree over the target points if the target changed since it was last built. */
+      inline void
+      updateTargetTree ()
+      {
+        if (target_tree_outdated_ && target_ && !force_no_recompute_)
+          tree_->setInputCloud (target_);
+        target_tree_outdated_ = false;
+      }
+
       /** \brief Estimate the transformation and returns the transformed source (input) as output.
         * \param[out] output the resultant input transfomed point cloud dataset
         */
@@ -250,17 +657,105 @@ namespace pcl
       virtual void
       computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess);
 
+      /** \brief Estimate the transformation and returns the transformed source (input) as output, the derivatives are
+        * evaluated by all threads.
+        * \param[out] output the resultant input transfomed point cloud dataset
+        * \param[in] guess the initial gross estimation of the transformation
+        */
       virtual void
       omp_computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess);
 
-      /** \brief Initiate covariance voxel structure. */
+      /** \brief Run one hypothesis of \ref alignBatch on this object, which shares the target of the batch.
+        * \param[in,out] hypothesis the hypothesis, its transformation is the starting point
+        * \param[in] max_iterations maximum number of iterations per pyramid level
+        * \param[in] finest_only resume the finest level from the transformation, skipping the coarse levels already run
+        */
+      void
+      alignHypothesis (NDTHypothesis &hypothesis, int max_iterations, bool finest_only);
+
+      /** \brief Align the input over every level of the resolution pyramid, shared by \ref computeTransformation
+        * and \ref omp_computeTransformation.
+        * \param[out] output the resultant input transfomed point cloud dataset
+        * \param[in] guess the initial gross estimation of the transformation
+        * \param[in] use_omp evaluate the initial derivatives of each level with \ref omp_computeDerivatives
+        * \param[in] finest_only only align on the finest level
+        */
+      void
+      computePyramidTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess, bool use_omp,
+                                    bool finest_only = false);
+
+      /** \brief Run the newton iterations on the current level of the resolution pyramid.
+        * \param[in,out] output the input transformed by the current transform vector
+        * \param[in,out] p the current transform vector
+        * \param[in] use_omp evaluate the initial derivatives with \ref omp_computeDerivatives
+        * \return the score of the final transform vector
+        */
+      double
+      computeLevelTransformation (PointCloudSource &output, Eigen::Matrix<double, 6, 1> &p, bool use_omp);
+
+      /** \brief Compute the gaussian fitting parameters d1 and d2 for a voxel resolution, Equation 6.8 [Magnusson 2009].
+        * \param[in] resolution side length of voxels
+        */
+      inline void
+      updateGaussParameters (double resolution)
+      {
+        double gauss_c1, gauss_c2, gauss_d3;
+
+        gauss_c1 = 10 * (1 - outlier_ratio_);
+        gauss_c2 = outlier_ratio_ / pow (resolution, 3);
+        gauss_d3 = -log (gauss_c2);
+        gauss_d1_ = -log ( gauss_c1 + gauss_c2 ) - gauss_d3;
+        gauss_d2_ = -2 * log ((-log ( gauss_c1 * exp ( -0.5 ) + gauss_c2 ) - gauss_d3) / gauss_d1_);
+      }
+
+      /** \brief Initiate covariance voxel structure, one per level of the resolution pyramid.
+        * \note If the previous structure is used by this solver only and has the same parameters it is rebuilt in place,
+        * reusing its memory. Otherwise a new structure is built, the previous one is left untouched for the solvers sharing it.
+        */
       void inline
       init ()
       {
-        target_cells_.setLeafSize (resolution_, resolution_, resolution_);
-        target_cells_.setInputCloud ( target_ );
-        // Initiate voxel structure.
-        target_cells_.filter (true);
+        if (!target_)
+          return;
+        // Initiate voxel structure, the kdtree is only needed for radius search.
+        if (target_cells_ && target_cells_.unique () && target_cells_->getResolutionPyramid () == getResolutionPyramid () &&
+            target_cells_->getNeighborhoodSearchMethod () == search_method_ && target_cells_->getWindowSize () == target_window_size_)
+          const_cast<Target&> (*target_cells_).setInputCloud (target_, target_window_center_);
+        else
+          target_cells_.reset (new Target (target_, getResolutionPyramid (), search_method_, target_window_size_, target_window_center_));
+      }
+
+      /** \brief Get the voxel structure for modification, copying it first if other solvers share it. */
+      inline Target&
+      getMutableTarget ()
+      {
+        if (!target_cells_.unique ())
+          target_cells_.reset (new Target (*target_cells_));
+        return (const_cast<Target&> (*target_cells_));
+      }
+
+      /** \brief Rebuild the target kdtrees left outdated by incremental updates (addPointsToTarget, removeTargetCellsOutside,
+        * moveTargetWindow), once before the searches of an alignment.
+        * \note The target is not copied if it is shared, the kdtrees are rebuilt in place (see NDTTarget::updateSearch).
+        */
+      inline void
+      updateTargetSearch ()
+      {
+        if (target_cells_)
+          target_cells_->updateSearch ();
+      }
+
+      /** \brief Find the occupied target voxels surrounding a transformed source point.
+        * \param[in] x_trans_pt transformed source point
+        * \param[out] neighborhood the resultant leaves
+        * \return number of leaves found
+        */
+      inline int
+      searchTargetCells (const PointSource &x_trans_pt, std::vector<TargetGridLeafConstPtr> &neighborhood)
+      {
+        // The finest level is the default, coarser ones are only selected during computePyramidTransformation
+        int level = (level_ < 0) ? target_cells_->getNumberOfLevels () - 1 : level_;
+        return (target_cells_->searchCells (x_trans_pt, level, neighborhood));
       }
 
       /** \brief Compute derivatives of probability function w.r.t. the transformation vector.
@@ -278,6 +773,14 @@ namespace pcl
                           Eigen::Matrix<double, 6, 1> &p,
                           bool compute_hessian = true);
 
+      /** \brief Compute derivatives of probability function w.r.t. the transformation vector using OpenMP and the vectorized batch kernel.
+        * \note Equation 6.10, 6.12 and 6.13 [Magnusson 2009].
+        * \param[out] score_gradient the gradient vector of the probability function w.r.t. the transformation vector
+        * \param[out] hessian the hessian matrix of the probability function w.r.t. the transformation vector
+        * \param[in] trans_cloud transformed point cloud
+        * \param[in] p the current transform vector
+        * \param[in] compute_hessian flag to calculate hessian, unnessissary for step calculation.
+        */
       double
       omp_computeDerivatives (Eigen::Matrix<double, 6, 1> &score_gradient,
                           Eigen::Matrix<double, 6, 6> &hessian,
@@ -285,6 +788,105 @@ namespace pcl
                           Eigen::Matrix<double, 6, 1> &p,
                           bool compute_hessian = true);
 
+      /** \brief Accumulate the derivatives of all (point, voxel) pairs with one \ref NDTDerivativeBatch per thread.
+        * \note The angular derivatives must have been computed for the current transform vector.
+        * \param[in,out] score_gradient the gradient vector of the probability function w.r.t. the transformation vector
+        * \param[in,out] hessian the hessian matrix of the probability function w.r.t. the transformation vector
+        * \param[in] trans_cloud transformed point cloud
+        * \param[in] compute_hessian flag to calculate hessian, unnessissary for step calculation.
+        * \return the score of the pairs
+        */
+      double
+      accumulateDerivatives (Eigen::Matrix<double, 6, 1> &score_gradient,
+                             Eigen::Matrix<double, 6, 6> &hessian,
+                             PointCloudSource &trans_cloud,
+                             bool compute_hessian);
+
+      /** \brief Compute the score and its derivative along a step direction, used for the line search trial steps.
+        * \note Cheaper than \ref omp_computeDerivatives, neither the gradient nor the hessian are accumulated.
+        * \param[out] score the score of the transformed cloud, Equation 6.10 [Magnusson 2009]
+        * \param[in] step_dir the step direction
+        * \param[in] trans_cloud transformed point cloud
+        * \param[in] p the current transform vector
+        * \return the derivative of the score along step_dir
+        */
+      double
+      computeDirectionalDerivative (double &score,
+                                    const Eigen::Matrix<double, 6, 1> &step_dir,
+                                    PointCloudSource &trans_cloud,
+                                    Eigen::Matrix<double, 6, 1> &p);
+
+      /** \brief Order the source points so that every prefix of \ref sample_order_ is spread over azimuth and range.
+        * \note The points are grouped in azimuth and range bins, the bins are then visited in turn, each one taking its
+        * points with a stride so consecutive picks are not neighbors along the scan line.
+        */
+      void
+      computeSampleOrder ();
+
+      /** \brief Grow the subset of evaluated source points after an accepted step, see \ref setMinSamples.
+        * \param[in] step_length length of the accepted step, 0 to switch to every point
+        * \return true if the subset changed, the derivatives at the current transform vector must then be recomputed
+        */
+      bool
+      updateSampleSize (double step_length);
+
+      /** \brief Get the number of source points evaluated by the derivatives. */
+      inline int
+      getNumberOfSamples () const
+      {
+        return ((nr_samples_ > 0) ? nr_samples_ : static_cast<int> (input_->points.size ()));
+      }
+
+      /** \brief Get the index in the input cloud of the i-th evaluated source point. */
+      inline int
+      getSampleIndex (int i) const
+      {
+        return ((nr_samples_ > 0) ? sample_order_[i] : i);
+      }
+
+      /** \brief Make sure there is one \ref NDTDerivativeBatch per thread.
+        * \return the number of threads evaluating the derivatives
+        */
+      int
+      resizeDerivativeBatches ();
+
+      /** \brief Push every (point, voxel) pair into the batches previously reset, one batch per thread.
+        * \note Virtual so that NormalDistributionsTransformD2D can push (distribution, voxel) pairs instead.
+        * \param[in] trans_cloud transformed point cloud
+        * \param[in] num_threads the number of threads, as returned by \ref resizeDerivativeBatches
+        */
+      virtual void
+      evaluateDerivativeBatches (PointCloudSource &trans_cloud, int num_threads);
+
+      /** \brief Transform the source points by \ref final_transformation_, at every trial step of the line search.
+        * \note Virtual so that NormalDistributionsTransformD2D, which only evaluates the source distributions, skips it.
+        * \param[out] trans_cloud transformed point cloud
+        */
+      virtual void
+      transformSource (PointCloudSource &trans_cloud)
+      {
+        transformPointCloud (*input_, trans_cloud, final_transformation_);
+      }
+
+      /** \brief Copy the precomputed angular derivatives into the arrays used by \ref NDTDerivativeBatch.
+        * \param[out] j_ang 24 doubles, gradient terms a to h of Equation 6.19 [Magnusson 2009]
+        * \param[out] h_ang 45 doubles, hessian terms a2 to f3 of Equation 6.21 [Magnusson 2009]
+        */
+      inline void
+      getAngleDerivatives (double *j_ang, double *h_ang) const
+      {
+        const Eigen::Vector3d *j_terms[8] = {&j_ang_a_, &j_ang_b_, &j_ang_c_, &j_ang_d_, &j_ang_e_, &j_ang_f_, &j_ang_g_, &j_ang_h_};
+        const Eigen::Vector3d *h_terms[15] = {&h_ang_a2_, &h_ang_a3_, &h_ang_b2_, &h_ang_b3_, &h_ang_c2_, &h_ang_c3_,
+                                              &h_ang_d1_, &h_ang_d2_, &h_ang_d3_, &h_ang_e1_, &h_ang_e2_, &h_ang_e3_,
+                                              &h_ang_f1_, &h_ang_f2_, &h_ang_f3_};
+        for (int i = 0; i < 8; i++)
+          for (int k = 0; k < 3; k++)
+            j_ang[3 * i + k] = (*j_terms[i]) (k);
+        for (int i = 0; i < 15; i++)
+          for (int k = 0; k < 3; k++)
+            h_ang[3 * i + k] = (*h_terms[i]) (k);
+      }
+
       /** \brief Compute individual point contirbutions to derivatives of probability function w.r.t. the transformation vector.
         * \note Equation 6.10, 6.12 and 6.13 [Magnusson 2009].
         * \param[in,out] score_gradient the gradient vector of the probability function w.r.t. the transformation vector
@@ -359,82 +961,31 @@ namespace pcl
                            Eigen::Matrix<double, 6, 6> &hessian,
                            PointCloudSource &trans_cloud);
 
-      /** \brief Update interval of possible step lengths for More-Thuente method, \f$ I \f$ in More-Thuente (1994)
-        * \note Updating Algorithm until some value satifies \f$ \psi(\alpha_k) \leq 0 \f$ and \f$ \phi'(\alpha_k) \geq 0 \f$
-        * and Modified Updating Algorithm from then on [More, Thuente 1994].
-        * \param[in,out] a_l first endpoint of interval \f$ I \f$, \f$ \alpha_l \f$ in Moore-Thuente (1994)
-        * \param[in,out] f_l value at first endpoint, \f$ f_l \f$ in Moore-Thuente (1994), \f$ \psi(\alpha_l) \f$ for Update Algorithm and \f$ \phi(\alpha_l) \f$ for Modified Update Algorithm
-        * \param[in,out] g_l derivative at first endpoint, \f$ g_l \f$ in Moore-Thuente (1994), \f$ \psi'(\alpha_l) \f$ for Update Algorithm and \f$ \phi'(\alpha_l) \f$ for Modified Update Algorithm
-        * \param[in,out] a_u second endpoint of interval \f$ I \f$, \f$ \alpha_u \f$ in Moore-Thuente (1994)
-        * \param[in,out] f_u value at second endpoint, \f$ f_u \f$ in Moore-Thuente (1994), \f$ \psi(\alpha_u) \f$ for Update Algorithm and \f$ \phi(\alpha_u) \f$ for Modified Update Algorithm
-        * \param[in,out] g_u derivative at second endpoint, \f$ g_u \f$ in Moore-Thuente (1994), \f$ \psi'(\alpha_u) \f$ for Update Algorithm and \f$ \phi'(\alpha_u) \f$ for Modified Update Algorithm
-        * \param[in] a_t trial value, \f$ \alpha_t \f$ in Moore-Thuente (1994)
-        * \param[in] f_t value at trial value, \f$ f_t \f$ in Moore-Thuente (1994), \f$ \psi(\alpha_t) \f$ for Update Algorithm and \f$ \phi(\alpha_t) \f$ for Modified Update Algorithm
-        * \param[in] g_t derivative at trial value, \f$ g_t \f$ in Moore-Thuente (1994), \f$ \psi'(\alpha_t) \f$ for Update Algorithm and \f$ \phi'(\alpha_t) \f$ for Modified Update Algorithm
-        * \return if interval converges
-        */
-      bool
-      updateIntervalMT (double &a_l, double &f_l, double &g_l,
-                        double &a_u, double &f_u, double &g_u,
-                        double a_t, double f_t, double g_t);
-
-      /** \brief Select new trial value for More-Thuente method.
-        * \note Trial Value Selection [More, Thuente 1994], \f$ \psi(\alpha_k) \f$ is used for \f$ f_k \f$ and \f$ g_k \f$
-        * until some value satifies the test \f$ \psi(\alpha_k) \leq 0 \f$ and \f$ \phi'(\alpha_k) \geq 0 \f$
-        * then \f$ \phi(\alpha_k) \f$ is used from then on.
-        * \note Interpolation Minimizer equations from Optimization Theory and Methods: Nonlinear Programming By Wenyu Sun, Ya-xiang Yuan (89-100).
-        * \param[in] a_l first endpoint of interval \f$ I \f$, \f$ \alpha_l \f$ in Moore-Thuente (1994)
-        * \param[in] f_l value at first endpoint, \f$ f_l \f$ in Moore-Thuente (1994)
-        * \param[in] g_l derivative at first endpoint, \f$ g_l \f$ in Moore-Thuente (1994)
-        * \param[in] a_u second endpoint of interval \f$ I \f$, \f$ \alpha_u \f$ in Moore-Thuente (1994)
-        * \param[in] f_u value at second endpoint, \f$ f_u \f$ in Moore-Thuente (1994)
-        * \param[in] g_u derivative at second endpoint, \f$ g_u \f$ in Moore-Thuente (1994)
-        * \param[in] a_t previous trial value, \f$ \alpha_t \f$ in Moore-Thuente (1994)
-        * \param[in] f_t value at previous trial value, \f$ f_t \f$ in Moore-Thuente (1994)
-        * \param[in] g_t derivative at previous trial value, \f$ g_t \f$ in Moore-Thuente (1994)
-        * \return new trial value
-        */
-      double
-      trialValueSelectionMT (double a_l, double f_l, double g_l,
-                             double a_u, double f_u, double g_u,
-                             double a_t, double f_t, double g_t);
-
-      /** \brief Auxilary function used to determin endpoints of More-Thuente interval.
-        * \note \f$ \psi(\alpha) \f$ in Equation 1.6 (Moore, Thuente 1994)
-        * \param[in] a the step length, \f$ \alpha \f$ in More-Thuente (1994)
-        * \param[in] f_a function value at step length a, \f$ \phi(\alpha) \f$ in More-Thuente (1994)
-        * \param[in] f_0 initial function value, \f$ \phi(0) \f$ in Moore-Thuente (1994)
-        * \param[in] g_0 initial function gradiant, \f$ \phi'(0) \f$ in More-Thuente (1994)
-        * \param[in] mu the step length, constant \f$ \mu \f$ in Equation 1.1 [More, Thuente 1994]
-        * \return sufficent decrease value
-        */
-      inline double
-      auxilaryFunction_PsiMT (double a, double f_a, double f_0, double g_0, double mu = 1.e-4)
-      {
-        return (f_a - f_0 - mu * g_0 * a);
-      }
-
-      /** \brief Auxilary function derivative used to determin endpoints of More-Thuente interval.
-        * \note \f$ \psi'(\alpha) \f$, derivative of Equation 1.6 (Moore, Thuente 1994)
-        * \param[in] g_a function gradient at step length a, \f$ \phi'(\alpha) \f$ in More-Thuente (1994)
-        * \param[in] g_0 initial function gradiant, \f$ \phi'(0) \f$ in More-Thuente (1994)
-        * \param[in] mu the step length, constant \f$ \mu \f$ in Equation 1.1 [More, Thuente 1994]
-        * \return sufficent decrease derivative
+      /** \brief The voxel grids generated from target cloud containing point means and covariances, possibly shared
+        * with other solvers and only modified through \ref getMutableTarget.
         */
-      inline double
-      auxilaryFunction_dPsiMT (double g_a, double g_0, double mu = 1.e-4)
-      {
-        return (g_a - mu * g_0);
-      }
-
-      /** \brief The voxel grid generated from target cloud containing point means and covariances. */
-      TargetGrid target_cells_;
+      TargetConstPtr target_cells_;
 
       //double fitness_epsilon_;
 
       /** \brief The side length of voxels. */
       float resolution_;
 
+      /** \brief The side lengths of the voxels of the coarser pyramid levels, from coarse to fine. */
+      std::vector<float> coarse_resolutions_;
+
+      /** \brief The pyramid level searched by \ref searchTargetCells, index in \ref coarse_resolutions_ or -1 for the finest one. */
+      int level_;
+
+      /** \brief The method used to find the target voxels surrounding each source point. */
+      NeighborSearchMethod search_method_;
+
+      /** \brief Minimum side lengths of the box bounding the target voxel grids, zero if they are not bounded. */
+      Eigen::Vector3f target_window_size_;
+
+      /** \brief Center of the box bounding the target voxel grids. */
+      Eigen::Vector3f target_window_center_;
+
       /** \brief The maximum step length. */
       double step_size_;
 
@@ -470,6 +1021,33 @@ namespace pcl
       /** \brief The second order derivative of the transformation of a point w.r.t. the transform vector, \f$ H_E \f$ in Equation 6.20 [Magnusson 2009]. */
       Eigen::Matrix<double, 18, 6> point_hessian_;
 
+      /** \brief Number of iterations run from every guess of \ref alignBatch before pruning. */
+      int batch_prune_iterations_;
+
+      /** \brief Hypotheses of \ref alignBatch below this ratio of the best transformation probability are pruned. */
+      double batch_prune_ratio_;
+
+      /** \brief Whether the hessian is replaced by its gauss-newton approximation. */
+      bool use_gauss_newton_;
+
+      /** \brief The number of threads used to evaluate the derivatives, 0 for the OpenMP default. */
+      int num_threads_;
+
+      /** \brief Per thread derivative accumulators, kept between calls to avoid reallocating them every iteration. */
+      std::vector<NDTDerivativeBatch> derivative_batches_;
+
+      /** \brief Number of source points evaluated by the first iterations of every level, 0 for every point. */
+      int min_samples_;
+
+      /** \brief Indices of the source points, every prefix is a subset spread over azimuth and range. */
+      std::vector<int> sample_order_;
+
+      /** \brief Number of source points currently evaluated (first ones of \ref sample_order_), 0 for every point. */
+      int nr_samples_;
+
+      /** \brief Whether the target points changed since the kdtree over them was last built. */
+      bool target_tree_outdated_;
+
     public:
       EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
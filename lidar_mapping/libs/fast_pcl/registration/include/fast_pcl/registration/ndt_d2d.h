@@ -0,0 +1,146 @@
+#ifndef FAST_PCL_REGISTRATION_NDT_D2D_H_
+#define FAST_PCL_REGISTRATION_NDT_D2D_H_
+
+#include "fast_pcl/registration/ndt.h"
+
+#include <vector>
+
+namespace pcl
+{
+  /** \brief A 3D distribution to distribution Normal Distributions Transform (D2D-NDT).
+    * \note The source cloud is summarized by the normal distributions of its own voxel grid (one per level of the
+    * resolution pyramid, built with VoxelGridCovariance like the target) and every source distribution is scored
+    * against the target distributions around its transformed mean. The score of a pair is Equation 6.9 of
+    * [Magnusson 2009] with the mean difference and the sum of both covariances, the source one rotated by the
+    * transformation (Equation 3 of Stoyanov et al. 2012). A dense scan only gives a few thousand distributions, so
+    * an iteration is much cheaper than with the points.
+    * \note The newton step uses the gauss-newton approximation of the hessian, the score and gradient are exact (the
+    * rotation of the source covariance included). The line search, the resolution pyramid and the shared target are
+    * the ones of NormalDistributionsTransform, \ref alignBatch and \ref computeFitness still use the source points.
+    * The distributions are always all evaluated, \ref setMinSamples is reset to 0 by the alignment.
+    * <b>Stoyanov, T., Magnusson, M., Andreasson, H. and Lilienthal, A. J. (2012). Fast and accurate scan
+    * registration through minimization of the distance between compact 3D NDT representations.
+    * The International Journal of Robotics Research 31(12).</b>
+    */
+  template<typename PointSource, typename PointTarget>
+  class NormalDistributionsTransformD2D : public NormalDistributionsTransform<PointSource, PointTarget>
+  {
+    protected:
+
+      typedef typename NormalDistributionsTransform<PointSource, PointTarget>::PointCloudSource PointCloudSource;
+      typedef typename NormalDistributionsTransform<PointSource, PointTarget>::PointCloudSourceConstPtr PointCloudSourceConstPtr;
+      typedef typename NormalDistributionsTransform<PointSource, PointTarget>::TargetGridLeafConstPtr TargetGridLeafConstPtr;
+
+      /** \brief Typename of the voxel grid summarizing the source cloud. */
+      typedef VoxelGridCovariance<PointSource> SourceGrid;
+
+      /** \brief Normal distribution of a source voxel. */
+      struct SourceDistribution
+      {
+        Eigen::Vector3d mean;
+        Eigen::Matrix3d cov;
+      };
+
+    public:
+
+      typedef boost::shared_ptr< NormalDistributionsTransformD2D<PointSource, PointTarget> > Ptr;
+      typedef boost::shared_ptr< const NormalDistributionsTransformD2D<PointSource, PointTarget> > ConstPtr;
+
+      /** \brief Constructor, the parameters are the ones of NormalDistributionsTransform and the gauss-newton hessian is used. */
+      NormalDistributionsTransformD2D ();
+
+      /** \brief Empty destructor */
+      virtual ~NormalDistributionsTransformD2D () {}
+
+      /** \brief Provide a pointer to the input source (e.g., the point cloud that we want to align to the target).
+        * \note Its distributions are built at the first alignment of each resolution.
+        * \param[in] cloud the input point cloud source
+        */
+      virtual void
+      setInputSource (const PointCloudSourceConstPtr &cloud)
+      {
+        Registration<PointSource, PointTarget>::setInputSource (cloud);
+        source_resolutions_.clear ();
+        source_distributions_.clear ();
+      }
+
+      /** \brief Get the number of source distributions of the finest resolution, 0 before the first alignment. */
+      inline int
+      getNumberOfSourceDistributions () const
+      {
+        for (size_t i = 0; i < source_resolutions_.size (); i++)
+          if (source_resolutions_[i] == resolution_)
+            return (static_cast<int> (source_distributions_[i].size ()));
+        return (0);
+      }
+
+    protected:
+
+      using NormalDistributionsTransform<PointSource, PointTarget>::reg_name_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::input_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::final_transformation_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::target_cells_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::resolution_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::coarse_resolutions_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::level_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::trans_probability_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::min_samples_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::getClassName;
+      using NormalDistributionsTransform<PointSource, PointTarget>::use_gauss_newton_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::derivative_batches_;
+      using NormalDistributionsTransform<PointSource, PointTarget>::computePyramidTransformation;
+      using NormalDistributionsTransform<PointSource, PointTarget>::searchTargetCells;
+
+      /** \brief Estimate the transformation and returns the transformed source (input) as output.
+        * \note The derivatives are always evaluated by all threads, as with \ref omp_computeTransformation.
+        * \param[out] output the resultant input transfomed point cloud dataset
+        * \param[in] guess the initial gross estimation of the transformation
+        */
+      virtual void
+      computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess)
+      {
+        omp_computeTransformation (output, guess);
+      }
+
+      /** \brief Estimate the transformation and returns the transformed source (input) as output.
+        * \param[out] output the resultant input transfomed point cloud dataset
+        * \param[in] guess the initial gross estimation of the transformation
+        */
+      virtual void
+      omp_computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess);
+
+      /** \brief Push every (source distribution, target voxel) pair into the batches previously reset, one batch per thread.
+        * \note The pair is pushed as a (point, voxel) pair whose derivatives are the ones of the D2D score: the mean
+        * difference with the inverse of the summed covariances, and a point moved from the source mean so that its
+        * derivatives include the rotation of the source covariance.
+        * \param[in] trans_cloud transformed point cloud, not used (the current transformation is \ref final_transformation_)
+        * \param[in] num_threads the number of threads, as returned by \ref resizeDerivativeBatches
+        */
+      virtual void
+      evaluateDerivativeBatches (PointCloudSource &trans_cloud, int num_threads);
+
+      /** \brief Nothing to do, the trial steps of the line search only transform the source distributions.
+        * \param[out] trans_cloud transformed point cloud, left as is
+        */
+      virtual void
+      transformSource (PointCloudSource &)
+      {
+      }
+
+      /** \brief Get the source distributions of the current level, building them at the first call.
+        * \return the distributions of the source voxels with a usable covariance
+        */
+      const std::vector<SourceDistribution>&
+      getSourceDistributions ();
+
+      /** \brief The side lengths of voxels of the source distributions built so far. */
+      std::vector<float> source_resolutions_;
+
+      /** \brief The source distributions built so far, matching \ref source_resolutions_. */
+      std::vector<std::vector<SourceDistribution> > source_distributions_;
+  };
+}
+
+#include "fast_pcl/registration/impl/ndt_d2d.hpp"
+
+#endif // FAST_PCL_REGISTRATION_NDT_D2D_H_
@@ -0,0 +1,162 @@
+#ifndef FAST_PCL_REGISTRATION_NDT_DERIVATIVE_BATCH_H_
+#define FAST_PCL_REGISTRATION_NDT_DERIVATIVE_BATCH_H_
+
+#include <Eigen/Core>
+
+namespace pcl
+{
+  /** \brief Accumulates the NDT score, gradient and hessian (Equations 6.10, 6.12 and 6.13 [Magnusson 2009])
+    * of (source point, target voxel) pairs evaluated in batches.
+    * \note Pairs are buffered in structure of arrays form and evaluated by \ref flush with loops over the pairs
+    * which are vectorized (4 doubles per instruction with AVX2, 8 with AVX-512, scalar code otherwise). The kernel
+    * is compiled in its own translation unit so that it can use the instruction set of the build host without
+    * affecting the Eigen alignment of the code including this header. The point derivatives (Equations 6.18 and 6.20)
+    * are recomputed inside the kernel from the angular terms, one batch per thread shares no state with the others.
+    * Its size is a multiple of the 64 byte cache lines, so that the batches stored in an array do not share one.
+    */
+  class alignas (64) NDTDerivativeBatch
+  {
+    public:
+
+      /** \brief Number of pairs buffered before they are evaluated. */
+      static const int CAPACITY = 256;
+
+      /** \brief Constructor. */
+      NDTDerivativeBatch ();
+
+      /** \brief Clear the buffer and the accumulators and set the parameters of the following evaluations.
+        * \param[in] gauss_d1 gaussian fitting parameter d1 (Equation 6.8) [Magnusson 2009]
+        * \param[in] gauss_d2 gaussian fitting parameter d2 (Equation 6.8) [Magnusson 2009]
+        * \param[in] j_ang the 8 angular gradient vectors a to h of Equation 6.19, 3 doubles each [Magnusson 2009]
+        * \param[in] h_ang the 15 angular hessian vectors a2, a3, b2, b3, c2, c3, d1, d2, d3, e1, e2, e3, f1, f2, f3
+        * of Equation 6.21, 3 doubles each [Magnusson 2009], not used (and may be NULL) with gauss_newton
+        * \param[in] compute_hessian true if the hessian is accumulated
+        * \param[in] gauss_newton accumulate the gauss-newton approximation of the hessian (only the first order point
+        * derivatives weighted by the exponential terms) instead of Equation 6.13
+        */
+      void
+      reset (double gauss_d1, double gauss_d2, const double *j_ang, const double *h_ang, bool compute_hessian,
+             bool gauss_newton = false);
+
+      /** \brief Clear the buffer and the accumulators, the following evaluations only accumulate the score and its
+        * derivative along a step direction (the gradient is not accumulated).
+        * \param[in] gauss_d1 gaussian fitting parameter d1 (Equation 6.8) [Magnusson 2009]
+        * \param[in] gauss_d2 gaussian fitting parameter d2 (Equation 6.8) [Magnusson 2009]
+        * \param[in] j_ang the 8 angular gradient vectors a to h of Equation 6.19, 3 doubles each [Magnusson 2009]
+        * \param[in] step_dir the 6 doubles of the step direction
+        */
+      void
+      resetDirectional (double gauss_d1, double gauss_d2, const double *j_ang, const double *step_dir);
+
+      /** \brief Add a pair to the batch, the batch is evaluated when it is full.
+        * \param[in] x the source point
+        * \param[in] x_trans the transformed source point minus the voxel mean, x_k' in Equations 6.12 and 6.13 [Magnusson 2009]
+        * \param[in] c_inv the inverse covariance of the voxel
+        */
+      inline void
+      push (const Eigen::Vector3d &x, const Eigen::Vector3d &x_trans, const Eigen::Matrix3d &c_inv)
+      {
+        x_[0][size_] = x[0];
+        x_[1][size_] = x[1];
+        x_[2][size_] = x[2];
+        d_[0][size_] = x_trans[0];
+        d_[1][size_] = x_trans[1];
+        d_[2][size_] = x_trans[2];
+        c_[0][size_] = c_inv (0, 0);
+        c_[1][size_] = c_inv (0, 1);
+        c_[2][size_] = c_inv (0, 2);
+        c_[3][size_] = c_inv (1, 1);
+        c_[4][size_] = c_inv (1, 2);
+        c_[5][size_] = c_inv (2, 2);
+
+        if (++size_ == CAPACITY)
+          flush ();
+      }
+
+      /** \brief Evaluate the buffered pairs and add them to the accumulators. */
+      void
+      flush ();
+
+      /** \brief Add the accumulated score, gradient and hessian, \ref flush must be called first.
+        * \param[in,out] score the score
+        * \param[in,out] score_gradient the gradient
+        * \param[in,out] hessian the hessian, only updated if the batch computes it
+        */
+      inline void
+      addTo (double &score, Eigen::Matrix<double, 6, 1> &score_gradient, Eigen::Matrix<double, 6, 6> &hessian) const
+      {
+        score += score_;
+        for (int i = 0; i < 6; i++)
+          score_gradient (i) += gradient_[i];
+
+        if (!compute_hessian_)
+          return;
+
+        for (int i = 0, k = 0; i < 6; i++)
+          for (int j = i; j < 6; j++, k++)
+          {
+            hessian (i, j) += hessian_[k];
+            if (j != i)
+              hessian (j, i) += hessian_[k];
+          }
+      }
+
+      /** \brief Add the accumulated score and directional derivative, \ref flush must be called first.
+        * \param[in,out] score the score
+        * \param[in,out] derivative the derivative of the score along the step direction given to \ref resetDirectional
+        */
+      inline void
+      addDirectionalTo (double &score, double &derivative) const
+      {
+        score += score_;
+        derivative += derivative_;
+      }
+
+      /** \brief Get the instruction set the kernel was compiled for ("AVX-512", "AVX2", "AVX" or "scalar"). */
+      static const char*
+      getInstructionSet ();
+
+    private:
+
+      /** \brief Source points, structure of arrays. */
+      double x_[3][CAPACITY];
+
+      /** \brief Transformed source points minus the voxel means. */
+      double d_[3][CAPACITY];
+
+      /** \brief Upper triangles of the inverse covariances (00, 01, 02, 11, 12, 22). */
+      double c_[6][CAPACITY];
+
+      /** \brief Scratch buffer of the exponential terms. */
+      double e_[CAPACITY];
+
+      /** \brief Number of buffered pairs. */
+      int size_;
+
+      double gauss_d1_, gauss_d2_;
+
+      double j_ang_[24];
+
+      double h_ang_[45];
+
+      bool compute_hessian_;
+
+      bool gauss_newton_;
+
+      /** \brief True if only the score and its derivative along \ref step_dir_ are accumulated. */
+      bool directional_;
+
+      double step_dir_[6];
+
+      double score_;
+
+      double derivative_;
+
+      double gradient_[6];
+
+      /** \brief Upper triangle of the hessian, row major. */
+      double hessian_[21];
+  };
+}
+
+#endif  // FAST_PCL_REGISTRATION_NDT_DERIVATIVE_BATCH_H_
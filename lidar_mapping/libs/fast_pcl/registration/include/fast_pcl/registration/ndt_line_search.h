@@ -0,0 +1,196 @@
+#ifndef FAST_PCL_REGISTRATION_NDT_LINE_SEARCH_H_
+#define FAST_PCL_REGISTRATION_NDT_LINE_SEARCH_H_
+
+#include <algorithm>
+#include <cmath>
+
+namespace pcl
+{
+  /** \brief Steps of the More-Thuente line search shared by the NDT solvers of fast_pcl (pcl::NormalDistributionsTransform
+    * and cpu::NormalDistributionsTransform), which search the step length along the newton direction with them.
+    */
+  namespace ndt_line_search
+  {
+    /** \brief Update interval of possible step lengths for More-Thuente method, \f$ I \f$ in More-Thuente (1994)
+      * \note Updating Algorithm until some value satifies \f$ \psi(\alpha_k) \leq 0 \f$ and \f$ \phi'(\alpha_k) \geq 0 \f$
+      * and Modified Updating Algorithm from then on [More, Thuente 1994].
+      * \param[in,out] a_l first endpoint of interval \f$ I \f$, \f$ \alpha_l \f$ in Moore-Thuente (1994)
+      * \param[in,out] f_l value at first endpoint, \f$ f_l \f$ in Moore-Thuente (1994), \f$ \psi(\alpha_l) \f$ for Update Algorithm and \f$ \phi(\alpha_l) \f$ for Modified Update Algorithm
+      * \param[in,out] g_l derivative at first endpoint, \f$ g_l \f$ in Moore-Thuente (1994), \f$ \psi'(\alpha_l) \f$ for Update Algorithm and \f$ \phi'(\alpha_l) \f$ for Modified Update Algorithm
+      * \param[in,out] a_u second endpoint of interval \f$ I \f$, \f$ \alpha_u \f$ in Moore-Thuente (1994)
+      * \param[in,out] f_u value at second endpoint, \f$ f_u \f$ in Moore-Thuente (1994), \f$ \psi(\alpha_u) \f$ for Update Algorithm and \f$ \phi(\alpha_u) \f$ for Modified Update Algorithm
+      * \param[in,out] g_u derivative at second endpoint, \f$ g_u \f$ in Moore-Thuente (1994), \f$ \psi'(\alpha_u) \f$ for Update Algorithm and \f$ \phi'(\alpha_u) \f$ for Modified Update Algorithm
+      * \param[in] a_t trial value, \f$ \alpha_t \f$ in Moore-Thuente (1994)
+      * \param[in] f_t value at trial value, \f$ f_t \f$ in Moore-Thuente (1994), \f$ \psi(\alpha_t) \f$ for Update Algorithm and \f$ \phi(\alpha_t) \f$ for Modified Update Algorithm
+      * \param[in] g_t derivative at trial value, \f$ g_t \f$ in Moore-Thuente (1994), \f$ \psi'(\alpha_t) \f$ for Update Algorithm and \f$ \phi'(\alpha_t) \f$ for Modified Update Algorithm
+      * \return if interval converges
+      */
+    inline bool
+    updateIntervalMT (double &a_l, double &f_l, double &g_l,
+                      double &a_u, double &f_u, double &g_u,
+                      double a_t, double f_t, double g_t)
+    {
+      // Case U1 in Update Algorithm and Case a in Modified Update Algorithm [More, Thuente 1994]
+      if (f_t > f_l)
+      {
+        a_u = a_t;
+        f_u = f_t;
+        g_u = g_t;
+        return (false);
+      }
+      // Case U2 in Update Algorithm and Case b in Modified Update Algorithm [More, Thuente 1994]
+      else
+      if (g_t * (a_l - a_t) > 0)
+      {
+        a_l = a_t;
+        f_l = f_t;
+        g_l = g_t;
+        return (false);
+      }
+      // Case U3 in Update Algorithm and Case c in Modified Update Algorithm [More, Thuente 1994]
+      else
+      if (g_t * (a_l - a_t) < 0)
+      {
+        a_u = a_l;
+        f_u = f_l;
+        g_u = g_l;
+
+        a_l = a_t;
+        f_l = f_t;
+        g_l = g_t;
+        return (false);
+      }
+      // Interval Converged
+      else
+        return (true);
+    }
+
+    /** \brief Select new trial value for More-Thuente method.
+      * \note Trial Value Selection [More, Thuente 1994], \f$ \psi(\alpha_k) \f$ is used for \f$ f_k \f$ and \f$ g_k \f$
+      * until some value satifies the test \f$ \psi(\alpha_k) \leq 0 \f$ and \f$ \phi'(\alpha_k) \geq 0 \f$
+      * then \f$ \phi(\alpha_k) \f$ is used from then on.
+      * \note Interpolation Minimizer equations from Optimization Theory and Methods: Nonlinear Programming By Wenyu Sun, Ya-xiang Yuan (89-100).
+      * \param[in] a_l first endpoint of interval \f$ I \f$, \f$ \alpha_l \f$ in Moore-Thuente (1994)
+      * \param[in] f_l value at first endpoint, \f$ f_l \f$ in Moore-Thuente (1994)
+      * \param[in] g_l derivative at first endpoint, \f$ g_l \f$ in Moore-Thuente (1994)
+      * \param[in] a_u second endpoint of interval \f$ I \f$, \f$ \alpha_u \f$ in Moore-Thuente (1994)
+      * \param[in] f_u value at second endpoint, \f$ f_u \f$ in Moore-Thuente (1994)
+      * \param[in] g_u derivative at second endpoint, \f$ g_u \f$ in Moore-Thuente (1994)
+      * \param[in] a_t previous trial value, \f$ \alpha_t \f$ in Moore-Thuente (1994)
+      * \param[in] f_t value at previous trial value, \f$ f_t \f$ in Moore-Thuente (1994)
+      * \param[in] g_t derivative at previous trial value, \f$ g_t \f$ in Moore-Thuente (1994)
+      * \return new trial value
+      */
+    inline double
+    trialValueSelectionMT (double a_l, double f_l, double g_l,
+                           double a_u, double f_u, double g_u,
+                           double a_t, double f_t, double g_t)
+    {
+      // Case 1 in Trial Value Selection [More, Thuente 1994]
+      if (f_t > f_l)
+      {
+        // Calculate the minimizer of the cubic that interpolates f_l, f_t, g_l and g_t
+        // Equation 2.4.52 [Sun, Yuan 2006]
+        double z = 3 * (f_t - f_l) / (a_t - a_l) - g_t - g_l;
+        double w = std::sqrt (z * z - g_t * g_l);
+        // Equation 2.4.56 [Sun, Yuan 2006]
+        double a_c = a_l + (a_t - a_l) * (w - g_l - z) / (g_t - g_l + 2 * w);
+
+        // Calculate the minimizer of the quadratic that interpolates f_l, f_t and g_l
+        // Equation 2.4.2 [Sun, Yuan 2006]
+        double a_q = a_l - 0.5 * (a_l - a_t) * g_l / (g_l - (f_l - f_t) / (a_l - a_t));
+
+        if (std::fabs (a_c - a_l) < std::fabs (a_q - a_l))
+          return (a_c);
+        else
+          return (0.5 * (a_q + a_c));
+      }
+      // Case 2 in Trial Value Selection [More, Thuente 1994]
+      else
+      if (g_t * g_l < 0)
+      {
+        // Calculate the minimizer of the cubic that interpolates f_l, f_t, g_l and g_t
+        // Equation 2.4.52 [Sun, Yuan 2006]
+        double z = 3 * (f_t - f_l) / (a_t - a_l) - g_t - g_l;
+        double w = std::sqrt (z * z - g_t * g_l);
+        // Equation 2.4.56 [Sun, Yuan 2006]
+        double a_c = a_l + (a_t - a_l) * (w - g_l - z) / (g_t - g_l + 2 * w);
+
+        // Calculate the minimizer of the quadratic that interpolates f_l, g_l and g_t
+        // Equation 2.4.5 [Sun, Yuan 2006]
+        double a_s = a_l - (a_l - a_t) / (g_l - g_t) * g_l;
+
+        if (std::fabs (a_c - a_t) >= std::fabs (a_s - a_t))
+          return (a_c);
+        else
+          return (a_s);
+      }
+      // Case 3 in Trial Value Selection [More, Thuente 1994]
+      else
+      if (std::fabs (g_t) <= std::fabs (g_l))
+      {
+        // Calculate the minimizer of the cubic that interpolates f_l, f_t, g_l and g_t
+        // Equation 2.4.52 [Sun, Yuan 2006]
+        double z = 3 * (f_t - f_l) / (a_t - a_l) - g_t - g_l;
+        double w = std::sqrt (z * z - g_t * g_l);
+        double a_c = a_l + (a_t - a_l) * (w - g_l - z) / (g_t - g_l + 2 * w);
+
+        // Calculate the minimizer of the quadratic that interpolates g_l and g_t
+        // Equation 2.4.5 [Sun, Yuan 2006]
+        double a_s = a_l - (a_l - a_t) / (g_l - g_t) * g_l;
+
+        double a_t_next;
+
+        if (std::fabs (a_c - a_t) < std::fabs (a_s - a_t))
+          a_t_next = a_c;
+        else
+          a_t_next = a_s;
+
+        if (a_t > a_l)
+          return (std::min (a_t + 0.66 * (a_u - a_t), a_t_next));
+        else
+          return (std::max (a_t + 0.66 * (a_u - a_t), a_t_next));
+      }
+      // Case 4 in Trial Value Selection [More, Thuente 1994]
+      else
+      {
+        // Calculate the minimizer of the cubic that interpolates f_u, f_t, g_u and g_t
+        // Equation 2.4.52 [Sun, Yuan 2006]
+        double z = 3 * (f_t - f_u) / (a_t - a_u) - g_t - g_u;
+        double w = std::sqrt (z * z - g_t * g_u);
+        // Equation 2.4.56 [Sun, Yuan 2006]
+        return (a_u + (a_t - a_u) * (w - g_u - z) / (g_t - g_u + 2 * w));
+      }
+    }
+
+    /** \brief Auxilary function used to determin endpoints of More-Thuente interval.
+      * \note \f$ \psi(\alpha) \f$ in Equation 1.6 (Moore, Thuente 1994)
+      * \param[in] a the step length, \f$ \alpha \f$ in More-Thuente (1994)
+      * \param[in] f_a function value at step length a, \f$ \phi(\alpha) \f$ in More-Thuente (1994)
+      * \param[in] f_0 initial function value, \f$ \phi(0) \f$ in Moore-Thuente (1994)
+      * \param[in] g_0 initial function gradiant, \f$ \phi'(0) \f$ in More-Thuente (1994)
+      * \param[in] mu the step length, constant \f$ \mu \f$ in Equation 1.1 [More, Thuente 1994]
+      * \return sufficent decrease value
+      */
+    inline double
+    auxilaryFunction_PsiMT (double a, double f_a, double f_0, double g_0, double mu = 1.e-4)
+    {
+      return (f_a - f_0 - mu * g_0 * a);
+    }
+
+    /** \brief Auxilary function derivative used to determin endpoints of More-Thuente interval.
+      * \note \f$ \psi'(\alpha) \f$, derivative of Equation 1.6 (Moore, Thuente 1994)
+      * \param[in] g_a function gradient at step length a, \f$ \phi'(\alpha) \f$ in More-Thuente (1994)
+      * \param[in] g_0 initial function gradiant, \f$ \phi'(0) \f$ in More-Thuente (1994)
+      * \param[in] mu the step length, constant \f$ \mu \f$ in Equation 1.1 [More, Thuente 1994]
+      * \return sufficent decrease derivative
+      */
+    inline double
+    auxilaryFunction_dPsiMT (double g_a, double g_0, double mu = 1.e-4)
+    {
+      return (g_a - mu * g_0);
+    }
+  }
+}
+
+#endif // FAST_PCL_REGISTRATION_NDT_LINE_SEARCH_H_
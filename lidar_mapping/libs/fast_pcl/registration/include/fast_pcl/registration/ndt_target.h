@@ -0,0 +1,283 @@
+#ifndef FAST_PCL_REGISTRATION_NDT_TARGET_H_
+#define FAST_PCL_REGISTRATION_NDT_TARGET_H_
+
+//#include <pcl/filters/voxel_grid_covariance.h>
+#include "fast_pcl/filters/voxel_grid_covariance.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace pcl
+{
+  /** \brief The target of a NormalDistributionsTransform: the voxel grids (means, covariances and, for radius
+    * search, the kdtree over the voxel centroids) built from a target cloud, one per level of a resolution pyramid.
+    * \note Once built the target is only read by the solvers, so one instance can be attached to any number of
+    * NormalDistributionsTransform (see \ref NormalDistributionsTransform::setTarget) aligning concurrently in
+    * different threads. A solver modifying its target (addPointsToTarget, removeTargetCellsOutside) first copies it
+    * if it is shared. The kdtrees left outdated by the modifications are a cache of the voxels, they are rebuilt in
+    * place by the first solver aligning (see \ref updateSearch) without copying the shared voxels.
+    */
+  template<typename PointTarget>
+  class NDTTarget
+  {
+    public:
+
+      typedef pcl::PointCloud<PointTarget> PointCloudTarget;
+      typedef typename PointCloudTarget::ConstPtr PointCloudTargetConstPtr;
+
+      /** \brief Typename of searchable voxel grid containing mean and covariance. */
+      typedef VoxelGridCovariance<PointTarget> TargetGrid;
+      /** \brief Typename of const pointer to searchable voxel grid leaf. */
+      typedef typename TargetGrid::LeafConstPtr TargetGridLeafConstPtr;
+
+      typedef boost::shared_ptr< NDTTarget<PointTarget> > Ptr;
+      typedef boost::shared_ptr< const NDTTarget<PointTarget> > ConstPtr;
+
+      /** \brief Build the voxel grids of a target cloud.
+        * \param[in] cloud the target cloud
+        * \param[in] resolutions side lengths of voxels, one voxel grid is built per resolution (e.g. {4.0, 2.0, 1.0}),
+        * in any order
+        * \param[in] search_method the neighbor search method the grids are built for, the kdtree over the voxel
+        * centroids is only built for KDTREE
+        * \param[in] window_size minimum side lengths of the box bounding the grids (see VoxelGridCovariance::setWindow),
+        * zero for unbounded grids
+        * \param[in] window_center center of the box bounding the grids
+        */
+      NDTTarget (const PointCloudTargetConstPtr &cloud, const std::vector<float> &resolutions,
+                 NeighborSearchMethod search_method = KDTREE,
+                 const Eigen::Vector3f &window_size = Eigen::Vector3f::Zero (),
+                 const Eigen::Vector3f &window_center = Eigen::Vector3f::Zero ())
+        : cloud_ (cloud)
+        , resolutions_ (resolutions)
+        , search_method_ (search_method)
+        , window_size_ (window_size)
+        , grids_ ()
+        , search_mutex_ ()
+      {
+        std::sort (resolutions_.begin (), resolutions_.end (), std::greater<float> ());
+        resolutions_.erase (std::unique (resolutions_.begin (), resolutions_.end ()), resolutions_.end ());
+
+        grids_.resize (resolutions_.size ());
+        for (size_t i = 0; i < resolutions_.size (); i++)
+        {
+          grids_[i].reset (new TargetGrid);
+          grids_[i]->setLeafSize (resolutions_[i], resolutions_[i], resolutions_[i]);
+        }
+        setInputCloud (cloud, window_center);
+      }
+
+      /** \brief Copy constructor, the voxel grids are copied (not shared) so the copy can be modified. */
+      NDTTarget (const NDTTarget &other)
+        : cloud_ (other.cloud_)
+        , resolutions_ (other.resolutions_)
+        , search_method_ (other.search_method_)
+        , window_size_ (other.window_size_)
+        , grids_ (other.grids_.size ())
+        , search_mutex_ ()
+      {
+        for (size_t i = 0; i < grids_.size (); i++)
+          grids_[i].reset (new TargetGrid (*other.grids_[i]));
+      }
+
+      /** \brief Rebuild the voxel grids from another cloud, with the same resolutions and search method.
+        * \note The leaves, the leaf indices and the windows of the grids are reused, so rebuilding a target of similar size
+        * does not allocate memory (the kdtree over the voxel centroids is still rebuilt).
+        * \param[in] cloud the target cloud
+        * \param[in] window_center center of the box bounding the grids, not used by unbounded grids
+        */
+      inline void
+      setInputCloud (const PointCloudTargetConstPtr &cloud, const Eigen::Vector3f &window_center = Eigen::Vector3f::Zero ())
+      {
+        cloud_ = cloud;
+        for (size_t i = 0; i < grids_.size (); i++)
+        {
+          grids_[i]->setWindow (window_size_, window_center);
+          grids_[i]->setInputCloud (cloud_);
+          grids_[i]->filter (search_method_ == KDTREE);
+        }
+      }
+
+      /** \brief Get the cloud the voxel grids were built from (points added with \ref addPoints are not in it). */
+      inline PointCloudTargetConstPtr
+      getInputCloud () const
+      {
+        return (cloud_);
+      }
+
+      /** \brief Get the side lengths of voxels of the levels, from coarse to fine. */
+      inline const std::vector<float>&
+      getResolutionPyramid () const
+      {
+        return (resolutions_);
+      }
+
+      /** \brief Get the side length of voxels of the finest level. */
+      inline float
+      getResolution () const
+      {
+        return (resolutions_.back ());
+      }
+
+      /** \brief Get the minimum side lengths of the box bounding the voxel grids, zero if they are not bounded. */
+      inline const Eigen::Vector3f&
+      getWindowSize () const
+      {
+        return (window_size_);
+      }
+
+      /** \brief Get the neighbor search method the voxel grids were built for. */
+      inline NeighborSearchMethod
+      getNeighborhoodSearchMethod () const
+      {
+        return (search_method_);
+      }
+
+      /** \brief Get the number of levels (voxel grids), the finest one is the last. */
+      inline int
+      getNumberOfLevels () const
+      {
+        return (static_cast<int> (grids_.size ()));
+      }
+
+      /** \brief Get the voxel grid of a level.
+        * \param[in] level index of the level, 0 is the coarsest
+        */
+      inline const TargetGrid&
+      getGrid (int level) const
+      {
+        return (*grids_[level]);
+      }
+
+      /** \brief Find the occupied voxels of a level surrounding a point, safe to call from several threads.
+        * \note With the kdtree search, changes since the last \ref updateSearch are not seen.
+        * \param[in] point the query point
+        * \param[in] level index of the level, 0 is the coarsest
+        * \param[out] neighborhood the resultant leaves
+        * \return number of leaves found
+        */
+      inline int
+      searchCells (const PointTarget &point, int level, std::vector<TargetGridLeafConstPtr> &neighborhood) const
+      {
+        const TargetGrid &cells = *grids_[level];
+        if (search_method_ == KDTREE)
+        {
+          std::vector<float> distances;
+          return (cells.radiusSearch (point, resolutions_[level], neighborhood, distances));
+        }
+        return (cells.getNeighborhoodAtPoint (point, search_method_, neighborhood));
+      }
+
+      /** \brief Add points to every level, only the voxels containing them are recomputed.
+        * \param[in] cloud the points to add
+        */
+      inline void
+      addPoints (const PointCloudTarget &cloud)
+      {
+        for (size_t i = 0; i < grids_.size (); i++)
+          grids_[i]->addPoints (cloud, search_method_ == KDTREE);
+      }
+
+      /** \brief Remove the voxels of every level lying completely outside of an axis aligned box.
+        * \param[in] min_p minimum corner of the box
+        * \param[in] max_p maximum corner of the box
+        * \return number of voxels removed from the finest level
+        */
+      inline int
+      removeLeavesOutside (const Eigen::Vector3f &min_p, const Eigen::Vector3f &max_p)
+      {
+        int removed = 0;
+        for (size_t i = 0; i < grids_.size (); i++)
+          removed = grids_[i]->removeLeavesOutside (min_p, max_p);
+        return (removed);
+      }
+
+      /** \brief Remove the voxels of every level not lying completely inside an axis aligned box, the ones straddling
+        * its border are rebuilt from the points of cloud inside the box, see VoxelGridCovariance::cropLeaves.
+        * \param[in] min_p minimum corner of the box
+        * \param[in] max_p maximum corner of the box
+        * \param[in] cloud the points still in the box, at least the ones near its border
+        * \return number of voxels removed from the finest level
+        */
+      inline int
+      cropLeaves (const Eigen::Vector3f &min_p, const Eigen::Vector3f &max_p, const PointCloudTarget &cloud)
+      {
+        int removed = 0;
+        for (size_t i = 0; i < grids_.size (); i++)
+          removed = grids_[i]->cropLeaves (min_p, max_p, cloud);
+        return (removed);
+      }
+
+      /** \brief Move the box bounding the voxel grids of every level, the voxels leaving it are removed.
+        * \note Does nothing if the grids are not bounded.
+        * \param[in] center the new center of the box
+        * \return number of voxels removed from the finest level
+        */
+      inline int
+      moveWindow (const Eigen::Vector3f &center)
+      {
+        int removed = 0;
+        for (size_t i = 0; i < grids_.size (); i++)
+          removed = grids_[i]->moveWindow (center, search_method_ == KDTREE);
+        return (removed);
+      }
+
+      /** \brief Whether \ref searchCells needs \ref updateSearch to see the last changes, only the kdtree search does. */
+      inline bool
+      isSearchOutdated () const
+      {
+        if (search_method_ != KDTREE)
+          return (false);
+        for (size_t i = 0; i < grids_.size (); i++)
+          if (grids_[i]->areCentroidsOutdated ())
+            return (true);
+        return (false);
+      }
+
+      /** \brief Rebuild the kdtrees of the levels changed by \ref addPoints, \ref removeLeavesOutside, \ref cropLeaves or
+        * \ref moveWindow.
+        * \note Deferred so that several changes between two alignments rebuild them once. Every solver sharing the target
+        * calls it before its searches: the first one rebuilds the kdtrees, the voxels of a shared target are not modified
+        * so they then stay current and the searches of the others never run during a rebuild.
+        */
+      inline void
+      updateSearch () const
+      {
+        if (search_method_ != KDTREE)
+          return;
+        // The voxels are not modified, only the kdtrees over their centroids, once for all the solvers sharing them
+        boost::mutex::scoped_lock lock (search_mutex_);
+        for (size_t i = 0; i < grids_.size (); i++)
+          grids_[i]->updateCentroids ();
+      }
+
+    private:
+
+      /** \brief Not assignable, a target is replaced by building or copying another one. */
+      NDTTarget&
+      operator= (const NDTTarget &);
+
+      /** \brief The cloud the voxel grids were built from. */
+      PointCloudTargetConstPtr cloud_;
+
+      /** \brief The side lengths of voxels of the levels, from coarse to fine. */
+      std::vector<float> resolutions_;
+
+      /** \brief The neighbor search method the voxel grids were built for. */
+      NeighborSearchMethod search_method_;
+
+      /** \brief Minimum side lengths of the box bounding the voxel grids, zero if they are not bounded. */
+      Eigen::Vector3f window_size_;
+
+      /** \brief The voxel grids, matching \ref resolutions_. */
+      std::vector<boost::shared_ptr<TargetGrid> > grids_;
+
+      /** \brief Serializes \ref updateSearch between the solvers sharing the target. */
+      mutable boost::mutex search_mutex_;
+  };
+}
+
+#endif  // FAST_PCL_REGISTRATION_NDT_TARGET_H_
@@ -0,0 +1,394 @@
+#include "fast_pcl/registration/ndt_derivative_batch.h"
+
+#include <cmath>
+#include <cstring>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+pcl::NDTDerivativeBatch::NDTDerivativeBatch () :
+  size_ (0),
+  gauss_d1_ (0),
+  gauss_d2_ (0),
+  compute_hessian_ (false),
+  gauss_newton_ (false),
+  directional_ (false),
+  score_ (0),
+  derivative_ (0)
+{
+  memset (step_dir_, 0, sizeof (step_dir_));
+  memset (j_ang_, 0, sizeof (j_ang_));
+  memset (h_ang_, 0, sizeof (h_ang_));
+  memset (gradient_, 0, sizeof (gradient_));
+  memset (hessian_, 0, sizeof (hessian_));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+pcl::NDTDerivativeBatch::reset (double gauss_d1, double gauss_d2, const double *j_ang, const double *h_ang, bool compute_hessian,
+                                bool gauss_newton)
+{
+  size_ = 0;
+  gauss_d1_ = gauss_d1;
+  gauss_d2_ = gauss_d2;
+  memcpy (j_ang_, j_ang, sizeof (j_ang_));
+  if (h_ang)
+    memcpy (h_ang_, h_ang, sizeof (h_ang_));
+  compute_hessian_ = compute_hessian;
+  gauss_newton_ = gauss_newton;
+  directional_ = false;
+
+  score_ = 0;
+  derivative_ = 0;
+  memset (gradient_, 0, sizeof (gradient_));
+  memset (hessian_, 0, sizeof (hessian_));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+pcl::NDTDerivativeBatch::resetDirectional (double gauss_d1, double gauss_d2, const double *j_ang, const double *step_dir)
+{
+  reset (gauss_d1, gauss_d2, j_ang, NULL, false);
+  memcpy (step_dir_, step_dir, sizeof (step_dir_));
+  directional_ = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const char*
+pcl::NDTDerivativeBatch::getInstructionSet ()
+{
+#if defined(__AVX512F__)
+  return ("AVX-512");
+#elif defined(__AVX2__)
+  return ("AVX2");
+#elif defined(__AVX__)
+  return ("AVX");
+#else
+  return ("scalar");
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+pcl::NDTDerivativeBatch::flush ()
+{
+  const int n = size_;
+  if (n == 0)
+    return;
+  size_ = 0;
+
+  const double *x0 = x_[0], *x1 = x_[1], *x2 = x_[2];
+  const double *d0 = d_[0], *d1 = d_[1], *d2 = d_[2];
+  const double *c00 = c_[0], *c01 = c_[1], *c02 = c_[2], *c11 = c_[3], *c12 = c_[4], *c22 = c_[5];
+  double *e = e_;
+
+  // (x_k - mu_k)^T Sigma_k^-1 (x_k - mu_k)
+#pragma omp simd
+  for (int k = 0; k < n; k++)
+  {
+    double g0 = c00[k] * d0[k] + c01[k] * d1[k] + c02[k] * d2[k];
+    double g1 = c01[k] * d0[k] + c11[k] * d1[k] + c12[k] * d2[k];
+    double g2 = c02[k] * d0[k] + c12[k] * d1[k] + c22[k] * d2[k];
+    e[k] = d0[k] * g0 + d1[k] * g1 + d2[k] * g2;
+  }
+
+  // e^(-d_2/2 * (x_k - mu_k)^T Sigma_k^-1 (x_k - mu_k)) Equation 6.9 [Magnusson 2009]
+  // Kept apart from the other loops, it is only vectorized when libm provides simd variants of exp
+  const double exp_scale = -gauss_d2_ / 2;
+  for (int k = 0; k < n; k++)
+    e[k] = std::exp (exp_scale * e[k]);
+
+  const double gauss_d1 = gauss_d1_, gauss_d2 = gauss_d2_;
+
+  // Angular gradient terms, Equation 6.19 [Magnusson 2009]
+  const double ja0 = j_ang_[0], ja1 = j_ang_[1], ja2 = j_ang_[2];
+  const double jb0 = j_ang_[3], jb1 = j_ang_[4], jb2 = j_ang_[5];
+  const double jc0 = j_ang_[6], jc1 = j_ang_[7], jc2 = j_ang_[8];
+  const double jd0 = j_ang_[9], jd1 = j_ang_[10], jd2 = j_ang_[11];
+  const double je0 = j_ang_[12], je1 = j_ang_[13], je2 = j_ang_[14];
+  const double jf0 = j_ang_[15], jf1 = j_ang_[16], jf2 = j_ang_[17];
+  const double jg0 = j_ang_[18], jg1 = j_ang_[19], jg2 = j_ang_[20];
+  const double jh0 = j_ang_[21], jh1 = j_ang_[22], jh2 = j_ang_[23];
+
+  double s = 0;
+  double g_0 = 0, g_1 = 0, g_2 = 0, g_3 = 0, g_4 = 0, g_5 = 0;
+
+  if (directional_)
+  {
+    const double s0 = step_dir_[0], s1 = step_dir_[1], s2 = step_dir_[2];
+    const double s3 = step_dir_[3], s4 = step_dir_[4], s5 = step_dir_[5];
+    double dd = 0;
+
+#pragma omp simd reduction(+:s,dd)
+    for (int k = 0; k < n; k++)
+    {
+      double g0 = c00[k] * d0[k] + c01[k] * d1[k] + c02[k] * d2[k];
+      double g1 = c01[k] * d0[k] + c11[k] * d1[k] + c12[k] * d2[k];
+      double g2 = c02[k] * d0[k] + c12[k] * d1[k] + c22[k] * d2[k];
+
+      double w = gauss_d2 * e[k];
+      bool valid = (w >= 0 && w <= 1);
+      s += valid ? -gauss_d1 * e[k] : 0.0;
+      w = valid ? gauss_d1 * w : 0.0;
+      // A zero weight alone does not drop the pair, 0 * nan is still nan
+      g0 = valid ? g0 : 0.0; g1 = valid ? g1 : 0.0; g2 = valid ? g2 : 0.0;
+
+      // d(T(x,p))/dp times the step direction, Equation 6.18 [Magnusson 2009]
+      double v0 = s0 + s4 * (x0[k] * jc0 + x1[k] * jc1 + x2[k] * jc2) + s5 * (x0[k] * jf0 + x1[k] * jf1 + x2[k] * jf2);
+      double v1 = s1 + s3 * (x0[k] * ja0 + x1[k] * ja1 + x2[k] * ja2) + s4 * (x0[k] * jd0 + x1[k] * jd1 + x2[k] * jd2) +
+                  s5 * (x0[k] * jg0 + x1[k] * jg1 + x2[k] * jg2);
+      double v2 = s2 + s3 * (x0[k] * jb0 + x1[k] * jb1 + x2[k] * jb2) + s4 * (x0[k] * je0 + x1[k] * je1 + x2[k] * je2) +
+                  s5 * (x0[k] * jh0 + x1[k] * jh1 + x2[k] * jh2);
+
+      // Gradient of Equation 6.12 [Magnusson 2009] projected on the step direction
+      dd += w * (g0 * v0 + g1 * v1 + g2 * v2);
+    }
+
+    score_ += s;
+    derivative_ += dd;
+    return;
+  }
+
+  if (!compute_hessian_)
+  {
+#pragma omp simd reduction(+:s,g_0,g_1,g_2,g_3,g_4,g_5)
+    for (int k = 0; k < n; k++)
+    {
+      double g0 = c00[k] * d0[k] + c01[k] * d1[k] + c02[k] * d2[k];
+      double g1 = c01[k] * d0[k] + c11[k] * d1[k] + c12[k] * d2[k];
+      double g2 = c02[k] * d0[k] + c12[k] * d1[k] + c22[k] * d2[k];
+
+      // Error checking for invalid values (nan fails both comparisons)
+      double w = gauss_d2 * e[k];
+      bool valid = (w >= 0 && w <= 1);
+      s += valid ? -gauss_d1 * e[k] : 0.0;
+      // Reusable portion of Equation 6.12 and 6.13 [Magnusson 2009]
+      w = valid ? gauss_d1 * w : 0.0;
+      g0 = valid ? g0 : 0.0; g1 = valid ? g1 : 0.0; g2 = valid ? g2 : 0.0;
+
+      // Columns 3 to 5 of the point gradient, Equation 6.18 [Magnusson 2009]
+      double p13 = x0[k] * ja0 + x1[k] * ja1 + x2[k] * ja2;
+      double p23 = x0[k] * jb0 + x1[k] * jb1 + x2[k] * jb2;
+      double p04 = x0[k] * jc0 + x1[k] * jc1 + x2[k] * jc2;
+      double p14 = x0[k] * jd0 + x1[k] * jd1 + x2[k] * jd2;
+      double p24 = x0[k] * je0 + x1[k] * je1 + x2[k] * je2;
+      double p05 = x0[k] * jf0 + x1[k] * jf1 + x2[k] * jf2;
+      double p15 = x0[k] * jg0 + x1[k] * jg1 + x2[k] * jg2;
+      double p25 = x0[k] * jh0 + x1[k] * jh1 + x2[k] * jh2;
+
+      // Update gradient, Equation 6.12 [Magnusson 2009]
+      g_0 += w * g0;
+      g_1 += w * g1;
+      g_2 += w * g2;
+      g_3 += w * (g1 * p13 + g2 * p23);
+      g_4 += w * (g0 * p04 + g1 * p14 + g2 * p24);
+      g_5 += w * (g0 * p05 + g1 * p15 + g2 * p25);
+    }
+  }
+  else if (gauss_newton_)
+  {
+    double h_00 = 0, h_01 = 0, h_02 = 0, h_03 = 0, h_04 = 0, h_05 = 0;
+    double h_11 = 0, h_12 = 0, h_13 = 0, h_14 = 0, h_15 = 0;
+    double h_22 = 0, h_23 = 0, h_24 = 0, h_25 = 0;
+    double h_33 = 0, h_34 = 0, h_35 = 0;
+    double h_44 = 0, h_45 = 0;
+    double h_55 = 0;
+
+    // Same as below without the second order point terms and the curvature of the exponential
+#pragma omp simd reduction(+:s,g_0,g_1,g_2,g_3,g_4,g_5,h_00,h_01,h_02,h_03,h_04,h_05,h_11,h_12,h_13,h_14,h_15,h_22,h_23,h_24,h_25,h_33,h_34,h_35,h_44,h_45,h_55)
+    for (int k = 0; k < n; k++)
+    {
+      double g0 = c00[k] * d0[k] + c01[k] * d1[k] + c02[k] * d2[k];
+      double g1 = c01[k] * d0[k] + c11[k] * d1[k] + c12[k] * d2[k];
+      double g2 = c02[k] * d0[k] + c12[k] * d1[k] + c22[k] * d2[k];
+
+      double w = gauss_d2 * e[k];
+      bool valid = (w >= 0 && w <= 1);
+      s += valid ? -gauss_d1 * e[k] : 0.0;
+      w = valid ? gauss_d1 * w : 0.0;
+      g0 = valid ? g0 : 0.0; g1 = valid ? g1 : 0.0; g2 = valid ? g2 : 0.0;
+
+      double p13 = x0[k] * ja0 + x1[k] * ja1 + x2[k] * ja2;
+      double p23 = x0[k] * jb0 + x1[k] * jb1 + x2[k] * jb2;
+      double p04 = x0[k] * jc0 + x1[k] * jc1 + x2[k] * jc2;
+      double p14 = x0[k] * jd0 + x1[k] * jd1 + x2[k] * jd2;
+      double p24 = x0[k] * je0 + x1[k] * je1 + x2[k] * je2;
+      double p05 = x0[k] * jf0 + x1[k] * jf1 + x2[k] * jf2;
+      double p15 = x0[k] * jg0 + x1[k] * jg1 + x2[k] * jg2;
+      double p25 = x0[k] * jh0 + x1[k] * jh1 + x2[k] * jh2;
+
+      g_0 += w * g0;
+      g_1 += w * g1;
+      g_2 += w * g2;
+      g_3 += w * (g1 * p13 + g2 * p23);
+      g_4 += w * (g0 * p04 + g1 * p14 + g2 * p24);
+      g_5 += w * (g0 * p05 + g1 * p15 + g2 * p25);
+
+      double q30 = c01[k] * p13 + c02[k] * p23;
+      double q31 = c11[k] * p13 + c12[k] * p23;
+      double q32 = c12[k] * p13 + c22[k] * p23;
+      double q40 = c00[k] * p04 + c01[k] * p14 + c02[k] * p24;
+      double q41 = c01[k] * p04 + c11[k] * p14 + c12[k] * p24;
+      double q42 = c02[k] * p04 + c12[k] * p14 + c22[k] * p24;
+      double q50 = c00[k] * p05 + c01[k] * p15 + c02[k] * p25;
+      double q51 = c01[k] * p05 + c11[k] * p15 + c12[k] * p25;
+      double q52 = c02[k] * p05 + c12[k] * p15 + c22[k] * p25;
+
+      // d(T(x,p))/dpj^T Sigma_k^-1 d(T(x,p))/dpi
+      h_00 += w * c00[k];
+      h_01 += w * c01[k];
+      h_02 += w * c02[k];
+      h_03 += w * q30;
+      h_04 += w * q40;
+      h_05 += w * q50;
+      h_11 += w * c11[k];
+      h_12 += w * c12[k];
+      h_13 += w * q31;
+      h_14 += w * q41;
+      h_15 += w * q51;
+      h_22 += w * c22[k];
+      h_23 += w * q32;
+      h_24 += w * q42;
+      h_25 += w * q52;
+      h_33 += w * (p13 * q31 + p23 * q32);
+      h_34 += w * (p13 * q41 + p23 * q42);
+      h_35 += w * (p13 * q51 + p23 * q52);
+      h_44 += w * (p04 * q40 + p14 * q41 + p24 * q42);
+      h_45 += w * (p04 * q50 + p14 * q51 + p24 * q52);
+      h_55 += w * (p05 * q50 + p15 * q51 + p25 * q52);
+    }
+
+    hessian_[0] += h_00; hessian_[1] += h_01; hessian_[2] += h_02; hessian_[3] += h_03; hessian_[4] += h_04; hessian_[5] += h_05;
+    hessian_[6] += h_11; hessian_[7] += h_12; hessian_[8] += h_13; hessian_[9] += h_14; hessian_[10] += h_15;
+    hessian_[11] += h_22; hessian_[12] += h_23; hessian_[13] += h_24; hessian_[14] += h_25;
+    hessian_[15] += h_33; hessian_[16] += h_34; hessian_[17] += h_35;
+    hessian_[18] += h_44; hessian_[19] += h_45;
+    hessian_[20] += h_55;
+  }
+  else
+  {
+    // Angular hessian terms, Equation 6.21 [Magnusson 2009]
+    const double ha20 = h_ang_[0], ha21 = h_ang_[1], ha22 = h_ang_[2];
+    const double ha30 = h_ang_[3], ha31 = h_ang_[4], ha32 = h_ang_[5];
+    const double hb20 = h_ang_[6], hb21 = h_ang_[7], hb22 = h_ang_[8];
+    const double hb30 = h_ang_[9], hb31 = h_ang_[10], hb32 = h_ang_[11];
+    const double hc20 = h_ang_[12], hc21 = h_ang_[13], hc22 = h_ang_[14];
+    const double hc30 = h_ang_[15], hc31 = h_ang_[16], hc32 = h_ang_[17];
+    const double hd10 = h_ang_[18], hd11 = h_ang_[19], hd12 = h_ang_[20];
+    const double hd20 = h_ang_[21], hd21 = h_ang_[22], hd22 = h_ang_[23];
+    const double hd30 = h_ang_[24], hd31 = h_ang_[25], hd32 = h_ang_[26];
+    const double he10 = h_ang_[27], he11 = h_ang_[28], he12 = h_ang_[29];
+    const double he20 = h_ang_[30], he21 = h_ang_[31], he22 = h_ang_[32];
+    const double he30 = h_ang_[33], he31 = h_ang_[34], he32 = h_ang_[35];
+    const double hf10 = h_ang_[36], hf11 = h_ang_[37], hf12 = h_ang_[38];
+    const double hf20 = h_ang_[39], hf21 = h_ang_[40], hf22 = h_ang_[41];
+    const double hf30 = h_ang_[42], hf31 = h_ang_[43], hf32 = h_ang_[44];
+
+    double h_00 = 0, h_01 = 0, h_02 = 0, h_03 = 0, h_04 = 0, h_05 = 0;
+    double h_11 = 0, h_12 = 0, h_13 = 0, h_14 = 0, h_15 = 0;
+    double h_22 = 0, h_23 = 0, h_24 = 0, h_25 = 0;
+    double h_33 = 0, h_34 = 0, h_35 = 0;
+    double h_44 = 0, h_45 = 0;
+    double h_55 = 0;
+
+#pragma omp simd reduction(+:s,g_0,g_1,g_2,g_3,g_4,g_5,h_00,h_01,h_02,h_03,h_04,h_05,h_11,h_12,h_13,h_14,h_15,h_22,h_23,h_24,h_25,h_33,h_34,h_35,h_44,h_45,h_55)
+    for (int k = 0; k < n; k++)
+    {
+      // Sigma_k^-1 (x_k - mu_k)
+      double g0 = c00[k] * d0[k] + c01[k] * d1[k] + c02[k] * d2[k];
+      double g1 = c01[k] * d0[k] + c11[k] * d1[k] + c12[k] * d2[k];
+      double g2 = c02[k] * d0[k] + c12[k] * d1[k] + c22[k] * d2[k];
+
+      // Error checking for invalid values (nan fails both comparisons)
+      double w = gauss_d2 * e[k];
+      bool valid = (w >= 0 && w <= 1);
+      s += valid ? -gauss_d1 * e[k] : 0.0;
+      // Reusable portion of Equation 6.12 and 6.13 [Magnusson 2009]
+      w = valid ? gauss_d1 * w : 0.0;
+      g0 = valid ? g0 : 0.0; g1 = valid ? g1 : 0.0; g2 = valid ? g2 : 0.0;
+
+      // Columns 3 to 5 of the point gradient, Equation 6.18 [Magnusson 2009]
+      double p13 = x0[k] * ja0 + x1[k] * ja1 + x2[k] * ja2;
+      double p23 = x0[k] * jb0 + x1[k] * jb1 + x2[k] * jb2;
+      double p04 = x0[k] * jc0 + x1[k] * jc1 + x2[k] * jc2;
+      double p14 = x0[k] * jd0 + x1[k] * jd1 + x2[k] * jd2;
+      double p24 = x0[k] * je0 + x1[k] * je1 + x2[k] * je2;
+      double p05 = x0[k] * jf0 + x1[k] * jf1 + x2[k] * jf2;
+      double p15 = x0[k] * jg0 + x1[k] * jg1 + x2[k] * jg2;
+      double p25 = x0[k] * jh0 + x1[k] * jh1 + x2[k] * jh2;
+
+      // (x_k - mu_k)^T Sigma_k^-1 d(T(x,p))/dpi
+      double t0 = g0, t1 = g1, t2 = g2;
+      double t3 = g1 * p13 + g2 * p23;
+      double t4 = g0 * p04 + g1 * p14 + g2 * p24;
+      double t5 = g0 * p05 + g1 * p15 + g2 * p25;
+
+      // Update gradient, Equation 6.12 [Magnusson 2009]
+      g_0 += w * t0;
+      g_1 += w * t1;
+      g_2 += w * t2;
+      g_3 += w * t3;
+      g_4 += w * t4;
+      g_5 += w * t5;
+
+      // Sigma_k^-1 d(T(x,p))/dpi for the angular columns, the translational ones are the columns of Sigma_k^-1
+      double q30 = c01[k] * p13 + c02[k] * p23;
+      double q31 = c11[k] * p13 + c12[k] * p23;
+      double q32 = c12[k] * p13 + c22[k] * p23;
+      double q40 = c00[k] * p04 + c01[k] * p14 + c02[k] * p24;
+      double q41 = c01[k] * p04 + c11[k] * p14 + c12[k] * p24;
+      double q42 = c02[k] * p04 + c12[k] * p14 + c22[k] * p24;
+      double q50 = c00[k] * p05 + c01[k] * p15 + c02[k] * p25;
+      double q51 = c01[k] * p05 + c11[k] * p15 + c12[k] * p25;
+      double q52 = c02[k] * p05 + c12[k] * p15 + c22[k] * p25;
+
+      // (x_k - mu_k)^T Sigma_k^-1 d2(T(x,p))/dpidpj, vectors a to f of Equation 6.21 [Magnusson 2009]
+      double ha = g1 * (x0[k] * ha20 + x1[k] * ha21 + x2[k] * ha22) + g2 * (x0[k] * ha30 + x1[k] * ha31 + x2[k] * ha32);
+      double hb = g1 * (x0[k] * hb20 + x1[k] * hb21 + x2[k] * hb22) + g2 * (x0[k] * hb30 + x1[k] * hb31 + x2[k] * hb32);
+      double hc = g1 * (x0[k] * hc20 + x1[k] * hc21 + x2[k] * hc22) + g2 * (x0[k] * hc30 + x1[k] * hc31 + x2[k] * hc32);
+      double hd = g0 * (x0[k] * hd10 + x1[k] * hd11 + x2[k] * hd12) + g1 * (x0[k] * hd20 + x1[k] * hd21 + x2[k] * hd22) +
+                  g2 * (x0[k] * hd30 + x1[k] * hd31 + x2[k] * hd32);
+      double he = g0 * (x0[k] * he10 + x1[k] * he11 + x2[k] * he12) + g1 * (x0[k] * he20 + x1[k] * he21 + x2[k] * he22) +
+                  g2 * (x0[k] * he30 + x1[k] * he31 + x2[k] * he32);
+      double hf = g0 * (x0[k] * hf10 + x1[k] * hf11 + x2[k] * hf12) + g1 * (x0[k] * hf20 + x1[k] * hf21 + x2[k] * hf22) +
+                  g2 * (x0[k] * hf30 + x1[k] * hf31 + x2[k] * hf32);
+
+      // Update hessian, Equation 6.13 [Magnusson 2009]
+      double wd2 = -gauss_d2 * w;
+      h_00 += wd2 * t0 * t0 + w * c00[k];
+      h_01 += wd2 * t0 * t1 + w * c01[k];
+      h_02 += wd2 * t0 * t2 + w * c02[k];
+      h_03 += wd2 * t0 * t3 + w * q30;
+      h_04 += wd2 * t0 * t4 + w * q40;
+      h_05 += wd2 * t0 * t5 + w * q50;
+      h_11 += wd2 * t1 * t1 + w * c11[k];
+      h_12 += wd2 * t1 * t2 + w * c12[k];
+      h_13 += wd2 * t1 * t3 + w * q31;
+      h_14 += wd2 * t1 * t4 + w * q41;
+      h_15 += wd2 * t1 * t5 + w * q51;
+      h_22 += wd2 * t2 * t2 + w * c22[k];
+      h_23 += wd2 * t2 * t3 + w * q32;
+      h_24 += wd2 * t2 * t4 + w * q42;
+      h_25 += wd2 * t2 * t5 + w * q52;
+      h_33 += wd2 * t3 * t3 + w * (ha + p13 * q31 + p23 * q32);
+      h_34 += wd2 * t3 * t4 + w * (hb + p13 * q41 + p23 * q42);
+      h_35 += wd2 * t3 * t5 + w * (hc + p13 * q51 + p23 * q52);
+      h_44 += wd2 * t4 * t4 + w * (hd + p04 * q40 + p14 * q41 + p24 * q42);
+      h_45 += wd2 * t4 * t5 + w * (he + p04 * q50 + p14 * q51 + p24 * q52);
+      h_55 += wd2 * t5 * t5 + w * (hf + p05 * q50 + p15 * q51 + p25 * q52);
+    }
+
+    hessian_[0] += h_00; hessian_[1] += h_01; hessian_[2] += h_02; hessian_[3] += h_03; hessian_[4] += h_04; hessian_[5] += h_05;
+    hessian_[6] += h_11; hessian_[7] += h_12; hessian_[8] += h_13; hessian_[9] += h_14; hessian_[10] += h_15;
+    hessian_[11] += h_22; hessian_[12] += h_23; hessian_[13] += h_24; hessian_[14] += h_25;
+    hessian_[15] += h_33; hessian_[16] += h_34; hessian_[17] += h_35;
+    hessian_[18] += h_44; hessian_[19] += h_45;
+    hessian_[20] += h_55;
+  }
+
+  score_ += s;
+  gradient_[0] += g_0;
+  gradient_[1] += g_1;
+  gradient_[2] += g_2;
+  gradient_[3] += g_3;
+  gradient_[4] += g_4;
+  gradient_[5] += g_5;
+}
@@ -0,0 +1,260 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#include <Eigen/Dense>
+#include "fast_pcl/registration/ndt_derivative_batch.h"
+
+/** \brief One (source point, target voxel) pair. */
+struct Pair
+{
+  Eigen::Vector3d x, x_trans;
+  Eigen::Matrix3d c_inv;
+};
+
+static double
+uniform (double min, double max)
+{
+  return (min + (max - min) * rand () / RAND_MAX);
+}
+
+/** \brief Random pairs, their transformed points close enough to the voxel means for most of them to count. */
+static std::vector<Pair>
+makePairs (int nr_pairs)
+{
+  std::vector<Pair> pairs (nr_pairs);
+  for (int k = 0; k < nr_pairs; k++)
+  {
+    pairs[k].x = Eigen::Vector3d (uniform (-30, 30), uniform (-30, 30), uniform (-2, 5));
+    pairs[k].x_trans = Eigen::Vector3d (uniform (-1, 1), uniform (-1, 1), uniform (-0.3, 0.3));
+    Eigen::Matrix3d a = Eigen::Matrix3d::Random ();
+    pairs[k].c_inv = (a * a.transpose () + 0.1 * Eigen::Matrix3d::Identity ()).inverse ();
+  }
+  return (pairs);
+}
+
+/** \brief Scalar reference of the kernel, as pcl::NormalDistributionsTransform computePointDerivatives and
+  * updateDerivatives evaluate a pair (Equations 6.10, 6.12, 6.13 and 6.18 to 6.21 [Magnusson 2009]).
+  */
+static double
+referenceDerivatives (const std::vector<Pair> &pairs, double gauss_d1, double gauss_d2, const double *j_ang,
+                      const double *h_ang, bool gauss_newton, Eigen::Matrix<double, 6, 1> &score_gradient,
+                      Eigen::Matrix<double, 6, 6> &hessian)
+{
+  Eigen::Map<const Eigen::Matrix<double, 3, 8> > j (j_ang);
+  Eigen::Map<const Eigen::Matrix<double, 3, 15> > h (h_ang);
+
+  double score = 0;
+  score_gradient.setZero ();
+  hessian.setZero ();
+  for (size_t k = 0; k < pairs.size (); k++)
+  {
+    const Eigen::Vector3d &x = pairs[k].x, &x_trans = pairs[k].x_trans;
+    const Eigen::Matrix3d &c_inv = pairs[k].c_inv;
+
+    Eigen::Matrix<double, 3, 6> point_gradient = Eigen::Matrix<double, 3, 6>::Zero ();
+    point_gradient.block<3, 3> (0, 0).setIdentity ();
+    point_gradient (1, 3) = x.dot (j.col (0));
+    point_gradient (2, 3) = x.dot (j.col (1));
+    point_gradient (0, 4) = x.dot (j.col (2));
+    point_gradient (1, 4) = x.dot (j.col (3));
+    point_gradient (2, 4) = x.dot (j.col (4));
+    point_gradient (0, 5) = x.dot (j.col (5));
+    point_gradient (1, 5) = x.dot (j.col (6));
+    point_gradient (2, 5) = x.dot (j.col (7));
+
+    Eigen::Vector3d a (0, x.dot (h.col (0)), x.dot (h.col (1)));
+    Eigen::Vector3d b (0, x.dot (h.col (2)), x.dot (h.col (3)));
+    Eigen::Vector3d c (0, x.dot (h.col (4)), x.dot (h.col (5)));
+    Eigen::Vector3d d (x.dot (h.col (6)), x.dot (h.col (7)), x.dot (h.col (8)));
+    Eigen::Vector3d e (x.dot (h.col (9)), x.dot (h.col (10)), x.dot (h.col (11)));
+    Eigen::Vector3d f (x.dot (h.col (12)), x.dot (h.col (13)), x.dot (h.col (14)));
+    Eigen::Matrix<double, 18, 6> point_hessian = Eigen::Matrix<double, 18, 6>::Zero ();
+    point_hessian.block<3, 1> (9, 3) = a;
+    point_hessian.block<3, 1> (12, 3) = b;
+    point_hessian.block<3, 1> (15, 3) = c;
+    point_hessian.block<3, 1> (9, 4) = b;
+    point_hessian.block<3, 1> (12, 4) = d;
+    point_hessian.block<3, 1> (15, 4) = e;
+    point_hessian.block<3, 1> (9, 5) = c;
+    point_hessian.block<3, 1> (12, 5) = e;
+    point_hessian.block<3, 1> (15, 5) = f;
+
+    double e_x_cov_x = std::exp (-gauss_d2 * x_trans.dot (c_inv * x_trans) / 2);
+    double score_inc = -gauss_d1 * e_x_cov_x;
+    e_x_cov_x = gauss_d2 * e_x_cov_x;
+    if (e_x_cov_x > 1 || e_x_cov_x < 0 || e_x_cov_x != e_x_cov_x)
+      continue;
+    e_x_cov_x *= gauss_d1;
+    score += score_inc;
+
+    for (int i = 0; i < 6; i++)
+    {
+      Eigen::Vector3d cov_dxd_pi = c_inv * point_gradient.col (i);
+      score_gradient (i) += x_trans.dot (cov_dxd_pi) * e_x_cov_x;
+      for (int jj = 0; jj < 6; jj++)
+      {
+        if (gauss_newton)
+          hessian (i, jj) += e_x_cov_x * point_gradient.col (jj).dot (cov_dxd_pi);
+        else
+          hessian (i, jj) += e_x_cov_x * (-gauss_d2 * x_trans.dot (cov_dxd_pi) * x_trans.dot (c_inv * point_gradient.col (jj)) +
+                                          x_trans.dot (c_inv * point_hessian.block<3, 1> (3 * i, jj)) +
+                                          point_gradient.col (jj).dot (cov_dxd_pi));
+      }
+    }
+  }
+  return (score);
+}
+
+/** \brief Gaussian fitting parameters of a 1m resolution and an outlier ratio of 0.55 (Equation 6.8) [Magnusson 2009]. */
+static void
+gaussParameters (double &gauss_d1, double &gauss_d2)
+{
+  double gauss_c1 = 10.0 * (1 - 0.55), gauss_c2 = 0.55;
+  double gauss_d3 = -std::log (gauss_c2);
+  gauss_d1 = -std::log (gauss_c1 + gauss_c2) - gauss_d3;
+  gauss_d2 = -2 * std::log ((-std::log (gauss_c1 * std::exp (-0.5) + gauss_c2) - gauss_d3) / gauss_d1);
+}
+
+class NDTDerivativeBatchTest : public testing::Test
+{
+  protected:
+    virtual void
+    SetUp ()
+    {
+      srand (1);
+      // Spans several batches and leaves a partial one for the last flush
+      pairs_ = makePairs (3 * pcl::NDTDerivativeBatch::CAPACITY + 17);
+      gaussParameters (gauss_d1_, gauss_d2_);
+      for (int i = 0; i < 24; i++)
+        j_ang_[i] = uniform (-1, 1);
+      for (int i = 0; i < 45; i++)
+        h_ang_[i] = uniform (-1, 1);
+    }
+
+    void
+    evaluate (pcl::NDTDerivativeBatch &batch)
+    {
+      for (size_t k = 0; k < pairs_.size (); k++)
+        batch.push (pairs_[k].x, pairs_[k].x_trans, pairs_[k].c_inv);
+      batch.flush ();
+    }
+
+    std::vector<Pair> pairs_;
+    double gauss_d1_, gauss_d2_;
+    double j_ang_[24], h_ang_[45];
+};
+
+static void
+expectNear (const Eigen::MatrixXd &value, const Eigen::MatrixXd &reference)
+{
+  EXPECT_LE ((value - reference).norm (), 1e-9 * std::max (1.0, reference.norm ()));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST_F (NDTDerivativeBatchTest, Hessian)
+{
+  Eigen::Matrix<double, 6, 1> ref_gradient, gradient = Eigen::Matrix<double, 6, 1>::Zero ();
+  Eigen::Matrix<double, 6, 6> ref_hessian, hessian = Eigen::Matrix<double, 6, 6>::Zero ();
+  double ref_score = referenceDerivatives (pairs_, gauss_d1_, gauss_d2_, j_ang_, h_ang_, false, ref_gradient, ref_hessian);
+
+  pcl::NDTDerivativeBatch batch;
+  batch.reset (gauss_d1_, gauss_d2_, j_ang_, h_ang_, true);
+  evaluate (batch);
+  double score = 0;
+  batch.addTo (score, gradient, hessian);
+
+  EXPECT_NEAR (score, ref_score, 1e-9 * std::abs (ref_score));
+  expectNear (gradient, ref_gradient);
+  expectNear (hessian, ref_hessian);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST_F (NDTDerivativeBatchTest, GaussNewtonHessian)
+{
+  Eigen::Matrix<double, 6, 1> ref_gradient, gradient = Eigen::Matrix<double, 6, 1>::Zero ();
+  Eigen::Matrix<double, 6, 6> ref_hessian, hessian = Eigen::Matrix<double, 6, 6>::Zero ();
+  double ref_score = referenceDerivatives (pairs_, gauss_d1_, gauss_d2_, j_ang_, h_ang_, true, ref_gradient, ref_hessian);
+
+  pcl::NDTDerivativeBatch batch;
+  batch.reset (gauss_d1_, gauss_d2_, j_ang_, NULL, true, true);
+  evaluate (batch);
+  double score = 0;
+  batch.addTo (score, gradient, hessian);
+
+  EXPECT_NEAR (score, ref_score, 1e-9 * std::abs (ref_score));
+  expectNear (gradient, ref_gradient);
+  expectNear (hessian, ref_hessian);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST_F (NDTDerivativeBatchTest, GradientOnly)
+{
+  Eigen::Matrix<double, 6, 1> ref_gradient, gradient = Eigen::Matrix<double, 6, 1>::Zero ();
+  Eigen::Matrix<double, 6, 6> ref_hessian, hessian = Eigen::Matrix<double, 6, 6>::Zero ();
+  double ref_score = referenceDerivatives (pairs_, gauss_d1_, gauss_d2_, j_ang_, h_ang_, false, ref_gradient, ref_hessian);
+
+  pcl::NDTDerivativeBatch batch;
+  batch.reset (gauss_d1_, gauss_d2_, j_ang_, h_ang_, false);
+  evaluate (batch);
+  double score = 0;
+  batch.addTo (score, gradient, hessian);
+
+  EXPECT_NEAR (score, ref_score, 1e-9 * std::abs (ref_score));
+  expectNear (gradient, ref_gradient);
+  EXPECT_TRUE (hessian.isZero (0));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST_F (NDTDerivativeBatchTest, Directional)
+{
+  Eigen::Matrix<double, 6, 1> ref_gradient;
+  Eigen::Matrix<double, 6, 6> ref_hessian;
+  double ref_score = referenceDerivatives (pairs_, gauss_d1_, gauss_d2_, j_ang_, h_ang_, false, ref_gradient, ref_hessian);
+
+  double step_dir[6] = {0.4, -0.3, 0.1, 0.05, -0.02, 0.2};
+  double ref_derivative = ref_gradient.dot (Eigen::Map<Eigen::Matrix<double, 6, 1> > (step_dir));
+
+  pcl::NDTDerivativeBatch batch;
+  batch.resetDirectional (gauss_d1_, gauss_d2_, j_ang_, step_dir);
+  evaluate (batch);
+  double score = 0, derivative = 0;
+  batch.addDirectionalTo (score, derivative);
+
+  EXPECT_NEAR (score, ref_score, 1e-9 * std::abs (ref_score));
+  EXPECT_NEAR (derivative, ref_derivative, 1e-9 * std::max (1.0, std::abs (ref_derivative)));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST_F (NDTDerivativeBatchTest, InvalidPairsAreSkipped)
+{
+  // A NaN point difference fails the validity test of the exponential term
+  pairs_.resize (10);
+  pairs_[3].x_trans = Eigen::Vector3d (std::numeric_limits<double>::quiet_NaN (), 0, 0);
+  Eigen::Matrix<double, 6, 1> ref_gradient, gradient = Eigen::Matrix<double, 6, 1>::Zero ();
+  Eigen::Matrix<double, 6, 6> ref_hessian, hessian = Eigen::Matrix<double, 6, 6>::Zero ();
+  double ref_score = referenceDerivatives (pairs_, gauss_d1_, gauss_d2_, j_ang_, h_ang_, false, ref_gradient, ref_hessian);
+
+  pcl::NDTDerivativeBatch batch;
+  batch.reset (gauss_d1_, gauss_d2_, j_ang_, h_ang_, true);
+  evaluate (batch);
+  double score = 0;
+  batch.addTo (score, gradient, hessian);
+
+  EXPECT_TRUE (gradient.allFinite ());
+  EXPECT_TRUE (hessian.allFinite ());
+  EXPECT_NEAR (score, ref_score, 1e-9 * std::abs (ref_score));
+  expectNear (gradient, ref_gradient);
+  expectNear (hessian, ref_hessian);
+}
+
+int
+main (int argc, char **argv)
+{
+  testing::InitGoogleTest (&argc, argv);
+  return (RUN_ALL_TESTS ());
+}
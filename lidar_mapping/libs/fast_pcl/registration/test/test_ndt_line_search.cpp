@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+
+#include <pcl/point_types.h>
+#include <pcl/common/transforms.h>
+#include "fast_pcl/registration/ndt.h"
+
+typedef pcl::PointCloud<pcl::PointXYZ> PointCloud;
+
+/** \brief Exposes the two derivative paths of the line search. */
+class LineSearchNDT : public pcl::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ>
+{
+  public:
+    /** \brief Evaluate the derivatives of the source moved by the transform vector p.
+      * \param[out] directional derivative along step_dir of the trial step path (computeDirectionalDerivative)
+      * \param[out] directional_score score of the trial step path
+      * \param[out] full score_gradient.dot (step_dir) of the accepted step path (omp_computeDerivatives)
+      * \param[out] full_score score of the accepted step path
+      */
+    void
+    evaluate (const Eigen::Matrix<double, 6, 1> &p, const Eigen::Matrix<double, 6, 1> &step_dir,
+              double &directional, double &directional_score, double &full, double &full_score)
+    {
+      updateGaussParameters (resolution_);
+      Eigen::Matrix4f transform = (Eigen::Translation<float, 3> (static_cast<float> (p (0)), static_cast<float> (p (1)), static_cast<float> (p (2))) *
+                                   Eigen::AngleAxis<float> (static_cast<float> (p (3)), Eigen::Vector3f::UnitX ()) *
+                                   Eigen::AngleAxis<float> (static_cast<float> (p (4)), Eigen::Vector3f::UnitY ()) *
+                                   Eigen::AngleAxis<float> (static_cast<float> (p (5)), Eigen::Vector3f::UnitZ ())).matrix ();
+      PointCloud trans_cloud;
+      pcl::transformPointCloud (*input_, trans_cloud, transform);
+
+      Eigen::Matrix<double, 6, 1> x = p, score_gradient;
+      Eigen::Matrix<double, 6, 6> hessian;
+      full_score = omp_computeDerivatives (score_gradient, hessian, trans_cloud, x, true);
+      full = score_gradient.dot (step_dir);
+
+      directional = computeDirectionalDerivative (directional_score, step_dir, trans_cloud, x);
+    }
+};
+
+/** \brief A floor, two walls and a box, with some noise. */
+static void
+makeScene (PointCloud &cloud)
+{
+  srand (42);
+  cloud.clear ();
+  for (int i = 0; i < 20000; i++)
+  {
+    float u = 20.f * rand () / RAND_MAX - 10.f, v = 20.f * rand () / RAND_MAX - 10.f;
+    float n = 0.02f * rand () / RAND_MAX;
+    switch (i % 4)
+    {
+      case 0: cloud.push_back (pcl::PointXYZ (u, v, n)); break;
+      case 1: cloud.push_back (pcl::PointXYZ (u, 10.f + n, 0.15f * (v + 10.f))); break;
+      case 2: cloud.push_back (pcl::PointXYZ (-10.f + n, u, 0.15f * (v + 10.f))); break;
+      default: cloud.push_back (pcl::PointXYZ (2.f + 0.1f * u, 3.f + 0.1f * v, 0.05f * (u + 10.f))); break;
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST (NormalDistributionsTransform, DirectionalDerivative)
+{
+  PointCloud::Ptr target (new PointCloud), source (new PointCloud);
+  makeScene (*target);
+  for (size_t i = 0; i < target->size (); i += 7)
+    source->push_back (target->points[i]);
+
+  const pcl::NeighborSearchMethod methods[] = {pcl::KDTREE, pcl::DIRECT7};
+  for (int m = 0; m < 2; m++)
+  {
+    LineSearchNDT ndt;
+    ndt.setResolution (1.0f);
+    ndt.setNeighborhoodSearchMethod (methods[m]);
+    ndt.setInputTarget (target);
+    ndt.setInputSource (source);
+
+    Eigen::Matrix<double, 6, 1> p, step_dir;
+    p << 0.3, -0.2, 0.05, 0.01, -0.02, 0.1;
+    step_dir << 0.5, 0.3, -0.1, 0.02, 0.01, -0.05;
+    step_dir.normalize ();
+
+    double directional, directional_score, full, full_score;
+    ndt.evaluate (p, step_dir, directional, directional_score, full, full_score);
+
+    EXPECT_NE (full, 0.0);
+    EXPECT_NEAR (directional, full, 1e-6 * std::max (1.0, std::abs (full)));
+    EXPECT_NEAR (directional_score, full_score, 1e-6 * std::max (1.0, std::abs (full_score)));
+  }
+}
+
+int
+main (int argc, char **argv)
+{
+  testing::InitGoogleTest (&argc, argv);
+  return (RUN_ALL_TESTS ());
+}
@@ -0,0 +1,80 @@
+#ifndef LIDAR_PCL_BOUNDED_QUEUE_H_
+#define LIDAR_PCL_BOUNDED_QUEUE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace lidar_pcl
+{
+  /*
+    Blocking FIFO queue of bounded capacity, linking the stages of a processing pipeline running on their own thread.
+    push() waits while the queue is full (the producer cannot run more than capacity items ahead of the consumer),
+    pop() waits while it is empty. close() ends the stream: pushes are refused, pops return the remaining items,
+    then false.
+  */
+  template<typename T>
+  class BoundedQueue
+  {
+  private:
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+
+  public:
+    explicit BoundedQueue(size_t capacity = 1)
+      : capacity_(capacity > 0 ? capacity : 1)
+      , closed_(false)
+    {
+    }
+
+    // False if the queue is closed (item is dropped)
+    bool push(const T& item)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_full_.wait(lock, [this]{ return closed_ || items_.size() < capacity_; });
+      if(closed_)
+        return false;
+      items_.push_back(item);
+      lock.unlock();
+      not_empty_.notify_one();
+      return true;
+    }
+
+    // False once the queue is closed and empty
+    bool pop(T& item)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock, [this]{ return closed_ || !items_.empty(); });
+      if(items_.empty())
+        return false;
+      item = items_.front();
+      items_.pop_front();
+      lock.unlock();
+      not_full_.notify_one();
+      return true;
+    }
+
+    void close()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+      }
+      not_empty_.notify_all();
+      not_full_.notify_all();
+    }
+
+    size_t size()
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return items_.size();
+    }
+  };
+}
+
+#endif // LIDAR_PCL_BOUNDED_QUEUE_H_
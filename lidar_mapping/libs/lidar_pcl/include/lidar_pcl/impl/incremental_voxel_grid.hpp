@@ -0,0 +1,80 @@
+#ifndef LIDAR_PCL_INCREMENTAL_VOXEL_GRID_IMPL_H_
+#define LIDAR_PCL_INCREMENTAL_VOXEL_GRID_IMPL_H_
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT>
+lidar_pcl::IncrementalVoxelGrid<PointT>::IncrementalVoxelGrid(double leaf_size)
+  : leaf_size_(leaf_size)
+  , inverse_leaf_size_(1.0 / leaf_size)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::IncrementalVoxelGrid<PointT>::setLeafSize(double leaf_size)
+{
+  if(leaf_size == leaf_size_)
+    return;
+
+  clear();
+  leaf_size_ = leaf_size;
+  inverse_leaf_size_ = 1.0 / leaf_size;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::IncrementalVoxelGrid<PointT>::updateCentroid(PointT& centroid, const PointT& point, unsigned int count, 
+                                                        boost::mpl::true_) const
+{
+  // Running mean, stays exact to float rounding whatever the number of points
+  float weight = 1.0f / count;
+  centroid.x += (point.x - centroid.x) * weight;
+  centroid.y += (point.y - centroid.y) * weight;
+  centroid.z += (point.z - centroid.z) * weight;
+  centroid.intensity += (point.intensity - centroid.intensity) * weight;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::IncrementalVoxelGrid<PointT>::updateCentroid(PointT& centroid, const PointT& point, unsigned int count, 
+                                                        boost::mpl::false_) const
+{
+  float weight = 1.0f / count;
+  centroid.x += (point.x - centroid.x) * weight;
+  centroid.y += (point.y - centroid.y) * weight;
+  centroid.z += (point.z - centroid.z) * weight;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> bool
+lidar_pcl::IncrementalVoxelGrid<PointT>::addPoint(const PointT& point)
+{
+  if(!pcl_isfinite(point.x) || !pcl_isfinite(point.y) || !pcl_isfinite(point.z))
+    return false;
+
+  const int new_index = static_cast<int>(centroids_.points.size());
+  const int index = voxel_index_.insert(VoxelIndex::getKey(point.x, point.y, point.z, inverse_leaf_size_), new_index);
+  if(index == new_index)
+  {
+    centroids_.push_back(point);
+    counts_.push_back(1);
+    return true;
+  }
+
+  updateCentroid(centroids_.points[index], point, ++counts_[index], 
+                 typename pcl::traits::has_field<PointT, pcl::fields::intensity>::type());
+  return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> unsigned int
+lidar_pcl::IncrementalVoxelGrid<PointT>::addPointCloud(const pcl::PointCloud<PointT>& cloud)
+{
+  unsigned int new_voxels = 0;
+  for(PointCloudConstIter item = cloud.begin(); item != cloud.end(); item++)
+    if(addPoint(*item))
+      new_voxels++;
+  return new_voxels;
+}
+
+#endif // LIDAR_PCL_INCREMENTAL_VOXEL_GRID_IMPL_H_
@@ -151,49 +151,12 @@ lidar_pcl::NDTCorrectedLidarMapping<PointT>::correctLidarScan(pcl::PointCloud<Po
                                                               // Accel acceleration,
                                                               double interval)
 {
-  // Correct LIDAR scan due to car's linear and angular motion
-  pcl::PointCloud<PointT> scan_packet;
-  std::vector<pcl::PointCloud<PointT>> scan_packets_vector;
-  double base_azimuth = getYawAngle((scan.begin())->x, (scan.begin())->y);
-  for(PointCloudConstIter item = scan.begin(); item != scan.end(); item++)
-  {
-    double current_azimuth = getYawAngle(item->x, item->y);
-    if(std::fabs(calculateMinAngleDist(current_azimuth, base_azimuth)) < 0.01) // 0.17 degree is the typical change
-    {
-      scan_packet.push_back(*item);
-    }
-    else // new azimuth reached
-    {
-      scan_packets_vector.push_back(scan_packet);
-      scan_packet.clear();
-      scan_packet.push_back(*item);
-      base_azimuth = current_azimuth;
-    }
-  }
-
-  scan.clear();
-  Pose current_lidar_pose; // = {0., 0., 0., 0., 0., 0.};
-  for(int i = 0, npackets = scan_packets_vector.size(); i < npackets; i++)
-  {
-    double offset_time = interval * i / npackets;
-    Pose this_packet_lidar_pose(current_lidar_pose.x - velocity.x * offset_time, // - 0.5 * acceleration.x * interval * interval,
-                                current_lidar_pose.y - velocity.y * offset_time, // - 0.5 * acceleration.y * interval * interval,
-                                current_lidar_pose.z - velocity.z * offset_time, // - 0.5 * acceleration.z * interval * interval,
-                                current_lidar_pose.roll  - velocity.roll  * offset_time, // - 0.5 * acceleration.roll  * interval * interval,
-                                current_lidar_pose.pitch - velocity.pitch * offset_time, // - 0.5 * acceleration.pitch * interval * interval,
-                                current_lidar_pose.yaw   - velocity.yaw   * offset_time); // - 0.5 * acceleration.yaw   * interval * interval}; 
-
-    Eigen::Affine3f transform = pcl::getTransformation(this_packet_lidar_pose.x, 
-                                                       this_packet_lidar_pose.y, 
-                                                       this_packet_lidar_pose.z, 
-                                                       this_packet_lidar_pose.roll, 
-                                                       this_packet_lidar_pose.pitch, 
-                                                       this_packet_lidar_pose.yaw);
-    // Eigen::Affine3f transform = pcl::getTransformation(0, 0, 0, 0, 0, 0);
-    pcl::PointCloud<PointT> corrected_packet;
-    pcl::transformPointCloud(scan_packets_vector[npackets-1-i], corrected_packet, transform);
-    scan += corrected_packet;
-  }
+  // Correct LIDAR scan due to car's linear and angular motion, the motion during the scan is velocity * interval
+  // (the acceleration is not used)
+  Eigen::Affine3d relative_tf;
+  pcl::getTransformation(velocity.x * interval, velocity.y * interval, velocity.z * interval,
+                         velocity.roll * interval, velocity.pitch * interval, velocity.yaw * interval, relative_tf);
+  lidar_pcl::motionUndistort(scan, relative_tf);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,98 @@
+#ifndef LIDAR_PCL_POINT_CLOUD2_VIEW_IMPL_H_
+#define LIDAR_PCL_POINT_CLOUD2_VIEW_IMPL_H_
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::PointCloud2View::getFieldMap(pcl::MsgFieldMap& field_map, std::vector<FieldConversion>& conversions) const
+{
+  std::vector<pcl::PCLPointField> fields;
+  pcl_conversions::toPCL(msg_->fields, fields);
+  pcl::createMapping<PointT>(fields, field_map);
+
+  // pcl only maps the fields of the same datatype
+  conversions.clear();
+  std::vector<pcl::PCLPointField> point_fields;
+  pcl::getFields<PointT>(point_fields);
+  for(size_t f = 0; f < point_fields.size(); f++)
+  {
+    const Field* field = findField(point_fields[f].name);
+    if(field == NULL || field->datatype == point_fields[f].datatype || point_fields[f].count != 1)
+      continue;
+
+    const bool is_float = (field->datatype == sensor_msgs::PointField::FLOAT32 ||
+                           field->datatype == sensor_msgs::PointField::FLOAT64);
+    const uint8_t datatype = point_fields[f].datatype;
+    if(is_float ? datatype != sensor_msgs::PointField::FLOAT32
+                : (datatype != sensor_msgs::PointField::UINT16 && datatype != sensor_msgs::PointField::UINT8))
+      continue;
+
+    FieldConversion conversion;
+    conversion.struct_offset = point_fields[f].offset;
+    conversion.struct_datatype = datatype;
+    conversion.field = *field;
+    conversions.push_back(conversion);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> bool
+lidar_pcl::PointCloud2View::hasLayoutOf(const pcl::MsgFieldMap& field_map) const
+{
+  if(point_step_ != sizeof(PointT))
+    return false;
+
+  // Every field of PointT is found at the same offset in the message (the mapping merges contiguous fields)
+  size_t mapped_size = 0;
+  for(size_t m = 0; m < field_map.size(); m++)
+  {
+    if(field_map[m].serialized_offset != field_map[m].struct_offset)
+      return false;
+    mapped_size += field_map[m].size;
+  }
+
+  std::vector<pcl::PCLPointField> point_fields;
+  pcl::getFields<PointT>(point_fields);
+  size_t fields_size = 0;
+  for(size_t f = 0; f < point_fields.size(); f++)
+    fields_size += point_fields[f].count * pcl::getFieldSize(point_fields[f].datatype);
+  return mapped_size == fields_size;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::PointCloud2View::copyTo(pcl::PointCloud<PointT>& cloud, bool estimate_times, double scan_period) const
+{
+  pcl_conversions::toPCL(msg_->header, cloud.header);
+  cloud.width = msg_->width;
+  cloud.height = msg_->height;
+  cloud.is_dense = msg_->is_dense == 1;
+
+  const size_t nr_points = size();
+  cloud.points.resize(nr_points);
+  if(nr_points == 0)
+    return;
+
+  pcl::MsgFieldMap field_map;
+  std::vector<FieldConversion> conversions;
+  getFieldMap<PointT>(field_map, conversions);
+
+  // Same layout: the whole buffer in one go (the padding bytes of the message come along)
+  if(hasLayoutOf<PointT>(field_map))
+  {
+    if(contiguous_)
+      memcpy(&cloud.points[0], data_, nr_points * sizeof(PointT));
+    else
+      for(uint32_t row = 0; row < msg_->height; ++row)
+        memcpy(&cloud.points[row * msg_->width], data_ + row * row_step_, msg_->width * sizeof(PointT));
+  }
+  else
+  {
+    for(size_t n = 0; n < nr_points; n++)
+      copyPoint(n, field_map, conversions, cloud.points[n]);
+  }
+
+  if(estimate_times && !hasTime())
+    estimatePointTimes(cloud, scan_period);
+}
+
+#endif // LIDAR_PCL_POINT_CLOUD2_VIEW_IMPL_H_
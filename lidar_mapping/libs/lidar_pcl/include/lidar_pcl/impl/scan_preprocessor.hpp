@@ -0,0 +1,218 @@
+#ifndef LIDAR_PCL_SCAN_PREPROCESSOR_IMPL_H_
+#define LIDAR_PCL_SCAN_PREPROCESSOR_IMPL_H_
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT>
+lidar_pcl::ScanPreprocessor<PointT>::ScanPreprocessor()
+  : min_scan_range_(2.0)
+  , scan_period_(0.1)
+  , voxel_leaf_size_(0.1)
+  , inverse_leaf_size_(10.0)
+  , time_begin_(0.f)
+  , time_scale_(0.f)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::ScanPreprocessor<PointT>::process(const sensor_msgs::PointCloud2& msg, 
+                                             const Eigen::Affine3d& relative_tf,
+                                             pcl::PointCloud<PointT>& scan, 
+                                             pcl::PointCloud<PointT>& filtered_scan)
+{
+  read(msg, scan);
+  doProcess(scan, relative_tf, filtered_scan, NULL, NULL);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::ScanPreprocessor<PointT>::process(const sensor_msgs::PointCloud2& msg, 
+                                             const Eigen::Affine3d& relative_tf,
+                                             pcl::PointCloud<PointT>& scan, 
+                                             pcl::PointCloud<PointT>& filtered_scan,
+                                             const Eigen::Matrix4f& transform, 
+                                             pcl::PointCloud<PointT>& transformed_scan)
+{
+  read(msg, scan);
+  doProcess(scan, relative_tf, filtered_scan, &transform, &transformed_scan);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::ScanPreprocessor<PointT>::process(pcl::PointCloud<PointT>& scan, 
+                                             const Eigen::Affine3d& relative_tf,
+                                             pcl::PointCloud<PointT>& filtered_scan)
+{
+  doProcess(scan, relative_tf, filtered_scan, NULL, NULL);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::ScanPreprocessor<PointT>::process(pcl::PointCloud<PointT>& scan, 
+                                             const Eigen::Affine3d& relative_tf,
+                                             pcl::PointCloud<PointT>& filtered_scan,
+                                             const Eigen::Matrix4f& transform, 
+                                             pcl::PointCloud<PointT>& transformed_scan)
+{
+  doProcess(scan, relative_tf, filtered_scan, &transform, &transformed_scan);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::ScanPreprocessor<PointT>::doProcess(pcl::PointCloud<PointT>& scan, 
+                                               const Eigen::Affine3d& relative_tf,
+                                               pcl::PointCloud<PointT>& filtered_scan,
+                                               const Eigen::Matrix4f* transform, 
+                                               pcl::PointCloud<PointT>* transformed_scan)
+{
+  // 1. Time range of the read scan
+  setTimeRange(scan, PointHasTime());
+
+  // 2. Undistort the points in place, accumulating them into their voxel
+  resetVoxels(scan.points.size());
+  if(transformed_scan != NULL)
+  {
+    transformed_scan->header = scan.header;
+    transformed_scan->points.resize(scan.points.size());
+    transformed_scan->width = scan.width;
+    transformed_scan->height = 1;
+    transformed_scan->is_dense = scan.is_dense;
+  }
+
+  const ScanMotion motion(relative_tf);
+  ScanSweep sweep;
+  for(size_t n = 0; n < scan.points.size(); n++)
+  {
+    PointT& point = scan.points[n];
+    point.getVector3fMap() = motion.getTransform(getFraction(point, sweep, PointHasTime()))(point.getVector3fMap());
+    addToVoxel(point, n);
+
+    if(transformed_scan != NULL)
+    {
+      PointT& transformed_point = transformed_scan->points[n];
+      transformed_point = point;
+      transformed_point.getVector3fMap() = transform->block<3, 3>(0, 0) * point.getVector3fMap() + transform->block<3, 1>(0, 3);
+    }
+  }
+
+  // 3. Voxel centroids
+  getVoxelCentroids(scan, filtered_scan);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::ScanPreprocessor<PointT>::read(const sensor_msgs::PointCloud2& msg, pcl::PointCloud<PointT>& scan) const
+{
+  // Read the points in place from the message buffer, only the kept ones are copied
+  PointCloud2View view(msg);
+  pcl::MsgFieldMap field_map;
+  std::vector<PointCloud2View::FieldConversion> conversions;
+  view.getFieldMap<PointT>(field_map, conversions);
+
+  pcl_conversions::toPCL(msg.header, scan.header);
+  scan.points.resize(view.size());
+
+  // A single rotation, as fromROSMsg() keeps, the times are estimated over it
+  const size_t rotation_size = view.getRotationSize();
+  const double min_range2 = min_scan_range_ * min_scan_range_;
+  unsigned int nr_points = 0;
+  for(size_t n = 0; n < rotation_size && view.isValid(); n++)
+  {
+    // Range crop, the points with a NaN or infinite coordinate are dropped too (the scan is dense)
+    float x = view.getX(n), y = view.getY(n), z = view.getZ(n);
+    if(!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z) ||
+       !(static_cast<double>(x) * x + static_cast<double>(y) * y > min_range2))
+      continue;
+    view.copyPoint(n, field_map, conversions, scan.points[nr_points++]);
+  }
+
+  scan.points.resize(nr_points);
+  scan.width = nr_points;
+  scan.height = 1;
+  scan.is_dense = true;
+  estimateTimes(view, scan, PointHasTime());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> template <typename PointInT> void
+lidar_pcl::ScanPreprocessor<PointT>::estimateTimes(const PointCloud2View& view, pcl::PointCloud<PointInT>& scan, boost::mpl::true_) const
+{
+  if(!view.hasTime())
+    estimatePointTimes(scan, scan_period_);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> template <typename PointInT> void
+lidar_pcl::ScanPreprocessor<PointT>::setTimeRange(const pcl::PointCloud<PointInT>& scan, boost::mpl::true_)
+{
+  time_begin_ = 0.f;
+  time_scale_ = 0.f;
+  if(scan.points.empty())
+    return;
+
+  float end = time_begin_ = scan.points[0].time;
+  for(size_t n = 1; n < scan.points.size(); n++)
+  {
+    time_begin_ = scan.points[n].time < time_begin_ ? scan.points[n].time : time_begin_;
+    end = scan.points[n].time > end ? scan.points[n].time : end;
+  }
+  time_scale_ = end > time_begin_ ? 1.f / (end - time_begin_) : 0.f;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::ScanPreprocessor<PointT>::resetVoxels(size_t nr_points)
+{
+  // The table is at least twice as large as the number of points, it is never rehashed while points are added
+  voxel_index_.clear();
+  voxel_index_.reserve(nr_points);
+  voxel_sums_.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::ScanPreprocessor<PointT>::addToVoxel(const PointT& point, unsigned int point_index)
+{
+  const int new_index = static_cast<int>(voxel_sums_.size());
+  const int index = voxel_index_.insert(VoxelIndex::getKey(point.x, point.y, point.z, inverse_leaf_size_), new_index);
+  if(index == new_index)
+  {
+    VoxelSum sum;
+    sum.x = sum.y = sum.z = sum.intensity = 0.f;
+    sum.count = 0;
+    sum.first_point = point_index;
+    voxel_sums_.push_back(sum);
+  }
+
+  VoxelSum& sum = voxel_sums_[index];
+  sum.x += point.x;
+  sum.y += point.y;
+  sum.z += point.z;
+  addIntensity(sum, point, typename pcl::traits::has_field<PointT, pcl::fields::intensity>::type());
+  sum.count++;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+lidar_pcl::ScanPreprocessor<PointT>::getVoxelCentroids(const pcl::PointCloud<PointT>& scan, 
+                                                       pcl::PointCloud<PointT>& filtered_scan) const
+{
+  filtered_scan.header = scan.header;
+  filtered_scan.points.resize(voxel_sums_.size());
+  for(size_t v = 0; v < voxel_sums_.size(); v++)
+  {
+    // The fields that are not averaged are the ones of the first point of the voxel
+    const VoxelSum& sum = voxel_sums_[v];
+    PointT& centroid = filtered_scan.points[v];
+    centroid = scan.points[sum.first_point];
+    centroid.x = sum.x / sum.count;
+    centroid.y = sum.y / sum.count;
+    centroid.z = sum.z / sum.count;
+    setIntensity(centroid, sum.intensity / sum.count, typename pcl::traits::has_field<PointT, pcl::fields::intensity>::type());
+  }
+  filtered_scan.width = voxel_sums_.size();
+  filtered_scan.height = 1;
+  filtered_scan.is_dense = true;
+}
+
+#endif // LIDAR_PCL_SCAN_PREPROCESSOR_IMPL_H_
@@ -0,0 +1,91 @@
+#ifndef LIDAR_PCL_INCREMENTAL_VOXEL_GRID_H_
+#define LIDAR_PCL_INCREMENTAL_VOXEL_GRID_H_
+
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/mpl/bool.hpp>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/point_traits.h>
+
+#include "lidar_pcl/voxel_index.h"
+
+namespace lidar_pcl
+{
+  /*
+    Voxel grid kept between calls, for maps that keep growing (e.g. the tiles of world_map).
+    Every occupied voxel holds the centroid of all the points ever added to it (x, y, z and intensity
+    if PointT has one, the other fields are the ones of its first point) and their number.
+    Adding points updates the centroids in place, so the map keeps one point per voxel however many
+    times the same place is scanned, and the centroids are stored contiguously as a point cloud
+    that is exported without any copy.
+  */
+  template<typename PointT>
+  class IncrementalVoxelGrid
+  {
+    typedef typename pcl::PointCloud<PointT>::const_iterator PointCloudConstIter;
+
+  private:
+    VoxelIndex voxel_index_; // packed voxel coordinates -> index in centroids_
+    pcl::PointCloud<PointT> centroids_;
+    std::vector<unsigned int> counts_;
+    double leaf_size_;
+    double inverse_leaf_size_;
+
+    void updateCentroid(PointT& centroid, const PointT& point, unsigned int count, boost::mpl::true_) const;
+    void updateCentroid(PointT& centroid, const PointT& point, unsigned int count, boost::mpl::false_) const;
+
+  public:
+    IncrementalVoxelGrid(double leaf_size = 0.2);
+
+    // Changing the leaf size clears the grid
+    void setLeafSize(double leaf_size);
+
+    // Add a point to its voxel, returns true if the voxel was empty (the point is then the new centroid)
+    bool addPoint(const PointT& point);
+
+    // Add all the points of a cloud, returns the number of voxels created
+    unsigned int addPointCloud(const pcl::PointCloud<PointT>& cloud);
+
+    inline double getLeafSize() const
+    {
+      return leaf_size_;
+    }
+
+    // The centroids of the occupied voxels, in order of creation
+    inline const pcl::PointCloud<PointT>& getPointCloud() const
+    {
+      return centroids_;
+    }
+
+    // Number of points added to each voxel, in the order of getPointCloud()
+    inline const std::vector<unsigned int>& getCounts() const
+    {
+      return counts_;
+    }
+
+    inline size_t size() const
+    {
+      return centroids_.points.size();
+    }
+
+    inline bool empty() const
+    {
+      return centroids_.points.empty();
+    }
+
+    inline void clear()
+    {
+      voxel_index_.clear();
+      centroids_.clear();
+      counts_.clear();
+    }
+  };
+}
+
+#include "lidar_pcl/impl/incremental_voxel_grid.hpp"
+
+#endif // LIDAR_PCL_INCREMENTAL_VOXEL_GRID_H_
@@ -4,61 +4,14 @@
 #define PCL_NO_PRECOMPILE // to create a custom pcl point type
 
 #include <pcl_conversions/pcl_conversions.h>
+#include <pcl/common/io.h>
+
+#include "lidar_pcl/point_types.h"
+#include "lidar_pcl/point_cloud2_view.h"
+#include "lidar_pcl/motion_undistortion.h"
 
 namespace lidar_pcl
 {
-  struct PointXYZIR
-  {
-    PCL_ADD_POINT4D; // add x,y,z member + padding
-    union
-    {
-      struct
-      {
-        float intensity;
-        uint16_t ring;
-      };
-      float data_c[4];
-    };
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-
-    inline PointXYZIR()
-    {
-      x = 0.; y = 0.; z = 0.;
-      intensity = 0.;
-      ring = 0;
-    }
-
-    inline PointXYZIR(const lidar_pcl::PointXYZIR &p)
-    {
-      x = p.x; y = p.y; z = p.z;
-      intensity = p.intensity;
-      ring = p.ring;
-    }
-
-    inline PointXYZIR(float _x, float _y, float _z, float _intensity, uint16_t _ring)
-    {
-      x = _x; y = _y; z = _z;
-      intensity = _intensity;
-      ring = _ring;
-    }
-
-    inline PointXYZIR(const uint8_t * source)
-    {
-      memcpy(&x, source, 4);
-      memcpy(&y, source + 4, 4);
-      memcpy(&z, source + 8, 4);
-      memcpy(&intensity, source + 16, 4);
-      memcpy(&ring, source + 20, 4);
-    }
-
-    friend std::ostream& operator<<(std::ostream& os, const PointXYZIR& ret) 
-    { 
-      os << "(" << ret.x << "," << ret.y << "," << ret.z << "," 
-         << ret.intensity << "," << ret.ring << ")" ;  
-      return os;  
-    } 
-  }EIGEN_ALIGN16;
-
   inline float getYawAngleFromPtr(const uint8_t* data)
   {
     float _x, _y;
@@ -84,7 +37,7 @@ namespace lidar_pcl
 
   template <typename PointT>
   void fromPCLPointCloud2Custom(const pcl::PCLPointCloud2& msg, pcl::PointCloud<PointT>& cloud,
-                                const pcl::MsgFieldMap& field_map)
+                                const pcl::MsgFieldMap& field_map, double scan_period = 0.1)
   {
     // Copy info fields
     cloud.header   = msg.header;
@@ -143,30 +96,37 @@ namespace lidar_pcl
             cloud.width = col + 1;
             num_points = row * msg.width + (col + 1);
             cloud.points.resize(num_points);
+            if(pcl::getFieldIndex(msg, "time") < 0)
+              estimatePointTimes(cloud, scan_period);
             return; 
           }
         }
       }
     }
+    if(pcl::getFieldIndex(msg, "time") < 0)
+      estimatePointTimes(cloud, scan_period);
   }
 
   template <typename PointT>
-  void fromROSMsg(const sensor_msgs::PointCloud2& cloud, pcl::PointCloud<PointT> &pcl_cloud)
+  void fromROSMsg(const sensor_msgs::PointCloud2& cloud, pcl::PointCloud<PointT> &pcl_cloud, double scan_period = 0.1)
   {
-    ::pcl::PCLPointCloud2 pcl_pc2;
-    ::pcl_conversions::toPCL(cloud, pcl_pc2);
-    ::pcl::MsgFieldMap field_map;
-    ::pcl::createMapping<PointT>(pcl_pc2.fields, field_map);
-    fromPCLPointCloud2Custom(pcl_pc2, pcl_cloud, field_map);
+    // Read the message buffer in place (single memcpy if its layout is the one of PointT),
+    // no intermediate pcl::PCLPointCloud2 copy. The point times are estimated once cut to a single rotation.
+    PointCloud2View view(cloud);
+    view.copyTo(pcl_cloud, false);
+    if(view.empty() || !view.isValid())
+      return;
+
+    // Keep a single rotation, as fromPCLPointCloud2Custom() does
+    size_t rotation_size = view.getRotationSize();
+    if(rotation_size < view.size())
+    {
+      pcl_cloud.width = (rotation_size - 1) % cloud.width + 1;
+      pcl_cloud.points.resize(rotation_size);
+    }
+    if(!view.hasTime())
+      estimatePointTimes(pcl_cloud, scan_period);
   }
 } // namespace lidar_pcl
 
-POINT_CLOUD_REGISTER_POINT_STRUCT(lidar_pcl::PointXYZIR,  // here we assume a XYZ + "intensity" + ring (as fields)
-                                 (float, x, x)
-                                 (float, y, y)
-                                 (float, z, z)
-                                 (float, intensity, intensity)
-                                 (uint16_t, ring, ring)
-)
-
 #endif // _LIDAR_PCL_H_
\ No newline at end of file
@@ -2,12 +2,17 @@
 #define MOTION_UNDISTORTION_H_
 
 #include <cmath>
+#include <stdexcept>
+#include <vector>
 #include <pcl/common/common.h>
 #include <pcl/common/eigen.h>
 #include <pcl/common/transforms.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <lidar_pcl/data_types.h>
+#include <lidar_pcl/point_types.h>
+
+#include <boost/mpl/bool.hpp>
 
 namespace lidar_pcl
 {
@@ -28,59 +33,240 @@ namespace lidar_pcl
     return difference;
   }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+  inline float fastAtan2(float _y, float _x) // radian value, max error ~1e-5 rad
+  {
+    float ax = std::fabs(_x), ay = std::fabs(_y);
+    float mx = ax > ay ? ax : ay;
+    if(mx == 0.f)
+      return 0.f;
+    float a = (ax > ay ? ay : ax) / mx;
+    float s = a * a;
+    float r = ((((-0.0117212f * s + 0.05265332f) * s - 0.11643287f) * s + 0.19354346f) * s - 0.33262347f) * s + 0.99997726f;
+    r *= a;
+    if(ay > ax)
+      r = 1.57079637f - r;
+    if(_x < 0.f)
+      r = 3.14159274f - r;
+    return _y < 0.f ? -r : r;
+  }
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+  /*
+    Fraction of the rotation swept by the sensor since the first point of the scan, 0 at the first point and
+    1 after a full turn (clamped). The azimuth is unwrapped from a point to the next one, so the points must be given
+    in firing order; the lasers of a firing may be a few degrees apart and CW or CCW rotation both work.
+  */
+  class ScanSweep
+  {
+  private:
+    float previous_azimuth_;
+    float sweep_;
+    bool started_;
+
+  public:
+    ScanSweep()
+      : previous_azimuth_(0.f)
+      , sweep_(0.f)
+      , started_(false)
+    {}
+
+    inline float getFraction(float _x, float _y)
+    {
+      float azimuth = fastAtan2(_y, _x);
+      if(!started_)
+      {
+        previous_azimuth_ = azimuth;
+        started_ = true;
+        return 0.f;
+      }
+
+      float difference = azimuth - previous_azimuth_;
+      if(difference > 3.14159274f)
+        difference -= 6.28318548f;
+      else if(difference < -3.14159274f)
+        difference += 6.28318548f;
+      sweep_ += difference;
+      previous_azimuth_ = azimuth;
+
+      float fraction = std::fabs(sweep_) * 0.159154943f; // 1 / (2 pi)
+      return fraction < 1.f ? fraction : 1.f;
+    }
+  };
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+  /*
+    Motion of the sensor during a scan, relative_tf being the motion from the previous scan pose to the current one
+    (end of scan). A point measured at fraction f of the scan is moved to the end of scan pose by relative_tf^-(1 - f),
+    interpolated with slerp for the rotation and lerp for the translation. The transforms are tabulated over
+    [0, 1] so getting the transform of a point is a single lookup.
+  */
+  class ScanMotion
+  {
+  public:
+    struct Transform
+    {
+      Eigen::Matrix3f rotation;
+      Eigen::Vector3f translation;
+
+      inline Eigen::Vector3f operator()(const Eigen::Vector3f& point) const
+      {
+        return rotation * point + translation;
+      }
+    };
+
+  private:
+    std::vector<Transform> transforms_;
+    float steps_;
+
+  public:
+    ScanMotion(const Eigen::Affine3d& relative_tf, int steps = 2048);
+
+    // Transform of a point measured at fraction (in [0, 1]) of the scan
+    inline const Transform& getTransform(float fraction) const
+    {
+      return transforms_[static_cast<int>(fraction * steps_ + 0.5f)];
+    }
+  };
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+  template <typename PointT>
+  void motionUndistort(pcl::PointCloud<PointT>& scan, const Eigen::Affine3d& relative_tf, const std::vector<float>& fractions)
+  /* Note: fractions gives the time of each point in the scan, 0 at the first firing and 1 at the end of scan pose,
+           std::invalid_argument is thrown if it does not have one fraction per point
+    */
+  {
+    if(fractions.size() != scan.points.size())
+      throw std::invalid_argument("motionUndistort: the number of fractions differs from the number of points");
+
+    const ScanMotion motion(relative_tf);
+    for(size_t n = 0; n < scan.points.size(); n++)
+    {
+      float fraction = fractions[n] < 0.f ? 0.f : (fractions[n] > 1.f ? 1.f : fractions[n]);
+      scan.points[n].getVector3fMap() = motion.getTransform(fraction)(scan.points[n].getVector3fMap());
+    }
+  }
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   template <typename PointT>
-  void motionUndistort(pcl::PointCloud<PointT>& scan, Eigen::Affine3d relative_tf)
+  void motionUndistortByAzimuth(pcl::PointCloud<PointT>& scan, const Eigen::Affine3d& relative_tf)
   /* Note: This function is tested with Velodyne LiDAR scanners (VLP16, HDL32, and HDL64E)
-           where the points in PointCloud are in order of firing sequence
+           where the points in PointCloud are in order of firing sequence.
+           The time of each point is its azimuth swept since the first point, the points are corrected in place.
     */
   {
-    pcl::PointCloud<PointT> scan_packet;
-    std::vector< pcl::PointCloud<PointT> > scan_packet_vector;
-    double base_azimuth = getYawAngle((scan.begin())->x, (scan.begin())->y);
+    const ScanMotion motion(relative_tf);
+    ScanSweep sweep;
+    for(size_t n = 0; n < scan.points.size(); n++)
+    {
+      PointT& point = scan.points[n];
+      point.getVector3fMap() = motion.getTransform(sweep.getFraction(point.x, point.y))(point.getVector3fMap());
+    }
+  }
 
-    for(auto item = scan.begin(); item != scan.end(); item++)
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+  template <typename PointT>
+  void motionUndistortByTime(pcl::PointCloud<PointT>& scan, const Eigen::Affine3d& relative_tf)
+  /* Note: PointT must have a time field (e.g. PointXYZIRT), the scan is taken from its earliest to its latest point
+           and the points can be in any order.
+    */
+  {
+    if(scan.points.empty())
+      return;
+
+    float begin = scan.points[0].time, end = begin;
+    for(size_t n = 1; n < scan.points.size(); n++)
     {
-      double crnt_azimuth = getYawAngle(item->x, item->y);
-      if(std::fabs(calculateMinAngleDist(crnt_azimuth, base_azimuth)) < 0.01) // 0.17 degree is the typical change for 10Hz rotation
-      {
-        scan_packet.push_back(*item);
-      }
-      else // new azimuth reached
+      begin = scan.points[n].time < begin ? scan.points[n].time : begin;
+      end = scan.points[n].time > end ? scan.points[n].time : end;
+    }
+    const float scale = end > begin ? 1.f / (end - begin) : 0.f;
+
+    const ScanMotion motion(relative_tf);
+    for(size_t n = 0; n < scan.points.size(); n++)
+    {
+      PointT& point = scan.points[n];
+      point.getVector3fMap() = motion.getTransform((point.time - begin) * scale)(point.getVector3fMap());
+    }
+  }
+
+  namespace detail
+  {
+    template <typename PointT> inline void
+    motionUndistort(pcl::PointCloud<PointT>& scan, const Eigen::Affine3d& relative_tf, boost::mpl::true_)
+    {
+      motionUndistortByTime(scan, relative_tf);
+    }
+
+    template <typename PointT> inline void
+    motionUndistort(pcl::PointCloud<PointT>& scan, const Eigen::Affine3d& relative_tf, boost::mpl::false_)
+    {
+      motionUndistortByAzimuth(scan, relative_tf);
+    }
+
+    template <typename PointT> inline void
+    estimateFiringTimes(pcl::PointCloud<PointT>& scan, double scan_period, boost::mpl::true_ /*has ring*/)
+    {
+      // A new firing starts when a ring fires again
+      uint64_t fired[4] = {0, 0, 0, 0};
+      unsigned int firing = 0;
+      for(size_t n = 0; n < scan.points.size(); n++)
       {
-        scan_packet_vector.push_back(scan_packet);
-        scan_packet.clear();
-        scan_packet.push_back(*item);
-        base_azimuth = crnt_azimuth;
+        unsigned int ring = scan.points[n].ring & 255;
+        uint64_t bit = static_cast<uint64_t>(1) << (ring & 63);
+        if(fired[ring >> 6] & bit)
+        {
+          fired[0] = fired[1] = fired[2] = fired[3] = 0;
+          firing++;
+        }
+        fired[ring >> 6] |= bit;
+        scan.points[n].time = static_cast<float>(firing);
       }
+
+      const float firing_period = firing > 0 ? static_cast<float>(scan_period / firing) : 0.f;
+      for(size_t n = 0; n < scan.points.size(); n++)
+        scan.points[n].time *= firing_period;
+    }
+
+    template <typename PointT> inline void
+    estimateFiringTimes(pcl::PointCloud<PointT>& scan, double scan_period, boost::mpl::false_ /*no ring*/)
+    {
+      const size_t last = scan.points.size() > 1 ? scan.points.size() - 1 : 1;
+      for(size_t n = 0; n < scan.points.size(); n++)
+        scan.points[n].time = static_cast<float>(scan_period * n / last);
+    }
+
+    template <typename PointT> inline void
+    estimatePointTimes(pcl::PointCloud<PointT>& scan, double scan_period, boost::mpl::true_ /*has time*/)
+    {
+      estimateFiringTimes(scan, scan_period, typename pcl::traits::has_field<PointT, pcl::fields::ring>::type());
     }
 
-    scan.clear();
-
-    Pose relative_pose;
-    pcl::getTranslationAndEulerAngles(relative_tf,
-                                      relative_pose.x, relative_pose.y, relative_pose.z, 
-                                      relative_pose.roll, relative_pose.pitch, relative_pose.yaw);
-    for(int i = 0, npackets = scan_packet_vector.size(); i < npackets; i++)
-    { 
-      Pose current_packet_pose(-relative_pose.x * i / npackets,
-                               -relative_pose.y * i / npackets,
-                               -relative_pose.z * i / npackets,
-                               -relative_pose.roll * i / npackets,
-                               -relative_pose.pitch * i / npackets,
-                               -relative_pose.yaw * i / npackets);
-      Eigen::Affine3d transform;
-      pcl::getTransformation(current_packet_pose.x, 
-                             current_packet_pose.y, 
-                             current_packet_pose.z, 
-                             current_packet_pose.roll, 
-                             current_packet_pose.pitch, 
-                             current_packet_pose.yaw, transform);
-      pcl::PointCloud<PointT> corrected_packet;
-      pcl::transformPointCloud(scan_packet_vector[npackets-1-i], corrected_packet, transform);
-      scan += corrected_packet;
+    template <typename PointT> inline void
+    estimatePointTimes(pcl::PointCloud<PointT>& scan, double scan_period, boost::mpl::false_ /*no time*/)
+    {
     }
   }
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+  template <typename PointT>
+  void motionUndistort(pcl::PointCloud<PointT>& scan, const Eigen::Affine3d& relative_tf)
+  /* Note: The time of the points is their time field if PointT has one, else their azimuth (see motionUndistortByAzimuth)
+    */
+  {
+    detail::motionUndistort(scan, relative_tf, typename pcl::traits::has_field<PointT, pcl::fields::time>::type());
+  }
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+  template <typename PointT>
+  void estimatePointTimes(pcl::PointCloud<PointT>& scan, double scan_period = 0.1)
+  /* Note: For the scans whose driver does not give the time of the points, nothing is done if PointT has no time field.
+           The points must be in order of firing sequence, the firings (every ring fired once) are evenly spread
+           over scan_period, or the points if PointT has no ring.
+    */
+  {
+    detail::estimatePointTimes(scan, scan_period, typename pcl::traits::has_field<PointT, pcl::fields::time>::type());
+  }
 } // namespace lidar_pcl
 
-#endif // MOTION_UNDISTORTION_H_
\ No newline at end of file
+#endif // MOTION_UNDISTORTION_H_
@@ -0,0 +1,213 @@
+#ifndef LIDAR_PCL_POINT_CLOUD2_VIEW_H_
+#define LIDAR_PCL_POINT_CLOUD2_VIEW_H_
+
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/PointField.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_traits.h>
+#include <pcl/conversions.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include "lidar_pcl/motion_undistortion.h"
+
+namespace lidar_pcl
+{
+  /*
+    Non-owning view over the data buffer of a sensor_msgs::PointCloud2.
+    The offsets of the x, y, z, intensity, ring and time fields are looked up once, then every point is read
+    in place with strided accessors (no pcl::PCLPointCloud2 copy, no per point field map loop).
+    copyTo() fills a pcl cloud, with a single memcpy when the message layout is the one of PointT
+    (e.g. lidar_pcl::PointXYZIR and the velodyne_pointcloud points).
+    Note: the message must outlive the view. x, y, z, intensity and time are FLOAT32 or FLOAT64, ring is UINT16
+    or UINT8. The fields whose datatype is not the one of PointT are converted as the accessors read them.
+  */
+  class PointCloud2View
+  {
+  public:
+    struct Field
+    {
+      int offset; // -1 if the message has no such field
+      uint8_t datatype;
+
+      Field() : offset(-1), datatype(0) {}
+    };
+
+    // A field of PointT the message has with another datatype (e.g. a UINT8 ring), left out of the pcl field map
+    struct FieldConversion
+    {
+      size_t struct_offset;
+      uint8_t struct_datatype;
+      Field field;
+    };
+
+  private:
+    const sensor_msgs::PointCloud2* msg_;
+    const uint8_t* data_;
+    uint32_t point_step_;
+    uint32_t row_step_;
+    bool contiguous_; // rows are not padded, point i is at i * point_step
+
+    Field x_, y_, z_, intensity_, ring_, time_;
+
+    inline float readFloat(size_t index, const Field& field) const
+    {
+      if(field.datatype == sensor_msgs::PointField::FLOAT64)
+      {
+        double value;
+        memcpy(&value, getPointData(index) + field.offset, sizeof(double));
+        return static_cast<float>(value);
+      }
+      float value;
+      memcpy(&value, getPointData(index) + field.offset, sizeof(float));
+      return value;
+    }
+
+    inline uint16_t readUInt(size_t index, const Field& field) const
+    {
+      if(field.datatype == sensor_msgs::PointField::UINT8)
+        return getPointData(index)[field.offset];
+      uint16_t value;
+      memcpy(&value, getPointData(index) + field.offset, sizeof(uint16_t));
+      return value;
+    }
+
+    // The field of the message matching a field name of PointT, NULL if the view does not read it
+    const Field* findField(const std::string& name) const;
+
+  public:
+    explicit PointCloud2View(const sensor_msgs::PointCloud2& msg);
+
+    inline const sensor_msgs::PointCloud2& getMessage() const
+    {
+      return *msg_;
+    }
+
+    inline size_t size() const
+    {
+      return static_cast<size_t>(msg_->width) * msg_->height;
+    }
+
+    inline bool empty() const
+    {
+      return size() == 0;
+    }
+
+    inline bool isValid() const
+    {
+      return x_.offset >= 0 && y_.offset >= 0 && z_.offset >= 0;
+    }
+
+    inline bool hasIntensity() const
+    {
+      return intensity_.offset >= 0;
+    }
+
+    inline bool hasRing() const
+    {
+      return ring_.offset >= 0;
+    }
+
+    inline bool hasTime() const
+    {
+      return time_.offset >= 0;
+    }
+
+    // Raw data of the point at index (row major)
+    inline const uint8_t* getPointData(size_t index) const
+    {
+      if(contiguous_)
+        return data_ + index * point_step_;
+      return data_ + (index / msg_->width) * row_step_ + (index % msg_->width) * point_step_;
+    }
+
+    inline float getX(size_t index) const
+    {
+      return readFloat(index, x_);
+    }
+
+    inline float getY(size_t index) const
+    {
+      return readFloat(index, y_);
+    }
+
+    inline float getZ(size_t index) const
+    {
+      return readFloat(index, z_);
+    }
+
+    // 0 if the message has no intensity
+    inline float getIntensity(size_t index) const
+    {
+      return hasIntensity() ? readFloat(index, intensity_) : 0.f;
+    }
+
+    // 0 if the message has no ring
+    inline uint16_t getRing(size_t index) const
+    {
+      return hasRing() ? readUInt(index, ring_) : 0;
+    }
+
+    // 0 if the message has no time
+    inline float getTime(size_t index) const
+    {
+      return hasTime() ? readFloat(index, time_) : 0.f;
+    }
+
+    // Number of points of the first rotation: the scan is cut after the first point back within 45 degrees of the
+    // azimuth of the first one once past it, as fromPCLPointCloud2Custom() does (size() if it never comes back)
+    size_t getRotationSize() const;
+
+    // Mapping of the message fields to the ones of PointT, as pcl::fromROSMsg() uses, and the fields of PointT
+    // the message has with another datatype
+    template <typename PointT>
+    void getFieldMap(pcl::MsgFieldMap& field_map, std::vector<FieldConversion>& conversions) const;
+
+    // True if the points of the message can be copied as is into a pcl::PointCloud<PointT>
+    template <typename PointT>
+    bool hasLayoutOf(const pcl::MsgFieldMap& field_map) const;
+
+    // Copy the fields of the message point at index into point, following field_map, then convert the others
+    template <typename PointT>
+    inline void copyPoint(size_t index, const pcl::MsgFieldMap& field_map, const std::vector<FieldConversion>& conversions,
+                          PointT& point) const
+    {
+      const uint8_t* point_data = getPointData(index);
+      uint8_t* out = reinterpret_cast<uint8_t*>(&point);
+      for(size_t m = 0; m < field_map.size(); m++)
+        memcpy(out + field_map[m].struct_offset, point_data + field_map[m].serialized_offset, field_map[m].size);
+
+      for(size_t c = 0; c < conversions.size(); c++)
+      {
+        const FieldConversion& conversion = conversions[c];
+        if(conversion.struct_datatype == sensor_msgs::PointField::FLOAT32)
+        {
+          float value = readFloat(index, conversion.field);
+          memcpy(out + conversion.struct_offset, &value, sizeof(float));
+        }
+        else if(conversion.struct_datatype == sensor_msgs::PointField::UINT16)
+        {
+          uint16_t value = readUInt(index, conversion.field);
+          memcpy(out + conversion.struct_offset, &value, sizeof(uint16_t));
+        }
+        else
+        {
+          out[conversion.struct_offset] = static_cast<uint8_t>(readUInt(index, conversion.field));
+        }
+      }
+    }
+
+    // Convert the whole message, as pcl::fromROSMsg() does (the point times are estimated over scan_period if PointT
+    // has a time field the message does not have and estimate_times is set, see estimatePointTimes())
+    template <typename PointT>
+    void copyTo(pcl::PointCloud<PointT>& cloud, bool estimate_times = true, double scan_period = 0.1) const;
+  };
+}
+
+#include "lidar_pcl/impl/point_cloud2_view.hpp"
+
+#endif // LIDAR_PCL_POINT_CLOUD2_VIEW_H_
@@ -0,0 +1,137 @@
+#ifndef LIDAR_PCL_POINT_TYPES_H_
+#define LIDAR_PCL_POINT_TYPES_H_
+
+/*
+  Custom point types of the Velodyne scans. To use them with the pcl algorithms, define PCL_NO_PRECOMPILE
+  before including any pcl header (as lidar_pcl.h does).
+*/
+
+#include <cstring>
+#include <ostream>
+#include <stdint.h>
+
+#include <pcl/point_types.h>
+
+namespace lidar_pcl
+{
+  struct PointXYZIR
+  {
+    PCL_ADD_POINT4D; // add x,y,z member + padding
+    union
+    {
+      struct
+      {
+        float intensity;
+        uint16_t ring;
+      };
+      float data_c[4];
+    };
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    inline PointXYZIR()
+    {
+      x = 0.; y = 0.; z = 0.;
+      intensity = 0.;
+      ring = 0;
+    }
+
+    inline PointXYZIR(const lidar_pcl::PointXYZIR &p)
+    {
+      x = p.x; y = p.y; z = p.z;
+      intensity = p.intensity;
+      ring = p.ring;
+    }
+
+    inline PointXYZIR(float _x, float _y, float _z, float _intensity, uint16_t _ring)
+    {
+      x = _x; y = _y; z = _z;
+      intensity = _intensity;
+      ring = _ring;
+    }
+
+    inline PointXYZIR(const uint8_t * source)
+    {
+      memcpy(&x, source, 4);
+      memcpy(&y, source + 4, 4);
+      memcpy(&z, source + 8, 4);
+      memcpy(&intensity, source + 16, 4);
+      memcpy(&ring, source + 20, 4);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const PointXYZIR& ret) 
+    { 
+      os << "(" << ret.x << "," << ret.y << "," << ret.z << "," 
+         << ret.intensity << "," << ret.ring << ")" ;  
+      return os;  
+    } 
+  }EIGEN_ALIGN16;
+
+  // Same layout as velodyne_pointcloud::PointXYZIRT, time is the firing time of the point relative to the scan stamp
+  // (in seconds), see estimatePointTimes() for the scans that do not provide it
+  struct PointXYZIRT
+  {
+    PCL_ADD_POINT4D; // add x,y,z member + padding
+    union
+    {
+      struct
+      {
+        float intensity;
+        uint16_t ring;
+        float time;
+      };
+      float data_c[4];
+    };
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    inline PointXYZIRT()
+    {
+      x = 0.; y = 0.; z = 0.;
+      intensity = 0.;
+      ring = 0;
+      time = 0.;
+    }
+
+    inline PointXYZIRT(const lidar_pcl::PointXYZIRT &p)
+    {
+      x = p.x; y = p.y; z = p.z;
+      intensity = p.intensity;
+      ring = p.ring;
+      time = p.time;
+    }
+
+    inline PointXYZIRT(float _x, float _y, float _z, float _intensity, uint16_t _ring, float _time)
+    {
+      x = _x; y = _y; z = _z;
+      intensity = _intensity;
+      ring = _ring;
+      time = _time;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const PointXYZIRT& ret) 
+    { 
+      os << "(" << ret.x << "," << ret.y << "," << ret.z << "," 
+         << ret.intensity << "," << ret.ring << "," << ret.time << ")" ;  
+      return os;  
+    } 
+  }EIGEN_ALIGN16;
+} // namespace lidar_pcl
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(lidar_pcl::PointXYZIR,  // here we assume a XYZ + "intensity" + ring (as fields)
+                                 (float, x, x)
+                                 (float, y, y)
+                                 (float, z, z)
+                                 (float, intensity, intensity)
+                                 (uint16_t, ring, ring)
+)
+
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(lidar_pcl::PointXYZIRT,  // XYZ + "intensity" + ring + time (as fields)
+                                 (float, x, x)
+                                 (float, y, y)
+                                 (float, z, z)
+                                 (float, intensity, intensity)
+                                 (uint16_t, ring, ring)
+                                 (float, time, time)
+)
+
+#endif // LIDAR_PCL_POINT_TYPES_H_
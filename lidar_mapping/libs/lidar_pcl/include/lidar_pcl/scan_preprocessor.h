@@ -0,0 +1,138 @@
+#ifndef LIDAR_PCL_SCAN_PREPROCESSOR_H_
+#define LIDAR_PCL_SCAN_PREPROCESSOR_H_
+
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/mpl/bool.hpp>
+
+#include <sensor_msgs/PointCloud2.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/point_traits.h>
+#include <pcl/conversions.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include "lidar_pcl/data_types.h"
+#include "lidar_pcl/motion_undistortion.h"
+#include "lidar_pcl/point_cloud2_view.h"
+#include "lidar_pcl/voxel_index.h"
+
+namespace lidar_pcl
+{
+  /*
+    Scan preprocessing as a single pipeline stage, from the PointCloud2 message to the NDT source:
+      1. the points of the first rotation (see PointCloud2View::getRotationSize()) are read straight from the
+         message buffer, the ones closer than the minimum scan range (in the xy plane) or with a non finite
+         coordinate are dropped,
+      2. every point is moved to the end of scan pose as motionUndistort() does (from its time field if PointT
+         has one, estimated from the firing order if the message has none), in place, while the
+         points are accumulated into their voxel (VoxelIndex over the voxel coordinates),
+      3. the voxel centroids (x, y, z and intensity if PointT has one) give the downsampled scan.
+    The output clouds and the internal buffers keep their memory from a scan to the next one.
+    read() only does step 1 and is const, it can run on another thread (e.g. ahead of the alignment of the previous
+    scans, whose pose gives relative_tf), process() on the read scan then does steps 2 and 3.
+    Note: without a time field in the message, the points must be in firing order (Velodyne drivers).
+  */
+  template<typename PointT>
+  class ScanPreprocessor
+  {
+  private:
+    struct VoxelSum
+    {
+      float x, y, z, intensity; // float sums, as pcl::VoxelGrid
+      unsigned int count;
+      unsigned int first_point;
+    };
+
+    typedef typename pcl::traits::has_field<PointT, pcl::fields::time>::type PointHasTime;
+
+    double min_scan_range_;
+    double scan_period_; // duration of a rotation, for the point times the message does not give
+    double voxel_leaf_size_;
+    double inverse_leaf_size_;
+    float time_begin_; // time range of the scan, if PointT has a time field
+    float time_scale_;
+
+    VoxelIndex voxel_index_; // packed voxel coordinates -> index in voxel_sums_
+    std::vector<VoxelSum> voxel_sums_;
+
+    void doProcess(pcl::PointCloud<PointT>& scan, const Eigen::Affine3d& relative_tf, pcl::PointCloud<PointT>& filtered_scan,
+                   const Eigen::Matrix4f* transform, pcl::PointCloud<PointT>* transformed_scan);
+    void resetVoxels(size_t nr_points);
+    void addToVoxel(const PointT& point, unsigned int point_index);
+    void getVoxelCentroids(const pcl::PointCloud<PointT>& scan, pcl::PointCloud<PointT>& filtered_scan) const;
+    // The field specific overloads are member templates, only the ones for the fields of PointT get instantiated
+    template <typename PointInT> void addIntensity(VoxelSum& sum, const PointInT& point, boost::mpl::true_) const { sum.intensity += point.intensity; }
+    template <typename PointInT> void addIntensity(VoxelSum& sum, const PointInT& point, boost::mpl::false_) const {}
+    template <typename PointInT> void setIntensity(PointInT& point, float intensity, boost::mpl::true_) const { point.intensity = intensity; }
+    template <typename PointInT> void setIntensity(PointInT& point, float intensity, boost::mpl::false_) const {}
+    template <typename PointInT> void estimateTimes(const PointCloud2View& view, pcl::PointCloud<PointInT>& scan, boost::mpl::true_) const;
+    template <typename PointInT> void estimateTimes(const PointCloud2View& view, pcl::PointCloud<PointInT>& scan, boost::mpl::false_) const {}
+    template <typename PointInT> void setTimeRange(const pcl::PointCloud<PointInT>& scan, boost::mpl::true_);
+    template <typename PointInT> void setTimeRange(const pcl::PointCloud<PointInT>& scan, boost::mpl::false_) {}
+    template <typename PointInT> float getFraction(const PointInT& point, ScanSweep& sweep, boost::mpl::true_) const { return (point.time - time_begin_) * time_scale_; }
+    template <typename PointInT> float getFraction(const PointInT& point, ScanSweep& sweep, boost::mpl::false_) const { return sweep.getFraction(point.x, point.y); }
+
+  public:
+    ScanPreprocessor();
+
+    inline void setMinScanRange(double min_scan_range)
+    {
+      min_scan_range_ = min_scan_range;
+    }
+
+    inline double getMinScanRange() const
+    {
+      return min_scan_range_;
+    }
+
+    inline void setScanPeriod(double scan_period)
+    {
+      scan_period_ = scan_period;
+    }
+
+    inline double getScanPeriod() const
+    {
+      return scan_period_;
+    }
+
+    inline void setVoxelLeafSize(double voxel_leaf_size)
+    {
+      voxel_leaf_size_ = voxel_leaf_size;
+      inverse_leaf_size_ = 1.0 / voxel_leaf_size;
+    }
+
+    inline double getVoxelLeafSize() const
+    {
+      return voxel_leaf_size_;
+    }
+
+    // Read the points of msg farther than the minimum scan range into scan (thread safe)
+    void read(const sensor_msgs::PointCloud2& msg, pcl::PointCloud<PointT>& scan) const;
+
+    // Undistort (in place) and downsample a scan given by read()
+    // relative_tf: motion of the sensor during the scan (previous to current pose), as for motionUndistort()
+    void process(pcl::PointCloud<PointT>& scan, const Eigen::Affine3d& relative_tf, pcl::PointCloud<PointT>& filtered_scan);
+
+    // Same, also writing the undistorted points moved by transform into transformed_scan
+    void process(pcl::PointCloud<PointT>& scan, const Eigen::Affine3d& relative_tf, pcl::PointCloud<PointT>& filtered_scan,
+                 const Eigen::Matrix4f& transform, pcl::PointCloud<PointT>& transformed_scan);
+
+    // Crop, undistort and downsample the scan of msg (read() then process())
+    // relative_tf: motion of the sensor during the scan (previous to current pose), as for motionUndistort()
+    // scan: the cropped and undistorted points, filtered_scan: their voxel centroids
+    void process(const sensor_msgs::PointCloud2& msg, const Eigen::Affine3d& relative_tf,
+                 pcl::PointCloud<PointT>& scan, pcl::PointCloud<PointT>& filtered_scan);
+
+    // Same, also writing the undistorted points moved by transform into transformed_scan
+    void process(const sensor_msgs::PointCloud2& msg, const Eigen::Affine3d& relative_tf,
+                 pcl::PointCloud<PointT>& scan, pcl::PointCloud<PointT>& filtered_scan,
+                 const Eigen::Matrix4f& transform, pcl::PointCloud<PointT>& transformed_scan);
+  };
+}
+
+#include "lidar_pcl/impl/scan_preprocessor.hpp"
+
+#endif // LIDAR_PCL_SCAN_PREPROCESSOR_H_
@@ -0,0 +1,214 @@
+#ifndef LIDAR_PCL_VOXEL_INDEX_H_
+#define LIDAR_PCL_VOXEL_INDEX_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace lidar_pcl
+{
+  /*
+    Voxel coordinates packed into a 64 bit key and an open addressing hash table from the keys to the index of the
+    voxel in a contiguous array, shared by the voxel grids (ScanPreprocessor, IncrementalVoxelGrid and the fast_pcl
+    VoxelGridCovariance, as pcl::VoxelLeafIndex).
+    Linear probing over a power of two sized table kept at most half full, the slots hold the key and the value side
+    by side so that a lookup usually touches a single cache line.
+  */
+  class VoxelIndex
+  {
+  public:
+    // Voxel coordinates are packed in 21 bits each, i.e. +-2^20 voxels (+-209km with 0.2m voxels)
+    static const int COORD_BITS = 21;
+
+  private:
+    static const uint64_t EMPTY_KEY = ~static_cast<uint64_t>(0); // never a packed key, its top bit is unused
+
+    struct Slot
+    {
+      Slot() : key(EMPTY_KEY), value(-1) {}
+
+      uint64_t key;
+      int value;
+    };
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    size_t size_;
+
+    void rehash(size_t capacity)
+    {
+      std::vector<Slot> old_slots(capacity);
+      old_slots.swap(slots_);
+      mask_ = capacity - 1;
+
+      for(size_t i = 0; i < old_slots.size(); i++)
+      {
+        if(old_slots[i].key == EMPTY_KEY)
+          continue;
+        size_t s = hash(old_slots[i].key) & mask_;
+        while(slots_[s].key != EMPTY_KEY)
+          s = (s + 1) & mask_;
+        slots_[s] = old_slots[i];
+      }
+    }
+
+  public:
+    VoxelIndex() : slots_(), mask_(0), size_(0) {}
+
+    // True if the voxel coordinates can be packed without wrapping around
+    static inline bool inRange(int64_t i, int64_t j, int64_t k)
+    {
+      const int64_t half = static_cast<int64_t>(1) << (COORD_BITS - 1);
+      return i >= -half && i < half && j >= -half && j < half && k >= -half && k < half;
+    }
+
+    // Pack voxel coordinates into a key, the ones out of range (see inRange()) wrap around
+    static inline uint64_t packKey(int64_t i, int64_t j, int64_t k)
+    {
+      const uint64_t mask = (static_cast<uint64_t>(1) << COORD_BITS) - 1;
+      const int64_t half = static_cast<int64_t>(1) << (COORD_BITS - 1);
+      return ((static_cast<uint64_t>(i + half) & mask) << (2 * COORD_BITS)) |
+             ((static_cast<uint64_t>(j + half) & mask) << COORD_BITS) |
+              (static_cast<uint64_t>(k + half) & mask);
+    }
+
+    // Recover the voxel coordinates of a key given by packKey()
+    static inline void unpackKey(uint64_t key, int& i, int& j, int& k)
+    {
+      const uint64_t mask = (static_cast<uint64_t>(1) << COORD_BITS) - 1;
+      const int half = 1 << (COORD_BITS - 1);
+      i = static_cast<int>((key >> (2 * COORD_BITS)) & mask) - half;
+      j = static_cast<int>((key >> COORD_BITS) & mask) - half;
+      k = static_cast<int>(key & mask) - half;
+    }
+
+    // Key of the voxel containing the point (x, y, z)
+    static inline uint64_t getKey(float x, float y, float z, double inverse_leaf_size)
+    {
+      return packKey(static_cast<int64_t>(std::floor(x * inverse_leaf_size)),
+                     static_cast<int64_t>(std::floor(y * inverse_leaf_size)),
+                     static_cast<int64_t>(std::floor(z * inverse_leaf_size)));
+    }
+
+    // Mix the key bits (murmur3 finalizer) so that neighboring voxels spread over the table
+    static inline size_t hash(uint64_t key)
+    {
+      key ^= key >> 33;
+      key *= 0xff51afd7ed558ccdULL;
+      key ^= key >> 33;
+      key *= 0xc4ceb9fe1a85ec53ULL;
+      key ^= key >> 33;
+      return static_cast<size_t>(key);
+    }
+
+    inline size_t size() const
+    {
+      return size_;
+    }
+
+    // Remove all keys, the allocated table is kept for the next fill
+    inline void clear()
+    {
+      std::fill(slots_.begin(), slots_.end(), Slot());
+      size_ = 0;
+    }
+
+    // Make room for n keys without rehashing
+    inline void reserve(size_t n)
+    {
+      size_t capacity = 16;
+      while(capacity < 2 * n)
+        capacity <<= 1;
+      if(capacity > slots_.size())
+        rehash(capacity);
+    }
+
+    // The value stored for key, -1 if key is not present
+    inline int find(uint64_t key) const
+    {
+      if(size_ == 0)
+        return -1;
+
+      for(size_t s = hash(key) & mask_; ; s = (s + 1) & mask_)
+      {
+        if(slots_[s].key == key)
+          return slots_[s].value;
+        if(slots_[s].key == EMPTY_KEY)
+          return -1;
+      }
+    }
+
+    // Insert key with value if it is not present yet, returns the value associated with key after the call
+    inline int insert(uint64_t key, int value)
+    {
+      if(2 * (size_ + 1) > slots_.size())
+        rehash(std::max<size_t>(16, 2 * slots_.size()));
+
+      size_t s = hash(key) & mask_;
+      while(slots_[s].key != EMPTY_KEY)
+      {
+        if(slots_[s].key == key)
+          return slots_[s].value;
+        s = (s + 1) & mask_;
+      }
+
+      slots_[s].key = key;
+      slots_[s].value = value;
+      ++size_;
+      return value;
+    }
+
+    // Change the value stored for a key already present, returns false if key is not present
+    inline bool assign(uint64_t key, int value)
+    {
+      if(size_ == 0)
+        return false;
+
+      for(size_t s = hash(key) & mask_; slots_[s].key != EMPTY_KEY; s = (s + 1) & mask_)
+      {
+        if(slots_[s].key == key)
+        {
+          slots_[s].value = value;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Remove key, the probe sequence is repaired by shifting back the following slots
+    // Returns false if key is not present
+    inline bool erase(uint64_t key)
+    {
+      if(size_ == 0)
+        return false;
+
+      size_t s = hash(key) & mask_;
+      while(slots_[s].key != key)
+      {
+        if(slots_[s].key == EMPTY_KEY)
+          return false;
+        s = (s + 1) & mask_;
+      }
+
+      // Move back every following slot that can not be reached anymore once s is emptied
+      size_t next = (s + 1) & mask_;
+      while(slots_[next].key != EMPTY_KEY)
+      {
+        size_t home = hash(slots_[next].key) & mask_;
+        if(((next - home) & mask_) >= ((next - s) & mask_))
+        {
+          slots_[s] = slots_[next];
+          s = next;
+        }
+        next = (next + 1) & mask_;
+      }
+      slots_[s] = Slot();
+      --size_;
+      return true;
+    }
+  };
+}
+
+#endif // LIDAR_PCL_VOXEL_INDEX_H_
@@ -0,0 +1,7 @@
+#include <pcl/point_types.h>
+#include "lidar_pcl/incremental_voxel_grid.h"
+#include "lidar_pcl/impl/incremental_voxel_grid.hpp"
+
+template class PCL_EXPORTS lidar_pcl::IncrementalVoxelGrid<pcl::PointXYZ>;
+template class PCL_EXPORTS lidar_pcl::IncrementalVoxelGrid<pcl::PointXYZI>;
+template class PCL_EXPORTS lidar_pcl::IncrementalVoxelGrid<pcl::PointXYZRGB>;
@@ -1 +1,18 @@
-#include "lidar_pcl/motion_undistortion.h"
\ No newline at end of file
+#include "lidar_pcl/motion_undistortion.h"
+
+lidar_pcl::ScanMotion::ScanMotion(const Eigen::Affine3d& relative_tf, int steps)
+  : transforms_(steps + 1)
+  , steps_(static_cast<float>(steps))
+{
+  // Motion from the pose at fraction f to the end of scan pose: relative_tf^-(1 - f)
+  const Eigen::Affine3d inverse_tf = relative_tf.inverse();
+  const Eigen::Quaterniond identity = Eigen::Quaterniond::Identity();
+  const Eigen::Quaterniond inverse_rotation(inverse_tf.linear());
+  const Eigen::Vector3d inverse_translation = inverse_tf.translation();
+  for(int k = 0; k <= steps; k++)
+  {
+    double ratio = 1.0 - static_cast<double>(k) / steps;
+    transforms_[k].rotation = identity.slerp(ratio, inverse_rotation).toRotationMatrix().cast<float>();
+    transforms_[k].translation = (ratio * inverse_translation).cast<float>();
+  }
+}
@@ -0,0 +1,85 @@
+#include <cmath>
+
+#include "lidar_pcl/point_cloud2_view.h"
+
+lidar_pcl::PointCloud2View::PointCloud2View(const sensor_msgs::PointCloud2& msg)
+  : msg_(&msg)
+  , data_(msg.data.empty() ? NULL : &msg.data[0])
+  , point_step_(msg.point_step)
+  , row_step_(msg.row_step)
+  , contiguous_(msg.height <= 1 || msg.row_step == msg.width * msg.point_step)
+{
+  for(size_t f = 0; f < msg.fields.size(); f++)
+  {
+    const sensor_msgs::PointField& field = msg.fields[f];
+    Field* view_field = NULL;
+    if(field.datatype == sensor_msgs::PointField::FLOAT32 || field.datatype == sensor_msgs::PointField::FLOAT64)
+    {
+      if(field.name == "x")
+        view_field = &x_;
+      else if(field.name == "y")
+        view_field = &y_;
+      else if(field.name == "z")
+        view_field = &z_;
+      else if(field.name == "intensity")
+        view_field = &intensity_;
+      else if(field.name == "time")
+        view_field = &time_;
+    }
+    else if(field.name == "ring" && (field.datatype == sensor_msgs::PointField::UINT16 || 
+                                     field.datatype == sensor_msgs::PointField::UINT8))
+    {
+      view_field = &ring_;
+    }
+
+    if(view_field != NULL)
+    {
+      view_field->offset = field.offset;
+      view_field->datatype = field.datatype;
+    }
+  }
+}
+
+const lidar_pcl::PointCloud2View::Field* lidar_pcl::PointCloud2View::findField(const std::string& name) const
+{
+  const Field* field = NULL;
+  if(name == "x")
+    field = &x_;
+  else if(name == "y")
+    field = &y_;
+  else if(name == "z")
+    field = &z_;
+  else if(name == "intensity")
+    field = &intensity_;
+  else if(name == "ring")
+    field = &ring_;
+  else if(name == "time")
+    field = &time_;
+  return (field != NULL && field->offset >= 0) ? field : NULL;
+}
+
+size_t lidar_pcl::PointCloud2View::getRotationSize() const
+{
+  if(empty() || !isValid())
+    return size();
+
+  // Azimuths in degree, assuming CW (-) rotation (checked with all current models)
+  const double to_degree = 180 / 3.14159265359;
+  const double origin_angle = std::atan2(getY(0), getX(0)) * to_degree;
+  const double stop_threshold = 45.0;
+  bool half_circle_check = false;
+  for(size_t n = 0; n < size(); n++)
+  {
+    double relative_angle = std::atan2(getY(n), getX(n)) * to_degree - origin_angle;
+    if(relative_angle >= 180.0)
+      relative_angle -= 360.0;
+    else if(relative_angle <= -180.0)
+      relative_angle += 360.0;
+
+    if(!half_circle_check)
+      half_circle_check = std::fabs(relative_angle) > stop_threshold;
+    else if(std::fabs(relative_angle) <= stop_threshold)
+      return n + 1; // 360 degree has been traversed through
+  }
+  return size();
+}
@@ -0,0 +1,8 @@
+#include <pcl/point_types.h>
+#include "lidar_pcl/point_types.h"
+#include "lidar_pcl/scan_preprocessor.h"
+#include "lidar_pcl/impl/scan_preprocessor.hpp"
+
+template class PCL_EXPORTS lidar_pcl::ScanPreprocessor<pcl::PointXYZ>;
+template class PCL_EXPORTS lidar_pcl::ScanPreprocessor<pcl::PointXYZI>;
+template class PCL_EXPORTS lidar_pcl::ScanPreprocessor<lidar_pcl::PointXYZIRT>;
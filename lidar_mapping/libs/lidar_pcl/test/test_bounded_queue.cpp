@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <lidar_pcl/bounded_queue.h>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(BoundedQueue, CloseDrainsRemainingItems)
+{
+  lidar_pcl::BoundedQueue<int> queue(3);
+  EXPECT_TRUE(queue.push(1));
+  EXPECT_TRUE(queue.push(2));
+  queue.close();
+
+  // Pushes are refused once closed, the items already queued are still popped in order
+  EXPECT_FALSE(queue.push(3));
+  EXPECT_EQ(queue.size(), 2u);
+  int item = 0;
+  EXPECT_TRUE(queue.pop(item));
+  EXPECT_EQ(item, 1);
+  EXPECT_TRUE(queue.pop(item));
+  EXPECT_EQ(item, 2);
+  EXPECT_FALSE(queue.pop(item));
+  EXPECT_FALSE(queue.pop(item));
+  EXPECT_EQ(item, 2);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(BoundedQueue, CloseWakesBlockedThreads)
+{
+  // A consumer waiting on an empty queue returns false
+  lidar_pcl::BoundedQueue<int> empty_queue(1);
+  std::atomic<int> popped(-1);
+  std::thread consumer([&]{ int item; popped = empty_queue.pop(item) ? 1 : 0; });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(popped, -1);
+  empty_queue.close();
+  consumer.join();
+  EXPECT_EQ(popped, 0);
+
+  // A producer waiting on a full queue gives up its item
+  lidar_pcl::BoundedQueue<int> full_queue(1);
+  EXPECT_TRUE(full_queue.push(1));
+  std::atomic<int> pushed(-1);
+  std::thread producer([&]{ pushed = full_queue.push(2) ? 1 : 0; });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(pushed, -1);
+  full_queue.close();
+  producer.join();
+  EXPECT_EQ(pushed, 0);
+  EXPECT_EQ(full_queue.size(), 1u);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(BoundedQueue, PipelineKeepsOrder)
+{
+  // Two stages linked by small queues: every item goes through in order and the producer stays within capacity
+  const int nr_items = 100000;
+  lidar_pcl::BoundedQueue<int> first(2), second(3);
+  std::atomic<size_t> max_size(0);
+
+  std::thread producer([&]
+  {
+    for(int i = 0; i < nr_items; i++)
+      first.push(i);
+    first.close();
+  });
+  std::thread stage([&]
+  {
+    int item;
+    while(first.pop(item))
+    {
+      size_t size = first.size();
+      if(size > max_size)
+        max_size = size;
+      second.push(2 * item);
+    }
+    second.close();
+  });
+
+  int item, expected = 0;
+  while(second.pop(item))
+  {
+    EXPECT_EQ(item, 2 * expected);
+    expected++;
+  }
+  producer.join();
+  stage.join();
+  EXPECT_EQ(expected, nr_items);
+  EXPECT_LE(max_size, 2u);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
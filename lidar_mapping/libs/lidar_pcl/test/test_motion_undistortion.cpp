@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include <lidar_pcl/motion_undistortion.h>
+
+typedef pcl::PointXYZI PointT;
+
+namespace
+{
+// The previous lidar_pcl::motionUndistort: the scan is split into packets of equal azimuth, the packet i from the end
+// is moved by the Euler angles and translation of relative_tf scaled by -i / npackets, the last packet is dropped.
+void perPacketUndistort(pcl::PointCloud<PointT>& scan, const Eigen::Affine3d& relative_tf)
+{
+  pcl::PointCloud<PointT> scan_packet;
+  std::vector< pcl::PointCloud<PointT> > scan_packet_vector;
+  double base_azimuth = lidar_pcl::getYawAngle(scan.points[0].x, scan.points[0].y);
+
+  for(size_t n = 0; n < scan.points.size(); n++)
+  {
+    double crnt_azimuth = lidar_pcl::getYawAngle(scan.points[n].x, scan.points[n].y);
+    if(std::fabs(lidar_pcl::calculateMinAngleDist(crnt_azimuth, base_azimuth)) < 0.01)
+    {
+      scan_packet.push_back(scan.points[n]);
+    }
+    else
+    {
+      scan_packet_vector.push_back(scan_packet);
+      scan_packet.clear();
+      scan_packet.push_back(scan.points[n]);
+      base_azimuth = crnt_azimuth;
+    }
+  }
+
+  scan.clear();
+
+  double x, y, z, roll, pitch, yaw;
+  pcl::getTranslationAndEulerAngles(relative_tf, x, y, z, roll, pitch, yaw);
+  for(int i = 0, npackets = scan_packet_vector.size(); i < npackets; i++)
+  {
+    double s = -static_cast<double>(i) / npackets;
+    Eigen::Affine3d transform;
+    pcl::getTransformation(x * s, y * s, z * s, roll * s, pitch * s, yaw * s, transform);
+    pcl::PointCloud<PointT> corrected_packet;
+    pcl::transformPointCloud(scan_packet_vector[npackets - 1 - i], corrected_packet, transform);
+    scan += corrected_packet;
+  }
+}
+
+// A clockwise scan of columns firing every ring at the same azimuth, the intensity holds the index of the point
+pcl::PointCloud<PointT> makeScan(int columns, int rings)
+{
+  srand(3);
+  pcl::PointCloud<PointT> scan;
+  for(int c = 0; c < columns; c++)
+  {
+    double azimuth = -2 * M_PI * c / columns;
+    for(int r = 0; r < rings; r++)
+    {
+      double elevation = (-15.0 + 30.0 * r / (rings - 1)) * M_PI / 180;
+      double range = 5.0 + 35.0 * rand() / RAND_MAX;
+      PointT p;
+      p.x = range * std::cos(elevation) * std::cos(azimuth);
+      p.y = range * std::cos(elevation) * std::sin(azimuth);
+      p.z = range * std::sin(elevation);
+      p.intensity = scan.points.size();
+      scan.push_back(p);
+    }
+  }
+  return scan;
+}
+
+// relative_tf^-(1 - fraction), slerp for the rotation and lerp for the translation
+Eigen::Vector3f exactUndistort(const Eigen::Vector3f& point, const Eigen::Affine3d& relative_tf, double fraction)
+{
+  Eigen::Affine3d inverse = relative_tf.inverse();
+  double rest = 1.0 - fraction;
+  Eigen::Quaterniond rotation = Eigen::Quaterniond::Identity().slerp(rest, Eigen::Quaterniond(inverse.linear()));
+  return (rotation * point.cast<double>() + rest * inverse.translation()).cast<float>();
+}
+
+// Compare a motion the per-packet code handled exactly (a translation or a rotation about a single axis)
+void expectSameAsPerPacket(const Eigen::Affine3d& relative_tf, double max_motion)
+{
+  const int columns = 1800, rings = 16;
+  pcl::PointCloud<PointT> scan = makeScan(columns, rings), packets = scan;
+  lidar_pcl::motionUndistort(scan, relative_tf);
+  perPacketUndistort(packets, relative_tf);
+
+  // The points stay in place and the last column is kept
+  ASSERT_EQ(scan.points.size(), static_cast<size_t>(columns * rings));
+  ASSERT_EQ(packets.points.size(), static_cast<size_t>((columns - 1) * rings));
+  for(size_t n = 0; n < scan.points.size(); n++)
+    ASSERT_EQ(scan.points[n].intensity, static_cast<float>(n));
+
+  // The packets were one column late, the table of transforms is 1/2048 of the scan
+  double tolerance = (2.0 / columns + 1.0 / 2048) * max_motion + 1e-4;
+  for(size_t n = 0; n < packets.points.size(); n++)
+  {
+    const PointT& p = packets.points[n];
+    const PointT& q = scan.points[static_cast<size_t>(p.intensity)];
+    EXPECT_NEAR(p.x, q.x, tolerance);
+    EXPECT_NEAR(p.y, q.y, tolerance);
+    EXPECT_NEAR(p.z, q.z, tolerance);
+  }
+}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(MotionUndistortion, SameAsPerPacketForTranslation)
+{
+  Eigen::Affine3d relative_tf;
+  pcl::getTransformation(1.2, -0.4, 0.05, 0.0, 0.0, 0.0, relative_tf);
+  expectSameAsPerPacket(relative_tf, 1.3);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(MotionUndistortion, SameAsPerPacketForYaw)
+{
+  Eigen::Affine3d relative_tf;
+  pcl::getTransformation(0.0, 0.0, 0.0, 0.0, 0.0, 0.05, relative_tf);
+  // 0.05 rad at 40 m
+  expectSameAsPerPacket(relative_tf, 2.0);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(MotionUndistortion, ExactInverseMotion)
+{
+  // With a rotation on every axis the per-packet code was off by the negated Euler angles, compare with the exact motion
+  const int columns = 1800, rings = 16;
+  pcl::PointCloud<PointT> scan = makeScan(columns, rings), by_azimuth = scan, by_fraction = scan;
+  Eigen::Affine3d relative_tf;
+  pcl::getTransformation(1.2, 0.1, 0.02, 0.01, 0.005, 0.05, relative_tf);
+
+  std::vector<float> fractions(scan.points.size());
+  for(size_t n = 0; n < scan.points.size(); n++)
+    fractions[n] = static_cast<float>(n / rings) / columns;
+
+  lidar_pcl::motionUndistort(by_azimuth, relative_tf);
+  lidar_pcl::motionUndistort(by_fraction, relative_tf, fractions);
+
+  // Table step of 1/2048 of a motion of 1.2 m and 0.05 rad at 40 m
+  double tolerance = 1.0 / 2048 * 3.3 + 1e-4;
+  for(size_t n = 0; n < scan.points.size(); n++)
+  {
+    Eigen::Vector3f exact = exactUndistort(scan.points[n].getVector3fMap(), relative_tf, fractions[n]);
+    EXPECT_LT((by_fraction.points[n].getVector3fMap() - exact).norm(), tolerance);
+    EXPECT_LT((by_azimuth.points[n].getVector3fMap() - exact).norm(), tolerance);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(MotionUndistortion, FractionBounds)
+{
+  pcl::PointCloud<PointT> scan = makeScan(10, 4), corrected = scan;
+  Eigen::Affine3d relative_tf;
+  pcl::getTransformation(0.5, 0.2, 0.1, 0.02, -0.01, 0.1, relative_tf);
+
+  // The end of scan points do not move, the first ones (and the fractions out of [0, 1]) get the whole inverse motion
+  std::vector<float> fractions(scan.points.size(), 1.f);
+  for(size_t n = 0; n < scan.points.size(); n += 3)
+    fractions[n] = (n % 2) ? 0.f : -0.5f;
+  fractions[1] = 1.5f;
+  lidar_pcl::motionUndistort(corrected, relative_tf, fractions);
+
+  for(size_t n = 0; n < scan.points.size(); n++)
+  {
+    Eigen::Vector3f expected = fractions[n] < 1.f ? (relative_tf.inverse().cast<float>() * scan.points[n].getVector3fMap())
+                                                  : Eigen::Vector3f(scan.points[n].getVector3fMap());
+    EXPECT_LT((corrected.points[n].getVector3fMap() - expected).norm(), 1e-4);
+    EXPECT_EQ(corrected.points[n].intensity, scan.points[n].intensity);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(MotionUndistortion, FractionCountMismatch)
+{
+  pcl::PointCloud<PointT> scan = makeScan(10, 4), corrected = scan;
+  Eigen::Affine3d relative_tf;
+  pcl::getTransformation(0.5, 0.2, 0.1, 0.02, -0.01, 0.1, relative_tf);
+
+  // One fraction short: nothing is read past the fractions, the scan is left as is
+  std::vector<float> fractions(scan.points.size() - 1, 0.f);
+  EXPECT_THROW(lidar_pcl::motionUndistort(corrected, relative_tf, fractions), std::invalid_argument);
+  for(size_t n = 0; n < scan.points.size(); n++)
+    EXPECT_EQ(corrected.points[n].getVector3fMap(), scan.points[n].getVector3fMap());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
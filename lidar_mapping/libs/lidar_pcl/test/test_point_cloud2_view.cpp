@@ -0,0 +1,241 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <lidar_pcl/point_cloud2_view.h>
+#include <lidar_pcl/point_types.h>
+
+namespace
+{
+struct FieldSpec
+{
+  const char* name;
+  uint8_t datatype;
+};
+
+size_t datatypeSize(uint8_t datatype)
+{
+  switch(datatype)
+  {
+    case sensor_msgs::PointField::UINT8: return 1;
+    case sensor_msgs::PointField::UINT16: return 2;
+    case sensor_msgs::PointField::FLOAT64: return 8;
+    default: return 4;
+  }
+}
+
+void writeValue(uint8_t* data, uint8_t datatype, double value)
+{
+  if(datatype == sensor_msgs::PointField::UINT8)
+  {
+    data[0] = static_cast<uint8_t>(value);
+  }
+  else if(datatype == sensor_msgs::PointField::UINT16)
+  {
+    uint16_t v = static_cast<uint16_t>(value);
+    memcpy(data, &v, sizeof(v));
+  }
+  else if(datatype == sensor_msgs::PointField::FLOAT64)
+  {
+    memcpy(data, &value, sizeof(value));
+  }
+  else
+  {
+    float v = static_cast<float>(value);
+    memcpy(data, &v, sizeof(v));
+  }
+}
+
+// Expected values of the point n of the messages
+double fieldValue(const std::string& name, size_t n)
+{
+  if(name == "x")
+    return 10.0 * std::cos(n * 0.01) + 0.25;
+  if(name == "y")
+    return 10.0 * std::sin(n * 0.01) - 0.5;
+  if(name == "z")
+    return -1.0 + 0.001 * n;
+  if(name == "intensity")
+    return n % 200;
+  if(name == "ring")
+    return n % 32;
+  return 0.1 * n / 1000; // time
+}
+
+// A message of width x height points with the given fields packed in order, rows padded with row_padding bytes
+sensor_msgs::PointCloud2 makeMessage(const std::vector<FieldSpec>& specs, uint32_t width, uint32_t height,
+                                     uint32_t row_padding = 0)
+{
+  sensor_msgs::PointCloud2 msg;
+  msg.width = width;
+  msg.height = height;
+  msg.is_bigendian = false;
+  msg.is_dense = true;
+
+  uint32_t offset = 0;
+  for(size_t f = 0; f < specs.size(); f++)
+  {
+    sensor_msgs::PointField field;
+    field.name = specs[f].name;
+    field.offset = offset;
+    field.datatype = specs[f].datatype;
+    field.count = 1;
+    msg.fields.push_back(field);
+    offset += datatypeSize(specs[f].datatype);
+  }
+  msg.point_step = (offset + 3) / 4 * 4;
+  msg.row_step = msg.point_step * width + row_padding;
+  msg.data.assign(msg.row_step * height, 0);
+
+  for(size_t n = 0; n < static_cast<size_t>(width) * height; n++)
+  {
+    uint8_t* point = &msg.data[(n / width) * msg.row_step + (n % width) * msg.point_step];
+    for(size_t f = 0; f < msg.fields.size(); f++)
+      writeValue(point + msg.fields[f].offset, msg.fields[f].datatype, fieldValue(msg.fields[f].name, n));
+  }
+  return msg;
+}
+
+std::vector<FieldSpec> makeSpecs(uint8_t float_type, uint8_t ring_type, bool with_time)
+{
+  FieldSpec xyzi[] = {{"x", float_type}, {"y", float_type}, {"z", float_type}, {"intensity", float_type}};
+  std::vector<FieldSpec> specs(xyzi, xyzi + 4);
+  FieldSpec ring = {"ring", ring_type};
+  specs.push_back(ring);
+  if(with_time)
+  {
+    FieldSpec time = {"time", float_type};
+    specs.push_back(time);
+  }
+  return specs;
+}
+
+void expectPoints(const lidar_pcl::PointCloud2View& view, const pcl::PointCloud<lidar_pcl::PointXYZIRT>& cloud,
+                  bool with_time)
+{
+  ASSERT_EQ(cloud.points.size(), view.size());
+  for(size_t n = 0; n < view.size(); n++)
+  {
+    EXPECT_FLOAT_EQ(view.getX(n), static_cast<float>(fieldValue("x", n)));
+    EXPECT_FLOAT_EQ(view.getY(n), static_cast<float>(fieldValue("y", n)));
+    EXPECT_FLOAT_EQ(view.getZ(n), static_cast<float>(fieldValue("z", n)));
+    EXPECT_FLOAT_EQ(view.getIntensity(n), static_cast<float>(fieldValue("intensity", n)));
+    EXPECT_EQ(view.getRing(n), static_cast<uint16_t>(fieldValue("ring", n)));
+
+    const lidar_pcl::PointXYZIRT& p = cloud.points[n];
+    EXPECT_EQ(p.x, view.getX(n));
+    EXPECT_EQ(p.y, view.getY(n));
+    EXPECT_EQ(p.z, view.getZ(n));
+    EXPECT_EQ(p.intensity, view.getIntensity(n));
+    EXPECT_EQ(p.ring, view.getRing(n));
+    if(with_time)
+    {
+      EXPECT_EQ(p.time, view.getTime(n));
+    }
+  }
+}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(PointCloud2View, Layouts)
+{
+  const uint8_t float_types[] = {sensor_msgs::PointField::FLOAT32, sensor_msgs::PointField::FLOAT64};
+  const uint8_t ring_types[] = {sensor_msgs::PointField::UINT16, sensor_msgs::PointField::UINT8};
+  for(int f = 0; f < 2; f++)
+    for(int r = 0; r < 2; r++)
+    {
+      SCOPED_TRACE(static_cast<int>(float_types[f]) * 10 + ring_types[r]);
+      sensor_msgs::PointCloud2 msg = makeMessage(makeSpecs(float_types[f], ring_types[r], true), 100, 1);
+      lidar_pcl::PointCloud2View view(msg);
+      EXPECT_TRUE(view.isValid());
+      EXPECT_TRUE(view.hasIntensity());
+      EXPECT_TRUE(view.hasRing());
+      EXPECT_TRUE(view.hasTime());
+
+      pcl::PointCloud<lidar_pcl::PointXYZIRT> cloud;
+      view.copyTo(cloud);
+      expectPoints(view, cloud, true);
+      for(size_t n = 0; n < view.size(); n++)
+        EXPECT_FLOAT_EQ(view.getTime(n), static_cast<float>(fieldValue("time", n)));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(PointCloud2View, OrganizedRows)
+{
+  // Padded rows are read row by row, with the memory layout of PointXYZIRT (x y z _ intensity ring _ time _) and without
+  const uint8_t float32 = sensor_msgs::PointField::FLOAT32;
+  FieldSpec same[] = {{"x", float32}, {"y", float32}, {"z", float32}, {"pad", float32},
+                      {"intensity", float32}, {"ring", sensor_msgs::PointField::UINT16}, {"pad16", sensor_msgs::PointField::UINT16},
+                      {"time", float32}, {"pad", float32}};
+  std::vector<FieldSpec> specs(same, same + 9);
+  sensor_msgs::PointCloud2 msg = makeMessage(specs, 25, 4, 12);
+  ASSERT_EQ(msg.point_step, sizeof(lidar_pcl::PointXYZIRT));
+
+  lidar_pcl::PointCloud2View view(msg);
+  pcl::PointCloud<lidar_pcl::PointXYZIRT> cloud;
+  view.copyTo(cloud);
+  EXPECT_EQ(cloud.width, 25u);
+  EXPECT_EQ(cloud.height, 4u);
+  expectPoints(view, cloud, true);
+
+  msg = makeMessage(makeSpecs(float32, sensor_msgs::PointField::UINT8, true), 25, 4, 12);
+  lidar_pcl::PointCloud2View converted_view(msg);
+  converted_view.copyTo(cloud);
+  expectPoints(converted_view, cloud, true);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(PointCloud2View, MissingFields)
+{
+  // No time: the view reads 0 and copyTo estimates the firing times over the 0.1 s scan
+  sensor_msgs::PointCloud2 msg = makeMessage(makeSpecs(sensor_msgs::PointField::FLOAT32, sensor_msgs::PointField::UINT16, false), 320, 1);
+  lidar_pcl::PointCloud2View view(msg);
+  EXPECT_FALSE(view.hasTime());
+  EXPECT_EQ(view.getTime(5), 0.f);
+
+  pcl::PointCloud<lidar_pcl::PointXYZIRT> cloud;
+  view.copyTo(cloud, false);
+  expectPoints(view, cloud, false);
+  view.copyTo(cloud);
+  // A firing per 32 rings
+  for(size_t n = 0; n < cloud.points.size(); n++)
+    EXPECT_NEAR(cloud.points[n].time, 0.1 * (n / 32) / 9, 1e-6);
+
+  // No ring nor intensity
+  FieldSpec xyz[] = {{"x", sensor_msgs::PointField::FLOAT32}, {"y", sensor_msgs::PointField::FLOAT32},
+                     {"z", sensor_msgs::PointField::FLOAT32}};
+  msg = makeMessage(std::vector<FieldSpec>(xyz, xyz + 3), 10, 1);
+  lidar_pcl::PointCloud2View xyz_view(msg);
+  EXPECT_TRUE(xyz_view.isValid());
+  EXPECT_FALSE(xyz_view.hasIntensity());
+  EXPECT_FALSE(xyz_view.hasRing());
+  EXPECT_EQ(xyz_view.getIntensity(3), 0.f);
+  EXPECT_EQ(xyz_view.getRing(3), 0);
+
+  // No z
+  msg = makeMessage(std::vector<FieldSpec>(xyz, xyz + 2), 10, 1);
+  EXPECT_FALSE(lidar_pcl::PointCloud2View(msg).isValid());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TEST(PointCloud2View, RotationSize)
+{
+  // About 0.01 rad per point (the circle is slightly off center), the first point is at -2.8 degrees: the point 547 is
+  // the first one back within 45 degrees of it
+  const uint8_t float32 = sensor_msgs::PointField::FLOAT32;
+  sensor_msgs::PointCloud2 msg = makeMessage(makeSpecs(float32, sensor_msgs::PointField::UINT16, false), 700, 1);
+  EXPECT_EQ(lidar_pcl::PointCloud2View(msg).getRotationSize(), 548u);
+
+  // Less than a rotation
+  msg = makeMessage(makeSpecs(float32, sensor_msgs::PointField::UINT16, false), 500, 1);
+  EXPECT_EQ(lidar_pcl::PointCloud2View(msg).getRotationSize(), 500u);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
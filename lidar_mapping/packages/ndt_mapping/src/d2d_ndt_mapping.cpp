@@ -40,17 +40,9 @@
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
 
-#ifdef USE_FAST_PCL
-#include <fast_pcl/registration/ndt.h>
-#include <fast_pcl/filters/voxel_grid.h>
-#else
-#include <pcl/registration/ndt.h>
-#include <pcl/filters/voxel_grid.h>
-#endif
-
-// perception_oru packages
-#include <ndt_registration/ndt_matcher_d2d.h>
-#include <ndt_map/pointcloud_utils.h>
+#include <lidar_pcl/motion_undistortion.h>
+
+#include <fast_pcl/registration/ndt_d2d.h>
 
 // Here are the functions I wrote. De-comment to use
 #define TILE_WIDTH 35 // Maximum range of LIDAR 32E is 70m
@@ -129,10 +121,13 @@ static pcl::PointCloud<pcl::PointXYZI> local_map;
 static std::mutex mtx;
 static Key local_key, previous_key;
 
-static pcl::NormalDistributionsTransform<pcl::PointXYZI, pcl::PointXYZI> ndt;
+static pcl::NormalDistributionsTransformD2D<pcl::PointXYZI, pcl::PointXYZI> ndt;
 // Default values
 static int max_iter = 300;       // Maximum iterations
-static float ndt_res = 2.8;      // Resolution
+static float ndt_res = 1.0;      // Resolution
+// Coarser resolutions aligned before ndt_res, always from coarse to fine. Not the schedule of the former
+// lslgeneric::NDTMatcherD2D, which iterated its {1, 1, 5, 4.5} from the end: 4.5, 5, 1 then 1 again.
+static std::vector<float> resolution_pyramid = {5.0, 4.5};
 static double step_size = 0.05;   // Step size
 static double trans_eps = 0.001;  // Transformation epsilon
 
@@ -157,81 +152,12 @@ static Eigen::Matrix4d tf_btol, tf_ltob;
 static bool isMapUpdate = true;
 
 static double fitness_score;
+static pcl::NDTFitness ndt_fitness;
 
 // File name get from time
 std::time_t process_begin = std::time(NULL);
 std::tm* pnow = std::localtime(&process_begin);
 
-inline double getYawAngle(double _x, double _y)
-{
-  return std::atan2(_y, _x) * 180 / 3.14159265359; // degree value
-}
-
-inline double calculateMinAngleDist(double first, double second) // in degree
-{
-  double difference = first - second;
-  if(difference >= 180.0)
-    return difference - 360.0;
-  if(difference <= -180.0)
-    return difference + 360.0;
-  return difference;
-}
-
-void correctLIDARscan(pcl::PointCloud<pcl::PointXYZI>& scan, Eigen::Affine3d relative_tf, double scan_interval)
-{
-  // Correct scan using vel
-  pcl::PointCloud<pcl::PointXYZI> scan_packet;
-  std::vector<pcl::PointCloud<pcl::PointXYZI>> scan_packets_vector;
-  double base_azimuth = getYawAngle((scan.begin())->x, (scan.begin())->y);
-  for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = scan.begin(); item != scan.end(); item++)
-  {
-    double crnt_azimuth = getYawAngle(item->x, item->y);
-    if(std::fabs(calculateMinAngleDist(crnt_azimuth, base_azimuth)) < 0.01) // 0.17 degree is the typical change
-    {
-      scan_packet.push_back(*item);
-    }
-    else // new azimuth reached
-    {
-      scan_packets_vector.push_back(scan_packet);
-      scan_packet.clear();
-      scan_packet.push_back(*item);
-      base_azimuth = crnt_azimuth;
-    }
-  }
-
-  scan.clear();
-  pose crnt_pose = {0, 0, 0, 0, 0, 0};
-  velocity vel;
-  pcl::getTranslationAndEulerAngles(relative_tf, vel.x, vel.y, vel.z, vel.roll, vel.pitch, vel.yaw);
-  vel.x = vel.x / scan_interval;
-  vel.y = vel.y / scan_interval;
-  vel.z = vel.z / scan_interval;
-  vel.roll = vel.roll / scan_interval;
-  vel.pitch = vel.pitch / scan_interval;
-  vel.yaw = vel.yaw / scan_interval;
-  for(int i = 0, npackets = scan_packets_vector.size(); i < npackets; i++)
-  {
-    double offset_time = scan_interval * i / npackets;
-    pose this_packet_pose = {crnt_pose.x - vel.x * offset_time,
-                             crnt_pose.y - vel.y * offset_time,
-                             crnt_pose.z - vel.z * offset_time,
-                             crnt_pose.roll - vel.roll * offset_time,
-                             crnt_pose.pitch - vel.pitch * offset_time,
-                             crnt_pose.yaw - vel.yaw * offset_time}; 
-
-    Eigen::Affine3d transform;
-    pcl::getTransformation(this_packet_pose.x, 
-                           this_packet_pose.y, 
-                           this_packet_pose.z, 
-                           this_packet_pose.roll, 
-                           this_packet_pose.pitch, 
-                           this_packet_pose.yaw, transform);
-    pcl::PointCloud<pcl::PointXYZI> corrected_packet;
-    pcl::transformPointCloud(scan_packets_vector[npackets-1-i], corrected_packet, transform);
-    scan += corrected_packet;
-  }
-}
-
 static void add_new_scan(const pcl::PointCloud<pcl::PointXYZI> new_scan)
 {
   for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = new_scan.begin(); item < new_scan.end(); item++)
@@ -280,7 +206,7 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
     }
   }
 
-  correctLIDARscan(scan, relative_pose_tf, secs);
+  lidar_pcl::motionUndistort(scan, relative_pose_tf);
   pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr(new pcl::PointCloud<pcl::PointXYZI>(scan));
 
   // Add initial point cloud to velodyne_map
@@ -308,22 +234,16 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
   *filtered_scan_ptr = scan;
   pcl::PointCloud<pcl::PointXYZI>::Ptr local_map_ptr(new pcl::PointCloud<pcl::PointXYZI>(local_map));
 
-  // D2D NDT starts here
-  double __res[] = {1, 1, 5, 4.5};
-  std::vector<double> resolutions (__res, __res+sizeof(__res)/sizeof(double));
-  lslgeneric::NDTMatcherD2D matcherD2D(false, false, resolutions);
-  Eigen::Transform<double, 3, Eigen::Affine, Eigen::ColMajor> d2d_transformation;
-
-  // ndt.setInputSource(filtered_scan_ptr);
+  ndt.setInputSource(filtered_scan_ptr);
 
-  // std::chrono::time_point<std::chrono::system_clock> t1 = std::chrono::system_clock::now();
-  // if (isMapUpdate == true)
-  // {
-  //   ndt.setInputTarget(local_map_ptr);
-  //   isMapUpdate = false;
-  // }
-  // std::chrono::time_point<std::chrono::system_clock> t2 = std::chrono::system_clock::now();
-  // double ndt_update_time = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0;
+  std::chrono::time_point<std::chrono::system_clock> t1 = std::chrono::system_clock::now();
+  if (isMapUpdate == true)
+  {
+    ndt.setInputTarget(local_map_ptr);
+    isMapUpdate = false;
+  }
+  std::chrono::time_point<std::chrono::system_clock> t2 = std::chrono::system_clock::now();
+  double ndt_update_time = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0;
 
   guess_pose.x = previous_pose.x + diff_x;
   guess_pose.y = previous_pose.y + diff_y;
@@ -341,47 +261,15 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
   Eigen::Matrix4d init_guess =
       (init_translation * init_rotation_z * init_rotation_y * init_rotation_x).matrix() * tf_btol;
 
-  d2d_transformation = init_guess;
-
-  // convert pointxyzi to pointxyz here
-  pcl::PointCloud<pcl::PointXYZ> source_cloud, target_cloud;
-  for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = filtered_scan_ptr->begin(); item != filtered_scan_ptr->end(); item++)
-  {
-    pcl::PointXYZ p;
-    p.x = (double)item->x;
-    p.y = (double)item->y;
-    p.z = (double)item->z;
-    source_cloud.push_back(p);
-  }
-
-  for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = local_map_ptr->begin(); item != local_map_ptr->end(); item++)
-  {
-    pcl::PointXYZ p;
-    p.x = (double)item->x;
-    p.y = (double)item->y;
-    p.z = (double)item->z;
-    target_cloud.push_back(p);
-  }
-
-  if(matcherD2D.match(target_cloud, source_cloud, d2d_transformation, true))
-    std::cout << "I think D2D NDT succeeded..." << std::endl;
+  pcl::PointCloud<pcl::PointXYZI>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZI>);
 
-  // pcl::PointCloud<pcl::PointXYZI>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZI>);
+  t1 = std::chrono::system_clock::now();
+  ndt.omp_align(*output_cloud, init_guess.cast<float>());
+  fitness_score = ndt.computeFitness(ndt_fitness);
+  t2 = std::chrono::system_clock::now();
+  double ndt_align_time = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0;
 
-//   t1 = std::chrono::system_clock::now();
-// #ifdef USE_FAST_PCL
-//   ndt.omp_align(*output_cloud, init_guess);
-//   fitness_score = ndt.getFitnessScore();
-// #else
-//   ndt.align(*output_cloud, init_guess);
-//   fitness_score = ndt.getFitnessScore();
-// #endif
-//   t2 = std::chrono::system_clock::now();
-//   double ndt_align_time = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0;
-
-  // fitness_score = ndt.getFitnessScore();
-
-  t_localizer = d2d_transformation.matrix();
+  t_localizer = ndt.getFinalTransformation().cast<double>();
 
   t_base_link = t_localizer * tf_ltob;
 
@@ -529,7 +417,11 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
   std::cout << "Local map: " << local_map.points.size() << " points.\n";
   std::cout << "NDT has converged: " << ndt.hasConverged() << "\n";
   std::cout << "Fitness score: " << fitness_score << "\n";
+  std::cout << "Inlier ratio: " << ndt_fitness.inlier_ratio << " (" << ndt_fitness.nr_inliers << "/" << ndt_fitness.nr_points << ")\n";
   std::cout << "Number of iteration: " << ndt.getFinalNumIteration() << "\n";
+  std::cout << "Number of scan distributions: " << ndt.getNumberOfSourceDistributions() << "\n";
+  std::cout << "NDT target update took: " << ndt_update_time << "ms.\n";
+  std::cout << "NDT align took: " << ndt_align_time << "ms.\n";
   // std::cout << "Guessed posed: " << "\n";
   // std::cout << "(" << guess_pose.x << ", " << guess_pose.y << ", " << guess_pose.z << ", " << guess_pose.roll
   //           << ", " << guess_pose.pitch << ", " << guess_pose.yaw << ")\n";
@@ -565,6 +457,8 @@ static void map_maintenance_callback(pose local_pose)
         tmp_key.y = y;
         local_map += world_map[tmp_key];
       }
+    // The ndt target is rebuilt from the new local_map at the next scan
+    isMapUpdate = true;
 
     // Update key
     previous_key = local_key;
@@ -691,6 +585,7 @@ int main(int argc, char** argv)
   private_nh.getParam("start_time", _start_time);
   private_nh.getParam("play_duration", _play_duration);
   private_nh.getParam("resolution", ndt_res);
+  private_nh.getParam("resolution_pyramid", resolution_pyramid);
   private_nh.getParam("step_size", step_size);  
   private_nh.getParam("transformation_epsilon", trans_eps);
   private_nh.getParam("max_iteration", max_iter);
@@ -710,6 +605,10 @@ int main(int argc, char** argv)
   std::cout << "start_time: " << _start_time << std::endl;
   std::cout << "play_duration: " << _play_duration << std::endl;
   std::cout << "ndt_res: " << ndt_res << std::endl;
+  std::cout << "resolution_pyramid:";
+  for(size_t i = 0; i < resolution_pyramid.size(); i++)
+    std::cout << " " << resolution_pyramid[i];
+  std::cout << (resolution_pyramid.empty() ? " N/A" : "") << std::endl;
   std::cout << "step_size: " << step_size << std::endl;
   std::cout << "trans_epsilon: " << trans_eps << std::endl;
   std::cout << "max_iter: " << max_iter << std::endl;
@@ -724,6 +623,11 @@ int main(int argc, char** argv)
   ndt.setStepSize(step_size);
   ndt.setResolution(ndt_res);
   ndt.setMaximumIterations(max_iter);
+  if(!resolution_pyramid.empty())
+  {
+    resolution_pyramid.push_back(ndt_res);
+    ndt.setResolutionPyramid(resolution_pyramid);
+  }
 
   Eigen::Translation3d tl_btol(_tf_x, _tf_y, _tf_z);                 // tl: translation
   Eigen::AngleAxisd rot_x_btol(_tf_roll, Eigen::Vector3d::UnitX());  // rot: rotation
@@ -48,6 +48,8 @@
 #include <pcl/filters/voxel_grid.h>
 #endif
 
+#include <lidar_pcl/motion_undistortion.h>
+
 // #include <lidar_pcl/lidar_pcl.h>
 
 // Here are the functions I wrote. De-comment to use
@@ -160,76 +162,6 @@ static double fitness_score;
 std::time_t process_begin = std::time(NULL);
 std::tm* pnow = std::localtime(&process_begin);
 
-inline double getYawAngle(double _x, double _y)
-{
-  return std::atan2(_y, _x) * 180 / 3.14159265359; // degree value
-}
-
-inline double calculateMinAngleDist(double first, double second) // in degree
-{
-  double difference = first - second;
-  if(difference >= 180.0)
-    return difference - 360.0;
-  if(difference <= -180.0)
-    return difference + 360.0;
-  return difference;
-}
-
-void correctLIDARscan(pcl::PointCloud<pcl::PointXYZI>& scan, Eigen::Affine3d relative_tf, double scan_interval)
-{
-  // Correct scan using vel
-  pcl::PointCloud<pcl::PointXYZI> scan_packet;
-  std::vector<pcl::PointCloud<pcl::PointXYZI>> scan_packets_vector;
-  double base_azimuth = getYawAngle((scan.begin())->x, (scan.begin())->y);
-  for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = scan.begin(); item != scan.end(); item++)
-  {
-    double crnt_azimuth = getYawAngle(item->x, item->y);
-    if(std::fabs(calculateMinAngleDist(crnt_azimuth, base_azimuth)) < 0.01) // 0.17 degree is the typical change
-    {
-      scan_packet.push_back(*item);
-    }
-    else // new azimuth reached
-    {
-      scan_packets_vector.push_back(scan_packet);
-      scan_packet.clear();
-      scan_packet.push_back(*item);
-      base_azimuth = crnt_azimuth;
-    }
-  }
-
-  scan.clear();
-  pose crnt_pose = {0, 0, 0, 0, 0, 0};
-  velocity vel;
-  pcl::getTranslationAndEulerAngles(relative_tf, vel.x, vel.y, vel.z, vel.roll, vel.pitch, vel.yaw);
-  vel.x = vel.x / scan_interval;
-  vel.y = vel.y / scan_interval;
-  vel.z = vel.z / scan_interval;
-  vel.roll = vel.roll / scan_interval;
-  vel.pitch = vel.pitch / scan_interval;
-  vel.yaw = vel.yaw / scan_interval;
-  for(int i = 0, npackets = scan_packets_vector.size(); i < npackets; i++)
-  {
-    double offset_time = scan_interval * i / npackets;
-    pose this_packet_pose = {crnt_pose.x - vel.x * offset_time,
-                             crnt_pose.y - vel.y * offset_time,
-                             crnt_pose.z - vel.z * offset_time,
-                             crnt_pose.roll - vel.roll * offset_time,
-                             crnt_pose.pitch - vel.pitch * offset_time,
-                             crnt_pose.yaw - vel.yaw * offset_time}; 
-
-    Eigen::Affine3d transform;
-    pcl::getTransformation(this_packet_pose.x, 
-                           this_packet_pose.y, 
-                           this_packet_pose.z, 
-                           this_packet_pose.roll, 
-                           this_packet_pose.pitch, 
-                           this_packet_pose.yaw, transform);
-    pcl::PointCloud<pcl::PointXYZI> corrected_packet;
-    pcl::transformPointCloud(scan_packets_vector[npackets-1-i], corrected_packet, transform);
-    scan += corrected_packet;
-  }
-}
-
 #ifdef REMOVE_GROUND
 bool removeGroundPlane(const pcl::PointCloud<pcl::PointXYZI> cloud,
                        pcl::PointCloud<pcl::PointXYZI>& cloud_extract,
@@ -367,7 +299,7 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
 
   pcl::fromROSMsg(*input, tmp);
   // lidar_pcl::fromROSMsg(*input, tmp); // note here
-  correctLIDARscan(tmp, relative_pose_tf, secs);
+  lidar_pcl::motionUndistort(tmp, relative_pose_tf);
 
   for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = tmp.begin(); item != tmp.end(); item++)
   {
@@ -42,6 +42,10 @@
 #include <fast_pcl/ndt_gpu/NormalDistributionsTransform.h>
 #endif
 
+#ifdef NDT_CPU_FOUND
+#include <fast_pcl/ndt_cpu/NormalDistributionsTransform.h>
+#endif
+
 #include <lidar_pcl/motion_undistortion.h>
 
 // Here are the functions I wrote. De-comment to use
@@ -89,8 +93,25 @@ static pcl::PointCloud<pcl::PointXYZI> world_map;
 
 #ifdef USE_GPU_PCL
 static gpu::GNormalDistributionsTransform gpu_ndt;
-#else
+#endif
 static pcl::NormalDistributionsTransform<pcl::PointXYZI, pcl::PointXYZI> ndt;
+#ifdef NDT_CPU_FOUND
+static cpu::NormalDistributionsTransform cpu_ndt;
+#endif
+
+// NDT implementation used for matching, chosen at startup with the ndt_backend param
+enum NdtBackend
+{
+  PCL_BACKEND, // "pcl": pcl (or fast_pcl with USE_FAST_PCL) NormalDistributionsTransform
+  CPU_BACKEND, // "cpu": ndt_cpu, multithreaded CPU implementation of the ndt_gpu interface
+  GPU_BACKEND  // "gpu": ndt_gpu, needs USE_GPU_PCL
+};
+#ifdef USE_GPU_PCL
+static std::string ndt_backend_name = "gpu";
+static NdtBackend ndt_backend = GPU_BACKEND;
+#else
+static std::string ndt_backend_name = "pcl";
+static NdtBackend ndt_backend = PCL_BACKEND;
 #endif
 
 // Default NDT algorithm param values
@@ -98,6 +119,7 @@ static int max_iter = 300;       // Maximum iterations
 static float ndt_res = 2.8;      // Resolution
 static double step_size = 0.05;   // Step size
 static double trans_eps = 0.001;  // Transformation epsilon
+static int num_threads = 0;       // 0: one per core (fast_pcl and cpu backends)
 
 static double voxel_leaf_size = 0.1;
 static double min_scan_range = 2.0;
@@ -116,6 +138,15 @@ static double fitness_score;
 static bool has_converged;
 static int final_num_iteration;
 
+#ifdef USE_FAST_PCL
+// Global initialisation, the first scan is aligned from a grid of guesses around the initial pose
+static bool global_init = false;
+static double global_init_radius = 2.0;  // Half width of the xy grid
+static double global_init_step = 1.0;    // xy spacing of the grid
+static int global_init_yaw_steps = 8;    // Number of yaw guesses over a full turn
+static bool initialized = false;
+#endif
+
 // File name get from time
 std::time_t process_begin = std::time(NULL);
 std::tm* pnow = std::localtime(&process_begin);
@@ -125,6 +156,24 @@ static inline double getYawAngle(double _x, double _y)
   return std::atan2(_y, _x) * 180 / 3.14159265359; // degree value
 }
 
+static NdtBackend parse_ndt_backend(std::string &name)
+{
+#ifdef USE_GPU_PCL
+  if(name == "gpu")
+    return GPU_BACKEND;
+#endif
+#ifdef NDT_CPU_FOUND
+  if(name == "cpu")
+    return CPU_BACKEND;
+#endif
+  if(name != "pcl")
+  {
+    std::cout << "WARNING: ndt_backend " << name << " is not available in this build, using pcl" << std::endl;
+    name = "pcl";
+  }
+  return PCL_BACKEND;
+}
+
 static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 {
   std::chrono::time_point<std::chrono::system_clock> t1 = std::chrono::system_clock::now();
@@ -169,10 +218,16 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
   voxel_grid_filter.filter(*filtered_scan_ptr);
 
 #ifdef USE_GPU_PCL
-  gpu_ndt.setInputSource(filtered_scan_ptr);
-#else
-  ndt.setInputSource(filtered_scan_ptr);
+  if(ndt_backend == GPU_BACKEND)
+    gpu_ndt.setInputSource(filtered_scan_ptr);
+  else
 #endif
+#ifdef NDT_CPU_FOUND
+  if(ndt_backend == CPU_BACKEND)
+    cpu_ndt.setInputSource(filtered_scan_ptr);
+  else
+#endif
+    ndt.setInputSource(filtered_scan_ptr);
 
   guess_pose.x = previous_pose.x + diff_x;
   guess_pose.y = previous_pose.y + diff_y;
@@ -189,27 +244,73 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
       (init_translation * init_rotation_z * init_rotation_y * init_rotation_x).matrix() * tf_btol;
   
   t1 = std::chrono::system_clock::now();
+#ifdef USE_GPU_PCL
+  if(ndt_backend == GPU_BACKEND)
+  {
+    gpu_ndt.align(init_guess);
+    t_localizer = gpu_ndt.getFinalTransformation();
+    has_converged = gpu_ndt.hasConverged();
+    fitness_score = gpu_ndt.getFitnessScore();
+    final_num_iteration = gpu_ndt.getFinalNumIteration();
+  }
+  else
+#endif
+#ifdef NDT_CPU_FOUND
+  if(ndt_backend == CPU_BACKEND)
+  {
+    cpu_ndt.align(init_guess);
+    t_localizer = cpu_ndt.getFinalTransformation();
+    has_converged = cpu_ndt.hasConverged();
+    fitness_score = cpu_ndt.getFitnessScore();
+    final_num_iteration = cpu_ndt.getFinalNumIteration();
+  }
+  else
+#endif
+  {
 #ifdef USE_FAST_PCL
-  pcl::PointCloud<pcl::PointXYZI>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZI>);
-  ndt.omp_align(*output_cloud, init_guess);
-  t_localizer = ndt.getFinalTransformation();
-  has_converged = ndt.hasConverged();
-  fitness_score = ndt.omp_getFitnessScore();
-  final_num_iteration = ndt.getFinalNumIteration();
-#elif defined USE_GPU_PCL
-  gpu_ndt.align(init_guess);
-  t_localizer = gpu_ndt.getFinalTransformation();
-  has_converged = gpu_ndt.hasConverged();
-  fitness_score = gpu_ndt.getFitnessScore();
-  final_num_iteration = gpu_ndt.getFinalNumIteration();
+    pcl::PointCloud<pcl::PointXYZI>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZI>);
+    if (global_init && !initialized)
+    {
+      pcl::NormalDistributionsTransform<pcl::PointXYZI, pcl::PointXYZI>::TransformationList guesses;
+      pcl::NormalDistributionsTransform<pcl::PointXYZI, pcl::PointXYZI>::HypothesisList hypotheses;
+      int xy_steps = static_cast<int>(global_init_radius / global_init_step);
+      for (int ix = -xy_steps; ix <= xy_steps; ix++)
+        for (int iy = -xy_steps; iy <= xy_steps; iy++)
+          for (int iyaw = 0; iyaw < global_init_yaw_steps; iyaw++)
+          {
+            Eigen::AngleAxisf rotation_z(guess_pose.yaw + 2.0 * M_PI * iyaw / global_init_yaw_steps,
+                                         Eigen::Vector3f::UnitZ());
+            Eigen::Translation3f translation(guess_pose.x + ix * global_init_step, guess_pose.y + iy * global_init_step,
+                                             guess_pose.z);
+            guesses.push_back((translation * rotation_z * init_rotation_y * init_rotation_x).matrix() * tf_btol);
+          }
+
+      ndt.alignBatch(filtered_scan_ptr, guesses, hypotheses);
+      if (hypotheses.empty())
+      {
+        std::cout << "WARNING: global initialisation failed, aligning from the initial pose" << std::endl;
+        ndt.omp_align(*output_cloud, init_guess);
+      }
+      else
+        std::cout << "Global initialisation: " << guesses.size() << " guesses, best " << hypotheses.front().index
+                  << " (probability " << hypotheses.front().probability << ")" << std::endl;
+      initialized = true;
+    }
+    else
+      ndt.omp_align(*output_cloud, init_guess);
+    t_localizer = ndt.getFinalTransformation();
+    has_converged = ndt.hasConverged();
+    fitness_score = ndt.omp_getFitnessScore();
+    final_num_iteration = ndt.getFinalNumIteration();
 #else
-  pcl::PointCloud<pcl::PointXYZI>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZI>);
-  ndt.align(*output_cloud, init_guess);
-  t_localizer = ndt.getFinalTransformation();
-  has_converged = ndt.hasConverged();
-  fitness_score = ndt.getFitnessScore();
-  final_num_iteration = ndt.getFinalNumIteration();
+    pcl::PointCloud<pcl::PointXYZI>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZI>);
+    ndt.align(*output_cloud, init_guess);
+    t_localizer = ndt.getFinalTransformation();
+    has_converged = ndt.hasConverged();
+    fitness_score = ndt.getFitnessScore();
+    final_num_iteration = ndt.getFinalNumIteration();
 #endif
+  }
   
   t_base_link = t_localizer * tf_ltob;
   
@@ -381,6 +482,9 @@ int main(int argc, char** argv)
   private_nh.getParam("step_size", step_size);  
   private_nh.getParam("transformation_epsilon", trans_eps);
   private_nh.getParam("max_iteration", max_iter);
+  private_nh.getParam("num_threads", num_threads);
+  private_nh.getParam("ndt_backend", ndt_backend_name);
+  ndt_backend = parse_ndt_backend(ndt_backend_name);
 
   private_nh.getParam("voxel_leaf_size", voxel_leaf_size);
   private_nh.getParam("min_scan_range", min_scan_range);
@@ -394,6 +498,29 @@ int main(int argc, char** argv)
   private_nh.getParam("initial_pitch", guess_pose.pitch);
   private_nh.getParam("initial_yaw", guess_pose.yaw);
 
+#ifdef USE_FAST_PCL
+  private_nh.getParam("global_init", global_init);
+  private_nh.getParam("global_init_radius", global_init_radius);
+  private_nh.getParam("global_init_step", global_init_step);
+  private_nh.getParam("global_init_yaw_steps", global_init_yaw_steps);
+  if(global_init && ndt_backend != PCL_BACKEND)
+  {
+    std::cout << "WARNING: global_init is only supported by the pcl ndt_backend, disabled" << std::endl;
+    global_init = false;
+  }
+  if(global_init_yaw_steps < 1)
+  {
+    std::cout << "WARNING: global_init_yaw_steps must be at least 1, using 1" << std::endl;
+    global_init_yaw_steps = 1;
+  }
+  if(!(global_init_step > 0.0) || global_init_radius < 0.0)
+  {
+    std::cout << "WARNING: global_init_step must be positive and global_init_radius not negative, using 1 and 0" << std::endl;
+    global_init_step = 1.0;
+    global_init_radius = 0.0;
+  }
+#endif
+
   private_nh.getParam("tf_x", _tf_x);
   private_nh.getParam("tf_y", _tf_y);
   private_nh.getParam("tf_z", _tf_z);
@@ -435,6 +562,8 @@ int main(int argc, char** argv)
   std::cout << "step_size: " << step_size << std::endl;
   std::cout << "trans_epsilon: " << trans_eps << std::endl;
   std::cout << "max_iter: " << max_iter << std::endl;
+  std::cout << "num_threads: " << num_threads << std::endl;
+  std::cout << "ndt_backend: " << ndt_backend_name << std::endl;
   std::cout << "voxel_leaf_size: " << voxel_leaf_size << std::endl;
   std::cout << "min_scan_range: " << min_scan_range << std::endl;
   std::cout << "min_add_scan_shift: " << min_add_scan_shift << std::endl;
@@ -484,19 +613,40 @@ int main(int argc, char** argv)
   ndt_map_msg.header.frame_id = "map";
   ndt_map_pub.publish(ndt_map_msg);
 
+  // Only the selected backend builds the voxels of the map
 #ifdef USE_GPU_PCL
-  gpu_ndt.setTransformationEpsilon(trans_eps);
-  gpu_ndt.setStepSize(step_size);
-  gpu_ndt.setResolution(ndt_res);
-  gpu_ndt.setMaximumIterations(max_iter);
-  gpu_ndt.setInputTarget(world_map_ptr);
-#else
-  ndt.setTransformationEpsilon(trans_eps);
-  ndt.setStepSize(step_size);
-  ndt.setResolution(ndt_res);
-  ndt.setMaximumIterations(max_iter);
-  ndt.setInputTarget(world_map_ptr);
+  if(ndt_backend == GPU_BACKEND)
+  {
+    gpu_ndt.setTransformationEpsilon(trans_eps);
+    gpu_ndt.setStepSize(step_size);
+    gpu_ndt.setResolution(ndt_res);
+    gpu_ndt.setMaximumIterations(max_iter);
+    gpu_ndt.setInputTarget(world_map_ptr);
+  }
+  else
+#endif
+#ifdef NDT_CPU_FOUND
+  if(ndt_backend == CPU_BACKEND)
+  {
+    cpu_ndt.setTransformationEpsilon(trans_eps);
+    cpu_ndt.setStepSize(step_size);
+    cpu_ndt.setResolution(ndt_res);
+    cpu_ndt.setMaximumIterations(max_iter);
+    cpu_ndt.setNumThreads(num_threads);
+    cpu_ndt.setInputTarget(world_map_ptr);
+  }
+  else
 #endif
+  {
+    ndt.setTransformationEpsilon(trans_eps);
+    ndt.setStepSize(step_size);
+    ndt.setResolution(ndt_res);
+    ndt.setMaximumIterations(max_iter);
+#ifdef USE_FAST_PCL
+    ndt.setNumThreads(num_threads);
+#endif
+    ndt.setInputTarget(world_map_ptr);
+  }
 
   Eigen::Translation3f tl_btol(_tf_x, _tf_y, _tf_z);                 // tl: translation
   Eigen::AngleAxisf rot_x_btol(_tf_roll, Eigen::Vector3f::UnitX());  // rot: rotation
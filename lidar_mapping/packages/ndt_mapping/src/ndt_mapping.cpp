@@ -1,4 +1,5 @@
 // Basic libs
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <iostream>
@@ -6,6 +7,7 @@
 #include <omp.h>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -46,14 +48,21 @@
 #include <fast_pcl/ndt_gpu/NormalDistributionsTransform.h>
 #endif
 
+#ifdef NDT_CPU_FOUND
+#include <fast_pcl/ndt_cpu/NormalDistributionsTransform.h>
+#endif
+
+#include <lidar_pcl/bounded_queue.h>
 #include <lidar_pcl/motion_undistortion.h>
+#include <lidar_pcl/incremental_voxel_grid.h>
+#include <lidar_pcl/scan_preprocessor.h>
 
 // Here are the functions I wrote. De-comment to use
 #define TILE_WIDTH 35 // Maximum range of LIDAR 32E is 70m
 #define MY_EXTRACT_SCANPOSE // do not use this, this is to extract scans and poses to close loop
 // #define LIMIT_HEIGHT 3.0 // filter out high points when aligning
 // #define CORRECT_SCAN_DEBUG
-// #define DOWNSAMPLE_ADD_MAP
+// #define DOWNSAMPLE_ADD_MAP 0.2 // keep the map tiles as voxel grids of this leaf size, bounding the map density
 
 #ifdef MY_EXTRACT_SCANPOSE
 std::ofstream csv_stream;
@@ -121,15 +130,39 @@ static double diff, diff_x, diff_y, diff_z, diff_roll, diff_pitch, diff_yaw; //
 static double secs = 0.100085; // scan duration
 // static velocity current_velocity;
 
+#ifdef DOWNSAMPLE_ADD_MAP
+// Each tile accumulates its points into the centroids of its voxels, revisited places do not add points
+static std::unordered_map<Key, lidar_pcl::IncrementalVoxelGrid<pcl::PointXYZI>> world_map;
+#else
 static std::unordered_map<Key, pcl::PointCloud<pcl::PointXYZI>> world_map;
+#endif // DOWNSAMPLE_ADD_MAP
 static pcl::PointCloud<pcl::PointXYZI> local_map;
-static std::mutex mtx;
+static bool local_map_stale = false; // the ndt target slid to other tiles, local_map is composed again when needed
+static std::mutex mtx; // world_map
+static std::atomic<bool> stop_requested(false); // set on SIGINT, the pipeline stops after the current scan
 static Key local_key, previous_key;
 
 #ifdef USE_GPU_PCL
 static gpu::GNormalDistributionsTransform gpu_ndt;
-#else
+#endif
 static pcl::NormalDistributionsTransform<pcl::PointXYZI, pcl::PointXYZI> ndt;
+#ifdef NDT_CPU_FOUND
+static cpu::NormalDistributionsTransform cpu_ndt;
+#endif
+
+// NDT implementation used for matching, chosen at startup with the ndt_backend param
+enum NdtBackend
+{
+  PCL_BACKEND, // "pcl": pcl (or fast_pcl with USE_FAST_PCL) NormalDistributionsTransform
+  CPU_BACKEND, // "cpu": ndt_cpu, multithreaded CPU implementation of the ndt_gpu interface
+  GPU_BACKEND  // "gpu": ndt_gpu, needs USE_GPU_PCL
+};
+#ifdef USE_GPU_PCL
+static std::string ndt_backend_name = "gpu";
+static NdtBackend ndt_backend = GPU_BACKEND;
+#else
+static std::string ndt_backend_name = "pcl";
+static NdtBackend ndt_backend = PCL_BACKEND;
 #endif
 
 // Default NDT algorithm param values
@@ -137,11 +170,67 @@ static int max_iter = 300;       // Maximum iterations
 static float ndt_res = 2.8;      // Resolution
 static double step_size = 0.05;   // Step size
 static double trans_eps = 0.001;  // Transformation epsilon
+static int num_threads = 0;       // 0: one per core (fast_pcl and cpu backends)
+#ifdef USE_FAST_PCL
+static int search_method = 0;     // 0: KDTREE, 1: DIRECT27, 2: DIRECT7, 3: DIRECT1
+static std::vector<float> resolution_pyramid; // coarser resolutions aligned before ndt_res, e.g. [8.0, 4.0]
+static bool gauss_newton = false; // gauss-newton approximation of the hessian
+static int min_samples = 0;       // scan points of the first iterations, growing to all of them (0: always all)
+static double target_window_height = 64.0; // height of the dense ndt target window around the vehicle (0: hashed target)
+#endif
 
 static double voxel_leaf_size = 0.1;
 static double min_scan_range = 2.0;
+// Range crop + motion undistortion + voxel filter of the scans, its output clouds keep their memory between scans
+static lidar_pcl::ScanPreprocessor<pcl::PointXYZI> scan_preprocessor;
+static pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
 static double min_add_scan_shift = 1.0;
 static double min_add_scan_yaw_diff = 0.005;
+static double map_prefetch_distance = 10.0; // build the next local map when this far from its tiles (0: no prefetch)
+
+// Next local map, built in the background for the tiles the vehicle is heading to (with its ndt target for the pcl
+// backend), swapped with local_map when the vehicle enters them
+struct LocalMapBuild
+{
+  Key key;
+  pcl::PointCloud<pcl::PointXYZI>::Ptr map;
+  pcl::PointCloud<pcl::PointXYZI> increment; // keyscan points added to world_map after map was read (under mtx)
+#ifdef USE_FAST_PCL
+  pcl::NormalDistributionsTransform<pcl::PointXYZI, pcl::PointXYZI>::TargetPtr target;
+#endif
+  std::thread builder;
+  std::atomic<bool> done;
+};
+static LocalMapBuild next_local_map;
+
+// Parameters of the ndt target built in the background, copied by the main thread at launch since ndt is not
+// thread safe (its setters run on the main thread)
+struct LocalMapTargetParams
+{
+#ifdef USE_FAST_PCL
+  std::vector<float> resolutions;
+  pcl::NeighborSearchMethod search_method;
+  Eigen::Vector3f window_size;
+#endif
+};
+
+// Offline pipeline, each stage on its own thread:
+//   bag reading and deserialisation -> conversion and range crop -> mapping (pose dependent, in order) -> publishing
+// with at most pipeline_depth scans waiting between two stages
+static int pipeline_depth = 4;
+
+struct ScanItem
+{
+  std_msgs::Header header;
+  pcl::PointCloud<pcl::PointXYZI>::Ptr scan; // cropped, not undistorted yet
+};
+
+struct OutputItem
+{
+  pcl::PointCloud<pcl::PointXYZI>::Ptr local_map;
+  pcl::PointCloud<pcl::PointXYZI>::Ptr current_scan;
+  pcl::PointCloud<pcl::PointXYZI>::Ptr source_scan;
+};
 
 // Workspace params
 static float _start_time = 0; // 0 means start playing bag from beginnning
@@ -156,6 +245,12 @@ static Eigen::Matrix4f tf_btol, tf_ltob;
 static int add_scan_number = 1; // added frame count
 static int initial_scan_loaded = 0;
 static bool isMapUpdate = true;
+#ifdef USE_FAST_PCL
+// Keyscan points added to local_map since the last ndt target update
+static pcl::PointCloud<pcl::PointXYZI>::Ptr target_increment_ptr(new pcl::PointCloud<pcl::PointXYZI>());
+// Fitness of the pcl backend, measured with the ndt voxels instead of a kdtree over local_map
+static pcl::NDTFitness ndt_fitness;
+#endif
 static double fitness_score;
 static bool has_converged;
 static int final_num_iteration;
@@ -169,104 +264,99 @@ static inline double getYawAngle(double _x, double _y)
   return std::atan2(_y, _x) * 180 / 3.14159265359; // degree value
 }
 
-static inline double calculateMinAngleDist(double first, double second) // in degree
-{
-  double difference = first - second;
-  if(difference >= 180.0)
-    return difference - 360.0;
-  if(difference <= -180.0)
-    return difference + 360.0;
-  return difference;
-}
-
-static void correctLIDARscan(pcl::PointCloud<pcl::PointXYZI>& scan, Eigen::Affine3d relative_tf, double scan_interval)
+static NdtBackend parse_ndt_backend(std::string &name)
 {
-  // Correct scan using vel
-  pcl::PointCloud<pcl::PointXYZI> scan_packet;
-  std::vector<pcl::PointCloud<pcl::PointXYZI>> scan_packets_vector;
-  double base_azimuth = getYawAngle((scan.begin())->x, (scan.begin())->y);
-  for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = scan.begin(); item != scan.end(); item++)
+#ifdef USE_GPU_PCL
+  if(name == "gpu")
+    return GPU_BACKEND;
+#endif
+#ifdef NDT_CPU_FOUND
+  if(name == "cpu")
+    return CPU_BACKEND;
+#endif
+  if(name != "pcl")
   {
-    double crnt_azimuth = getYawAngle(item->x, item->y);
-    if(std::fabs(calculateMinAngleDist(crnt_azimuth, base_azimuth)) < 0.01) // 0.17 degree is the typical change
-    {
-      scan_packet.push_back(*item);
-    }
-    else // new azimuth reached
-    {
-      scan_packets_vector.push_back(scan_packet);
-      scan_packet.clear();
-      scan_packet.push_back(*item);
-      base_azimuth = crnt_azimuth;
-    }
+    std::cout << "WARNING: ndt_backend " << name << " is not available in this build, using pcl" << std::endl;
+    name = "pcl";
   }
+  return PCL_BACKEND;
+}
 
-  scan.clear();
-  pose crnt_pose = {0, 0, 0, 0, 0, 0};
-  velocity vel;
-  pcl::getTranslationAndEulerAngles(relative_tf, vel.x, vel.y, vel.z, vel.roll, vel.pitch, vel.yaw);
-  vel.x = vel.x / scan_interval;
-  vel.y = vel.y / scan_interval;
-  vel.z = vel.z / scan_interval;
-  vel.roll = vel.roll / scan_interval;
-  vel.pitch = vel.pitch / scan_interval;
-  vel.yaw = vel.yaw / scan_interval;
-  for(int i = 0, npackets = scan_packets_vector.size(); i < npackets; i++)
-  {
-    double offset_time = scan_interval * i / npackets;
-    pose this_packet_pose = {crnt_pose.x - vel.x * offset_time,
-                             crnt_pose.y - vel.y * offset_time,
-                             crnt_pose.z - vel.z * offset_time,
-                             crnt_pose.roll - vel.roll * offset_time,
-                             crnt_pose.pitch - vel.pitch * offset_time,
-                             crnt_pose.yaw - vel.yaw * offset_time}; 
-
-    Eigen::Affine3d transform;
-    pcl::getTransformation(this_packet_pose.x, 
-                           this_packet_pose.y, 
-                           this_packet_pose.z, 
-                           this_packet_pose.roll, 
-                           this_packet_pose.pitch, 
-                           this_packet_pose.yaw, transform);
-    pcl::PointCloud<pcl::PointXYZI> corrected_packet;
-    pcl::transformPointCloud(scan_packets_vector[npackets-1-i], corrected_packet, transform);
-    scan += corrected_packet;
-  }
+// True if the tile of key is one of the 5x5 tiles of the local map around center
+static inline bool in_local_map(const Key& key, const Key& center)
+{
+  return std::abs(key.x - center.x) <= 2 && std::abs(key.y - center.y) <= 2;
 }
 
 static void add_new_scan(const pcl::PointCloud<pcl::PointXYZI> new_scan)
 {
- #ifdef DOWNSAMPLE_ADD_MAP
-  pcl::PointCloud<pcl::PointXYZI>::Ptr new_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>(new_scan));
-  pcl::VoxelGrid<pcl::PointXYZI> voxel_grid_filter;
-  voxel_grid_filter.setLeafSize(0.2, 0.2, 0.2);
-  voxel_grid_filter.setInputCloud(new_scan_ptr);
-  voxel_grid_filter.filter(*new_scan_ptr);
-  for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = new_scan_ptr->begin(); item < new_scan_ptr->end(); item++)
- #else
+  std::lock_guard<std::mutex> lck(mtx);
+  const bool prefetching = next_local_map.builder.joinable();
   for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = new_scan.begin(); item < new_scan.end(); item++)
- #endif // DOWNSAMPLE_ADD_MAP
   {
     // Get 2D point
     Key key;
     key.x = int(floor(item->x / TILE_WIDTH));
     key.y = int(floor(item->y / TILE_WIDTH));
 
-    world_map[key].push_back(*item);
-  }
  #ifdef DOWNSAMPLE_ADD_MAP
-  local_map += *new_scan_ptr;
+    lidar_pcl::IncrementalVoxelGrid<pcl::PointXYZI>& tile = world_map[key];
+    if(tile.empty())
+      tile.setLeafSize(DOWNSAMPLE_ADD_MAP);
+
+    // Points falling in occupied voxels only move their centroid, local_map and the ndt target
+    // get them at the next tile change
+    if(!tile.addPoint(*item))
+      continue;
  #else
-  local_map += new_scan;
+    world_map[key].push_back(*item);
  #endif // DOWNSAMPLE_ADD_MAP
+
+    // local_map and the ndt target only hold the tiles around the vehicle, the other points reach them with their tile
+    if(in_local_map(key, local_key))
+    {
+      if(!local_map_stale)
+        local_map.push_back(*item);
+    #ifdef USE_FAST_PCL
+      target_increment_ptr->push_back(*item);
+    #endif
+    }
+    if(prefetching && in_local_map(key, next_local_map.key))
+      next_local_map.increment.push_back(*item);
+  }
+}
+
+// The 5x5 tiles around key (under mtx)
+static void get_local_map(const Key& key, pcl::PointCloud<pcl::PointXYZI>& map)
+{
+  map.clear();
+  Key tmp_key;
+  for(int x = key.x - 2, x_max = key.x + 2; x <= x_max; x++)
+    for(int y = key.y - 2, y_max = key.y + 2; y <= y_max; y++)
+    {
+      tmp_key.x = x;
+      tmp_key.y = y;
+      auto tile = world_map.find(tmp_key);
+      if(tile == world_map.end())
+        continue;
+    #ifdef DOWNSAMPLE_ADD_MAP
+      map += tile->second.getPointCloud();
+    #else
+      map += tile->second;
+    #endif // DOWNSAMPLE_ADD_MAP
+    }
 }
 
-static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
+static void compose_local_map()
 {
-  double r;
-  pcl::PointXYZI p;
-  pcl::PointCloud<pcl::PointXYZI> tmp, scan;
-  pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
+  std::lock_guard<std::mutex> lck(mtx);
+  get_local_map(local_key, local_map);
+  local_map_stale = false;
+}
+
+static void ndt_mapping_callback(const ScanItem& input, OutputItem& output)
+{
+  pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr(input.scan);
   pcl::PointCloud<pcl::PointXYZI>::Ptr transformed_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
   tf::Quaternion q;
 
@@ -275,33 +365,20 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
   tf::TransformBroadcaster br;
   tf::Transform transform;
 
-  current_scan_time = input->header.stamp;
-
-  pcl::fromROSMsg(*input, tmp);
-  // lidar_pcl::fromROSMsg(*input, tmp); // note here
+  current_scan_time = input.header.stamp;
 
-  for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = tmp.begin(); item != tmp.end(); item++)
-  {
-    p.x = (double)item->x;
-    p.y = (double)item->y;
-    p.z = (double)item->z;
-    p.intensity = (double)item->intensity;
-
-    r = sqrt(pow(p.x, 2.0) + pow(p.y, 2.0));
-    if(r > min_scan_range)
-    {
-      scan.push_back(p);
-    }
-  }
-
-  // correctLIDARscan(scan, relative_pose_tf, secs);
-  lidar_pcl::motionUndistort(scan, relative_pose_tf);
-  pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr(new pcl::PointCloud<pcl::PointXYZI>(scan));
+  // Motion undistortion and voxel filter in one pass over the cropped scan
+  // (the first scan goes to the map as is, its transformed copy is made in the same pass)
+  if(initial_scan_loaded == 0)
+    scan_preprocessor.process(*scan_ptr, relative_pose_tf, *filtered_scan_ptr, tf_btol, *transformed_scan_ptr);
+  else
+    scan_preprocessor.process(*scan_ptr, relative_pose_tf, *filtered_scan_ptr);
+  // lidar_pcl::motionUndistort(scan, relative_pose_tf);
 
   #ifdef LIMIT_HEIGHT
   pcl::PointCloud<pcl::PointXYZI> src;
-  if(/*input->header.seq > 1780 &&*/ input->header.seq < 2300)
-    for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = scan.begin(); item != scan.end(); item++)
+  if(/*input.header.seq > 1780 &&*/ input.header.seq < 2300)
+    for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = scan_ptr->begin(); item != scan_ptr->end(); item++)
     {
       // Eigen::Vector3d p(item->x, item->y, item->z);
       // Eigen::Vector3d f = relative_pose_tf.inverse() * p;
@@ -315,19 +392,18 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
       }
     }
   else 
-    src = scan;
+    src = *scan_ptr;
   pcl::PointCloud<pcl::PointXYZI>::Ptr src_ptr(new pcl::PointCloud<pcl::PointXYZI>(src));
   #endif // LIMIT_HEIGHT
 
   // Add initial point cloud to velodyne_map
   if(initial_scan_loaded == 0)
   {
-    pcl::transformPointCloud(*scan_ptr, *transformed_scan_ptr, tf_btol);
     add_new_scan(*transformed_scan_ptr);
     initial_scan_loaded = 1;
 #ifdef MY_EXTRACT_SCANPOSE
     // outputing into csv
-    csv_stream << add_scan_number << "," << input->header.seq << "," << current_scan_time.sec << "," << current_scan_time.nsec << ","
+    csv_stream << add_scan_number << "," << input.header.seq << "," << current_scan_time.sec << "," << current_scan_time.nsec << ","
                << _tf_x << "," << _tf_y << "," << _tf_z << "," 
                << _tf_roll << "," << _tf_pitch << "," << _tf_yaw
                << std::endl;
@@ -335,34 +411,64 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
     add_scan_number++;
     return;
   }
-  // Apply voxelgrid filter
+  #ifdef LIMIT_HEIGHT
+  // Apply voxelgrid filter to the height limited scan instead
   pcl::VoxelGrid<pcl::PointXYZI> voxel_grid_filter;
   voxel_grid_filter.setLeafSize(voxel_leaf_size, voxel_leaf_size, voxel_leaf_size);
-  #ifdef LIMIT_HEIGHT
   voxel_grid_filter.setInputCloud(src_ptr);
-  #else
-  voxel_grid_filter.setInputCloud(scan_ptr);
-  #endif // LIMIT_HEIGHT
   voxel_grid_filter.filter(*filtered_scan_ptr);
+  #endif // LIMIT_HEIGHT
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr local_map_ptr(new pcl::PointCloud<pcl::PointXYZI>(local_map));
+  // Copy of local_map for a full target rebuild or for the subscribers only
+  pcl::PointCloud<pcl::PointXYZI>::Ptr local_map_ptr;
+  if(isMapUpdate || ndt_map_pub.getNumSubscribers() > 0)
+  {
+    if(local_map_stale)
+      compose_local_map();
+    local_map_ptr.reset(new pcl::PointCloud<pcl::PointXYZI>(local_map));
+  }
 
 #ifdef USE_GPU_PCL
-  gpu_ndt.setInputSource(filtered_scan_ptr);
-#else
-  ndt.setInputSource(filtered_scan_ptr);
+  if(ndt_backend == GPU_BACKEND)
+    gpu_ndt.setInputSource(filtered_scan_ptr);
+  else
 #endif
+#ifdef NDT_CPU_FOUND
+  if(ndt_backend == CPU_BACKEND)
+    cpu_ndt.setInputSource(filtered_scan_ptr);
+  else
+#endif
+    ndt.setInputSource(filtered_scan_ptr);
 
   std::chrono::time_point<std::chrono::system_clock> t1 = std::chrono::system_clock::now();
   if(isMapUpdate == true)
   {
   #ifdef USE_GPU_PCL
-    gpu_ndt.setInputTarget(local_map_ptr);
-  #else
-    ndt.setInputTarget(local_map_ptr);
+    if(ndt_backend == GPU_BACKEND)
+      gpu_ndt.setInputTarget(local_map_ptr);
+    else
+  #endif
+  #ifdef NDT_CPU_FOUND
+    if(ndt_backend == CPU_BACKEND)
+      cpu_ndt.setInputTarget(local_map_ptr);
+    else
+  #endif
+      ndt.setInputTarget(local_map_ptr);
+  #ifdef USE_FAST_PCL
+    target_increment_ptr->clear();
   #endif
     isMapUpdate = false;
   }
+#ifdef USE_FAST_PCL
+  else if(!target_increment_ptr->empty())
+  {
+    // Same tiles as the current target, only the voxels touched by the new keyscan are updated
+    // (the cpu and gpu backends rebuild their target from local_map at each keyscan instead)
+    if(ndt_backend == PCL_BACKEND)
+      ndt.addPointsToTarget(target_increment_ptr);
+    target_increment_ptr->clear();
+  }
+#endif
   std::chrono::time_point<std::chrono::system_clock> t2 = std::chrono::system_clock::now();
   double ndt_update_time = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0;
 
@@ -381,27 +487,45 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
       (init_translation * init_rotation_z * init_rotation_y * init_rotation_x).matrix() * tf_btol;
   
   t1 = std::chrono::system_clock::now();
+#ifdef USE_GPU_PCL
+  if(ndt_backend == GPU_BACKEND)
+  {
+    gpu_ndt.align(init_guess);
+    t_localizer = gpu_ndt.getFinalTransformation();
+    has_converged = gpu_ndt.hasConverged();
+    fitness_score = gpu_ndt.getFitnessScore();
+    final_num_iteration = gpu_ndt.getFinalNumIteration();
+  }
+  else
+#endif
+#ifdef NDT_CPU_FOUND
+  if(ndt_backend == CPU_BACKEND)
+  {
+    cpu_ndt.align(init_guess);
+    t_localizer = cpu_ndt.getFinalTransformation();
+    has_converged = cpu_ndt.hasConverged();
+    fitness_score = cpu_ndt.getFitnessScore();
+    final_num_iteration = cpu_ndt.getFinalNumIteration();
+  }
+  else
+#endif
+  {
 #ifdef USE_FAST_PCL
-  pcl::PointCloud<pcl::PointXYZI>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZI>);
-  ndt.omp_align(*output_cloud, init_guess);
-  t_localizer = ndt.getFinalTransformation();
-  has_converged = ndt.hasConverged();
-  fitness_score = ndt.omp_getFitnessScore();
-  final_num_iteration = ndt.getFinalNumIteration();
-#elif defined USE_GPU_PCL
-  gpu_ndt.align(init_guess);
-  t_localizer = gpu_ndt.getFinalTransformation();
-  has_converged = gpu_ndt.hasConverged();
-  fitness_score = gpu_ndt.getFitnessScore();
-  final_num_iteration = gpu_ndt.getFinalNumIteration();
+    pcl::PointCloud<pcl::PointXYZI>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZI>);
+    ndt.omp_align(*output_cloud, init_guess);
+    t_localizer = ndt.getFinalTransformation();
+    has_converged = ndt.hasConverged();
+    fitness_score = ndt.computeFitness(ndt_fitness);
+    final_num_iteration = ndt.getFinalNumIteration();
 #else
-  pcl::PointCloud<pcl::PointXYZI>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZI>);
-  ndt.align(*output_cloud, init_guess);
-  t_localizer = ndt.getFinalTransformation();
-  has_converged = ndt.hasConverged();
-  fitness_score = ndt.getFitnessScore();
-  final_num_iteration = ndt.getFinalNumIteration();
+    pcl::PointCloud<pcl::PointXYZI>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZI>);
+    ndt.align(*output_cloud, init_guess);
+    t_localizer = ndt.getFinalTransformation();
+    has_converged = ndt.hasConverged();
+    fitness_score = ndt.getFitnessScore();
+    final_num_iteration = ndt.getFinalNumIteration();
 #endif
+  }
   t2 = std::chrono::system_clock::now();
   double ndt_align_time = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0;
   
@@ -466,7 +590,7 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
 #ifdef MY_EXTRACT_SCANPOSE
 
     // outputing into csv
-    csv_stream << add_scan_number << "," << input->header.seq << "," << current_scan_time.sec << "," << current_scan_time.nsec << ","
+    csv_stream << add_scan_number << "," << input.header.seq << "," << current_scan_time.sec << "," << current_scan_time.nsec << ","
                << localizer_pose.x << "," << localizer_pose.y << "," << localizer_pose.z << ","
                << localizer_pose.roll << "," << localizer_pose.pitch << "," << localizer_pose.yaw
                << std::endl;
@@ -480,13 +604,19 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
     added_pose.roll = current_pose.roll;
     added_pose.pitch = current_pose.pitch;
     added_pose.yaw = current_pose.yaw;
+#ifdef USE_FAST_PCL
+    // Only the pcl backend updates its target incrementally, the others rebuild it
+    if(ndt_backend != PCL_BACKEND)
+      isMapUpdate = true;
+#else
     isMapUpdate = true;
+#endif
   }
 #ifdef MY_EXTRACT_SCANPOSE
   else
   {
     // outputing into csv, with add_scan_number = 0
-    csv_stream << 0 << "," << input->header.seq << "," << current_scan_time.sec << "," << current_scan_time.nsec << ","
+    csv_stream << 0 << "," << input.header.seq << "," << current_scan_time.sec << "," << current_scan_time.nsec << ","
                << localizer_pose.x << "," << localizer_pose.y << "," << localizer_pose.z << ","
                << localizer_pose.roll << "," << localizer_pose.pitch << "," << localizer_pose.yaw
                << std::endl;
@@ -548,32 +678,37 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
   previous_scan_time.sec = current_scan_time.sec;
   previous_scan_time.nsec = current_scan_time.nsec;
 
-  sensor_msgs::PointCloud2::Ptr map_msg_ptr(new sensor_msgs::PointCloud2);
-  pcl::toROSMsg(*local_map_ptr, *map_msg_ptr);
-  ndt_map_pub.publish(*map_msg_ptr);
-
-  sensor_msgs::PointCloud2::Ptr scan_msg_ptr(new sensor_msgs::PointCloud2);
+  // Clouds to publish, the conversion to messages is left to the publishing thread
   transformed_scan_ptr->header.frame_id = "map";
-  pcl::toROSMsg(*transformed_scan_ptr, *scan_msg_ptr);
-  current_scan_pub.publish(*scan_msg_ptr);
-
   pcl::PointCloud<pcl::PointXYZI>::Ptr transformed_tmp_ptr(new pcl::PointCloud<pcl::PointXYZI>());
   #ifdef LIMIT_HEIGHT
   pcl::transformPointCloud(src, *transformed_tmp_ptr, t_localizer);
   #else
   pcl::transformPointCloud(*filtered_scan_ptr, *transformed_tmp_ptr, t_localizer);
   #endif // LIMIT_HEIGHT
-  sensor_msgs::PointCloud2::Ptr tmp_msg_ptr(new sensor_msgs::PointCloud2);
-  pcl::toROSMsg(*transformed_tmp_ptr, *tmp_msg_ptr);
-  tmp_msg_ptr->header.frame_id = "map";
-  original_scan_pub.publish(*tmp_msg_ptr);
+  transformed_tmp_ptr->header.frame_id = "map";
+  output.local_map = local_map_ptr;
+  output.current_scan = transformed_scan_ptr;
+  output.source_scan = transformed_tmp_ptr;
 
   std::cout << "-----------------------------------------------------------------\n";
-  std::cout << "Sequence number: " << input->header.seq << "\n";
+  std::cout << "Sequence number: " << input.header.seq << "\n";
   std::cout << "Number of scan points: " << scan_ptr->size() << " points.\n";
   std::cout << "Number of filtered scan points: " << filtered_scan_ptr->size() << " points.\n";
-  std::cout << "Local map: " << local_map.points.size() << " points.\n";
+  if(local_map_stale)
+    std::cout << "Local map: not composed (ndt target slid over the tiles).\n";
+  else
+    std::cout << "Local map: " << local_map.points.size() << " points.\n";
   std::cout << "NDT has converged: " << has_converged << "\n";
+#ifdef USE_FAST_PCL
+  // The pcl backend measures the mean Mahalanobis distance of the inliers, not the Euclidean fitness score
+  if(ndt_backend == PCL_BACKEND)
+  {
+    std::cout << "Mean Mahalanobis distance: " << fitness_score << "\n";
+    std::cout << "Inlier ratio: " << ndt_fitness.inlier_ratio << " (" << ndt_fitness.nr_inliers << "/" << ndt_fitness.nr_points << ")\n";
+  }
+  else
+#endif
   std::cout << "Fitness score: " << fitness_score << "\n";
   std::cout << "Number of iteration: " << final_num_iteration << "\n";
   // std::cout << "Guessed posed: " << "\n";
@@ -592,6 +727,91 @@ static void ndt_mapping_callback(const sensor_msgs::PointCloud2::ConstPtr& input
   std::cout << "-----------------------------------------------------------------" << std::endl;
 }
 
+static inline Eigen::Vector3f get_local_map_center(const Key& key, double z)
+{
+  return Eigen::Vector3f((key.x + 0.5) * TILE_WIDTH, (key.y + 0.5) * TILE_WIDTH, z);
+}
+
+static void build_next_local_map(Key key, Eigen::Vector3f center, LocalMapTargetParams params)
+{
+  pcl::PointCloud<pcl::PointXYZI>::Ptr map(new pcl::PointCloud<pcl::PointXYZI>());
+  {
+    // The keyscans added from now on are recorded into the increment
+    std::lock_guard<std::mutex> lck(mtx);
+    get_local_map(key, *map);
+    next_local_map.increment.clear();
+  }
+  map->header.frame_id = "map";
+
+#ifdef USE_FAST_PCL
+  // Same voxel grids as ndt.setInputTarget would build
+  if(ndt_backend == PCL_BACKEND)
+    next_local_map.target.reset(new pcl::NormalDistributionsTransform<pcl::PointXYZI, pcl::PointXYZI>::Target(
+        map, params.resolutions, params.search_method, params.window_size, center));
+#endif
+  next_local_map.map = map;
+  next_local_map.done = true;
+}
+
+#ifdef USE_FAST_PCL
+// Move the ndt target from the tiles around old_key to the ones around new_key (under mtx)
+static void slide_local_map(const Key& old_key, const Key& new_key, double z)
+{
+  // The pending keyscan points go in first, the voxels straddling the border are then rebuilt with them
+  if(!target_increment_ptr->empty())
+    ndt.addPointsToTarget(target_increment_ptr);
+
+  // Points of the tiles kept on the border of the new window, the voxels straddling it are rebuilt from them alone so
+  // the points of the tiles left are dropped (the voxels are assumed smaller than a tile)
+  pcl::PointCloud<pcl::PointXYZI> border;
+  Key tmp_key;
+  for(int x = new_key.x - 2, x_max = new_key.x + 2; x <= x_max; x++)
+    for(int y = new_key.y - 2, y_max = new_key.y + 2; y <= y_max; y++)
+    {
+      tmp_key.x = x;
+      tmp_key.y = y;
+      if(std::abs(x - new_key.x) < 2 && std::abs(y - new_key.y) < 2)
+        continue;
+      if(!in_local_map(tmp_key, old_key))
+        continue;
+      auto tile = world_map.find(tmp_key);
+      if(tile == world_map.end())
+        continue;
+    #ifdef DOWNSAMPLE_ADD_MAP
+      border += tile->second.getPointCloud();
+    #else
+      border += tile->second;
+    #endif // DOWNSAMPLE_ADD_MAP
+    }
+
+  const double z_range = 1e4;
+  ndt.moveTargetWindow(get_local_map_center(new_key, z));
+  ndt.cropTarget(Eigen::Vector3f((new_key.x - 2) * TILE_WIDTH, (new_key.y - 2) * TILE_WIDTH, z - z_range),
+                 Eigen::Vector3f((new_key.x + 3) * TILE_WIDTH, (new_key.y + 3) * TILE_WIDTH, z + z_range), border);
+
+  // The tiles entering the window
+  pcl::PointCloud<pcl::PointXYZI>::Ptr increment_ptr(new pcl::PointCloud<pcl::PointXYZI>());
+  for(int x = new_key.x - 2, x_max = new_key.x + 2; x <= x_max; x++)
+    for(int y = new_key.y - 2, y_max = new_key.y + 2; y <= y_max; y++)
+    {
+      tmp_key.x = x;
+      tmp_key.y = y;
+      if(in_local_map(tmp_key, old_key))
+        continue;
+      auto tile = world_map.find(tmp_key);
+      if(tile == world_map.end())
+        continue;
+    #ifdef DOWNSAMPLE_ADD_MAP
+      *increment_ptr += tile->second.getPointCloud();
+    #else
+      *increment_ptr += tile->second;
+    #endif // DOWNSAMPLE_ADD_MAP
+    }
+  target_increment_ptr = increment_ptr;
+  local_map_stale = true;
+}
+#endif
+
 static void map_maintenance_callback(pose local_pose)
 {
   // Get local_key
@@ -603,24 +823,147 @@ static void map_maintenance_callback(pose local_pose)
   // Only update local_map through world_map only if local_key changes
   if(local_key != previous_key)
   {
-    std::lock_guard<std::mutex> lck(mtx);
-    // Get local_map, a 3x3 tile map with the center being the local_key
-    local_map.clear();
-    Key tmp_key;
-    for(int x = local_key.x - 2, x_max = local_key.x + 2; x <= x_max; x++)
-      for(int y = local_key.y - 2, y_max = local_key.y + 2; y <= y_max; y++)
+    if(next_local_map.builder.joinable() && next_local_map.key == local_key)
+    {
+      // Prefetched: swap in the map (and ndt target) built in the background, with the keyscans added meanwhile
+      next_local_map.builder.join();
+      std::lock_guard<std::mutex> lck(mtx);
+      local_map.swap(*next_local_map.map);
+      local_map += next_local_map.increment;
+      local_map_stale = false;
+      next_local_map.map.reset();
+    #ifdef USE_FAST_PCL
+      if(ndt_backend == PCL_BACKEND)
       {
-        tmp_key.x = x;
-        tmp_key.y = y;
-        local_map += world_map[tmp_key];
+        ndt.setTarget(next_local_map.target);
+        next_local_map.target.reset();
+        target_increment_ptr->swap(next_local_map.increment);
       }
+      else
+        isMapUpdate = true;
+    #endif
+      next_local_map.increment.clear();
+    }
+#ifdef USE_FAST_PCL
+    else if(ndt_backend == PCL_BACKEND && ndt.getTarget())
+    {
+      // Slide the ndt target: the voxels of the tiles leaving the window are removed, the tiles entering it are added
+      // as the keyscans are, and local_map is only composed again if needed
+      std::lock_guard<std::mutex> lck(mtx);
+      slide_local_map(previous_key, local_key, local_pose.z);
+    }
+#endif
+    else
+    {
+      std::lock_guard<std::mutex> lck(mtx);
+      // Get local_map, a 5x5 tile map with the center being the local_key
+      get_local_map(local_key, local_map);
+      local_map_stale = false;
+    #ifdef USE_FAST_PCL
+      // Keyscans only update the ndt target incrementally, a new set of tiles requires a full rebuild
+      // (centered on the new tiles, in place so the voxel memory is reused)
+      ndt.moveTargetWindow(get_local_map_center(local_key, local_pose.z));
+      isMapUpdate = true;
+    #endif
+    }
 
     // Update key
     previous_key = local_key;
   }
+
+  // Prefetch the tiles under the point map_prefetch_distance ahead, along the last motion (the heading if standing)
+  if(map_prefetch_distance <= 0)
+    return;
+  double heading = (diff_x * diff_x + diff_y * diff_y > 1e-6) ? std::atan2(diff_y, diff_x) : local_pose.yaw;
+  Key next_key = {int(floor((local_pose.x + map_prefetch_distance * std::cos(heading)) / TILE_WIDTH)),
+                  int(floor((local_pose.y + map_prefetch_distance * std::sin(heading)) / TILE_WIDTH))};
+  if(next_key == local_key)
+    return;
+  if(next_local_map.builder.joinable())
+  {
+    // A build in progress is never waited for here, the prediction is updated once it is done
+    if(next_local_map.key == next_key || !next_local_map.done)
+      return;
+    next_local_map.builder.join();
+  }
+  next_local_map.key = next_key;
+  next_local_map.done = false;
+  LocalMapTargetParams params;
+#ifdef USE_FAST_PCL
+  params.resolutions = ndt.getResolutionPyramid();
+  params.search_method = ndt.getNeighborhoodSearchMethod();
+  params.window_size = ndt.getTargetWindowSize();
+#endif
+  next_local_map.builder = std::thread(build_next_local_map, next_key, get_local_map_center(next_key, local_pose.z), params);
+}
+
+// Pipeline stages
+static void read_bag(rosbag::View& view, lidar_pcl::BoundedQueue<sensor_msgs::PointCloud2::ConstPtr>& msg_queue)
+{
+  // rosbag is not thread safe, the messages are read and deserialised by this thread only
+  foreach(rosbag::MessageInstance const message, view)
+  {
+    if(!ros::ok() || stop_requested)
+      break;
+
+    sensor_msgs::PointCloud2::ConstPtr input_cloud = message.instantiate<sensor_msgs::PointCloud2>();
+    if(input_cloud == NULL)
+    {
+      std::cout << "No input PointCloud available. Waiting..." << std::endl;
+      continue;
+    }
+    if(!msg_queue.push(input_cloud))
+      break;
+  }
+  msg_queue.close();
 }
 
-void mySigintHandler(int sig) // Publish the map/final_submap if node is terminated
+static void read_scans(lidar_pcl::BoundedQueue<sensor_msgs::PointCloud2::ConstPtr>& msg_queue,
+                       lidar_pcl::BoundedQueue<ScanItem>& scan_queue)
+{
+  // Conversion and range crop do not depend on the pose, they run ahead of the alignment
+  sensor_msgs::PointCloud2::ConstPtr input_cloud;
+  while(msg_queue.pop(input_cloud))
+  {
+    ScanItem item;
+    item.header = input_cloud->header;
+    item.scan.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    scan_preprocessor.read(*input_cloud, *item.scan);
+    if(!scan_queue.push(item))
+      break;
+  }
+  scan_queue.close();
+  msg_queue.close();
+}
+
+static void publish_outputs(lidar_pcl::BoundedQueue<OutputItem>& output_queue)
+{
+  OutputItem output;
+  while(output_queue.pop(output))
+  {
+    if(output.local_map)
+    {
+      sensor_msgs::PointCloud2::Ptr map_msg_ptr(new sensor_msgs::PointCloud2);
+      pcl::toROSMsg(*output.local_map, *map_msg_ptr);
+      ndt_map_pub.publish(*map_msg_ptr);
+    }
+
+    sensor_msgs::PointCloud2::Ptr scan_msg_ptr(new sensor_msgs::PointCloud2);
+    pcl::toROSMsg(*output.current_scan, *scan_msg_ptr);
+    current_scan_pub.publish(*scan_msg_ptr);
+
+    sensor_msgs::PointCloud2::Ptr tmp_msg_ptr(new sensor_msgs::PointCloud2);
+    pcl::toROSMsg(*output.source_scan, *tmp_msg_ptr);
+    original_scan_pub.publish(*tmp_msg_ptr);
+  }
+}
+
+void mySigintHandler(int sig) // Stop the pipeline, the map is saved by main once the threads are joined
+{
+  stop_requested = true;
+}
+
+static void save_map() // Write the config file and the map
 {
   char buffer[100];
   std::strftime(buffer, 100, "%Y%b%d_%H%M", pnow);
@@ -653,6 +996,9 @@ void mySigintHandler(int sig) // Publish the map/final_submap if node is termina
   config_stream << "Minimum Scan Range: " << min_scan_range << std::endl;
   config_stream << "Minimum Add Scan Shift: " << min_add_scan_shift << std::endl;
   config_stream << "Minimum Add Scan Yaw Change: " << min_add_scan_yaw_diff << std::endl;
+#ifdef DOWNSAMPLE_ADD_MAP
+  config_stream << "Map voxel leaf size: " << DOWNSAMPLE_ADD_MAP << std::endl;
+#endif // DOWNSAMPLE_ADD_MAP
 #ifdef TILE_WIDTH
   config_stream << "Tile-map type used. Size of each tile: " 
                 << TILE_WIDTH << "x" << TILE_WIDTH << std::endl;
@@ -666,17 +1012,21 @@ void mySigintHandler(int sig) // Publish the map/final_submap if node is termina
   std::cout << "Writing the last map to pcd file before shutting down node..." << std::endl;
 
   pcl::PointCloud<pcl::PointXYZI> last_map;
-  for (auto& item: world_map) 
-    last_map += item.second;
+  {
+    std::lock_guard<std::mutex> lck(mtx);
+    for (auto& item: world_map) 
+    #ifdef DOWNSAMPLE_ADD_MAP
+      last_map += item.second.getPointCloud();
+    #else
+      last_map += item.second;
+    #endif // DOWNSAMPLE_ADD_MAP
+  }
 
   last_map.header.frame_id = "map";
   pcl::io::savePCDFileBinary(filename, last_map);
   std::cout << "Saved " << last_map.points.size() << " data points to " << filename << ".\n";
   std::cout << "-----------------------------------------------------------------" << std::endl;
   std::cout << "Done. Node will now shutdown." << std::endl;
-
-  // All the default sigint handler does is call shutdown()
-  ros::shutdown();
 }
 
 int main(int argc, char** argv)
@@ -744,11 +1094,25 @@ int main(int argc, char** argv)
   private_nh.getParam("step_size", step_size);  
   private_nh.getParam("transformation_epsilon", trans_eps);
   private_nh.getParam("max_iteration", max_iter);
+  private_nh.getParam("num_threads", num_threads);
+  private_nh.getParam("ndt_backend", ndt_backend_name);
+  ndt_backend = parse_ndt_backend(ndt_backend_name);
+#ifdef USE_FAST_PCL
+  private_nh.getParam("search_method", search_method);
+  private_nh.getParam("resolution_pyramid", resolution_pyramid);
+  private_nh.getParam("gauss_newton", gauss_newton);
+  private_nh.getParam("min_samples", min_samples);
+  private_nh.getParam("target_window_height", target_window_height);
+#endif
 
   private_nh.getParam("voxel_leaf_size", voxel_leaf_size);
   private_nh.getParam("min_scan_range", min_scan_range);
+  scan_preprocessor.setVoxelLeafSize(voxel_leaf_size);
+  scan_preprocessor.setMinScanRange(min_scan_range);
   private_nh.getParam("min_add_scan_shift", min_add_scan_shift);
   private_nh.getParam("min_add_scan_yaw_diff", min_add_scan_yaw_diff);
+  private_nh.getParam("pipeline_depth", pipeline_depth);
+  private_nh.getParam("map_prefetch_distance", map_prefetch_distance);
 
   private_nh.getParam("tf_x", _tf_x);
   private_nh.getParam("tf_y", _tf_y);
@@ -766,10 +1130,25 @@ int main(int argc, char** argv)
   std::cout << "step_size: " << step_size << std::endl;
   std::cout << "trans_epsilon: " << trans_eps << std::endl;
   std::cout << "max_iter: " << max_iter << std::endl;
+  std::cout << "num_threads: " << num_threads << std::endl;
+  std::cout << "ndt_backend: " << ndt_backend_name << std::endl;
+#ifdef USE_FAST_PCL
+  std::cout << "search_method: " << search_method << std::endl;
+  std::cout << "resolution_pyramid:";
+  for(size_t i = 0; i < resolution_pyramid.size(); i++)
+    std::cout << " " << resolution_pyramid[i];
+  std::cout << (resolution_pyramid.empty() ? " N/A" : "") << std::endl;
+  std::cout << "gauss_newton: " << gauss_newton << std::endl;
+  std::cout << "min_samples: " << min_samples << std::endl;
+  std::cout << "target_window_height: " << target_window_height << std::endl;
+  std::cout << "derivative kernel: " << pcl::NDTDerivativeBatch::getInstructionSet() << std::endl;
+#endif
   std::cout << "voxel_leaf_size: " << voxel_leaf_size << std::endl;
   std::cout << "min_scan_range: " << min_scan_range << std::endl;
   std::cout << "min_add_scan_shift: " << min_add_scan_shift << std::endl;
   std::cout << "min_add_scan_yaw_diff: " << min_add_scan_yaw_diff << std::endl;
+  std::cout << "pipeline_depth: " << pipeline_depth << std::endl;
+  std::cout << "map_prefetch_distance: " << map_prefetch_distance << std::endl;
   std::cout << "(tf_x,tf_y,tf_z,tf_roll,tf_pitch,tf_yaw): (" << _tf_x << ", " << _tf_y << ", " << _tf_z << ", "
             << _tf_roll << ", " << _tf_pitch << ", " << _tf_yaw << ")\n" << std::endl;
 
@@ -804,11 +1183,31 @@ int main(int argc, char** argv)
   gpu_ndt.setStepSize(step_size);
   gpu_ndt.setResolution(ndt_res);
   gpu_ndt.setMaximumIterations(max_iter);
-#else
+#endif
+#ifdef NDT_CPU_FOUND
+  cpu_ndt.setTransformationEpsilon(trans_eps);
+  cpu_ndt.setStepSize(step_size);
+  cpu_ndt.setResolution(ndt_res);
+  cpu_ndt.setMaximumIterations(max_iter);
+  cpu_ndt.setNumThreads(num_threads);
+#endif
   ndt.setTransformationEpsilon(trans_eps);
   ndt.setStepSize(step_size);
   ndt.setResolution(ndt_res);
   ndt.setMaximumIterations(max_iter);
+#ifdef USE_FAST_PCL
+  ndt.setNeighborhoodSearchMethod(static_cast<pcl::NeighborSearchMethod>(search_method));
+  ndt.setNumThreads(num_threads);
+  ndt.setUseGaussNewton(gauss_newton);
+  ndt.setMinSamples(min_samples);
+  // The target is the 5x5 tiles around the vehicle, its voxels are indexed by a dense array moving with the tiles
+  if(target_window_height > 0)
+    ndt.setTargetWindow(Eigen::Vector3f(5 * TILE_WIDTH, 5 * TILE_WIDTH, target_window_height));
+  if(!resolution_pyramid.empty())
+  {
+    resolution_pyramid.push_back(ndt_res);
+    ndt.setResolutionPyramid(resolution_pyramid);
+  }
 #endif
 
   Eigen::Translation3f tl_btol(_tf_x, _tf_y, _tf_z);                 // tl: translation
@@ -858,45 +1257,48 @@ int main(int argc, char** argv)
   std::chrono::time_point<std::chrono::system_clock> t1, t2, t3;
   std::cout << "Finished preparing bagfile. Starting mapping..." << std::endl;
   std::cout << "Note: if the mapping does not start immediately, check the subscribed topic names.\n" << std::endl;
-  foreach(rosbag::MessageInstance const message, view)
+  lidar_pcl::BoundedQueue<sensor_msgs::PointCloud2::ConstPtr> msg_queue(pipeline_depth);
+  lidar_pcl::BoundedQueue<ScanItem> scan_queue(pipeline_depth);
+  lidar_pcl::BoundedQueue<OutputItem> output_queue(pipeline_depth);
+  std::thread bag_reader(read_bag, std::ref(view), std::ref(msg_queue));
+  std::thread scan_reader(read_scans, std::ref(msg_queue), std::ref(scan_queue));
+  std::thread publisher(publish_outputs, std::ref(output_queue));
+
+  ScanItem input;
+  while(!stop_requested && scan_queue.pop(input))
   {
-    sensor_msgs::PointCloud2::ConstPtr input_cloud = message.instantiate<sensor_msgs::PointCloud2>();
-    if(input_cloud == NULL)
-    {
-      std::cout << "No input PointCloud available. Waiting..." << std::endl;
-      continue;
-    }
-
     // Global callback to call scans process and submap process
+    OutputItem output;
     t1 = std::chrono::system_clock::now();
     map_maintenance_callback(current_pose);
     t2 = std::chrono::system_clock::now();
-    ndt_mapping_callback(input_cloud);
+    ndt_mapping_callback(input, output);
     t3 = std::chrono::system_clock::now();
-    // #pragma omp parallel sections
-    // {
-    //   #pragma omp section
-    //   {
-    //     ndt_mapping_callback(input_cloud);
-    //   }
-    //   #pragma omp section
-    //   {
-    //     std::cout << "current_pose: (" << current_pose.x << "," << current_pose.y << "," << current_pose.z << ","
-    //                                    << current_pose.roll << "," << current_pose.pitch << "," << current_pose.yaw << std::endl;
-    //     //using current_pose as local_pose to get local_map
-    //     map_maintenance_callback(current_pose);
-    //   }
-    // }
+    if(output.current_scan) // nothing to publish for the first scan
+      output_queue.push(output);
+
     msg_pos++;
     std::cout << "---Number of key scans: " << add_scan_number << "\n";
     std::cout << "---Processed: " << msg_pos << "/" << msg_size << "\n";
     std::cout << "---Get local map took: " << std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() / 1.0 << "ns.\n";
     std::cout << "---NDT Mapping took: " << std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count() / 1000.0 << "ms."<< std::endl;
   }
+  // On SIGINT the readers may be blocked on full queues, closing them unblocks every stage
+  msg_queue.close();
+  scan_queue.close();
+  output_queue.close();
+  bag_reader.join();
+  scan_reader.join();
+  publisher.join();
+  if(next_local_map.builder.joinable())
+    next_local_map.builder.join();
   bag.close();
   std::cout << "Finished processing bag file." << std::endl;
 
-  mySigintHandler(0);
+  save_map();
+
+  // All the default sigint handler does is call shutdown()
+  ros::shutdown();
 
   return 0;
 }
\ No newline at end of file
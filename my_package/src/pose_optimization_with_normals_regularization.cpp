@@ -14,6 +14,8 @@
 #include <pcl/point_types.h>
 #include <pcl_ros/transforms.h>
 
+#include <lidar_pcl/motion_undistortion.h>
+
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -49,76 +51,6 @@ struct velocity
   double yaw;
 };
 
-inline double getYawAngle(double _x, double _y)
-{
-  return std::atan2(_y, _x) * 180 / 3.14159265359; // degree value
-}
-
-inline double calculateMinAngleDist(double first, double second) // in degree
-{
-  double difference = first - second;
-  if(difference >= 180.0)
-    return difference - 360.0;
-  if(difference <= -180.0)
-    return difference + 360.0;
-  return difference;
-}
-
-void correctLIDARscan(pcl::PointCloud<pcl::PointXYZI>& scan, Eigen::Affine3d relative_tf, double scan_interval)
-{
-  // Correct scan using vel
-  pcl::PointCloud<pcl::PointXYZI> scan_packet;
-  std::vector<pcl::PointCloud<pcl::PointXYZI>> scan_packets_vector;
-  double base_azimuth = getYawAngle((scan.begin())->x, (scan.begin())->y);
-  for(pcl::PointCloud<pcl::PointXYZI>::const_iterator item = scan.begin(); item != scan.end(); item++)
-  {
-    double crnt_azimuth = getYawAngle(item->x, item->y);
-    if(std::fabs(calculateMinAngleDist(crnt_azimuth, base_azimuth)) < 0.01) // 0.17 degree is the typical change
-    {
-      scan_packet.push_back(*item);
-    }
-    else // new azimuth reached
-    {
-      scan_packets_vector.push_back(scan_packet);
-      scan_packet.clear();
-      scan_packet.push_back(*item);
-      base_azimuth = crnt_azimuth;
-    }
-  }
-
-  scan.clear();
-  pose crnt_pose = {0, 0, 0, 0, 0, 0};
-  velocity vel;
-  pcl::getTranslationAndEulerAngles(relative_tf, vel.x, vel.y, vel.z, vel.roll, vel.pitch, vel.yaw);
-  vel.x = vel.x / scan_interval;
-  vel.y = vel.y / scan_interval;
-  vel.z = vel.z / scan_interval;
-  vel.roll = vel.roll / scan_interval;
-  vel.pitch = vel.pitch / scan_interval;
-  vel.yaw = vel.yaw / scan_interval;
-  for(int i = 0, npackets = scan_packets_vector.size(); i < npackets; i++)
-  {
-    double offset_time = scan_interval * i / npackets;
-    pose this_packet_pose = {crnt_pose.x - vel.x * offset_time,
-                             crnt_pose.y - vel.y * offset_time,
-                             crnt_pose.z - vel.z * offset_time,
-                             crnt_pose.roll - vel.roll * offset_time,
-                             crnt_pose.pitch - vel.pitch * offset_time,
-                             crnt_pose.yaw - vel.yaw * offset_time}; 
-
-    Eigen::Affine3d transform;
-    pcl::getTransformation(this_packet_pose.x, 
-                           this_packet_pose.y, 
-                           this_packet_pose.z, 
-                           this_packet_pose.roll, 
-                           this_packet_pose.pitch, 
-                           this_packet_pose.yaw, transform);
-    pcl::PointCloud<pcl::PointXYZI> corrected_packet;
-    pcl::transformPointCloud(scan_packets_vector[npackets-1-i], corrected_packet, transform);
-    scan += corrected_packet;
-  }
-}
-
 bool optimizeEssentialGraphWithL2(const VectorofPoses &NonCorrectedSim3,
                                   const VectorofNormalVectors &GroundNormalVector3,
                                   const double regularization_strength,
@@ -433,7 +365,6 @@ int main(int argc, char** argv)
   map.header.frame_id = "map";
   Eigen::Affine3d prev_transform, crnt_transform, rel_transform;
   ros::Time prev_time;
-  double interval;
   for(int i = 0, i_end = corrected_sim3.size(); i < i_end; i++)
   {
     // Get transform
@@ -454,17 +385,15 @@ int main(int argc, char** argv)
     if(i == 0) // first scan?
     {
       prev_transform = crnt_transform;
-      interval = 0.1; // dummy value
       rel_transform = prev_transform.inverse() * crnt_transform;
     }
     else
     {
-      interval = (crnt_time - prev_time).toSec();
       rel_transform = prev_transform.inverse() * crnt_transform;
     }
 
     pcl::PointCloud<pcl::PointXYZI> src = all_scans[i];
-    correctLIDARscan(src, rel_transform, interval);
+    lidar_pcl::motionUndistort(src, rel_transform);
 
     // Do transform
     pcl::PointCloud<pcl::PointXYZI> dst;